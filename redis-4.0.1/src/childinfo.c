@@ -80,6 +80,11 @@ void receiveChildInfo(void) {
             server.stat_rdb_cow_bytes = server.child_info_data.cow_size;
         } else if (server.child_info_data.process_type == CHILD_INFO_TYPE_AOF) {
             server.stat_aof_cow_bytes = server.child_info_data.cow_size;
+            if (server.child_info_data.keys_usec) {
+                server.stat_aof_rewrite_keys_per_sec =
+                    server.child_info_data.keys*1000000/
+                    server.child_info_data.keys_usec;
+            }
         }
     }
 }
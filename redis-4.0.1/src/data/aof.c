@@ -193,6 +193,447 @@ ssize_t aofRewriteBufferWrite(int fd) {
     return count;
 }
 
+/* ----------------------------------------------------------------------------
+ * AOF manifest
+ *
+ * When aof-use-manifest is enabled the AOF is not a single file that every
+ * rewrite replaces: a rewrite only produces a new base file, containing the
+ * dataset at the time of the fork, while the parent keeps appending to a new
+ * incremental file, opened just before forking. So there is no need to send
+ * the commands executed during the rewrite to the child, or to write them
+ * into the new file once the child exits: when the base is ready the manifest
+ * is switched to reference it, followed by the last incremental file only,
+ * and the files it replaces are deleted.
+ *
+ * When the AOF is enabled at runtime the files still listed in the manifest
+ * are stale, since nothing was written while the AOF was off. The commands
+ * executed during the rewrite then go to a temp file kept out of the
+ * manifest, that replaces all of them once the new base is installed.
+ *
+ * The manifest is a small text file named after appendfilename with the
+ * ".manifest" suffix, listing the files in the order they are loaded:
+ *
+ *   file "appendonly.aof.2.base.rdb" seq 2 type b
+ *   file "appendonly.aof.3.incr.aof" seq 3 type i
+ *
+ * Every time the set of files changes a new manifest is written to a temp
+ * file and renamed over the old one.
+ * ------------------------------------------------------------------------- */
+
+#define AOF_MANIFEST_MAX_LINE 1024
+
+static aofInfo *aofInfoCreate(sds name, long long seq) {
+    aofInfo *ai = zmalloc(sizeof(*ai));
+
+    ai->name = name;
+    ai->seq = seq;
+    return ai;
+}
+
+static void aofInfoFree(void *ptr) {
+    aofInfo *ai = ptr;
+
+    sdsfree(ai->name);
+    zfree(ai);
+}
+
+static aofManifest *aofManifestCreate(void) {
+    aofManifest *am = zmalloc(sizeof(*am));
+
+    am->base = NULL;
+    am->incr = listCreate();
+    listSetFreeMethod(am->incr,aofInfoFree);
+    am->base_seq = 0;
+    am->incr_seq = 0;
+    am->pending = NULL;
+    return am;
+}
+
+static void aofManifestFree(aofManifest *am) {
+    if (am->base) aofInfoFree(am->base);
+    listRelease(am->incr);
+    if (am->pending) aofInfoFree(am->pending);
+    zfree(am);
+}
+
+static sds aofManifestPath(void) {
+    return sdscatfmt(sdsempty(),"%s.manifest",server.aof_filename);
+}
+
+/* Return the name of the file 'seq' of the given kind, for instance
+ * "appendonly.aof.3.incr.aof". */
+static sds aofFileName(long long seq, char *kind) {
+    return sdscatfmt(sdsempty(),"%s.%I.%s",server.aof_filename,seq,kind);
+}
+
+/* Load the manifest from disk. NULL is returned if it does not exist, while
+ * on any other error the server exits, since loading only a part of the AOF
+ * would silently lose data. */
+static aofManifest *aofLoadManifest(void) {
+    char buf[AOF_MANIFEST_MAX_LINE+1];
+    sds path = aofManifestPath();
+    FILE *fp = fopen(path,"r");
+    aofManifest *am;
+    char *err = NULL;
+    int linenum = 0;
+
+    if (fp == NULL) {
+        if (errno == ENOENT) {
+            sdsfree(path);
+            return NULL;
+        }
+        serverLog(LL_WARNING,"Fatal error: can't open the AOF manifest %s: %s",
+            path,strerror(errno));
+        exit(1);
+    }
+
+    am = aofManifestCreate();
+    while(err == NULL && fgets(buf,sizeof(buf),fp) != NULL) {
+        sds *argv, name = NULL;
+        char *type = NULL;
+        long long seq = -1;
+        int argc, j;
+
+        linenum++;
+        if (buf[0] == '#') continue;
+        if ((argv = sdssplitargs(buf,&argc)) == NULL) {
+            err = "Unbalanced quotes";
+            break;
+        }
+        for (j = 0; j+1 < argc; j += 2) {
+            if (!strcasecmp(argv[j],"file")) {
+                name = argv[j+1];
+            } else if (!strcasecmp(argv[j],"seq")) {
+                if (!string2ll(argv[j+1],sdslen(argv[j+1]),&seq)) seq = -1;
+            } else if (!strcasecmp(argv[j],"type")) {
+                type = argv[j+1];
+            }
+        }
+
+        if (argc == 0) {
+            /* Empty line. */
+        } else if (name == NULL || type == NULL || seq < 0) {
+            err = "Missing or invalid file, seq or type";
+        } else if (!strcmp(type,"b")) {
+            if (am->base || listLength(am->incr)) {
+                err = "The base file must be the first and only one";
+            } else {
+                am->base = aofInfoCreate(sdsdup(name),seq);
+                am->base_seq = seq;
+            }
+        } else if (!strcmp(type,"i")) {
+            listAddNodeTail(am->incr,aofInfoCreate(sdsdup(name),seq));
+            if (seq > am->incr_seq) am->incr_seq = seq;
+        } else {
+            err = "Unknown file type";
+        }
+        sdsfreesplitres(argv,argc);
+    }
+    if (err == NULL && ferror(fp)) err = strerror(errno);
+    fclose(fp);
+
+    if (err) {
+        serverLog(LL_WARNING,"Fatal error loading the AOF manifest %s, "
+            "line %d: %s",path,linenum,err);
+        exit(1);
+    }
+    sdsfree(path);
+    return am;
+}
+
+static sds aofCatManifestLine(sds s, aofInfo *ai, char *type) {
+    s = sdscat(s,"file ");
+    s = sdscatrepr(s,ai->name,sdslen(ai->name));
+    return sdscatfmt(s," seq %I type %s\n",ai->seq,type);
+}
+
+/* Write the manifest 'am' on disk, atomically replacing the previous one.
+ * Returns C_OK on success, otherwise C_ERR is returned and the manifest on
+ * disk is left untouched. */
+static int aofPersistManifest(aofManifest *am) {
+    sds path = aofManifestPath();
+    sds tmpfile = sdscatfmt(sdsempty(),"temp-%S",path);
+    sds content = sdsempty();
+    listIter li;
+    listNode *ln;
+    int fd, retval = C_ERR;
+
+    if (am->base) content = aofCatManifestLine(content,am->base,"b");
+    listRewind(am->incr,&li);
+    while((ln = listNext(&li)) != NULL)
+        content = aofCatManifestLine(content,ln->value,"i");
+
+    if ((fd = open(tmpfile,O_WRONLY|O_CREAT|O_TRUNC,0644)) == -1) goto werr;
+    if (write(fd,content,sdslen(content)) != (ssize_t)sdslen(content) ||
+        fsync(fd) == -1)
+    {
+        close(fd);
+        unlink(tmpfile);
+        goto werr;
+    }
+    close(fd);
+    if (rename(tmpfile,path) == -1) {
+        unlink(tmpfile);
+        goto werr;
+    }
+    retval = C_OK;
+
+werr:
+    if (retval == C_ERR)
+        serverLog(LL_WARNING,"Error writing the AOF manifest %s: %s",
+            path,strerror(errno));
+    sdsfree(content);
+    sdsfree(tmpfile);
+    sdsfree(path);
+    return retval;
+}
+
+/* Open a new incremental file and make it the target of the AOF writes,
+ * recording it in the manifest. The previous file, if any, is fsynced and
+ * closed by a background thread: its fsync can't be skipped even with
+ * 'appendfsync no' since the new base may not include it yet. */
+static int aofOpenIncrFile(void) {
+    aofManifest *am = server.aof_manifest;
+    aofInfo *ai;
+    int fd;
+
+    /* The commands accumulated so far belong to the current file. */
+    if (server.aof_fd != -1) {
+        flushAppendOnlyFile(1);
+        if (sdslen(server.aof_buf)) {
+            serverLog(LL_WARNING,"Can't switch to a new incremental AOF "
+                "file: the AOF buffer could not be written.");
+            return C_ERR;
+        }
+        /* An empty file can follow the new base as well, so that rewrites
+         * failing one after the other don't grow the manifest when there
+         * are no writes. */
+        if (server.aof_fd_size == 0) return C_OK;
+    }
+
+    ai = aofInfoCreate(aofFileName(am->incr_seq+1,"incr.aof"),am->incr_seq+1);
+    if ((fd = open(ai->name,O_WRONLY|O_APPEND|O_CREAT|O_TRUNC,0644)) == -1) {
+        serverLog(LL_WARNING,"Can't open the incremental AOF file %s: %s",
+            ai->name,strerror(errno));
+        aofInfoFree(ai);
+        return C_ERR;
+    }
+    listAddNodeTail(am->incr,ai);
+    if (aofPersistManifest(am) == C_ERR) {
+        close(fd);
+        unlink(ai->name);
+        listDelNode(am->incr,listLast(am->incr));
+        return C_ERR;
+    }
+    am->incr_seq = ai->seq;
+
+    if (server.aof_fd != -1)
+        bioCreateBackgroundJob(BIO_AOF_FSYNC,(void*)(long)server.aof_fd,
+                               (void*)1,NULL);
+    server.aof_fd = fd;
+    server.aof_fd_size = 0;
+    server.aof_selected_db = -1; /* Make sure SELECT is re-issued */
+    serverLog(LL_NOTICE,"Appending to the incremental AOF file %s",ai->name);
+    return C_OK;
+}
+
+/* Return the name of the pending incremental file 'ai' on disk. */
+static sds aofPendingFileName(aofInfo *ai) {
+    return sdscatfmt(sdsempty(),"temp-%S",ai->name);
+}
+
+/* Make the pending incremental file the target of the AOF writes, while
+ * the rewrite enabling the AOF is in progress. If a previous rewrite failed
+ * the file is already open: it is truncated and reused, as the commands it
+ * contains are part of the dataset of the next base. */
+static int aofOpenPendingIncrFile(void) {
+    aofManifest *am = server.aof_manifest;
+    sds tmpfile;
+    int fd;
+
+    if (am->pending) {
+        flushAppendOnlyFile(1);
+        if (sdslen(server.aof_buf) || ftruncate(server.aof_fd,0) == -1) {
+            serverLog(LL_WARNING,"Can't truncate the pending incremental "
+                "AOF file: %s", sdslen(server.aof_buf) ?
+                "the AOF buffer could not be written" : strerror(errno));
+            return C_ERR;
+        }
+        server.aof_fd_size = 0;
+        server.aof_selected_db = -1; /* Make sure SELECT is re-issued */
+        return C_OK;
+    }
+
+    am->pending = aofInfoCreate(aofFileName(am->incr_seq+1,"incr.aof"),
+                                am->incr_seq+1);
+    tmpfile = aofPendingFileName(am->pending);
+    if ((fd = open(tmpfile,O_WRONLY|O_APPEND|O_CREAT|O_TRUNC,0644)) == -1) {
+        serverLog(LL_WARNING,"Can't open the incremental AOF file %s: %s",
+            tmpfile,strerror(errno));
+        aofInfoFree(am->pending);
+        am->pending = NULL;
+        sdsfree(tmpfile);
+        return C_ERR;
+    }
+    server.aof_fd = fd;
+    server.aof_fd_size = 0;
+    server.aof_selected_db = -1; /* Make sure SELECT is re-issued */
+    serverLog(LL_NOTICE,"Appending to the incremental AOF file %s",tmpfile);
+    sdsfree(tmpfile);
+    return C_OK;
+}
+
+/* Delete the pending incremental file, if any, when the AOF is turned off
+ * before a rewrite could enable it. It is up to the caller to close the
+ * file descriptor. */
+static void aofDiscardPendingIncrFile(void) {
+    aofManifest *am = server.aof_manifest;
+    sds tmpfile;
+
+    if (!server.aof_use_manifest || am->pending == NULL) return;
+    tmpfile = aofPendingFileName(am->pending);
+    unlink(tmpfile);
+    sdsfree(tmpfile);
+    aofInfoFree(am->pending);
+    am->pending = NULL;
+}
+
+/* Unlink the file 'name', leaving the actual deletion of its data to a
+ * background close(2). */
+static void aofDeleteFile(char *name) {
+    int fd = open(name,O_RDONLY|O_NONBLOCK);
+
+    if (unlink(name) == -1 && errno != ENOENT)
+        serverLog(LL_WARNING,"Error deleting the AOF file %s: %s",
+            name,strerror(errno));
+    if (fd != -1) bioCreateBackgroundJob(BIO_CLOSE_FILE,(void*)(long)fd,NULL,NULL);
+}
+
+/* Make the file written by the rewrite child the new base of the AOF. It
+ * is followed by the last incremental file if the AOF is enabled, since
+ * that one was opened when the rewrite started, or by the pending one if
+ * the rewrite is enabling the AOF, while all the other files are no longer
+ * needed and are deleted. */
+static int aofInstallBaseFile(char *tmpfile) {
+    aofManifest *old = server.aof_manifest, *am;
+    long long seq = old->base_seq+1;
+    sds name = aofFileName(seq,server.aof_use_rdb_preamble ? "base.rdb" :
+                                                             "base.aof");
+    sds pending = NULL;
+    aofInfo *incr = NULL;
+    listIter li;
+    listNode *ln;
+    mstime_t latency;
+
+    latencyStartMonitor(latency);
+    if (rename(tmpfile,name) == -1) {
+        serverLog(LL_WARNING,
+            "Error trying to rename the temporary AOF file %s into %s: %s",
+            tmpfile,name,strerror(errno));
+        sdsfree(name);
+        return C_ERR;
+    }
+    latencyEndMonitor(latency);
+    latencyAddSampleIfNeeded("aof-rename",latency);
+
+    am = aofManifestCreate();
+    am->base = aofInfoCreate(name,seq);
+    am->base_seq = seq;
+    am->incr_seq = old->incr_seq;
+    if (old->pending) {
+        incr = aofInfoCreate(sdsdup(old->pending->name),old->pending->seq);
+        pending = aofPendingFileName(old->pending);
+        am->incr_seq = incr->seq;
+    } else if (server.aof_fd != -1 && listLength(old->incr)) {
+        aofInfo *last = listNodeValue(listLast(old->incr));
+        incr = aofInfoCreate(sdsdup(last->name),last->seq);
+    }
+    if (incr) listAddNodeTail(am->incr,incr);
+
+    /* The open file descriptor of the pending file is still valid once it
+     * is renamed. */
+    if (pending && rename(pending,incr->name) == -1) {
+        serverLog(LL_WARNING,
+            "Error trying to rename the incremental AOF file %s into %s: %s",
+            pending,incr->name,strerror(errno));
+        goto werr;
+    }
+    if (aofPersistManifest(am) == C_ERR) {
+        if (pending) rename(incr->name,pending);
+        goto werr;
+    }
+
+    /* Delete the files of the old manifest that are not referenced by the
+     * new one. As when a rewritten AOF replaces the old one, the unlink
+     * operation is left to a background close(2). */
+    if (old->base) aofDeleteFile(old->base->name);
+    listRewind(old->incr,&li);
+    while((ln = listNext(&li)) != NULL) {
+        aofInfo *ai = ln->value;
+
+        if (incr && ai->seq == incr->seq) continue;
+        aofDeleteFile(ai->name);
+    }
+    aofManifestFree(old);
+    server.aof_manifest = am;
+    sdsfree(pending);
+    return C_OK;
+
+werr:
+    unlink(name);
+    aofManifestFree(am);
+    sdsfree(pending);
+    return C_ERR;
+}
+
+/* Called at startup to load the manifest, if enabled, and to open the
+ * file receiving the AOF writes when the AOF is on. */
+void aofOpenOnStartup(void) {
+    if (!server.aof_use_manifest) {
+        if (server.aof_state != AOF_ON) return;
+        server.aof_fd = open(server.aof_filename,
+                               O_WRONLY|O_APPEND|O_CREAT,0644);
+        if (server.aof_fd == -1) {
+            serverLog(LL_WARNING, "Can't open the append-only file: %s",
+                strerror(errno));
+            exit(1);
+        }
+        return;
+    }
+
+    if ((server.aof_manifest = aofLoadManifest()) == NULL) {
+        struct redis_stat sb;
+
+        /* No manifest yet: an AOF written without a manifest becomes the
+         * base of the new one. */
+        server.aof_manifest = aofManifestCreate();
+        if (redis_stat(server.aof_filename,&sb) == 0) {
+            serverLog(LL_NOTICE,"Using the append only file %s as the base "
+                "of the AOF manifest",server.aof_filename);
+            server.aof_manifest->base =
+                aofInfoCreate(sdsnew(server.aof_filename),0);
+        }
+    }
+    if (server.aof_state != AOF_ON) return;
+
+    /* Keep appending to the last incremental file, if any. */
+    if (listLength(server.aof_manifest->incr)) {
+        aofInfo *last = listNodeValue(listLast(server.aof_manifest->incr));
+        struct redis_stat sb;
+
+        server.aof_fd = open(last->name,O_WRONLY|O_APPEND|O_CREAT,0644);
+        if (server.aof_fd == -1) {
+            serverLog(LL_WARNING, "Can't open the incremental AOF file %s: %s",
+                last->name,strerror(errno));
+            exit(1);
+        }
+        if (redis_fstat(server.aof_fd,&sb) != -1)
+            server.aof_fd_size = sb.st_size;
+    } else if (aofOpenIncrFile() == C_ERR) {
+        exit(1);
+    }
+}
+
 /* ----------------------------------------------------------------------------
  * AOF file implementation
  * ------------------------------------------------------------------------- */
@@ -203,6 +644,105 @@ void aof_background_fsync(int fd) {
     bioCreateBackgroundJob(BIO_AOF_FSYNC,(void*)(long)fd,NULL,NULL);
 }
 
+/* ----------------------------------------------------------------------------
+ * AOF group commit
+ *
+ * With appendfsync always the main thread normally fsyncs the AOF every time
+ * it writes the AOF buffer, before replying to the clients, so the latency of
+ * fsync limits the number of event loop iterations, and of writes, per second.
+ * With aof-group-commit enabled the fsync is instead performed by the bio
+ * fsync thread, while the replies of the clients that executed writes are held
+ * in their output buffers until an fsync covering them completes. Meanwhile
+ * the main thread serves the other clients, and the commands they execute are
+ * covered by the next fsync, started as soon as the current one completes, so
+ * that a single fsync is shared by the writes of many event loop iterations.
+ *
+ * Writes are tracked by offset in the stream of bytes fed to the AOF buffer:
+ * call() stores in c->aof_woff the offset reached by the last write of the
+ * client, whose replies are held while a group commit fsync is in progress
+ * and server.aof_fsynced_offset is behind it (see clientWaitsAofFsync()).
+ * Once the fsync is done the bio thread writes its errno to a pipe in order
+ * to wake up the event loop.
+ * ------------------------------------------------------------------------- */
+
+/* Offset of the AOF bytes written to the file so far. */
+#define aofWrittenOffset() \
+    (server.aof_fed_offset-(long long)sdslen(server.aof_buf))
+
+/* Start a background fsync covering the AOF written so far, unless one is
+ * already in progress, in which case it's started once it completes. */
+static void aofGroupCommitFsync(void) {
+    if (server.aof_group_commit_in_progress ||
+        aofWrittenOffset() <= server.aof_fsynced_offset) return;
+
+    /* Like the fsync, the wait is skipped if no-appendfsync-on-rewrite is
+     * set to yes and there are children doing I/O in the background. */
+    if (server.aof_no_fsync_on_rewrite &&
+        (server.aof_child_pid != -1 || rdbSaveInProgress())) return;
+
+    server.aof_group_commit_offset = aofWrittenOffset();
+    server.aof_group_commit_fd = server.aof_fd;
+    server.aof_group_commit_start = ustime();
+    server.aof_group_commit_in_progress = 1;
+    bioCreateBackgroundJob(BIO_AOF_FSYNC,(void*)(long)server.aof_fd,NULL,
+                           (void*)1);
+}
+
+/* Called by the bio fsync thread once a group commit fsync is performed,
+ * with the errno of the fsync call, or 0 on success. */
+void aofGroupCommitFsynced(int err) {
+    if (write(server.aof_group_commit_pipe[1],&err,sizeof(err)) !=
+        sizeof(err))
+    {
+        serverLog(LL_WARNING,"Can't signal the AOF fsync completion: %s",
+            strerror(errno));
+    }
+}
+
+/* Release the replies covered by the fsync just completed. */
+static void aofGroupCommitPipeReadable(aeEventLoop *el, int fd, void *privdata, int mask) {
+    int err;
+    UNUSED(el);
+    UNUSED(privdata);
+    UNUSED(mask);
+
+    if (read(fd,&err,sizeof(err)) != sizeof(err)) return;
+    latencyAddSampleIfNeeded("aof-fsync-group-commit",
+        (ustime()-server.aof_group_commit_start)/1000);
+    server.aof_group_commit_in_progress = 0;
+
+    /* As with the synchronous fsync we can't recover from errors, since
+     * the writes are already applied to the dataset. Errors on files that
+     * were replaced in the meantime don't matter: the new file is synced
+     * when installed. */
+    if (err && server.aof_group_commit_fd == server.aof_fd) {
+        serverLog(LL_WARNING,"Can't recover from AOF fsync errors when the "
+            "AOF fsync policy is 'always' (%s). Exiting...",strerror(err));
+        exit(1);
+    }
+    if (server.aof_group_commit_offset > server.aof_fsynced_offset)
+        server.aof_fsynced_offset = server.aof_group_commit_offset;
+    server.aof_last_fsync = server.unixtime;
+    server.stat_aof_group_commits++;
+
+    /* Cover the writes performed in the meantime. If the group commit was
+     * disabled instead, no fsync is in progress and the remaining replies
+     * are no longer held. */
+    if (server.aof_group_commit && server.aof_fsync == AOF_FSYNC_ALWAYS &&
+        server.aof_fd != -1) aofGroupCommitFsync();
+}
+
+/* Create the pipe used to signal the completion of the group commit fsync. */
+void aofInitGroupCommit(void) {
+    if (pipe(server.aof_group_commit_pipe) == -1 ||
+        anetNonBlock(NULL,server.aof_group_commit_pipe[0]) != ANET_OK ||
+        aeCreateFileEvent(server.el,server.aof_group_commit_pipe[0],
+            AE_READABLE,aofGroupCommitPipeReadable,NULL) == AE_ERR)
+    {
+        serverPanic("Can't create the pipe for the AOF group commit.");
+    }
+}
+
 /* Called when the user switches from "appendonly yes" to "appendonly no"
  * at runtime using the CONFIG command. */
 void stopAppendOnly(void) {
@@ -210,6 +750,7 @@ void stopAppendOnly(void) {
     flushAppendOnlyFile(1);
     aof_fsync(server.aof_fd);
     close(server.aof_fd);
+    aofDiscardPendingIncrFile();
 
     server.aof_fd = -1;
     server.aof_selected_db = -1;
@@ -238,10 +779,12 @@ void stopAppendOnly(void) {
 int startAppendOnly(void) {
     char cwd[MAXPATHLEN]; /* Current working dir path for error messages. */
 
-    server.aof_last_fsync = server.unixtime;
-    server.aof_fd = open(server.aof_filename,O_WRONLY|O_APPEND|O_CREAT,0644);
     serverAssert(server.aof_state == AOF_OFF);
-    if (server.aof_fd == -1) {
+    server.aof_last_fsync = server.unixtime;
+    /* With a manifest the incremental file is opened by the rewrite. */
+    if (!server.aof_use_manifest)
+        server.aof_fd = open(server.aof_filename,O_WRONLY|O_APPEND|O_CREAT,0644);
+    if (!server.aof_use_manifest && server.aof_fd == -1) {
         char *cwdp = getcwd(cwd,MAXPATHLEN);
 
         serverLog(LL_WARNING,
@@ -252,17 +795,20 @@ int startAppendOnly(void) {
             strerror(errno));
         return C_ERR;
     }
-    if (server.rdb_child_pid != -1) {
+    /* We switch on AOF, now wait for the rewrite to be complete in order to
+     * append data on disk. */
+    server.aof_state = AOF_WAIT_REWRITE;
+    if (rdbSaveInProgress()) {
         server.aof_rewrite_scheduled = 1;
         serverLog(LL_WARNING,"AOF was enabled but there is already a child process saving an RDB file on disk. An AOF background was scheduled to start when possible.");
     } else if (rewriteAppendOnlyFileBackground() == C_ERR) {
-        close(server.aof_fd);
+        if (server.aof_fd != -1) close(server.aof_fd);
+        aofDiscardPendingIncrFile();
+        server.aof_fd = -1;
+        server.aof_state = AOF_OFF;
         serverLog(LL_WARNING,"Redis needs to enable the AOF but can't trigger a background AOF rewrite operation. Check the above logs for more info about the error.");
         return C_ERR;
     }
-    /* We correctly switched on AOF, now wait for the rewrite to be complete
-     * in order to append data on disk. */
-    server.aof_state = AOF_WAIT_REWRITE;
     return C_OK;
 }
 
@@ -332,7 +878,7 @@ void flushAppendOnlyFile(int force) {
      * useful for graphing / monitoring purposes. */
     if (sync_in_progress) {
         latencyAddSampleIfNeeded("aof-write-pending-fsync",latency);
-    } else if (server.aof_child_pid != -1 || server.rdb_child_pid != -1) {
+    } else if (server.aof_child_pid != -1 || rdbSaveInProgress()) {
         latencyAddSampleIfNeeded("aof-write-active-child",latency);
     } else {
         latencyAddSampleIfNeeded("aof-write-alone",latency);
@@ -368,7 +914,7 @@ void flushAppendOnlyFile(int force) {
                                        (long long)sdslen(server.aof_buf));
             }
 
-            if (ftruncate(server.aof_fd, server.aof_current_size) == -1) {
+            if (ftruncate(server.aof_fd, server.aof_fd_size) == -1) {
                 if (can_log) {
                     serverLog(LL_WARNING, "Could not remove short write "
                              "from the append-only file.  Redis may refuse "
@@ -401,6 +947,7 @@ void flushAppendOnlyFile(int force) {
              * was no way to undo it with ftruncate(2). */
             if (nwritten > 0) {
                 server.aof_current_size += nwritten;
+                server.aof_fd_size += nwritten;
                 sdsrange(server.aof_buf,nwritten,-1);
             }
             return; /* We'll try again on the next call... */
@@ -415,6 +962,7 @@ void flushAppendOnlyFile(int force) {
         }
     }
     server.aof_current_size += nwritten;
+    server.aof_fd_size += nwritten;
 
     /* Re-use AOF buffer when it is small enough. The maximum comes from the
      * arena size of 4k minus some overhead (but is otherwise arbitrary). */
@@ -428,11 +976,14 @@ void flushAppendOnlyFile(int force) {
     /* Don't fsync if no-appendfsync-on-rewrite is set to yes and there are
      * children doing I/O in the background. */
     if (server.aof_no_fsync_on_rewrite &&
-        (server.aof_child_pid != -1 || server.rdb_child_pid != -1))
+        (server.aof_child_pid != -1 || rdbSaveInProgress()))
             return;
 
     /* Perform the fsync if needed. */
-    if (server.aof_fsync == AOF_FSYNC_ALWAYS) {
+    if (server.aof_fsync == AOF_FSYNC_ALWAYS && server.aof_group_commit) {
+        /* The replies wait for the fsync in background. */
+        aofGroupCommitFsync();
+    } else if (server.aof_fsync == AOF_FSYNC_ALWAYS) {
         /* aof_fsync is defined as fdatasync() for Linux in order to avoid
          * flushing metadata. */
         latencyStartMonitor(latency);
@@ -561,15 +1112,22 @@ void feedAppendOnlyFile(struct redisCommand *cmd, int dictid, robj **argv, int a
 
     /* Append to the AOF buffer. This will be flushed on disk just before
      * of re-entering the event loop, so before the client will get a
-     * positive reply about the operation performed. */
-    if (server.aof_state == AOF_ON)
+     * positive reply about the operation performed. With a manifest this
+     * is also the case while the rewrite enabling the AOF is in progress,
+     * since the commands go to the incremental file following its base. */
+    if (server.aof_state == AOF_ON ||
+        (server.aof_use_manifest && server.aof_state == AOF_WAIT_REWRITE &&
+         server.aof_child_pid != -1))
+    {
         server.aof_buf = sdscatlen(server.aof_buf,buf,sdslen(buf));
+        server.aof_fed_offset += sdslen(buf);
+    }
 
     /* If a background append only file rewriting is in progress we want to
      * accumulate the differences between the child DB and the current one
      * in a buffer, so that when the child process will do its work we
      * can append the differences to the new append only file. */
-    if (server.aof_child_pid != -1)
+    if (server.aof_child_pid != -1 && !server.aof_use_manifest)
         aofRewriteBufferAppend((unsigned char*)buf,sdslen(buf));
 
     sdsfree(buf);
@@ -599,6 +1157,7 @@ struct client *createFakeClient(void) {
     c->replstate = SLAVE_STATE_WAIT_BGSAVE_START;
     c->reply = listCreate();
     c->reply_bytes = 0;
+    c->reply_sent = NULL;
     c->obuf_soft_limit_reached_time = 0;
     c->watched_keys = listCreate();
     c->peerid = NULL;
@@ -626,8 +1185,9 @@ void freeFakeClient(struct client *c) {
 
 /* Replay the append log file. On success C_OK is returned. On non fatal
  * error (the append only file is zero-length) C_ERR is returned. On
- * fatal error an error message is logged and the program exists. */
-int loadAppendOnlyFile(char *filename) {
+ * fatal error an error message is logged and the program exists. A
+ * truncated file is only accepted if it is the 'last' one of the AOF. */
+static int loadAppendOnlyFile(char *filename, int last) {
     struct client *fakeClient;
     FILE *fp = fopen(filename,"r");
     struct redis_stat sb;
@@ -645,7 +1205,6 @@ int loadAppendOnlyFile(char *filename) {
      * a zero length file at startup, that will remain like that if no write
      * operation is received. */
     if (fp && redis_fstat(fileno(fp),&sb) != -1 && sb.st_size == 0) {
-        server.aof_current_size = 0;
         fclose(fp);
         return C_ERR;
     }
@@ -763,8 +1322,6 @@ loaded_ok: /* DB loaded, cleanup and return C_OK to the caller. */
     freeFakeClient(fakeClient);
     server.aof_state = old_aof_state;
     stopLoading();
-    aofUpdateCurrentSize();
-    server.aof_rewrite_base_size = server.aof_current_size;
     return C_OK;
 
 readerr: /* Read error. If feof(fp) is true, fall through to unexpected EOF. */
@@ -775,7 +1332,7 @@ readerr: /* Read error. If feof(fp) is true, fall through to unexpected EOF. */
     }
 
 uxeof: /* Unexpected AOF end of file. */
-    if (server.aof_load_truncated) {
+    if (server.aof_load_truncated && last) {
         serverLog(LL_WARNING,"!!! Warning: short read while loading the AOF file !!!");
         serverLog(LL_WARNING,"!!! Truncating the AOF at offset %llu !!!",
             (unsigned long long) valid_up_to);
@@ -809,6 +1366,40 @@ fmterr: /* Format error. */
     exit(1);
 }
 
+/* Load the AOF: the file named appendfilename, or the files listed in the
+ * manifest when aof-use-manifest is enabled. C_OK is returned if some data
+ * was loaded, C_ERR if the AOF is empty. */
+int loadAppendOnlyFiles(void) {
+    aofManifest *am = server.aof_manifest;
+    int retval = C_ERR;
+
+    if (!server.aof_use_manifest) {
+        retval = loadAppendOnlyFile(server.aof_filename,1);
+    } else {
+        listIter li;
+        listNode *ln;
+
+        if (am->base &&
+            loadAppendOnlyFile(am->base->name,listLength(am->incr) == 0) == C_OK)
+            retval = C_OK;
+        listRewind(am->incr,&li);
+        while((ln = listNext(&li)) != NULL) {
+            aofInfo *ai = ln->value;
+
+            if (loadAppendOnlyFile(ai->name,ln == listLast(am->incr)) == C_OK)
+                retval = C_OK;
+        }
+    }
+
+    if (retval == C_OK) {
+        aofUpdateCurrentSize();
+        server.aof_rewrite_base_size = server.aof_current_size;
+    } else {
+        server.aof_current_size = 0;
+    }
+    return retval;
+}
+
 /* ----------------------------------------------------------------------------
  * AOF rewrite
  * ------------------------------------------------------------------------- */
@@ -884,11 +1475,11 @@ int rewriteSetObject(rio *r, robj *key, robj *o) {
             items--;
         }
     } else if (o->encoding == OBJ_ENCODING_HT) {
-        dictIterator *di = dictGetIterator(o->ptr);
-        dictEntry *de;
+        hashtableIterator *di = hashtableGetIterator(o->ptr);
+        hashtableEntry *de;
 
-        while((de = dictNext(di)) != NULL) {
-            sds ele = dictGetKey(de);
+        while((de = hashtableNext(di)) != NULL) {
+            sds ele = hashtableGetKey(de);
             if (count == 0) {
                 int cmd_items = (items > AOF_REWRITE_ITEMS_PER_CMD) ?
                     AOF_REWRITE_ITEMS_PER_CMD : items;
@@ -901,7 +1492,7 @@ int rewriteSetObject(rio *r, robj *key, robj *o) {
             if (++count == AOF_REWRITE_ITEMS_PER_CMD) count = 0;
             items--;
         }
-        dictReleaseIterator(di);
+        hashtableReleaseIterator(di);
     } else {
         serverPanic("Unknown set encoding");
     }
@@ -913,7 +1504,7 @@ int rewriteSetObject(rio *r, robj *key, robj *o) {
 int rewriteSortedSetObject(rio *r, robj *key, robj *o) {
     long long count = 0, items = zsetLength(o);
 
-    if (o->encoding == OBJ_ENCODING_ZIPLIST) {
+    if (o->encoding == OBJ_ENCODING_LISTPACK) {
         unsigned char *zl = o->ptr;
         unsigned char *eptr, *sptr;
         unsigned char *vstr;
@@ -921,13 +1512,13 @@ int rewriteSortedSetObject(rio *r, robj *key, robj *o) {
         long long vll;
         double score;
 
-        eptr = ziplistIndex(zl,0);
+        eptr = lpSeek(zl,0);
         serverAssert(eptr != NULL);
-        sptr = ziplistNext(zl,eptr);
+        sptr = lpNext(zl,eptr);
         serverAssert(sptr != NULL);
 
         while (eptr != NULL) {
-            serverAssert(ziplistGet(eptr,&vstr,&vlen,&vll));
+            serverAssert(lpGet(eptr,&vstr,&vlen,&vll));
             score = zzlGetScore(sptr);
 
             if (count == 0) {
@@ -948,14 +1539,15 @@ int rewriteSortedSetObject(rio *r, robj *key, robj *o) {
             if (++count == AOF_REWRITE_ITEMS_PER_CMD) count = 0;
             items--;
         }
-    } else if (o->encoding == OBJ_ENCODING_SKIPLIST) {
+    } else if (o->encoding == OBJ_ENCODING_SKIPLIST ||
+               o->encoding == OBJ_ENCODING_BTREE) {
         zset *zs = o->ptr;
         dictIterator *di = dictGetIterator(zs->dict);
         dictEntry *de;
 
         while((de = dictNext(di)) != NULL) {
             sds ele = dictGetKey(de);
-            double *score = dictGetVal(de);
+            double score = dictGetDoubleVal(de);
 
             if (count == 0) {
                 int cmd_items = (items > AOF_REWRITE_ITEMS_PER_CMD) ?
@@ -965,7 +1557,7 @@ int rewriteSortedSetObject(rio *r, robj *key, robj *o) {
                 if (rioWriteBulkString(r,"ZADD",4) == 0) return 0;
                 if (rioWriteBulkObject(r,key) == 0) return 0;
             }
-            if (rioWriteBulkDouble(r,*score) == 0) return 0;
+            if (rioWriteBulkDouble(r,score) == 0) return 0;
             if (rioWriteBulkString(r,ele,sdslen(ele)) == 0) return 0;
             if (++count == AOF_REWRITE_ITEMS_PER_CMD) count = 0;
             items--;
@@ -984,12 +1576,12 @@ int rewriteSortedSetObject(rio *r, robj *key, robj *o) {
  *
  * The function returns 0 on error, non-zero on success. */
 static int rioWriteHashIteratorCursor(rio *r, hashTypeIterator *hi, int what) {
-    if (hi->encoding == OBJ_ENCODING_ZIPLIST) {
+    if (hi->encoding == OBJ_ENCODING_LISTPACK) {
         unsigned char *vstr = NULL;
         unsigned int vlen = UINT_MAX;
         long long vll = LLONG_MAX;
 
-        hashTypeCurrentFromZiplist(hi, what, &vstr, &vlen, &vll);
+        hashTypeCurrentFromListpack(hi, what, &vstr, &vlen, &vll);
         if (vstr)
             return rioWriteBulkString(r, (char*)vstr, vlen);
         else
@@ -1031,6 +1623,91 @@ int rewriteHashObject(rio *r, robj *key, robj *o) {
     return 1;
 }
 
+/* Emit a BITFIELD SET operation writing the 'bits' (64 or 8) bits at the
+ * byte 'byte' of a bitmap, with the value 'val'. */
+static int rioWriteBitfieldSet(rio *r, uint64_t byte, int bits, int64_t val) {
+    char buf[LONG_STR_SIZE+1];
+    int len;
+
+    if (rioWriteBulkString(r,"SET",3) == 0) return 0;
+    if (bits == 64) {
+        if (rioWriteBulkString(r,"i64",3) == 0) return 0;
+        buf[0] = '#';
+        len = ll2string(buf+1,sizeof(buf)-1,byte/8)+1;
+    } else {
+        if (rioWriteBulkString(r,"u8",2) == 0) return 0;
+        len = ll2string(buf,sizeof(buf),byte*8);
+    }
+    if (rioWriteBulkString(r,buf,len) == 0) return 0;
+    return rioWriteBulkLongLong(r,val);
+}
+
+/* Emit the commands needed to rebuild a compressed bitmap: a SETBIT of
+ * the last bit creates the string with the right length, then the bits set
+ * are written 64 at a time with BITFIELD, skipping the empty chunks and the
+ * words without bits set.
+ * The function returns 0 on error, 1 on success. */
+int rewriteBitmapObject(rio *r, robj *key, robj *o) {
+    roaring *bm = o->ptr;
+    uint64_t len = roaringLen(bm), base, byte, word;
+    unsigned char *chunk = zmalloc(ROARING_CHUNK_BYTES);
+    uint32_t *ops = zmalloc(sizeof(uint32_t)*ROARING_CHUNK_BYTES);
+    uint32_t i, j, k, n, nops;
+    int bits, retval = 0;
+
+    if (rioWriteBulkCount(r,'*',4) == 0 ||
+        rioWriteBulkString(r,"SETBIT",6) == 0 ||
+        rioWriteBulkObject(r,key) == 0 ||
+        rioWriteBulkLongLong(r,len*8-1) == 0 ||
+        rioWriteBulkString(r,"0",1) == 0) goto werr;
+
+    for (i = 0; i < bm->count; i++) {
+        base = (uint64_t)bm->containers[i].key*ROARING_CHUNK_BYTES;
+        roaringGetChunk(bm,bm->containers[i].key,chunk);
+
+        /* Collect the offsets of the non zero words, or of the non zero
+         * bytes of the last partial word of the string. */
+        nops = 0;
+        for (j = 0; j < ROARING_CHUNK_BYTES && base+j < len; j += 8) {
+            memcpy(&word,chunk+j,8);
+            if (word == 0) continue;
+            if (base+j+8 <= len) {
+                ops[nops++] = j;
+            } else {
+                for (k = j; base+k < len; k++)
+                    if (chunk[k]) ops[nops++] = k;
+            }
+        }
+
+        for (j = 0; j < nops; j += n) {
+            n = nops-j;
+            if (n > AOF_REWRITE_ITEMS_PER_CMD) n = AOF_REWRITE_ITEMS_PER_CMD;
+            if (rioWriteBulkCount(r,'*',2+n*4) == 0 ||
+                rioWriteBulkString(r,"BITFIELD",8) == 0 ||
+                rioWriteBulkObject(r,key) == 0) goto werr;
+            for (k = j; k < j+n; k++) {
+                byte = base+ops[k];
+                bits = byte+8 <= len ? 64 : 8;
+                if (bits == 64) {
+                    /* The bitfield integer is big endian. */
+                    memcpy(&word,chunk+ops[k],8);
+                    word = ntohu64(word);
+                } else {
+                    word = chunk[ops[k]];
+                }
+                if (rioWriteBitfieldSet(r,byte,bits,(int64_t)word) == 0)
+                    goto werr;
+            }
+        }
+    }
+    retval = 1;
+
+werr:
+    zfree(chunk);
+    zfree(ops);
+    return retval;
+}
+
 /* Call the module type callback in order to rewrite a data type
  * that is exported by a module and is not handled by Redis itself.
  * The function returns 0 on error, 1 on success. */
@@ -1054,6 +1731,9 @@ ssize_t aofReadDiffFromParent(void) {
     char buf[65536]; /* Default pipe buffer size on most Linux systems. */
     ssize_t nread, total = 0;
 
+    /* With a manifest the parent doesn't send any diff, nor creates pipes. */
+    if (server.aof_use_manifest) return 0;
+
     while ((nread =
             read(server.aof_pipe_read_data_from_parent,buf,sizeof(buf))) > 0) {
         server.aof_child_diff = sdscatlen(server.aof_child_diff,buf,nread);
@@ -1062,83 +1742,221 @@ ssize_t aofReadDiffFromParent(void) {
     return total;
 }
 
+/* Emit the commands rebuilding the key 'keystr' with the value 'o', unless
+ * the key is already expired at the time 'now'. Returns 0 on write errors,
+ * otherwise 1 is returned. */
+static int rewriteAppendOnlyFileKey(rio *aof, sds keystr, robj *o,
+                                    long long now)
+{
+    robj key;
+    long long expiretime;
+
+    initStaticStringObject(key,keystr);
+    expiretime = keyGetExpire(keystr);
+
+    /* If this key is already expired skip it */
+    if (expiretime != -1 && expiretime < now) return 1;
+
+    /* Save the key and associated value */
+    if (o->type == OBJ_STRING && o->encoding == OBJ_ENCODING_BITMAP) {
+        if (rewriteBitmapObject(aof,&key,o) == 0) return 0;
+    } else if (o->type == OBJ_STRING) {
+        /* Emit a SET command */
+        char cmd[]="*3\r\n$3\r\nSET\r\n";
+        if (rioWrite(aof,cmd,sizeof(cmd)-1) == 0) return 0;
+        /* Key and value */
+        if (rioWriteBulkObject(aof,&key) == 0) return 0;
+        if (rioWriteBulkObject(aof,o) == 0) return 0;
+    } else if (o->type == OBJ_LIST) {
+        if (rewriteListObject(aof,&key,o) == 0) return 0;
+    } else if (o->type == OBJ_SET) {
+        if (rewriteSetObject(aof,&key,o) == 0) return 0;
+    } else if (o->type == OBJ_ZSET) {
+        if (rewriteSortedSetObject(aof,&key,o) == 0) return 0;
+    } else if (o->type == OBJ_HASH) {
+        if (rewriteHashObject(aof,&key,o) == 0) return 0;
+    } else if (o->type == OBJ_MODULE) {
+        if (rewriteModuleObject(aof,&key,o) == 0) return 0;
+    } else {
+        serverPanic("Unknown object type");
+    }
+    /* Save the expire time */
+    if (expiretime != -1) {
+        char cmd[]="*3\r\n$9\r\nPEXPIREAT\r\n";
+        if (rioWrite(aof,cmd,sizeof(cmd)-1) == 0) return 0;
+        if (rioWriteBulkObject(aof,&key) == 0) return 0;
+        if (rioWriteBulkLongLong(aof,expiretime) == 0) return 0;
+    }
+    return 1;
+}
+
+/* A segment of the rewritten AOF: the commands rebuilding the keys stored in
+ * a range of buckets of the main hash table of a DB, generated into a buffer
+ * by the threads of the work queue, exactly like the chunks of the RDB
+ * chunked format (see rdbSaveChunks()). */
+typedef struct aofRewriteSegment {
+    redisDb *db;
+    unsigned long start, end;   /* Range of buckets, see hashtableScanBuckets(). */
+    long long now;              /* Keys expired at this time are skipped. */
+    rio rio;                    /* Buffer the commands are written into. */
+} aofRewriteSegment;
+
+static void aofRewriteSegmentEntry(void *privdata, hashtableEntry *de) {
+    aofRewriteSegment *seg = privdata;
+
+    rewriteAppendOnlyFileKey(&seg->rio,hashtableGetKey(de),
+                             hashtableGetVal(de),seg->now);
+}
+
+/* Rewrite a segment: called by the threads of the work queue. */
+static void aofRewriteSegmentProcess(void *job) {
+    aofRewriteSegment *seg = job;
+    sds buf = seg->rio.io.buffer.ptr;
+
+    sdsclear(buf);
+    rioInitWithBuffer(&seg->rio,buf);
+    hashtableScanBuckets(seg->db->dict,seg->start,seg->end,
+                         aofRewriteSegmentEntry,seg);
+}
+
+static void aofRewriteSegmentFree(void *job) {
+    aofRewriteSegment *seg = job;
+
+    sdsfree(seg->rio.io.buffer.ptr);
+    zfree(seg);
+}
+
+/* Create the work queue rewriting the segments. */
+static rdbWorkQueue *aofRewriteSegmentsCreate(void) {
+    int j, numthreads = rdbUseThreads() ? server.aof_rewrite_threads : 1;
+    rdbWorkQueue *q = rdbWorkQueueCreate(numthreads,aofRewriteSegmentProcess);
+
+    for (j = 0; j < q->numjobs; j++) {
+        aofRewriteSegment *seg = zcalloc(sizeof(*seg));
+
+        rioInitWithBuffer(&seg->rio,sdsempty());
+        q->jobs[j] = seg;
+    }
+    return q;
+}
+
 int rewriteAppendOnlyFileRio(rio *aof) {
-    dictIterator *di = NULL;
-    dictEntry *de;
     size_t processed = 0;
     long long now = mstime();
+    rdbWorkQueue *q = aofRewriteSegmentsCreate();
+    aofRewriteSegment *seg;
     int j;
 
     for (j = 0; j < server.dbnum; j++) {
         char selectcmd[] = "*2\r\n$6\r\nSELECT\r\n";
         redisDb *db = server.db+j;
-        dict *d = db->dict;
-        if (dictSize(d) == 0) continue;
-        di = dictGetSafeIterator(d);
+        hashtable *h = db->dict;
+        unsigned long buckets = hashtableBuckets(h), start = 0, step;
+        int drain = 0;
+
+        if (hashtableSize(h) == 0) continue;
 
         /* SELECT the new DB */
         if (rioWrite(aof,selectcmd,sizeof(selectcmd)-1) == 0) goto werr;
         if (rioWriteBulkLongLong(aof,j) == 0) goto werr;
 
-        /* Iterate this DB writing every entry */
-        while((de = dictNext(di)) != NULL) {
-            sds keystr;
-            robj key, *o;
-            long long expiretime;
-
-            keystr = dictGetKey(de);
-            o = dictGetVal(de);
-            initStaticStringObject(key,keystr);
-
-            expiretime = getExpire(db,&key);
-
-            /* If this key is already expired skip it */
-            if (expiretime != -1 && expiretime < now) continue;
-
-            /* Save the key and associated value */
-            if (o->type == OBJ_STRING) {
-                /* Emit a SET command */
-                char cmd[]="*3\r\n$3\r\nSET\r\n";
-                if (rioWrite(aof,cmd,sizeof(cmd)-1) == 0) goto werr;
-                /* Key and value */
-                if (rioWriteBulkObject(aof,&key) == 0) goto werr;
-                if (rioWriteBulkObject(aof,o) == 0) goto werr;
-            } else if (o->type == OBJ_LIST) {
-                if (rewriteListObject(aof,&key,o) == 0) goto werr;
-            } else if (o->type == OBJ_SET) {
-                if (rewriteSetObject(aof,&key,o) == 0) goto werr;
-            } else if (o->type == OBJ_ZSET) {
-                if (rewriteSortedSetObject(aof,&key,o) == 0) goto werr;
-            } else if (o->type == OBJ_HASH) {
-                if (rewriteHashObject(aof,&key,o) == 0) goto werr;
-            } else if (o->type == OBJ_MODULE) {
-                if (rewriteModuleObject(aof,&key,o) == 0) goto werr;
+        /* Buckets in every segment, so that segments have about
+         * AOF_REWRITE_SEGMENT_KEYS keys. */
+        step = (unsigned long)
+               ((double)buckets*AOF_REWRITE_SEGMENT_KEYS/hashtableSize(h));
+        if (step == 0) step = 1;
+
+        while(1) {
+            if (start < buckets) {
+                seg = rdbWorkQueueTail(q);
+                seg->db = db;
+                seg->start = start;
+                seg->end = start+step;
+                seg->now = now;
+                rdbWorkQueuePush(q);
+                start += step;
             } else {
-                serverPanic("Unknown object type");
+                drain = 1;
             }
-            /* Save the expire time */
-            if (expiretime != -1) {
-                char cmd[]="*3\r\n$9\r\nPEXPIREAT\r\n";
-                if (rioWrite(aof,cmd,sizeof(cmd)-1) == 0) goto werr;
-                if (rioWriteBulkObject(aof,&key) == 0) goto werr;
-                if (rioWriteBulkLongLong(aof,expiretime) == 0) goto werr;
-            }
-            /* Read some diff from the parent process from time to time. */
-            if (aof->processed_bytes > processed+AOF_READ_DIFF_INTERVAL_BYTES) {
-                processed = aof->processed_bytes;
-                aofReadDiffFromParent();
+
+            /* Write the segments already rewritten, in order, waiting for
+             * the oldest one if no job is free or if all were queued. */
+            while((seg = rdbWorkQueueReady(q,drain || rdbWorkQueueFull(q)))
+                  != NULL)
+            {
+                sds buf = seg->rio.io.buffer.ptr;
+                int retval = rioWrite(aof,buf,sdslen(buf));
+
+                rdbWorkQueuePop(q);
+                if (retval == 0) goto werr;
+
+                /* Read some diff from the parent process from time to time. */
+                if (aof->processed_bytes >
+                    processed+AOF_READ_DIFF_INTERVAL_BYTES)
+                {
+                    processed = aof->processed_bytes;
+                    aofReadDiffFromParent();
+                }
             }
+            if (drain) break;
         }
-        dictReleaseIterator(di);
-        di = NULL;
     }
+    rdbWorkQueueRelease(q,aofRewriteSegmentFree);
     return C_OK;
 
 werr:
-    if (di) dictReleaseIterator(di);
+    rdbWorkQueueRelease(q,aofRewriteSegmentFree);
     return C_ERR;
 }
 
+/* Called by the rewrite child once the dataset is written, to append the
+ * diff accumulated by the parent in the meantime, as long as it is willing
+ * to send it. Returns C_ERR on errors. */
+static int rewriteAppendOnlyFileDiff(rio *aof) {
+    char byte;
+    int nodata = 0;
+    mstime_t start = mstime();
+
+    /* Read again a few times to get more data from the parent.
+     * We can't read forever (the server may receive data from clients
+     * faster than it is able to send data to the child), so we try to read
+     * some more data in a loop as soon as there is a good chance more data
+     * will come. If it looks like we are wasting time, we abort (this
+     * happens after 20 ms without new data). */
+    while(mstime()-start < 1000 && nodata < 20) {
+        if (aeWait(server.aof_pipe_read_data_from_parent, AE_READABLE, 1) <= 0)
+        {
+            nodata++;
+            continue;
+        }
+        nodata = 0; /* Start counting from zero, we stop on N *contiguous*
+                       timeouts. */
+        aofReadDiffFromParent();
+    }
+
+    /* Ask the master to stop sending diffs. */
+    if (write(server.aof_pipe_write_ack_to_parent,"!",1) != 1) return C_ERR;
+    if (anetNonBlock(NULL,server.aof_pipe_read_ack_from_parent) != ANET_OK)
+        return C_ERR;
+    /* We read the ACK from the server using a 10 seconds timeout. Normally
+     * it should reply ASAP, but just in case we lose its reply, we are sure
+     * the child will eventually get terminated. */
+    if (syncRead(server.aof_pipe_read_ack_from_parent,&byte,1,5000) != 1 ||
+        byte != '!') return C_ERR;
+    serverLog(LL_NOTICE,"Parent agreed to stop sending diffs. Finalizing AOF...");
+
+    /* Read the final diff if any. */
+    aofReadDiffFromParent();
+
+    /* Write the received diff to the file. */
+    serverLog(LL_NOTICE,
+        "Concatenating %.2f MB of AOF diff received from parent.",
+        (double) sdslen(server.aof_child_diff) / (1024*1024));
+    if (rioWrite(aof,server.aof_child_diff,sdslen(server.aof_child_diff)) == 0)
+        return C_ERR;
+    return C_OK;
+}
+
 /* Write a sequence of commands able to fully rebuild the dataset into
  * "filename". Used both by REWRITEAOF and BGREWRITEAOF.
  *
@@ -1150,7 +1968,9 @@ int rewriteAppendOnlyFile(char *filename) {
     rio aof;
     FILE *fp;
     char tmpfile[256];
-    char byte;
+    unsigned long long keys = 0;
+    long long start_usec, usec;
+    int j;
 
     /* Note that we have to use a different temp name here compared to the
      * one used by rewriteAppendOnlyFileBackground() function. */
@@ -1167,6 +1987,8 @@ int rewriteAppendOnlyFile(char *filename) {
     if (server.aof_rewrite_incremental_fsync)
         rioSetAutoSync(&aof,AOF_AUTOSYNC_BYTES);
 
+    for (j = 0; j < server.dbnum; j++) keys += hashtableSize(server.db[j].dict);
+    start_usec = ustime();
     if (server.aof_use_rdb_preamble) {
         int error;
         if (rdbSaveRio(&aof,&error,RDB_SAVE_AOF_PREAMBLE,NULL) == C_ERR) {
@@ -1176,50 +1998,21 @@ int rewriteAppendOnlyFile(char *filename) {
     } else {
         if (rewriteAppendOnlyFileRio(&aof) == C_ERR) goto werr;
     }
+    usec = ustime()-start_usec;
+    serverLog(LL_NOTICE,
+        "AOF rewrite: %llu keys written in %.3f seconds (%lld keys/s)",
+        keys, (double)usec/1000000, usec ? (long long)(keys*1000000/usec) : 0);
+    server.child_info_data.keys = keys;
+    server.child_info_data.keys_usec = usec;
 
     /* Do an initial slow fsync here while the parent is still sending
      * data, in order to make the next final fsync faster. */
     if (fflush(fp) == EOF) goto werr;
     if (fsync(fileno(fp)) == -1) goto werr;
 
-    /* Read again a few times to get more data from the parent.
-     * We can't read forever (the server may receive data from clients
-     * faster than it is able to send data to the child), so we try to read
-     * some more data in a loop as soon as there is a good chance more data
-     * will come. If it looks like we are wasting time, we abort (this
-     * happens after 20 ms without new data). */
-    int nodata = 0;
-    mstime_t start = mstime();
-    while(mstime()-start < 1000 && nodata < 20) {
-        if (aeWait(server.aof_pipe_read_data_from_parent, AE_READABLE, 1) <= 0)
-        {
-            nodata++;
-            continue;
-        }
-        nodata = 0; /* Start counting from zero, we stop on N *contiguous*
-                       timeouts. */
-        aofReadDiffFromParent();
-    }
-
-    /* Ask the master to stop sending diffs. */
-    if (write(server.aof_pipe_write_ack_to_parent,"!",1) != 1) goto werr;
-    if (anetNonBlock(NULL,server.aof_pipe_read_ack_from_parent) != ANET_OK)
-        goto werr;
-    /* We read the ACK from the server using a 10 seconds timeout. Normally
-     * it should reply ASAP, but just in case we lose its reply, we are sure
-     * the child will eventually get terminated. */
-    if (syncRead(server.aof_pipe_read_ack_from_parent,&byte,1,5000) != 1 ||
-        byte != '!') goto werr;
-    serverLog(LL_NOTICE,"Parent agreed to stop sending diffs. Finalizing AOF...");
-
-    /* Read the final diff if any. */
-    aofReadDiffFromParent();
-
-    /* Write the received diff to the file. */
-    serverLog(LL_NOTICE,
-        "Concatenating %.2f MB of AOF diff received from parent.",
-        (double) sdslen(server.aof_child_diff) / (1024*1024));
-    if (rioWrite(&aof,server.aof_child_diff,sdslen(server.aof_child_diff)) == 0)
+    /* Without a manifest the commands executed by the parent meanwhile have
+     * to be appended to the new file. */
+    if (!server.aof_use_manifest && rewriteAppendOnlyFileDiff(&aof) == C_ERR)
         goto werr;
 
     /* Make sure data will not remain on the OS's output buffers */
@@ -1308,6 +2101,7 @@ error:
 }
 
 void aofClosePipes(void) {
+    if (server.aof_use_manifest) return; /* Pipes are not used. */
     aeDeleteFileEvent(server.el,server.aof_pipe_read_ack_from_child,AE_READABLE);
     aeDeleteFileEvent(server.el,server.aof_pipe_write_data_to_child,AE_WRITABLE);
     close(server.aof_pipe_write_data_to_child);
@@ -1338,8 +2132,18 @@ int rewriteAppendOnlyFileBackground(void) {
     pid_t childpid;
     long long start;
 
-    if (server.aof_child_pid != -1 || server.rdb_child_pid != -1) return C_ERR;
-    if (aofCreatePipes() != C_OK) return C_ERR;
+    if (server.aof_child_pid != -1 || rdbSaveInProgress()) return C_ERR;
+    if (server.aof_use_manifest) {
+        /* The child writes the new base, while the parent keeps writing
+         * to a new incremental file, opened before the fork. */
+        if (server.aof_state == AOF_WAIT_REWRITE) {
+            if (aofOpenPendingIncrFile() == C_ERR) return C_ERR;
+        } else if (server.aof_state == AOF_ON && aofOpenIncrFile() == C_ERR) {
+            return C_ERR;
+        }
+    } else if (aofCreatePipes() != C_OK) {
+        return C_ERR;
+    }
     openChildInfoPipe();
     start = ustime();
     if ((childpid = fork()) == 0) {
@@ -1397,7 +2201,7 @@ int rewriteAppendOnlyFileBackground(void) {
 void bgrewriteaofCommand(client *c) {
     if (server.aof_child_pid != -1) {
         addReplyError(c,"Background append only file rewriting already in progress");
-    } else if (server.rdb_child_pid != -1) {
+    } else if (rdbSaveInProgress()) {
         server.aof_rewrite_scheduled = 1;
         addReplyStatus(c,"Background append only file rewriting scheduled");
     } else if (rewriteAppendOnlyFileBackground() == C_OK) {
@@ -1423,11 +2227,30 @@ void aofUpdateCurrentSize(void) {
     mstime_t latency;
 
     latencyStartMonitor(latency);
-    if (redis_fstat(server.aof_fd,&sb) == -1) {
+    if (server.aof_use_manifest) {
+        aofManifest *am = server.aof_manifest;
+        off_t size = 0;
+        listIter li;
+        listNode *ln;
+
+        /* The AOF size is the size of all the files of the manifest. */
+        if (am->base && redis_stat(am->base->name,&sb) != -1)
+            size += sb.st_size;
+        listRewind(am->incr,&li);
+        while((ln = listNext(&li)) != NULL) {
+            aofInfo *ai = ln->value;
+
+            if (redis_stat(ai->name,&sb) != -1) size += sb.st_size;
+        }
+        server.aof_current_size = size;
+        if (server.aof_fd != -1 && redis_fstat(server.aof_fd,&sb) != -1)
+            server.aof_fd_size = sb.st_size;
+    } else if (redis_fstat(server.aof_fd,&sb) == -1) {
         serverLog(LL_WARNING,"Unable to obtain the AOF file length. stat: %s",
             strerror(errno));
     } else {
         server.aof_current_size = sb.st_size;
+        server.aof_fd_size = sb.st_size;
     }
     latencyEndMonitor(latency);
     latencyAddSampleIfNeeded("aof-fstat",latency);
@@ -1444,12 +2267,28 @@ void backgroundRewriteDoneHandler(int exitcode, int bysignal) {
 
         serverLog(LL_NOTICE,
             "Background AOF rewrite terminated with success");
+        snprintf(tmpfile,256,"temp-rewriteaof-bg-%d.aof",
+            (int)server.aof_child_pid);
+
+        /* With a manifest there is no diff to flush: the commands executed
+         * meanwhile are already in the incremental file, so it's enough to
+         * install the new base. */
+        if (server.aof_use_manifest) {
+            if (aofInstallBaseFile(tmpfile) == C_ERR) goto cleanup;
+            aofUpdateCurrentSize();
+            server.aof_rewrite_base_size = server.aof_current_size;
+            server.aof_lastbgrewrite_status = C_OK;
+            serverLog(LL_NOTICE, "Background AOF rewrite finished successfully");
+            if (server.aof_state == AOF_WAIT_REWRITE)
+                server.aof_state = AOF_ON;
+            serverLog(LL_VERBOSE,
+                "Background AOF rewrite signal handler took %lldus", ustime()-now);
+            goto cleanup;
+        }
 
         /* Flush the differences accumulated by the parent to the
          * rewritten AOF. */
         latencyStartMonitor(latency);
-        snprintf(tmpfile,256,"temp-rewriteaof-bg-%d.aof",
-            (int)server.aof_child_pid);
         newfd = open(tmpfile,O_WRONLY|O_APPEND);
         if (newfd == -1) {
             serverLog(LL_WARNING,
@@ -76,6 +76,15 @@
 #define HAVE_EPOLL 1
 #endif
 
+/* io_uring, only if built with USE_IO_URING=yes: the kernel headers must be
+ * at least 5.9 for the features we use, the running kernel is checked when
+ * the event loop is created. */
+#if defined(__linux__) && defined(USE_IO_URING)
+#if (LINUX_VERSION_CODE >= 0x050900)
+#define HAVE_IO_URING 1
+#endif
+#endif
+
 #if (defined(__APPLE__) && defined(MAC_OS_X_VERSION_10_6)) || defined(__FreeBSD__) || defined(__OpenBSD__) || defined (__NetBSD__)
 #define HAVE_KQUEUE 1
 #endif
@@ -87,6 +96,21 @@
 #endif
 #endif
 
+/* Software prefetch of the cache line at 'addr', for reading. */
+#if defined(__GNUC__)
+#define redis_prefetch(addr) __builtin_prefetch(addr)
+#else
+#define redis_prefetch(addr) ((void)(addr))
+#endif
+
+/* SSE2 and AVX2 kernels. SSE2 is always available on x86_64, while the AVX2
+ * ones are compiled with the target attribute and only called when the CPU
+ * supports them, so no special compiler flags are needed. */
+#if defined(__x86_64__) && ((defined(__GNUC__) && __GNUC__ >= 5) || \
+    (defined(__clang__) && __clang_major__ >= 4))
+#define HAVE_X86_SIMD 1
+#endif
+
 /* Define aof_fsync to fdatasync() in Linux and fsync() for all the rest */
 #ifdef __linux__
 #define aof_fsync fdatasync
@@ -38,35 +38,73 @@
  * C-level DB API
  *----------------------------------------------------------------------------*/
 
+static robj *lookupKeyTouch(robj *val, int flags);
+static int dbFindBatch(redisDb *db, robj **keys, int count, hashtableEntry **des);
+static int expireEntryIfNeeded(redisDb *db, robj *key, hashtableEntry *de);
+void scanDatabaseForReadyLists(redisDb *db);
+
 /* Low level key lookup API, not actually called directly from commands
  * implementations that should instead rely on lookupKeyRead(),
  * lookupKeyWrite() and lookupKeyReadWithFlags(). */
 robj *lookupKey(redisDb *db, robj *key, int flags) {
-    dictEntry *de = dictFind(db->dict,key->ptr);
+    hashtableEntry *de = hashtableFind(db->dict,key->ptr);
     if (de) {
-        robj *val = dictGetVal(de);
-
-        /* Update the access time for the ageing algorithm.
-         * Don't do it if we have a saving child, as this will trigger
-         * a copy on write madness. */
-        if (server.rdb_child_pid == -1 &&
-            server.aof_child_pid == -1 &&
-            !(flags & LOOKUP_NOTOUCH))
-        {
-            if (server.maxmemory_policy & MAXMEMORY_FLAG_LFU) {
-                unsigned long ldt = val->lru >> 8;
-                unsigned long counter = LFULogIncr(val->lru & 255);
-                val->lru = (ldt << 8) | counter;
-            } else {
-                val->lru = LRU_CLOCK();
-            }
-        }
-        return val;
+        return lookupKeyTouch(hashtableGetVal(de),flags);
     } else {
         return NULL;
     }
 }
 
+/* Called by the lookup functions when the value 'val' of a key is found. */
+static robj *lookupKeyTouch(robj *val, int flags) {
+    /* Update the access time for the ageing algorithm.
+     * Don't do it if we have a saving child, as this will trigger
+     * a copy on write madness, nor while the snapshot thread may be
+     * reading the object. */
+    if (!rdbSaveInProgress() &&
+        server.aof_child_pid == -1 &&
+        !(flags & LOOKUP_NOTOUCH))
+    {
+        if (server.maxmemory_policy & MAXMEMORY_FLAG_LFU) {
+            unsigned long ldt = val->lru >> 8;
+            unsigned long counter = LFULogIncr(val->lru & 255);
+            val->lru = (ldt << 8) | counter;
+        } else {
+            val->lru = LRU_CLOCK();
+        }
+    }
+    return val;
+}
+
+/* Find the main dictionary entries of 'count' keys, at most HASHTABLE_FIND_BATCH,
+ * with a single hashtableFindBatch() call, storing them in 'des'.
+ *
+ * The function returns the number of leading keys whose entry can be used
+ * as it is, stopping at the first key that is logically expired: such key,
+ * and the ones following it, must be handled by the caller with the usual
+ * per-key API, since expiring the key may delete entries found by the batch
+ * (the same key can be repeated in the arguments of a command). */
+static int dbFindBatch(redisDb *db, robj **keys, int count, hashtableEntry **des) {
+    const void *ptrs[HASHTABLE_FIND_BATCH];
+    mstime_t now = -1, when;
+    int j;
+
+    serverAssert(count <= HASHTABLE_FIND_BATCH);
+    for (j = 0; j < count; j++) ptrs[j] = keys[j]->ptr;
+    hashtableFindBatch(db->dict,ptrs,des,count);
+    if (hashtableSize(db->expires) == 0) return count;
+
+    for (j = 0; j < count; j++) {
+        if (des[j] == NULL ||
+            (when = keyGetExpire(hashtableGetKey(des[j]))) == -1) continue;
+        /* Same notion of time as expireIfNeeded(). */
+        if (now == -1) now = server.lua_caller ? server.lua_time_start :
+                                                 mstime();
+        if (now > when) break;
+    }
+    return j;
+}
+
 /* Lookup a key for read operations, or return NULL if the key is not found
  * in the specified DB.
  *
@@ -89,9 +127,10 @@ robj *lookupKey(redisDb *db, robj *key, int flags) {
  * correctly report a key is expired on slaves even if the master is lagging
  * expiring our key via DELs in the replication link. */
 robj *lookupKeyReadWithFlags(redisDb *db, robj *key, int flags) {
-    robj *val;
+    hashtableEntry *de = hashtableFind(db->dict,key->ptr);
+    robj *val = NULL;
 
-    if (expireIfNeeded(db,key) == 1) {
+    if (de && expireEntryIfNeeded(db,key,de) == 1) {
         /* Key expired. If we are in the context of a master, expireIfNeeded()
          * returns 0 only when the key does not exist at all, so it's safe
          * to return NULL ASAP. */
@@ -117,7 +156,7 @@ robj *lookupKeyReadWithFlags(redisDb *db, robj *key, int flags) {
             return NULL;
         }
     }
-    val = lookupKey(db,key,flags);
+    if (de) val = lookupKeyTouch(hashtableGetVal(de),flags);
     if (val == NULL)
         server.stat_keyspace_misses++;
     else
@@ -131,14 +170,47 @@ robj *lookupKeyRead(redisDb *db, robj *key) {
     return lookupKeyReadWithFlags(db,key,LOOKUP_NONE);
 }
 
+/* Like lookupKeyRead(), but up to 'count' keys, at most HASHTABLE_FIND_BATCH, are
+ * looked up at once, storing the value of keys[j] (or NULL) in vals[j].
+ * Looking up the keys together allows to overlap the cache misses of the
+ * different lookups, see hashtableFindBatch().
+ *
+ * The number of keys looked up is returned: it is less than 'count' when a
+ * key is found to be expired, in which case the caller should look up the
+ * remaining keys with lookupKeyRead() only after it is done with the values
+ * returned, since expiring a key may free one of them. */
+int lookupKeysRead(redisDb *db, robj **keys, int count, robj **vals) {
+    hashtableEntry *des[HASHTABLE_FIND_BATCH];
+    int found = dbFindBatch(db,keys,count,des), j;
+
+    for (j = 0; j < found; j++) {
+        if (des[j]) {
+            vals[j] = lookupKeyTouch(hashtableGetVal(des[j]),LOOKUP_NONE);
+            server.stat_keyspace_hits++;
+        } else {
+            vals[j] = NULL;
+            server.stat_keyspace_misses++;
+        }
+    }
+    return found;
+}
+
 /* Lookup a key for write operations, and as a side effect, if needed, expires
  * the key if its TTL is reached.
  *
  * Returns the linked value object if the key exists or NULL if the key
  * does not exist in the specified DB. */
 robj *lookupKeyWrite(redisDb *db, robj *key) {
-    expireIfNeeded(db,key);
-    return lookupKey(db,key,LOOKUP_NONE);
+    hashtableEntry *de;
+
+    rdbSnapshotKeyWrite(db,key->ptr);
+    de = hashtableFind(db->dict,key->ptr);
+
+    if (de == NULL) return NULL;
+    /* Only masters delete expired keys, slaves still return them. */
+    if (expireEntryIfNeeded(db,key,de) == 1 && server.masterhost == NULL)
+        return NULL;
+    return lookupKeyTouch(hashtableGetVal(de),LOOKUP_NONE);
 }
 
 robj *lookupKeyReadOrReply(client *c, robj *key, robj *reply) {
@@ -159,7 +231,10 @@ robj *lookupKeyWriteOrReply(client *c, robj *key, robj *reply) {
  * The program is aborted if the key already exists. */
 void dbAdd(redisDb *db, robj *key, robj *val) {
     sds copy = sdsdup(key->ptr);
-    int retval = dictAdd(db->dict, copy, val);
+    int retval;
+
+    rdbSnapshotKeyWrite(db,key->ptr);
+    retval = hashtableAdd(db->dict, copy, val);
 
     serverAssertWithInfo(NULL,key,retval == DICT_OK);
     if (val->type == OBJ_LIST) signalListAsReady(db, key);
@@ -172,16 +247,19 @@ void dbAdd(redisDb *db, robj *key, robj *val) {
  *
  * The program is aborted if the key was not already present. */
 void dbOverwrite(redisDb *db, robj *key, robj *val) {
-    dictEntry *de = dictFind(db->dict,key->ptr);
+    hashtableEntry *de;
+
+    rdbSnapshotKeyWrite(db,key->ptr);
+    de = hashtableFind(db->dict,key->ptr);
 
     serverAssertWithInfo(NULL,key,de != NULL);
     if (server.maxmemory_policy & MAXMEMORY_FLAG_LFU) {
-        robj *old = dictGetVal(de);
+        robj *old = hashtableGetVal(de);
         int saved_lru = old->lru;
-        dictReplace(db->dict, key->ptr, val);
+        hashtableReplace(db->dict, key->ptr, val);
         val->lru = saved_lru;
     } else {
-        dictReplace(db->dict, key->ptr, val);
+        hashtableReplace(db->dict, key->ptr, val);
     }
 }
 
@@ -198,14 +276,14 @@ void setKey(redisDb *db, robj *key, robj *val) {
         dbAdd(db,key,val);
     } else {
         dbOverwrite(db,key,val);
+        removeExpire(db,key);
     }
     incrRefCount(val);
-    removeExpire(db,key);
     signalModifiedKey(db,key);
 }
 
 int dbExists(redisDb *db, robj *key) {
-    return dictFind(db->dict,key->ptr) != NULL;
+    return hashtableFind(db->dict,key->ptr) != NULL;
 }
 
 /* Return a random key, in form of a Redis object.
@@ -213,18 +291,18 @@ int dbExists(redisDb *db, robj *key) {
  *
  * The function makes sure to return keys not already expired. */
 robj *dbRandomKey(redisDb *db) {
-    dictEntry *de;
+    hashtableEntry *de;
 
     while(1) {
         sds key;
         robj *keyobj;
 
-        de = dictGetRandomKey(db->dict);
+        de = hashtableGetRandomEntry(db->dict);
         if (de == NULL) return NULL;
 
-        key = dictGetKey(de);
+        key = hashtableGetKey(de);
         keyobj = createStringObject(key,sdslen(key));
-        if (dictFind(db->expires,key)) {
+        if (keyGetExpire(key) != -1) {
             if (expireIfNeeded(db,keyobj)) {
                 decrRefCount(keyobj);
                 continue; /* search for another key. This expired. */
@@ -236,10 +314,14 @@ robj *dbRandomKey(redisDb *db) {
 
 /* Delete a key, value, and associated expiration entry if any, from the DB */
 int dbSyncDelete(redisDb *db, robj *key) {
-    /* Deleting an entry from the expires dict will not free the sds of
-     * the key, because it is shared with the main dictionary. */
-    if (dictSize(db->expires) > 0) dictDelete(db->expires,key->ptr);
-    if (dictDelete(db->dict,key->ptr) == DICT_OK) {
+    rdbSnapshotKeyWrite(db,key->ptr);
+    /* Deleting an entry from the expires index will not free the sds of
+     * the key, because it is shared with the main hash table. */
+    if (hashtableSize(db->expires) > 0) {
+        if (db->expires_index) expireIndexDel(db,key->ptr,getExpire(db,key));
+        hashtableDelete(db->expires,key->ptr);
+    }
+    if (hashtableDelete(db->dict,key->ptr) == DICT_OK) {
         if (server.cluster_enabled) slotToKeyDel(key);
         return 1;
     } else {
@@ -284,9 +366,14 @@ int dbDelete(redisDb *db, robj *key) {
 robj *dbUnshareStringValue(redisDb *db, robj *key, robj *o) {
     serverAssert(o->type == OBJ_STRING);
     if (o->refcount != 1 || o->encoding != OBJ_ENCODING_RAW) {
-        robj *decoded = getDecodedObject(o);
-        o = createRawStringObject(decoded->ptr, sdslen(decoded->ptr));
-        decrRefCount(decoded);
+        if (o->encoding == OBJ_ENCODING_BITMAP) {
+            /* Decoding a compressed bitmap already creates a new string. */
+            o = getDecodedObject(o);
+        } else {
+            robj *decoded = getDecodedObject(o);
+            o = createRawStringObject(decoded->ptr, sdslen(decoded->ptr));
+            decrRefCount(decoded);
+        }
         dbOverwrite(db,key,o);
     }
     return o;
@@ -314,15 +401,20 @@ long long emptyDb(int dbnum, int flags, void(callback)(void*)) {
         errno = EINVAL;
         return -1;
     }
+    rdbSnapshotAbort();
 
     for (j = 0; j < server.dbnum; j++) {
         if (dbnum != -1 && dbnum != j) continue;
-        removed += dictSize(server.db[j].dict);
+        removed += hashtableSize(server.db[j].dict);
         if (async) {
             emptyDbAsync(&server.db[j]);
         } else {
-            dictEmpty(server.db[j].dict,callback);
-            dictEmpty(server.db[j].expires,callback);
+            hashtableEmpty(server.db[j].dict,callback);
+            hashtableEmpty(server.db[j].expires,callback);
+            if (server.db[j].expires_index) {
+                raxFree(server.db[j].expires_index);
+                server.db[j].expires_index = raxNew();
+            }
         }
     }
     if (server.cluster_enabled) {
@@ -336,6 +428,85 @@ long long emptyDb(int dbnum, int flags, void(callback)(void*)) {
     return removed;
 }
 
+/* Return the number of keys in all the DBs of the server. */
+long long dbTotalServerKeyCount(void) {
+    long long total = 0;
+    int j;
+
+    for (j = 0; j < server.dbnum; j++)
+        total += hashtableSize(server.db[j].dict);
+    return total;
+}
+
+/* Create a set of empty DBs, like the ones of the server, where a dataset
+ * can be loaded while the current one is still served, see
+ * swapMainDbWithTempDb(). */
+redisDb *initTempDb(void) {
+    redisDb *tempDb = zcalloc(sizeof(redisDb)*server.dbnum);
+    int j;
+
+    for (j = 0; j < server.dbnum; j++) {
+        tempDb[j].dict = hashtableCreate(&dbDictType,NULL);
+        tempDb[j].expires = hashtableCreate(&keyptrDictType,NULL);
+        tempDb[j].blocking_keys = dictCreate(&keylistDictType,NULL);
+        tempDb[j].ready_keys = dictCreate(&objectKeyPointerValueDictType,NULL);
+        tempDb[j].watched_keys = dictCreate(&keylistDictType,NULL);
+        tempDb[j].id = j;
+        tempDb[j].avg_ttl = 0;
+        tempDb[j].expires_index =
+            server.active_expire_index ? raxNew() : NULL;
+        tempDb[j].expires_stale = 0;
+    }
+    return tempDb;
+}
+
+/* Release the DBs created by initTempDb(), with the keys they hold. With
+ * EMPTYDB_ASYNC the keys are freed in a different thread. */
+void discardTempDb(redisDb *tempDb, int flags) {
+    int j;
+
+    for (j = 0; j < server.dbnum; j++) {
+        if (flags & EMPTYDB_ASYNC) emptyDbAsync(&tempDb[j]);
+        hashtableRelease(tempDb[j].dict);
+        hashtableRelease(tempDb[j].expires);
+        if (tempDb[j].expires_index) raxFree(tempDb[j].expires_index);
+        dictRelease(tempDb[j].blocking_keys);
+        dictRelease(tempDb[j].ready_keys);
+        dictRelease(tempDb[j].watched_keys);
+    }
+    zfree(tempDb);
+}
+
+/* Make the keys of 'tempDb' the dataset of the server, and the old dataset
+ * the keys of 'tempDb', that the caller should then discard. Like for
+ * dbSwapDatabases() the clients remain blocked on and watching the keys of
+ * the DB they are in. */
+void swapMainDbWithTempDb(redisDb *tempDb) {
+    int j;
+
+    rdbSnapshotAbort();
+    for (j = 0; j < server.dbnum; j++) {
+        redisDb aux = server.db[j];
+        redisDb *activedb = &server.db[j], *newdb = &tempDb[j];
+
+        activedb->dict = newdb->dict;
+        activedb->expires = newdb->expires;
+        activedb->avg_ttl = newdb->avg_ttl;
+        activedb->expires_index = newdb->expires_index;
+        activedb->expires_stale = newdb->expires_stale;
+
+        newdb->dict = aux.dict;
+        newdb->expires = aux.expires;
+        newdb->avg_ttl = aux.avg_ttl;
+        newdb->expires_index = aux.expires_index;
+        newdb->expires_stale = aux.expires_stale;
+
+        /* Lists may now exist for the clients blocked on them. */
+        scanDatabaseForReadyLists(activedb);
+    }
+    flushSlaveKeysWithExpireList();
+}
+
 int selectDb(client *c, int id) {
     if (id < 0 || id >= server.dbnum)
         return C_ERR;
@@ -424,18 +595,31 @@ void flushallCommand(client *c) {
 
 /* This command implements DEL and LAZYDEL. */
 void delGenericCommand(client *c, int lazy) {
-    int numdel = 0, j;
-
-    for (j = 1; j < c->argc; j++) {
-        expireIfNeeded(c->db,c->argv[j]);
-        int deleted  = lazy ? dbAsyncDelete(c->db,c->argv[j]) :
-                              dbSyncDelete(c->db,c->argv[j]);
-        if (deleted) {
-            signalModifiedKey(c->db,c->argv[j]);
-            notifyKeyspaceEvent(NOTIFY_GENERIC,
-                "del",c->argv[j],c->db->id);
-            server.dirty++;
-            numdel++;
+    hashtableEntry *des[HASHTABLE_FIND_BATCH];
+    int numdel = 0, j, k, count, found;
+
+    /* The keys are looked up in batches first: missing keys are skipped
+     * and the deletion of the others finds their entries in the cache. */
+    for (j = 1; j < c->argc; j += count) {
+        count = c->argc-j;
+        if (count > HASHTABLE_FIND_BATCH) count = HASHTABLE_FIND_BATCH;
+        found = dbFindBatch(c->db,c->argv+j,count,des);
+        for (k = 0; k < count; k++) {
+            robj *key = c->argv[j+k];
+
+            if (k >= found)
+                expireIfNeeded(c->db,key);
+            else if (des[k] == NULL)
+                continue;
+            int deleted  = lazy ? dbAsyncDelete(c->db,key) :
+                                  dbSyncDelete(c->db,key);
+            if (deleted) {
+                signalModifiedKey(c->db,key);
+                notifyKeyspaceEvent(NOTIFY_GENERIC,
+                    "del",key,c->db->id);
+                server.dirty++;
+                numdel++;
+            }
         }
     }
     addReplyLongLong(c,numdel);
@@ -452,12 +636,22 @@ void unlinkCommand(client *c) {
 /* EXISTS key1 key2 ... key_N.
  * Return value is the number of keys existing. */
 void existsCommand(client *c) {
+    hashtableEntry *des[HASHTABLE_FIND_BATCH];
     long long count = 0;
-    int j;
-
-    for (j = 1; j < c->argc; j++) {
-        expireIfNeeded(c->db,c->argv[j]);
-        if (dbExists(c->db,c->argv[j])) count++;
+    int j, k, batch, found;
+
+    for (j = 1; j < c->argc; j += batch) {
+        batch = c->argc-j;
+        if (batch > HASHTABLE_FIND_BATCH) batch = HASHTABLE_FIND_BATCH;
+        found = dbFindBatch(c->db,c->argv+j,batch,des);
+        for (k = 0; k < batch; k++) {
+            if (k < found) {
+                if (des[k]) count++;
+            } else {
+                expireIfNeeded(c->db,c->argv[j+k]);
+                if (dbExists(c->db,c->argv[j+k])) count++;
+            }
+        }
     }
     addReplyLongLong(c,count);
 }
@@ -493,17 +687,17 @@ void randomkeyCommand(client *c) {
 }
 
 void keysCommand(client *c) {
-    dictIterator *di;
-    dictEntry *de;
+    hashtableIterator *di;
+    hashtableEntry *de;
     sds pattern = c->argv[1]->ptr;
     int plen = sdslen(pattern), allkeys;
     unsigned long numkeys = 0;
     void *replylen = addDeferredMultiBulkLength(c);
 
-    di = dictGetSafeIterator(c->db->dict);
+    di = hashtableGetSafeIterator(c->db->dict);
     allkeys = (pattern[0] == '*' && pattern[1] == '\0');
-    while((de = dictNext(di)) != NULL) {
-        sds key = dictGetKey(de);
+    while((de = hashtableNext(di)) != NULL) {
+        sds key = hashtableGetKey(de);
         robj *keyobj;
 
         if (allkeys || stringmatchlen(pattern,plen,key,sdslen(key),0)) {
@@ -515,33 +709,32 @@ void keysCommand(client *c) {
             decrRefCount(keyobj);
         }
     }
-    dictReleaseIterator(di);
+    hashtableReleaseIterator(di);
     setDeferredMultiBulkLength(c,replylen,numkeys);
 }
 
-/* This callback is used by scanGenericCommand in order to collect elements
- * returned by the dictionary iterator into a list. */
-void scanCallback(void *privdata, const dictEntry *de) {
-    void **pd = (void**) privdata;
+/* Used by the scanGenericCommand() callbacks in order to collect the
+ * elements returned by the hash table iterator into a list. */
+static void scanAddElement(void **pd, void *elekey, void *eleval) {
     list *keys = pd[0];
     robj *o = pd[1];
     robj *key, *val = NULL;
 
     if (o == NULL) {
-        sds sdskey = dictGetKey(de);
+        sds sdskey = elekey;
         key = createStringObject(sdskey, sdslen(sdskey));
     } else if (o->type == OBJ_SET) {
-        sds keysds = dictGetKey(de);
+        sds keysds = elekey;
         key = createStringObject(keysds,sdslen(keysds));
     } else if (o->type == OBJ_HASH) {
-        sds sdskey = dictGetKey(de);
-        sds sdsval = dictGetVal(de);
+        sds sdskey = elekey;
+        sds sdsval = eleval;
         key = createStringObject(sdskey,sdslen(sdskey));
         val = createStringObject(sdsval,sdslen(sdsval));
     } else if (o->type == OBJ_ZSET) {
-        sds sdskey = dictGetKey(de);
+        sds sdskey = elekey;
         key = createStringObject(sdskey,sdslen(sdskey));
-        val = createStringObjectFromLongDouble(*(double*)dictGetVal(de),0);
+        val = createStringObjectFromLongDouble(*(double*)eleval,0);
     } else {
         serverPanic("Type not handled in SCAN callback.");
     }
@@ -550,6 +743,20 @@ void scanCallback(void *privdata, const dictEntry *de) {
     if (val) listAddNodeTail(keys, val);
 }
 
+/* This callback is used by scanGenericCommand in order to collect elements
+ * returned by the dictionary iterator into a list. */
+void scanCallback(void *privdata, const dictEntry *de) {
+    /* Only the sorted sets are still stored in a dict, with the scores
+     * stored by value in the entries. */
+    scanAddElement(privdata,dictGetKey(de),(void*)&de->v.d);
+}
+
+/* Like scanCallback() for the collections stored in a hashtable, that is
+ * the keyspace, sets and hashes. */
+void scanHashtableCallback(void *privdata, hashtableEntry *de) {
+    scanAddElement(privdata,hashtableGetKey(de),hashtableGetVal(de));
+}
+
 /* Try to parse a SCAN cursor stored at object 'o':
  * if the cursor is valid, store it as unsigned integer into *cursor and
  * returns C_OK. Otherwise return C_ERR and send an error to the
@@ -588,6 +795,7 @@ void scanGenericCommand(client *c, robj *o, unsigned long cursor) {
     sds pat = NULL;
     int patlen = 0, use_pattern = 0;
     dict *ht;
+    hashtable *h;
 
     /* Object must be NULL (to iterate keys names), or the type of the object
      * must be Set, Sorted Set, or Hash. */
@@ -638,20 +846,21 @@ void scanGenericCommand(client *c, robj *o, unsigned long cursor) {
 
     /* Handle the case of a hash table. */
     ht = NULL;
+    h = NULL;
     if (o == NULL) {
-        ht = c->db->dict;
+        h = c->db->dict;
     } else if (o->type == OBJ_SET && o->encoding == OBJ_ENCODING_HT) {
-        ht = o->ptr;
+        h = o->ptr;
     } else if (o->type == OBJ_HASH && o->encoding == OBJ_ENCODING_HT) {
-        ht = o->ptr;
+        h = o->ptr;
         count *= 2; /* We return key / value for this type. */
-    } else if (o->type == OBJ_ZSET && o->encoding == OBJ_ENCODING_SKIPLIST) {
+    } else if (o->type == OBJ_ZSET && o->encoding != OBJ_ENCODING_LISTPACK) {
         zset *zs = o->ptr;
         ht = zs->dict;
         count *= 2; /* We return key / value for this type. */
     }
 
-    if (ht) {
+    if (ht || h) {
         void *privdata[2];
         /* We set the max number of iterations to ten times the specified
          * COUNT, so if the hash table is in a pathological state (very
@@ -665,7 +874,11 @@ void scanGenericCommand(client *c, robj *o, unsigned long cursor) {
         privdata[0] = keys;
         privdata[1] = o;
         do {
-            cursor = dictScan(ht, cursor, scanCallback, NULL, privdata);
+            if (h)
+                cursor = hashtableScan(h, cursor, scanHashtableCallback, NULL,
+                                       privdata);
+            else
+                cursor = dictScan(ht, cursor, scanCallback, NULL, privdata);
         } while (cursor &&
               maxiterations-- &&
               listLength(keys) < (unsigned long)count);
@@ -677,17 +890,17 @@ void scanGenericCommand(client *c, robj *o, unsigned long cursor) {
             listAddNodeTail(keys,createStringObjectFromLongLong(ll));
         cursor = 0;
     } else if (o->type == OBJ_HASH || o->type == OBJ_ZSET) {
-        unsigned char *p = ziplistIndex(o->ptr,0);
+        unsigned char *p = lpSeek(o->ptr,0);
         unsigned char *vstr;
         unsigned int vlen;
         long long vll;
 
         while(p) {
-            ziplistGet(p,&vstr,&vlen,&vll);
+            lpGet(p,&vstr,&vlen,&vll);
             listAddNodeTail(keys,
                 (vstr != NULL) ? createStringObject((char*)vstr,vlen) :
                                  createStringObjectFromLongLong(vll));
-            p = ziplistNext(o->ptr,p);
+            p = lpNext(o->ptr,p);
         }
         cursor = 0;
     } else {
@@ -765,7 +978,7 @@ void scanCommand(client *c) {
 }
 
 void dbsizeCommand(client *c) {
-    addReplyLongLong(c,dictSize(c->db->dict));
+    addReplyLongLong(c,hashtableSize(c->db->dict));
 }
 
 void lastsaveCommand(client *c) {
@@ -957,6 +1170,7 @@ int dbSwapDatabases(int id1, int id2) {
     if (id1 < 0 || id1 >= server.dbnum ||
         id2 < 0 || id2 >= server.dbnum) return C_ERR;
     if (id1 == id2) return C_OK;
+    rdbSnapshotAbort();
     redisDb aux = server.db[id1];
     redisDb *db1 = &server.db[id1], *db2 = &server.db[id2];
 
@@ -966,10 +1180,14 @@ int dbSwapDatabases(int id1, int id2) {
     db1->dict = db2->dict;
     db1->expires = db2->expires;
     db1->avg_ttl = db2->avg_ttl;
+    db1->expires_index = db2->expires_index;
+    db1->expires_stale = db2->expires_stale;
 
     db2->dict = aux.dict;
     db2->expires = aux.expires;
     db2->avg_ttl = aux.avg_ttl;
+    db2->expires_index = aux.expires_index;
+    db2->expires_stale = aux.expires_stale;
 
     /* Now we need to handle clients blocked on lists: as an effect
      * of swapping the two DBs, a client that was waiting for list
@@ -1018,11 +1236,33 @@ void swapdbCommand(client *c) {
  * Expires API
  *----------------------------------------------------------------------------*/
 
+/* The expire of a key is not stored in a separated dictionary, but in the
+ * aux field of the sds string used as key in the main hash table (see
+ * sdsnewlenaux()), so that checking if a key is expired costs no additional
+ * lookup, and touches the same memory just accessed to compare the key.
+ * Keys are created without the aux field, the string is replaced the first
+ * time an expire is set, and -1 is stored in the field when it is removed.
+ *
+ * The keys with an expire are also added to db->expires, an index with no
+ * other purpose than sampling the volatile keys (active expire cycle,
+ * volatile eviction policies) and counting them. When active-expire-index
+ * is enabled, they are also sorted by expire time in db->expires_index. */
+
 int removeExpire(redisDb *db, robj *key) {
     /* An expire may only be removed if there is a corresponding entry in the
      * main dict. Otherwise, the key will never be freed. */
-    serverAssertWithInfo(NULL,key,dictFind(db->dict,key->ptr) != NULL);
-    return dictDelete(db->expires,key->ptr) == DICT_OK;
+    hashtableEntry *de = hashtableFind(db->dict,key->ptr);
+    int64_t *when;
+
+    serverAssertWithInfo(NULL,key,de != NULL);
+    rdbSnapshotKeyWrite(db,key->ptr);
+    when = sdsaux(hashtableGetKey(de));
+    if (when == NULL || *when == -1) return 0;
+    expireIndexDel(db,key->ptr,*when);
+    *when = -1;
+    serverAssertWithInfo(NULL,key,
+        hashtableDelete(db->expires,key->ptr) == DICT_OK);
+    return 1;
 }
 
 /* Set an expire to the specified key. If the expire is set in the context
@@ -1030,13 +1270,29 @@ int removeExpire(redisDb *db, robj *key) {
  * to NULL. The 'when' parameter is the absolute unix time in milliseconds
  * after which the key will no longer be considered valid. */
 void setExpire(client *c, redisDb *db, robj *key, long long when) {
-    dictEntry *kde, *de;
+    hashtableEntry *kde;
+    int64_t *aux;
+    sds k;
 
-    /* Reuse the sds from the main dict in the expire dict */
-    kde = dictFind(db->dict,key->ptr);
+    rdbSnapshotKeyWrite(db,key->ptr);
+    kde = hashtableFind(db->dict,key->ptr);
     serverAssertWithInfo(NULL,key,kde != NULL);
-    de = dictAddOrFind(db->expires,dictGetKey(kde));
-    dictSetSignedIntegerVal(de,when);
+    k = hashtableGetKey(kde);
+    if ((aux = sdsaux(k)) == NULL) {
+        /* Make room for the expire replacing the key string. The hash of
+         * the key does not change, so the entry is updated in place. */
+        sds newk = sdsnewlenaux(k,sdslen(k));
+        kde->key = newk;
+        sdsfree(k);
+        k = newk;
+        aux = sdsaux(k);
+        *aux = -1;
+    }
+    /* Reuse the sds from the main hash table in the expires index. */
+    if (*aux == -1) hashtableAdd(db->expires,k,NULL);
+    else expireIndexDel(db,k,*aux);
+    *aux = when;
+    expireIndexAdd(db,k,when);
 
     int writable_slave = server.masterhost && server.repl_slave_ro == 0;
     if (c && writable_slave && !(c->flags & CLIENT_MASTER))
@@ -1046,16 +1302,13 @@ void setExpire(client *c, redisDb *db, robj *key, long long when) {
 /* Return the expire time of the specified key, or -1 if no expire
  * is associated with this key (i.e. the key is non volatile) */
 long long getExpire(redisDb *db, robj *key) {
-    dictEntry *de;
+    hashtableEntry *de;
 
     /* No expire? return ASAP */
-    if (dictSize(db->expires) == 0 ||
-       (de = dictFind(db->expires,key->ptr)) == NULL) return -1;
+    if (hashtableSize(db->expires) == 0 ||
+       (de = hashtableFind(db->dict,key->ptr)) == NULL) return -1;
 
-    /* The entry was found in the expire dict, this means it should also
-     * be present in the main dict (safety check). */
-    serverAssertWithInfo(NULL,key,dictFind(db->dict,key->ptr) != NULL);
-    return dictGetSignedIntegerVal(de);
+    return keyGetExpire(hashtableGetKey(de));
 }
 
 /* Propagate expires into slaves and the AOF file.
@@ -1083,7 +1336,18 @@ void propagateExpire(redisDb *db, robj *key, int lazy) {
 }
 
 int expireIfNeeded(redisDb *db, robj *key) {
-    mstime_t when = getExpire(db,key);
+    hashtableEntry *de;
+
+    if (hashtableSize(db->expires) == 0 ||
+       (de = hashtableFind(db->dict,key->ptr)) == NULL) return 0;
+    return expireEntryIfNeeded(db,key,de);
+}
+
+/* Like expireIfNeeded(), for callers that already looked up the entry 'de'
+ * of the key in the main hash table. The entry is no longer valid if the
+ * key gets deleted, that is, if 1 is returned and this is a master. */
+static int expireEntryIfNeeded(redisDb *db, robj *key, hashtableEntry *de) {
+    mstime_t when = keyGetExpire(hashtableGetKey(de));
     mstime_t now;
 
     if (when < 0) return 0; /* No expire for this key */
@@ -29,6 +29,8 @@
 
 #include "server.h"
 #include "lzf.h"    /* LZF compression library */
+#define ZSTD_STATIC_LINKING_ONLY /* For ZSTD_createCCtx_advanced(). */
+#include <zstd.h>
 #include "zipmap.h"
 #include "endianconv.h"
 
@@ -40,6 +42,7 @@
 #include <arpa/inet.h>
 #include <sys/stat.h>
 #include <sys/param.h>
+#include <sched.h>
 
 #define rdbExitReportCorruptRDB(...) rdbCheckThenExit(__LINE__,__VA_ARGS__)
 
@@ -68,6 +71,10 @@ void rdbCheckThenExit(int linenum, char *reason, ...) {
     exit(1);
 }
 
+/* Set by the threads serializing the chunks compressed with zstd: zstd
+ * compresses better the whole chunk if its strings are not compressed. */
+static __thread int rdbSaveUncompressedStrings = 0;
+
 static int rdbWriteRaw(rio *rdb, void *p, size_t len) {
     if (rdb && rioWrite(rdb,p,len) == 0)
         return -1;
@@ -387,7 +394,7 @@ ssize_t rdbSaveRawString(rio *rdb, unsigned char *s, size_t len) {
 
     /* Try LZF compression - under 20 bytes it's unable to compress even
      * aaaaaaaaaaaaaaaaaa so skip it */
-    if (server.rdb_compression && len > 20) {
+    if (server.rdb_compression && !rdbSaveUncompressedStrings && len > 20) {
         n = rdbSaveLzfStringObject(rdb,s,len);
         if (n == -1) return -1;
         if (n > 0) return n;
@@ -595,10 +602,12 @@ int rdbLoadBinaryFloatValue(rio *rdb, float *val) {
 int rdbSaveObjectType(rio *rdb, robj *o) {
     switch (o->type) {
     case OBJ_STRING:
+        if (o->encoding == OBJ_ENCODING_BITMAP)
+            return rdbSaveType(rdb,RDB_TYPE_STRING_BITMAP);
         return rdbSaveType(rdb,RDB_TYPE_STRING);
     case OBJ_LIST:
         if (o->encoding == OBJ_ENCODING_QUICKLIST)
-            return rdbSaveType(rdb,RDB_TYPE_LIST_QUICKLIST);
+            return rdbSaveType(rdb,RDB_TYPE_LIST_QUICKLIST_2);
         else
             serverPanic("Unknown list encoding");
     case OBJ_SET:
@@ -609,15 +618,16 @@ int rdbSaveObjectType(rio *rdb, robj *o) {
         else
             serverPanic("Unknown set encoding");
     case OBJ_ZSET:
-        if (o->encoding == OBJ_ENCODING_ZIPLIST)
-            return rdbSaveType(rdb,RDB_TYPE_ZSET_ZIPLIST);
-        else if (o->encoding == OBJ_ENCODING_SKIPLIST)
+        if (o->encoding == OBJ_ENCODING_LISTPACK)
+            return rdbSaveType(rdb,RDB_TYPE_ZSET_LISTPACK);
+        else if (o->encoding == OBJ_ENCODING_SKIPLIST ||
+                 o->encoding == OBJ_ENCODING_BTREE)
             return rdbSaveType(rdb,RDB_TYPE_ZSET_2);
         else
             serverPanic("Unknown sorted set encoding");
     case OBJ_HASH:
-        if (o->encoding == OBJ_ENCODING_ZIPLIST)
-            return rdbSaveType(rdb,RDB_TYPE_HASH_ZIPLIST);
+        if (o->encoding == OBJ_ENCODING_LISTPACK)
+            return rdbSaveType(rdb,RDB_TYPE_HASH_LISTPACK);
         else if (o->encoding == OBJ_ENCODING_HT)
             return rdbSaveType(rdb,RDB_TYPE_HASH);
         else
@@ -639,11 +649,34 @@ int rdbLoadObjectType(rio *rdb) {
     return type;
 }
 
+/* Save the listpack of a hash or a sorted set. The fingerprints are only an
+ * in memory index, rebuilt on load according to the configuration, so they
+ * are removed from a copy of the listpack before saving it. */
+static ssize_t rdbSaveListpack(rio *rdb, unsigned char *lp) {
+    ssize_t n;
+
+    if (!lpHasFingerprints(lp)) return rdbSaveRawString(rdb,lp,lpBytes(lp));
+    lp = lpSetFingerprints(lpDup(lp),0);
+    n = rdbSaveRawString(rdb,lp,lpBytes(lp));
+    zfree(lp);
+    return n;
+}
+
 /* Save a Redis object. Returns -1 on error, number of bytes written on success. */
 ssize_t rdbSaveObject(rio *rdb, robj *o) {
     ssize_t n = 0, nwritten = 0;
 
-    if (o->type == OBJ_STRING) {
+    if (o->type == OBJ_STRING && o->encoding == OBJ_ENCODING_BITMAP) {
+        /* Save a compressed bitmap as a single blob. */
+        size_t len = roaringSerializedSize(o->ptr);
+        unsigned char *buf = zmalloc(len);
+
+        roaringSerialize(o->ptr,buf);
+        n = rdbSaveRawString(rdb,buf,len);
+        zfree(buf);
+        if (n == -1) return -1;
+        nwritten += n;
+    } else if (o->type == OBJ_STRING) {
         /* Save a string value */
         if ((n = rdbSaveStringObject(rdb,o)) == -1) return -1;
         nwritten += n;
@@ -657,13 +690,16 @@ ssize_t rdbSaveObject(rio *rdb, robj *o) {
             nwritten += n;
 
             do {
+                if ((n = rdbSaveLen(rdb,node->container)) == -1) return -1;
+                nwritten += n;
+
                 if (quicklistNodeIsCompressed(node)) {
                     void *data;
                     size_t compress_len = quicklistGetLzf(node, &data);
                     if ((n = rdbSaveLzfBlob(rdb,data,compress_len,node->sz)) == -1) return -1;
                     nwritten += n;
                 } else {
-                    if ((n = rdbSaveRawString(rdb,node->zl,node->sz)) == -1) return -1;
+                    if ((n = rdbSaveRawString(rdb,node->entry,node->sz)) == -1) return -1;
                     nwritten += n;
                 }
             } while ((node = node->next));
@@ -673,20 +709,20 @@ ssize_t rdbSaveObject(rio *rdb, robj *o) {
     } else if (o->type == OBJ_SET) {
         /* Save a set value */
         if (o->encoding == OBJ_ENCODING_HT) {
-            dict *set = o->ptr;
-            dictIterator *di = dictGetIterator(set);
-            dictEntry *de;
+            hashtable *set = o->ptr;
+            hashtableIterator *di = hashtableGetIterator(set);
+            hashtableEntry *de;
 
-            if ((n = rdbSaveLen(rdb,dictSize(set))) == -1) return -1;
+            if ((n = rdbSaveLen(rdb,hashtableSize(set))) == -1) return -1;
             nwritten += n;
 
-            while((de = dictNext(di)) != NULL) {
-                sds ele = dictGetKey(de);
+            while((de = hashtableNext(di)) != NULL) {
+                sds ele = hashtableGetKey(de);
                 if ((n = rdbSaveRawString(rdb,(unsigned char*)ele,sdslen(ele)))
                     == -1) return -1;
                 nwritten += n;
             }
-            dictReleaseIterator(di);
+            hashtableReleaseIterator(di);
         } else if (o->encoding == OBJ_ENCODING_INTSET) {
             size_t l = intsetBlobLen((intset*)o->ptr);
 
@@ -697,10 +733,8 @@ ssize_t rdbSaveObject(rio *rdb, robj *o) {
         }
     } else if (o->type == OBJ_ZSET) {
         /* Save a sorted set value */
-        if (o->encoding == OBJ_ENCODING_ZIPLIST) {
-            size_t l = ziplistBlobLen((unsigned char*)o->ptr);
-
-            if ((n = rdbSaveRawString(rdb,o->ptr,l)) == -1) return -1;
+        if (o->encoding == OBJ_ENCODING_LISTPACK) {
+            if ((n = rdbSaveListpack(rdb,o->ptr)) == -1) return -1;
             nwritten += n;
         } else if (o->encoding == OBJ_ENCODING_SKIPLIST) {
             zset *zs = o->ptr;
@@ -728,27 +762,48 @@ ssize_t rdbSaveObject(rio *rdb, robj *o) {
                 nwritten += n;
                 zn = zn->backward;
             }
+        } else if (o->encoding == OBJ_ENCODING_BTREE) {
+            zset *zs = o->ptr;
+            zbtreeIter it;
+
+            if ((n = rdbSaveLen(rdb,zs->zbt->length)) == -1) return -1;
+            nwritten += n;
+
+            /* Same order of the skiplist, so that both the encodings load
+             * the elements always appending at the head. */
+            zbtLast(zs->zbt,&it);
+            while (it.leaf != NULL) {
+                sds ele = zbtIterEle(&it);
+                if ((n = rdbSaveRawString(rdb,
+                    (unsigned char*)ele,sdslen(ele))) == -1)
+                {
+                    return -1;
+                }
+                nwritten += n;
+                if ((n = rdbSaveBinaryDoubleValue(rdb,zbtIterScore(&it))) == -1)
+                    return -1;
+                nwritten += n;
+                zbtPrev(&it);
+            }
         } else {
             serverPanic("Unknown sorted set encoding");
         }
     } else if (o->type == OBJ_HASH) {
         /* Save a hash value */
-        if (o->encoding == OBJ_ENCODING_ZIPLIST) {
-            size_t l = ziplistBlobLen((unsigned char*)o->ptr);
-
-            if ((n = rdbSaveRawString(rdb,o->ptr,l)) == -1) return -1;
+        if (o->encoding == OBJ_ENCODING_LISTPACK) {
+            if ((n = rdbSaveListpack(rdb,o->ptr)) == -1) return -1;
             nwritten += n;
 
         } else if (o->encoding == OBJ_ENCODING_HT) {
-            dictIterator *di = dictGetIterator(o->ptr);
-            dictEntry *de;
+            hashtableIterator *di = hashtableGetIterator(o->ptr);
+            hashtableEntry *de;
 
-            if ((n = rdbSaveLen(rdb,dictSize((dict*)o->ptr))) == -1) return -1;
+            if ((n = rdbSaveLen(rdb,hashtableSize((hashtable*)o->ptr))) == -1) return -1;
             nwritten += n;
 
-            while((de = dictNext(di)) != NULL) {
-                sds field = dictGetKey(de);
-                sds value = dictGetVal(de);
+            while((de = hashtableNext(di)) != NULL) {
+                sds field = hashtableGetKey(de);
+                sds value = hashtableGetVal(de);
 
                 if ((n = rdbSaveRawString(rdb,(unsigned char*)field,
                         sdslen(field))) == -1) return -1;
@@ -757,7 +812,7 @@ ssize_t rdbSaveObject(rio *rdb, robj *o) {
                         sdslen(value))) == -1) return -1;
                 nwritten += n;
             }
-            dictReleaseIterator(di);
+            hashtableReleaseIterator(di);
         } else {
             serverPanic("Unknown hash encoding");
         }
@@ -871,6 +926,514 @@ int rdbSaveInfoAuxFields(rio *rdb, int flags, rdbSaveInfo *rsi) {
     return 1;
 }
 
+/*-----------------------------------------------------------------------------
+ * Zstd compression
+ *
+ * With rdb-compression-codec set to zstd the chunks are compressed as a
+ * whole, with the fastest level of zstd: since a chunk holds about one
+ * thousand keys, zstd finds a lot more redundancy than LZF compressing every
+ * string on its own.
+ *----------------------------------------------------------------------------*/
+
+#define RDB_ZSTD_LEVEL 1
+
+/* The zstd contexts are costly to create, so they are reused across calls.
+ * They are per thread, since the chunks are compressed and decompressed by
+ * the threads of the work queues. */
+static __thread ZSTD_CCtx *rdbZstdCCtx = NULL;
+static __thread ZSTD_DCtx *rdbZstdDCtx = NULL;
+
+static void *rdbZstdAlloc(void *opaque, size_t size) {
+    UNUSED(opaque);
+    return zmalloc(size);
+}
+
+static void rdbZstdFree(void *opaque, void *ptr) {
+    UNUSED(opaque);
+    zfree(ptr);
+}
+
+static ZSTD_customMem rdbZstdMem = {rdbZstdAlloc,rdbZstdFree,NULL};
+
+static ZSTD_CCtx *rdbZstdGetCCtx(void) {
+    if (rdbZstdCCtx == NULL) {
+        rdbZstdCCtx = ZSTD_createCCtx_advanced(rdbZstdMem);
+        ZSTD_CCtx_setParameter(rdbZstdCCtx,ZSTD_c_compressionLevel,
+                               RDB_ZSTD_LEVEL);
+        /* Chunks have their own CRC64. */
+        ZSTD_CCtx_setParameter(rdbZstdCCtx,ZSTD_c_checksumFlag,0);
+    }
+    return rdbZstdCCtx;
+}
+
+static ZSTD_DCtx *rdbZstdGetDCtx(void) {
+    if (rdbZstdDCtx == NULL) rdbZstdDCtx = ZSTD_createDCtx_advanced(rdbZstdMem);
+    return rdbZstdDCtx;
+}
+
+/* Free the zstd contexts of the calling thread, before it exits. */
+static void rdbZstdReleaseContexts(void) {
+    ZSTD_freeCCtx(rdbZstdCCtx);
+    ZSTD_freeDCtx(rdbZstdDCtx);
+    rdbZstdCCtx = NULL;
+    rdbZstdDCtx = NULL;
+}
+
+/* Compress 'src' into '*dst'. Returns 0 if the data can't be compressed. */
+static int rdbCompressChunk(sds src, sds *dst) {
+    size_t bound = ZSTD_compressBound(sdslen(src)), clen;
+
+    sdsclear(*dst);
+    *dst = sdsMakeRoomFor(*dst,bound);
+    clen = ZSTD_compress2(rdbZstdGetCCtx(),*dst,bound,src,sdslen(src));
+    if (ZSTD_isError(clen) || clen >= sdslen(src)) return 0;
+    sdssetlen(*dst,clen);
+    return 1;
+}
+
+/* Replace the payload of a compressed chunk with the decompressed data.
+ * Returns -1 if the payload is not a valid zstd frame. */
+int rdbDecompressChunk(sds *payload) {
+    unsigned long long len;
+    size_t retval;
+    sds buf;
+
+    len = ZSTD_getFrameContentSize(*payload,sdslen(*payload));
+    if (len == ZSTD_CONTENTSIZE_ERROR || len == ZSTD_CONTENTSIZE_UNKNOWN)
+        return -1;
+    buf = sdsnewlen(NULL,len);
+    retval = ZSTD_decompressDCtx(rdbZstdGetDCtx(),buf,len,
+                                 *payload,sdslen(*payload));
+    if (ZSTD_isError(retval) || retval != len) {
+        sdsfree(buf);
+        return -1;
+    }
+    sdsfree(*payload);
+    *payload = buf;
+    return 0;
+}
+
+/*-----------------------------------------------------------------------------
+ * Ordered work queues
+ *
+ * The chunked saving, the parallel loading and the AOF rewrite split the
+ * work in jobs that a pool of threads processes in any order, while the
+ * results must be used in the order the jobs were queued, that is, the order
+ * of the file. A work queue is a ring of jobs: the main thread fills the job at the tail and
+ * queues it, the threads process the queued jobs, and the main thread uses
+ * the oldest job once it is processed, or processes it itself if no thread
+ * took it yet, so that the main thread counts as one of the threads.
+ *----------------------------------------------------------------------------*/
+
+static void *rdbWorkQueueThreadMain(void *arg) {
+    rdbWorkQueue *q = arg;
+
+    pthread_mutex_lock(&q->mutex);
+    while(1) {
+        int j = q->next;
+
+        if (q->state[j] != RDB_JOB_QUEUED) {
+            if (q->exiting) break;
+            pthread_cond_wait(&q->queued_cond,&q->mutex);
+            continue;
+        }
+        q->state[j] = RDB_JOB_PROCESSING;
+        q->next = (j+1) % q->numjobs;
+        pthread_mutex_unlock(&q->mutex);
+
+        q->process(q->jobs[j]);
+
+        pthread_mutex_lock(&q->mutex);
+        q->state[j] = RDB_JOB_DONE;
+        pthread_cond_signal(&q->done_cond);
+    }
+    pthread_mutex_unlock(&q->mutex);
+    rdbZstdReleaseContexts();
+    return NULL;
+}
+
+/* Module values are serialized and loaded by the callbacks of the module
+ * types, that are not required to be thread safe, so only the main thread
+ * may handle them: when modules are loaded no thread is used to save the
+ * dataset or to rewrite the AOF, and the threads loading an RDB leave the
+ * module values to the main thread. */
+int rdbUseThreads(void) {
+    return moduleCount() == 0;
+}
+
+/* Create a thread running start(arg), with the same stack size of the
+ * background threads created by bioInit(). Returns 0 on success, otherwise
+ * the error of pthread_create(). */
+static int rdbCreateThread(pthread_t *thread, void *(*start)(void *),
+                           void *arg)
+{
+    pthread_attr_t attr;
+    size_t stacksize;
+    int err;
+
+    pthread_attr_init(&attr);
+    pthread_attr_getstacksize(&attr,&stacksize);
+    if (!stacksize) stacksize = 1; /* The world is full of Solaris Fixes */
+    while (stacksize < REDIS_THREAD_STACK_SIZE) stacksize *= 2;
+    pthread_attr_setstacksize(&attr, stacksize);
+    err = pthread_create(thread,&attr,start,arg);
+    pthread_attr_destroy(&attr);
+    return err;
+}
+
+/* Create a work queue served by 'numthreads' threads, including the main
+ * thread. The caller should set the q->numjobs entries of q->jobs. */
+rdbWorkQueue *rdbWorkQueueCreate(int numthreads, void (*process)(void *job)) {
+    rdbWorkQueue *q = zcalloc(sizeof(*q));
+    int j;
+
+    q->numthreads = numthreads;
+    q->numjobs = numthreads*RDB_JOBS_PER_THREAD;
+    q->jobs = zcalloc(sizeof(void*)*q->numjobs);
+    q->state = zcalloc(sizeof(int)*q->numjobs);
+    q->process = process;
+    pthread_mutex_init(&q->mutex,NULL);
+    pthread_cond_init(&q->queued_cond,NULL);
+    pthread_cond_init(&q->done_cond,NULL);
+
+    for (j = 1; j < numthreads; j++) {
+        if (rdbCreateThread(&q->threads[j],rdbWorkQueueThreadMain,q) != 0) {
+            serverLog(LL_WARNING,"Fatal: Can't initialize RDB thread.");
+            exit(1);
+        }
+    }
+    return q;
+}
+
+/* Queue the job at the tail, that the caller just filled. */
+void rdbWorkQueuePush(rdbWorkQueue *q) {
+    pthread_mutex_lock(&q->mutex);
+    q->state[q->tail] = RDB_JOB_QUEUED;
+    pthread_cond_signal(&q->queued_cond);
+    pthread_mutex_unlock(&q->mutex);
+    q->tail = (q->tail+1) % q->numjobs;
+    q->pending++;
+}
+
+/* Return the oldest queued job if it was already processed, otherwise NULL
+ * is returned, unless 'block' is true: in that case the job is processed by
+ * the caller if no thread took it yet, or the caller waits for the thread
+ * processing it. NULL is always returned if no job is queued. */
+void *rdbWorkQueueReady(rdbWorkQueue *q, int block) {
+    int j = q->head;
+    long long start;
+
+    if (q->pending == 0) return NULL;
+    pthread_mutex_lock(&q->mutex);
+    if (q->state[j] != RDB_JOB_DONE) {
+        if (!block) {
+            pthread_mutex_unlock(&q->mutex);
+            return NULL;
+        }
+        if (q->state[j] == RDB_JOB_QUEUED) {
+            q->state[j] = RDB_JOB_PROCESSING;
+            q->next = (j+1) % q->numjobs;
+            pthread_mutex_unlock(&q->mutex);
+            q->process(q->jobs[j]);
+            pthread_mutex_lock(&q->mutex);
+            q->state[j] = RDB_JOB_DONE;
+        } else {
+            start = ustime();
+            while (q->state[j] != RDB_JOB_DONE)
+                pthread_cond_wait(&q->done_cond,&q->mutex);
+            q->wait_usec += ustime()-start;
+        }
+    }
+    pthread_mutex_unlock(&q->mutex);
+    return q->jobs[j];
+}
+
+/* Release the oldest job returned by rdbWorkQueueReady(), so that it can be
+ * filled again. */
+void rdbWorkQueuePop(rdbWorkQueue *q) {
+    pthread_mutex_lock(&q->mutex);
+    q->state[q->head] = RDB_JOB_FREE;
+    pthread_mutex_unlock(&q->mutex);
+    q->head = (q->head+1) % q->numjobs;
+    q->pending--;
+}
+
+/* Stop the threads, once they processed the jobs still queued, and free the
+ * queue, calling 'freejob' for every job. */
+void rdbWorkQueueRelease(rdbWorkQueue *q, void (*freejob)(void *job)) {
+    int j;
+
+    pthread_mutex_lock(&q->mutex);
+    q->exiting = 1;
+    pthread_cond_broadcast(&q->queued_cond);
+    pthread_mutex_unlock(&q->mutex);
+    for (j = 1; j < q->numthreads; j++) pthread_join(q->threads[j],NULL);
+    pthread_mutex_destroy(&q->mutex);
+    pthread_cond_destroy(&q->queued_cond);
+    pthread_cond_destroy(&q->done_cond);
+    for (j = 0; j < q->numjobs; j++) freejob(q->jobs[j]);
+    zfree(q->jobs);
+    zfree(q->state);
+    zfree(q);
+}
+
+/*-----------------------------------------------------------------------------
+ * Chunked format
+ *
+ * With rdb-chunked enabled, the keys of every DB are not written as a single
+ * stream, but split in chunks of about RDB_CHUNK_KEYS keys, every chunk
+ * holding the keys of a range of buckets of the main hash table of the DB.
+ * Chunks are serialized by a pool of rdb-save-threads threads, and loaded
+ * by rdb-load-threads threads, since every chunk can be decoded on its own:
+ *
+ * RDB_OPCODE_CHUNK <dbid> <keys> <size> <payload> <crc64>
+ *
+ * The payload is made of <keys> key-value pairs written as
+ * rdbSaveKeyValuePair() does, and is followed by its CRC64 checksum as a
+ * little endian 64 bit integer (zero if rdbchecksum is disabled). Chunks
+ * compressed with zstd use the RDB_OPCODE_CHUNK_ZSTD opcode instead, and their
+ * payload is a zstd frame, holding uncompressed strings. The checksum is the
+ * one of the compressed payload. After the last chunk, and before the EOF
+ * opcode, the file has an index of the chunks, so that a file can be split
+ * among threads without reading it sequentially:
+ *
+ * RDB_OPCODE_CHUNK_INDEX <count> [<offset> <dbid> <keys>] ...
+ *
+ * All the numbers but the checksum are encoded with rdbSaveLen(). Offsets are
+ * relative to the start of the RDB file (the "REDIS" signature).
+ *----------------------------------------------------------------------------*/
+
+/* Append a chunk to the index. */
+void rdbChunkIndexAdd(rdbChunkIndex *idx, rdbChunkInfo *ci) {
+    if (idx->count == idx->size) {
+        idx->size = idx->size ? idx->size*2 : 64;
+        idx->chunks = zrealloc(idx->chunks,sizeof(rdbChunkInfo)*idx->size);
+    }
+    idx->chunks[idx->count++] = *ci;
+}
+
+void rdbChunkIndexFree(rdbChunkIndex *idx) {
+    zfree(idx->chunks);
+    idx->chunks = NULL;
+    idx->count = idx->size = 0;
+}
+
+/* Write the index of the chunks written so far. */
+static int rdbSaveChunkIndex(rio *rdb, rdbChunkIndex *idx) {
+    uint64_t j;
+
+    if (rdbSaveType(rdb,RDB_OPCODE_CHUNK_INDEX) == -1) return -1;
+    if (rdbSaveLen(rdb,idx->count) == -1) return -1;
+    for (j = 0; j < idx->count; j++) {
+        rdbChunkInfo *ci = idx->chunks+j;
+
+        if (rdbSaveLen(rdb,ci->offset) == -1) return -1;
+        if (rdbSaveLen(rdb,ci->dbid) == -1) return -1;
+        if (rdbSaveLen(rdb,ci->keys) == -1) return -1;
+    }
+    return 1;
+}
+
+/* Load the chunk index, after its opcode, and check that it matches the
+ * chunks loaded so far, as listed in 'idx'. Returns 1 if it matches, 0 if
+ * it does not, and -1 on read errors. */
+int rdbLoadChunkIndex(rio *rdb, rdbChunkIndex *idx) {
+    uint64_t count, j;
+    rdbChunkInfo ci;
+    int match;
+
+    if ((count = rdbLoadLen(rdb,NULL)) == RDB_LENERR) return -1;
+    match = count == idx->count;
+    for (j = 0; j < count; j++) {
+        if ((ci.offset = rdbLoadLen(rdb,NULL)) == RDB_LENERR ||
+            (ci.dbid = rdbLoadLen(rdb,NULL)) == RDB_LENERR ||
+            (ci.keys = rdbLoadLen(rdb,NULL)) == RDB_LENERR) return -1;
+        if (match && (ci.offset != idx->chunks[j].offset ||
+                      ci.dbid != idx->chunks[j].dbid ||
+                      ci.keys != idx->chunks[j].keys)) match = 0;
+    }
+    return match;
+}
+
+/* Load a chunk, after its opcode: the chunk is described in 'ci', its
+ * payload is appended to '*payload' and its checksum stored in '*crc', to
+ * be checked with rdbVerifyChunk(). The offset of the chunk is relative to
+ * the start of the stream. Returns -1 on read errors. */
+int rdbLoadChunk(rio *rdb, rdbChunkInfo *ci, sds *payload, uint64_t *crc) {
+    uint64_t size;
+    size_t oldlen = sdslen(*payload);
+
+    ci->offset = rdb->processed_bytes-1;
+    if ((ci->dbid = rdbLoadLen(rdb,NULL)) == RDB_LENERR) return -1;
+    if ((ci->keys = rdbLoadLen(rdb,NULL)) == RDB_LENERR) return -1;
+    if ((size = rdbLoadLen(rdb,NULL)) == RDB_LENERR) return -1;
+    *payload = sdsMakeRoomFor(*payload,size);
+    if (rioRead(rdb,*payload+oldlen,size) == 0) return -1;
+    sdssetlen(*payload,oldlen+size);
+    if (rioRead(rdb,crc,8) == 0) return -1;
+    memrev64ifbe(crc);
+    return 0;
+}
+
+/* Return 1 if the payload of a chunk matches its checksum, or if the chunk
+ * was saved without checksum, otherwise 0 is returned. */
+int rdbVerifyChunk(sds payload, uint64_t crc) {
+    if (crc == 0 || !server.rdb_checksum) return 1;
+    return crc64(0,(unsigned char*)payload,sdslen(payload)) == crc;
+}
+
+/* A chunk being saved: the keys stored in a range of buckets of the main
+ * hash table of a DB, serialized into a buffer. */
+typedef struct rdbSaveChunk {
+    redisDb *db;
+    unsigned long start, end;   /* Range of buckets, see hashtableScanBuckets(). */
+    long long now;              /* Keys expired at this time are skipped. */
+    rio rio;                    /* Buffer the keys are serialized into. */
+    sds zbuf;                   /* Compressed payload. */
+    int compressed;             /* True if 'zbuf' is the payload. */
+    uint64_t keys;
+    uint64_t crc;
+} rdbSaveChunk;
+
+static void rdbSaveChunkEntry(void *privdata, hashtableEntry *de) {
+    rdbSaveChunk *c = privdata;
+    sds keystr = hashtableGetKey(de);
+    robj key;
+
+    initStaticStringObject(key,keystr);
+    if (rdbSaveKeyValuePair(&c->rio,&key,hashtableGetVal(de),
+                            keyGetExpire(keystr),c->now) == 1) c->keys++;
+}
+
+/* Compress the keys serialized in the chunk if 'zstd' is true, and compute
+ * the checksum of the payload. */
+static void rdbSaveFinishChunk(rdbSaveChunk *c, int zstd) {
+    sds buf = c->rio.io.buffer.ptr;
+
+    c->compressed = zstd && c->keys && rdbCompressChunk(buf,&c->zbuf);
+    if (c->compressed) buf = c->zbuf;
+    c->crc = server.rdb_checksum ?
+             crc64(0,(unsigned char*)buf,sdslen(buf)) : 0;
+}
+
+/* Serialize a chunk: called by the threads of the work queue. */
+static void rdbSaveSerializeChunk(void *job) {
+    rdbSaveChunk *c = job;
+    sds buf = c->rio.io.buffer.ptr;
+    int zstd = rdbUseZstd();
+
+    sdsclear(buf);
+    rioInitWithBuffer(&c->rio,buf);
+    c->keys = 0;
+    rdbSaveUncompressedStrings = zstd;
+    hashtableScanBuckets(c->db->dict,c->start,c->end,rdbSaveChunkEntry,c);
+    rdbSaveUncompressedStrings = 0;
+    rdbSaveFinishChunk(c,zstd);
+}
+
+/* Write a serialized chunk, if not empty, adding it to the index. The RDB
+ * file starts at the offset 'base' of the stream. */
+static int rdbWriteChunk(rio *rdb, rdbSaveChunk *c, rdbChunkIndex *idx,
+                         size_t base)
+{
+    sds buf = c->compressed ? c->zbuf : c->rio.io.buffer.ptr;
+    rdbChunkInfo ci;
+    uint64_t crc = c->crc;
+
+    if (c->keys == 0) return 0;
+    ci.offset = rdb->processed_bytes-base;
+    ci.dbid = c->db->id;
+    ci.keys = c->keys;
+    rdbChunkIndexAdd(idx,&ci);
+
+    memrev64ifbe(&crc);
+    if (rdbSaveType(rdb,c->compressed ? RDB_OPCODE_CHUNK_ZSTD :
+                                        RDB_OPCODE_CHUNK) == -1) return -1;
+    if (rdbSaveLen(rdb,ci.dbid) == -1) return -1;
+    if (rdbSaveLen(rdb,ci.keys) == -1) return -1;
+    if (rdbSaveLen(rdb,sdslen(buf)) == -1) return -1;
+    if (rdbWriteRaw(rdb,buf,sdslen(buf)) == -1) return -1;
+    if (rdbWriteRaw(rdb,&crc,8) == -1) return -1;
+    return 1;
+}
+
+static rdbSaveChunk *rdbSaveChunkCreate(void) {
+    rdbSaveChunk *c = zcalloc(sizeof(*c));
+
+    rioInitWithBuffer(&c->rio,sdsempty());
+    c->zbuf = sdsempty();
+    return c;
+}
+
+/* Create the work queue used to serialize the chunks. */
+static rdbWorkQueue *rdbSaveChunksCreate(void) {
+    int j, numthreads = rdbUseThreads() ? server.rdb_save_threads : 1;
+    rdbWorkQueue *q = rdbWorkQueueCreate(numthreads,rdbSaveSerializeChunk);
+
+    for (j = 0; j < q->numjobs; j++) q->jobs[j] = rdbSaveChunkCreate();
+    return q;
+}
+
+static void rdbSaveChunkFree(void *job) {
+    rdbSaveChunk *c = job;
+
+    sdsfree(c->rio.io.buffer.ptr);
+    sdsfree(c->zbuf);
+    zfree(c);
+}
+
+/* Write all the keys of a DB as chunks, serialized by the threads of the
+ * work queue 'q', adding the chunks to the index 'idx'. */
+static int rdbSaveChunks(rio *rdb, rdbWorkQueue *q, redisDb *db,
+                         rdbChunkIndex *idx, size_t base, int flags,
+                         size_t *processed, long long now)
+{
+    hashtable *h = db->dict;
+    unsigned long buckets = hashtableBuckets(h), start, step;
+    rdbSaveChunk *c;
+    int drain = 0;
+
+    /* Buckets in every chunk, so that chunks have about RDB_CHUNK_KEYS keys. */
+    step = (unsigned long)((double)buckets*RDB_CHUNK_KEYS/hashtableSize(h));
+    if (step == 0) step = 1;
+
+    start = 0;
+    while(1) {
+        if (start < buckets) {
+            c = rdbWorkQueueTail(q);
+            c->db = db;
+            c->start = start;
+            c->end = start+step;
+            c->now = now;
+            rdbWorkQueuePush(q);
+            start += step;
+        } else {
+            drain = 1;
+        }
+
+        /* Write the chunks already serialized, waiting for the oldest one
+         * if no job is free or if all the chunks were queued. */
+        while((c = rdbWorkQueueReady(q,drain || rdbWorkQueueFull(q))) != NULL) {
+            int retval = rdbWriteChunk(rdb,c,idx,base);
+
+            rdbWorkQueuePop(q);
+            if (retval == -1) return -1;
+
+            /* When this RDB is produced as part of an AOF rewrite, move
+             * accumulated diff from parent to child while rewriting in
+             * order to have a smaller final write. */
+            if (flags & RDB_SAVE_AOF_PREAMBLE &&
+                rdb->processed_bytes > *processed+AOF_READ_DIFF_INTERVAL_BYTES)
+            {
+                *processed = rdb->processed_bytes;
+                aofReadDiffFromParent();
+            }
+        }
+        if (drain) break;
+    }
+    return 1;
+}
+
 /* Produces a dump of the database in RDB format sending it to the specified
  * Redis I/O channel. On success C_OK is returned, otherwise C_ERR
  * is returned and part of the output, or all the output, can be
@@ -880,26 +1443,29 @@ int rdbSaveInfoAuxFields(rio *rdb, int flags, rdbSaveInfo *rsi) {
  * integer pointed by 'error' is set to the value of errno just after the I/O
  * error. */
 int rdbSaveRio(rio *rdb, int *error, int flags, rdbSaveInfo *rsi) {
-    dictIterator *di = NULL;
-    dictEntry *de;
+    hashtableIterator *di = NULL;
+    hashtableEntry *de;
     char magic[10];
     int j;
     long long now = mstime();
     uint64_t cksum;
     size_t processed = 0;
+    rdbWorkQueue *chunks = NULL;
+    rdbChunkIndex idx = {NULL,0,0};
+    size_t base = rdb->processed_bytes;
 
     if (server.rdb_checksum)
         rdb->update_cksum = rioGenericUpdateChecksum;
-    snprintf(magic,sizeof(magic),"REDIS%04d",RDB_VERSION);
+    snprintf(magic,sizeof(magic),"REDIS%04d",
+        rdbUseChunks() ? RDB_VERSION_CHUNKED : RDB_VERSION);
     if (rdbWriteRaw(rdb,magic,9) == -1) goto werr;
     if (rdbSaveInfoAuxFields(rdb,flags,rsi) == -1) goto werr;
+    if (rdbUseChunks()) chunks = rdbSaveChunksCreate();
 
     for (j = 0; j < server.dbnum; j++) {
         redisDb *db = server.db+j;
-        dict *d = db->dict;
-        if (dictSize(d) == 0) continue;
-        di = dictGetSafeIterator(d);
-        if (!di) return C_ERR;
+        hashtable *h = db->dict;
+        if (hashtableSize(h) == 0) continue;
 
         /* Write the SELECT DB opcode */
         if (rdbSaveType(rdb,RDB_OPCODE_SELECTDB) == -1) goto werr;
@@ -910,25 +1476,34 @@ int rdbSaveRio(rio *rdb, int *error, int flags, rdbSaveInfo *rsi) {
          * However this does not limit the actual size of the DB to load since
          * these sizes are just hints to resize the hash tables. */
         uint32_t db_size, expires_size;
-        db_size = (dictSize(db->dict) <= UINT32_MAX) ?
-                                dictSize(db->dict) :
+        db_size = (hashtableSize(db->dict) <= UINT32_MAX) ?
+                                hashtableSize(db->dict) :
                                 UINT32_MAX;
-        expires_size = (dictSize(db->expires) <= UINT32_MAX) ?
-                                dictSize(db->expires) :
+        expires_size = (hashtableSize(db->expires) <= UINT32_MAX) ?
+                                hashtableSize(db->expires) :
                                 UINT32_MAX;
         if (rdbSaveType(rdb,RDB_OPCODE_RESIZEDB) == -1) goto werr;
         if (rdbSaveLen(rdb,db_size) == -1) goto werr;
         if (rdbSaveLen(rdb,expires_size) == -1) goto werr;
 
+        if (chunks) {
+            if (rdbSaveChunks(rdb,chunks,db,&idx,base,flags,&processed,now) == -1)
+                goto werr;
+            continue;
+        }
+
         /* Iterate this DB writing every entry */
-        while((de = dictNext(di)) != NULL) {
-            sds keystr = dictGetKey(de);
-            robj key, *o = dictGetVal(de);
+        di = hashtableGetSafeIterator(h);
+        if (!di) goto werr;
+        while((de = hashtableNext(di)) != NULL) {
+            sds keystr = hashtableGetKey(de);
+            robj key, *o = hashtableGetVal(de);
             long long expire;
 
             initStaticStringObject(key,keystr);
-            expire = getExpire(db,&key);
+            expire = keyGetExpire(keystr);
             if (rdbSaveKeyValuePair(rdb,&key,o,expire,now) == -1) goto werr;
+            if (server.rdb_key_save_delay) usleep(server.rdb_key_save_delay);
 
             /* When this RDB is produced as part of an AOF rewrite, move
              * accumulated diff from parent to child while rewriting in
@@ -940,10 +1515,17 @@ int rdbSaveRio(rio *rdb, int *error, int flags, rdbSaveInfo *rsi) {
                 aofReadDiffFromParent();
             }
         }
-        dictReleaseIterator(di);
+        hashtableReleaseIterator(di);
     }
     di = NULL; /* So that we don't release it again on error. */
 
+    if (chunks) {
+        if (rdbSaveChunkIndex(rdb,&idx) == -1) goto werr;
+        rdbWorkQueueRelease(chunks,rdbSaveChunkFree);
+        rdbChunkIndexFree(&idx);
+        chunks = NULL;
+    }
+
     /* EOF opcode */
     if (rdbSaveType(rdb,RDB_OPCODE_EOF) == -1) goto werr;
 
@@ -956,7 +1538,11 @@ int rdbSaveRio(rio *rdb, int *error, int flags, rdbSaveInfo *rsi) {
 
 werr:
     if (error) *error = errno;
-    if (di) dictReleaseIterator(di);
+    if (di) hashtableReleaseIterator(di);
+    if (chunks) {
+        rdbWorkQueueRelease(chunks,rdbSaveChunkFree);
+        rdbChunkIndexFree(&idx);
+    }
     return C_ERR;
 }
 
@@ -1046,14 +1632,442 @@ werr:
     return C_ERR;
 }
 
+/* -----------------------------------------------------------------------------
+ * Snapshot thread
+ *
+ * With rdb-snapshot-mode set to thread, BGSAVE writes the RDB file from a
+ * thread instead of a forked child. The thread visits the bucket chains of
+ * the main hash table of every DB, as they were when the snapshot started,
+ * while the main thread keeps serving commands. The rehashing of all the
+ * hash tables is paused meanwhile, so that no key moves to another chain,
+ * and no entry of a set or hash moves while the thread serializes it.
+ *
+ * The first bucket of every chain has a version, that is set to the epoch
+ * of the snapshot once the keys of the chain were saved, and to the epoch
+ * minus one while they are being saved. Before modifying or adding a key
+ * the main thread calls rdbSnapshotBeforeWrite(), that saves the chain of
+ * the key itself if the thread did not get to it yet: the old version of the
+ * keys is kept serialized in memory, and written by the thread once it is
+ * done with the chains of the DB. Since every chain is saved exactly once,
+ * by one thread or the other, the file has the keys as they were at the
+ * start of the snapshot, like the one written by a child.
+ *
+ * So instead of duplicating every page written while the snapshot is in
+ * progress, only the keys written before the thread visits them are
+ * duplicated, in their serialized form. Operations that replace whole DBs,
+ * like FLUSHALL, SWAPDB or loading a new dataset, abort the snapshot.
+ * -------------------------------------------------------------------------- */
+
+/* A DB saved by the snapshot thread. */
+typedef struct rdbSnapshotDb {
+    hashtable *dict;                /* Main hash table of the DB. */
+    hashtableBucket *buckets[2];    /* Bucket arrays of the two tables, */
+    unsigned long size[2];          /* and their sizes, zero if not saved. */
+    uint32_t keys, expires;         /* Sizes for the RESIZEDB opcode. */
+    list *preserved;                /* Chunks of keys saved by the main thread. */
+    int done;                       /* Set by the thread once the DB is saved. */
+} rdbSnapshotDb;
+
+typedef struct rdbSnapshot {
+    pthread_t thread;
+    pthread_mutex_t mutex;          /* Protects 'aborted' and 'keyspace_done'. */
+    pthread_cond_t cond;            /* Signaled when 'keyspace_done' is set. */
+    rdbSnapshotDb *dbs;
+    uint32_t epoch;                 /* Version of the chains already saved. */
+    long long now;                  /* Keys expired at this time are skipped. */
+    int chunked, zstd, checksum;    /* Format of the file. */
+    sds header;                     /* Magic and aux fields, already serialized. */
+    sds filename;
+    char tmpfile[256];
+    int aborted;                    /* Set by rdbSnapshotAbort(). */
+    int keyspace_done;              /* The thread no longer reads the keyspace. */
+    int rehashing_resumed;          /* Only used by the main thread. */
+    int finished;                   /* Set by the thread just before exiting. */
+    int status;                     /* C_OK or C_ERR, once finished. */
+    int saved_errno;
+    unsigned long long preserved_keys; /* Keys saved by the main thread, */
+    size_t preserved_bytes;            /* and their serialized size. */
+} rdbSnapshot;
+
+/* Epoch of the last snapshot. Chains are saved only by the snapshot whose
+ * epoch differs from their version, and new buckets have version zero. */
+static uint32_t rdbSnapshotEpoch = 0;
+
+/* Take the chain starting at 'head' in order to save it. Returns 1 if the
+ * caller has to save the chain and then call rdbSnapshotChainSaved(), or 0
+ * if the chain was already saved. If the other thread is saving the chain,
+ * wait for it to finish. */
+static int rdbSnapshotClaimChain(rdbSnapshot *s, hashtableBucket *head) {
+    uint32_t version = __atomic_load_n(&head->version,__ATOMIC_ACQUIRE);
+
+    while(1) {
+        if (version == s->epoch) return 0;
+        if (version == s->epoch-1) {
+            sched_yield();
+            version = __atomic_load_n(&head->version,__ATOMIC_ACQUIRE);
+        } else if (__atomic_compare_exchange_n(&head->version,&version,
+                       s->epoch-1,0,__ATOMIC_ACQUIRE,__ATOMIC_ACQUIRE))
+        {
+            return 1;
+        }
+    }
+}
+
+static void rdbSnapshotChainSaved(rdbSnapshot *s, hashtableBucket *head) {
+    __atomic_store_n(&head->version,s->epoch,__ATOMIC_RELEASE);
+}
+
+/* Signal the main thread that the keyspace is no longer accessed by the
+ * snapshot thread, see rdbSnapshotAbort(). */
+static void rdbSnapshotKeyspaceDone(rdbSnapshot *s) {
+    pthread_mutex_lock(&s->mutex);
+    s->keyspace_done = 1;
+    pthread_cond_signal(&s->cond);
+    pthread_mutex_unlock(&s->mutex);
+}
+
+/* Write the keys serialized in 'c', as a chunk if the file is chunked, and
+ * empty its buffer. */
+static int rdbSnapshotFlush(rdbSnapshot *s, rio *rdb, rdbSaveChunk *c,
+                            rdbChunkIndex *idx)
+{
+    sds buf = c->rio.io.buffer.ptr;
+    int retval;
+
+    if (s->chunked) {
+        rdbSaveFinishChunk(c,s->zstd);
+        retval = rdbWriteChunk(rdb,c,idx,0);
+    } else {
+        retval = rdbWriteRaw(rdb,buf,sdslen(buf));
+    }
+    sdsclear(buf);
+    rioInitWithBuffer(&c->rio,buf);
+    c->keys = 0;
+    return retval;
+}
+
+/* Save the DB 'j' from the snapshot thread: the chains not yet saved by the
+ * main thread first, then the keys the main thread saved. Returns -1 on
+ * write errors, or if the snapshot was aborted. */
+static int rdbSnapshotSaveDb(rdbSnapshot *s, rio *rdb, int j, rdbSaveChunk *c,
+                             rdbChunkIndex *idx)
+{
+    rdbSnapshotDb *sdb = s->dbs+j;
+    listNode *ln;
+    unsigned long i;
+    int t;
+
+    if (sdb->keys == 0) return 0;
+    if (rdbSaveType(rdb,RDB_OPCODE_SELECTDB) == -1) return -1;
+    if (rdbSaveLen(rdb,j) == -1) return -1;
+    if (rdbSaveType(rdb,RDB_OPCODE_RESIZEDB) == -1) return -1;
+    if (rdbSaveLen(rdb,sdb->keys) == -1) return -1;
+    if (rdbSaveLen(rdb,sdb->expires) == -1) return -1;
+
+    c->db = server.db+j;
+    for (t = 0; t <= 1; t++) {
+        for (i = 0; i < sdb->size[t]; i++) {
+            hashtableBucket *head = sdb->buckets[t]+i;
+            uint64_t keys = c->keys;
+
+            if (__atomic_load_n(&s->aborted,__ATOMIC_RELAXED)) return -1;
+            if (!rdbSnapshotClaimChain(s,head)) continue;
+            hashtableScanChain(head,rdbSaveChunkEntry,c);
+            rdbSnapshotChainSaved(s,head);
+
+            if (server.rdb_key_save_delay && c->keys > keys)
+                usleep((useconds_t)server.rdb_key_save_delay*(c->keys-keys));
+            if (c->keys >= RDB_CHUNK_KEYS &&
+                rdbSnapshotFlush(s,rdb,c,idx) == -1) return -1;
+        }
+    }
+    if (rdbSnapshotFlush(s,rdb,c,idx) == -1) return -1;
+
+    /* All the chains are saved, so the main thread no longer adds keys to
+     * the preserved ones: they can be written without locking. */
+    while((ln = listFirst(sdb->preserved)) != NULL) {
+        if (rdbSnapshotFlush(s,rdb,listNodeValue(ln),idx) == -1) return -1;
+        listDelNode(sdb->preserved,ln);
+    }
+    __atomic_store_n(&sdb->done,1,__ATOMIC_RELEASE);
+    return 0;
+}
+
+static void *rdbSnapshotThreadMain(void *arg) {
+    rdbSnapshot *s = arg;
+    rdbSaveChunk *c = rdbSaveChunkCreate();
+    rdbChunkIndex idx = {NULL,0,0};
+    uint64_t cksum;
+    FILE *fp;
+    rio rdb;
+    int j;
+
+    c->now = s->now;
+    rdbSaveUncompressedStrings = s->zstd;
+    if ((fp = fopen(s->tmpfile,"w")) == NULL) goto werr;
+    rioInitWithFile(&rdb,fp);
+    if (s->checksum) rdb.update_cksum = rioGenericUpdateChecksum;
+    if (rdbWriteRaw(&rdb,s->header,sdslen(s->header)) == -1) goto werr;
+    for (j = 0; j < server.dbnum; j++) {
+        if (rdbSnapshotSaveDb(s,&rdb,j,c,&idx) == -1) goto werr;
+    }
+    rdbSnapshotKeyspaceDone(s);
+
+    if (s->chunked && rdbSaveChunkIndex(&rdb,&idx) == -1) goto werr;
+    if (rdbSaveType(&rdb,RDB_OPCODE_EOF) == -1) goto werr;
+    cksum = rdb.cksum;
+    memrev64ifbe(&cksum);
+    if (rioWrite(&rdb,&cksum,8) == 0) goto werr;
+
+    /* Make sure data will not remain on the OS's output buffers */
+    if (fflush(fp) == EOF) goto werr;
+    if (fsync(fileno(fp)) == -1) goto werr;
+    j = fclose(fp);
+    fp = NULL;
+    if (j == EOF) goto werr;
+
+    /* Replace the old file only if the snapshot was not aborted meanwhile:
+     * SHUTDOWN aborts it before saving the DB itself. */
+    pthread_mutex_lock(&s->mutex);
+    if (s->aborted) {
+        unlink(s->tmpfile);
+    } else if (rename(s->tmpfile,s->filename) == -1) {
+        s->saved_errno = errno;
+        unlink(s->tmpfile);
+    } else {
+        s->status = C_OK;
+    }
+    pthread_mutex_unlock(&s->mutex);
+    goto done;
+
+werr:
+    s->saved_errno = errno;
+    rdbSnapshotKeyspaceDone(s);
+    if (fp) fclose(fp);
+    unlink(s->tmpfile);
+
+done:
+    rdbSaveUncompressedStrings = 0;
+    rdbZstdReleaseContexts();
+    rdbSaveChunkFree(c);
+    rdbChunkIndexFree(&idx);
+    __atomic_store_n(&s->finished,1,__ATOMIC_RELEASE);
+    return NULL;
+}
+
+static void rdbSnapshotResumeRehashing(rdbSnapshot *s) {
+    if (s->rehashing_resumed) return;
+    hashtableResumeRehashing();
+    s->rehashing_resumed = 1;
+}
+
+static void rdbSnapshotFree(rdbSnapshot *s) {
+    int j;
+
+    for (j = 0; j < server.dbnum; j++) listRelease(s->dbs[j].preserved);
+    zfree(s->dbs);
+    sdsfree(s->header);
+    sdsfree(s->filename);
+    pthread_mutex_destroy(&s->mutex);
+    pthread_cond_destroy(&s->cond);
+    zfree(s);
+}
+
+/* Start saving the DB on disk from the snapshot thread. */
+static int rdbSaveBackgroundThread(char *filename, rdbSaveInfo *rsi) {
+    rdbSnapshot *s = zcalloc(sizeof(*s));
+    char magic[10];
+    rio header;
+    int j, err;
+
+    rdbSnapshotEpoch += 2;
+    if (rdbSnapshotEpoch == 0) rdbSnapshotEpoch = 2;
+    s->epoch = rdbSnapshotEpoch;
+    s->now = mstime();
+    s->chunked = rdbUseChunks();
+    s->zstd = rdbUseZstd();
+    s->checksum = server.rdb_checksum;
+    s->status = C_ERR;
+    s->filename = sdsnew(filename);
+    snprintf(s->tmpfile,sizeof(s->tmpfile),"temp-snapshot-%d.rdb",
+        (int) getpid());
+    pthread_mutex_init(&s->mutex,NULL);
+    pthread_cond_init(&s->cond,NULL);
+
+    /* The aux fields describe the state of the server, so they are
+     * serialized here, at the time of the snapshot. */
+    rioInitWithBuffer(&header,sdsempty());
+    snprintf(magic,sizeof(magic),"REDIS%04d",
+        s->chunked ? RDB_VERSION_CHUNKED : RDB_VERSION);
+    rdbWriteRaw(&header,magic,9);
+    rdbSaveInfoAuxFields(&header,RDB_SAVE_NONE,rsi);
+    s->header = header.io.buffer.ptr;
+
+    s->dbs = zcalloc(sizeof(rdbSnapshotDb)*server.dbnum);
+    for (j = 0; j < server.dbnum; j++) {
+        rdbSnapshotDb *sdb = s->dbs+j;
+        redisDb *db = server.db+j;
+        hashtable *h = db->dict;
+        int t;
+
+        sdb->preserved = listCreate();
+        listSetFreeMethod(sdb->preserved,rdbSaveChunkFree);
+        if (hashtableSize(h) == 0) continue;
+        sdb->dict = h;
+        sdb->keys = (hashtableSize(h) <= UINT32_MAX) ?
+                    hashtableSize(h) : UINT32_MAX;
+        sdb->expires = (hashtableSize(db->expires) <= UINT32_MAX) ?
+                       hashtableSize(db->expires) : UINT32_MAX;
+        for (t = 0; t <= 1; t++) {
+            sdb->buckets[t] = h->ht[t].buckets;
+            sdb->size[t] = h->ht[t].size;
+        }
+    }
+    hashtablePauseRehashing();
+
+    if ((err = rdbCreateThread(&s->thread,rdbSnapshotThreadMain,s)) != 0) {
+        hashtableResumeRehashing();
+        rdbSnapshotFree(s);
+        server.lastbgsave_status = C_ERR;
+        serverLog(LL_WARNING,"Can't save in background: pthread_create: %s",
+            strerror(err));
+        return C_ERR;
+    }
+    serverLog(LL_NOTICE,"Background saving started by the snapshot thread");
+    server.rdb_save_time_start = time(NULL);
+    server.rdb_snapshot = s;
+    server.rdb_child_type = RDB_CHILD_TYPE_DISK;
+    return C_OK;
+}
+
+/* Save the keys of the chain starting at 'head' before they are modified,
+ * appending them to the preserved keys of the DB. */
+static void rdbSnapshotPreserveChain(rdbSnapshot *s, redisDb *db,
+                                     hashtableBucket *head)
+{
+    rdbSnapshotDb *sdb = s->dbs+db->id;
+    listNode *ln = listLast(sdb->preserved);
+    rdbSaveChunk *c = ln ? listNodeValue(ln) : NULL;
+    uint64_t keys;
+    size_t len;
+
+    if (c == NULL || c->keys >= RDB_CHUNK_KEYS) {
+        c = rdbSaveChunkCreate();
+        c->db = db;
+        c->now = s->now;
+        listAddNodeTail(sdb->preserved,c);
+    }
+    keys = c->keys;
+    len = sdslen(c->rio.io.buffer.ptr);
+    rdbSaveUncompressedStrings = s->zstd;
+    hashtableScanChain(head,rdbSaveChunkEntry,c);
+    rdbSaveUncompressedStrings = 0;
+    s->preserved_keys += c->keys-keys;
+    s->preserved_bytes += sdslen(c->rio.io.buffer.ptr)-len;
+}
+
+/* Called by the main thread, with a snapshot in progress, before 'key' is
+ * modified, deleted or added: if the snapshot thread did not save the
+ * chains where the key is stored yet, they are saved now, so that the
+ * snapshot has the keys as they were when it started. */
+void rdbSnapshotBeforeWrite(redisDb *db, sds key) {
+    rdbSnapshot *s = server.rdb_snapshot;
+    rdbSnapshotDb *sdb = s->dbs+db->id;
+    uint64_t hash;
+    int t;
+
+    /* Keys loaded into DBs that are not the ones of the server yet. */
+    if (db != server.db+db->id) return;
+
+    /* Once the rehashing is resumed the bucket arrays may be gone, but
+     * then the thread is no longer reading the keyspace anyway. */
+    if (s->rehashing_resumed || sdb->keys == 0 ||
+        __atomic_load_n(&sdb->done,__ATOMIC_ACQUIRE)) return;
+
+    hash = dictHashKey(sdb->dict,key);
+    for (t = 0; t <= 1; t++) {
+        hashtableBucket *head;
+
+        if (sdb->size[t] == 0) continue;
+        head = sdb->buckets[t]+(hash & (sdb->size[t]-1));
+        if (rdbSnapshotClaimChain(s,head)) {
+            rdbSnapshotPreserveChain(s,db,head);
+            rdbSnapshotChainSaved(s,head);
+        }
+    }
+}
+
+/* Abort the snapshot in progress, if any, before the DBs are replaced or
+ * the server exits. Returns once the thread stopped reading the keyspace.
+ * The snapshot is still in progress until the thread exits, but the file
+ * it was writing is removed and will not replace the current one. */
+void rdbSnapshotAbort(void) {
+    rdbSnapshot *s = server.rdb_snapshot;
+
+    if (s == NULL || s->aborted) return;
+    pthread_mutex_lock(&s->mutex);
+    __atomic_store_n(&s->aborted,1,__ATOMIC_RELAXED);
+    while(!s->keyspace_done) pthread_cond_wait(&s->cond,&s->mutex);
+    pthread_mutex_unlock(&s->mutex);
+    rdbSnapshotResumeRehashing(s);
+    unlink(s->tmpfile);
+    serverLog(LL_WARNING,"Background saving aborted");
+}
+
+/* Called by serverCron() while a snapshot is in progress: the rehashing is
+ * resumed as soon as the thread no longer reads the keyspace, and the end of
+ * the snapshot is handled like backgroundSaveDoneHandlerDisk() does for a
+ * child. */
+void rdbSnapshotCron(void) {
+    rdbSnapshot *s = server.rdb_snapshot;
+    int keyspace_done, ok;
+
+    pthread_mutex_lock(&s->mutex);
+    keyspace_done = s->keyspace_done;
+    pthread_mutex_unlock(&s->mutex);
+    if (keyspace_done) rdbSnapshotResumeRehashing(s);
+    if (!__atomic_load_n(&s->finished,__ATOMIC_ACQUIRE)) return;
+
+    pthread_join(s->thread,NULL);
+    ok = !s->aborted && s->status == C_OK;
+    if (ok) {
+        serverLog(LL_NOTICE,
+            "Background saving terminated with success");
+        server.dirty = server.dirty - server.dirty_before_bgsave;
+        server.lastsave = time(NULL);
+        server.lastbgsave_status = C_OK;
+    } else if (!s->aborted) {
+        serverLog(LL_WARNING,"Background saving error: %s",
+            strerror(s->saved_errno));
+        server.lastbgsave_status = C_ERR;
+    }
+    if (s->preserved_keys) {
+        serverLog(LL_NOTICE,
+            "RDB: %zu MB of memory used to save %llu keys before writing them",
+            s->preserved_bytes/(1024*1024), s->preserved_keys);
+    }
+    server.stat_rdb_cow_bytes = s->preserved_bytes;
+    server.rdb_snapshot = NULL;
+    server.rdb_child_type = RDB_CHILD_TYPE_NONE;
+    server.rdb_save_time_last = time(NULL)-server.rdb_save_time_start;
+    server.rdb_save_time_start = -1;
+    rdbSnapshotFree(s);
+    /* Possibly there are slaves waiting for a BGSAVE in order to be served
+     * (the first stage of SYNC is a bulk transfer of dump.rdb) */
+    updateSlavesWaitingBgsave(ok ? C_OK : C_ERR, RDB_CHILD_TYPE_DISK);
+}
+
 int rdbSaveBackground(char *filename, rdbSaveInfo *rsi) {
     pid_t childpid;
     long long start;
 
-    if (server.aof_child_pid != -1 || server.rdb_child_pid != -1) return C_ERR;
+    if (server.aof_child_pid != -1 || rdbSaveInProgress()) return C_ERR;
 
     server.dirty_before_bgsave = server.dirty;
     server.lastbgsave_try = time(NULL);
+
+    if (server.rdb_snapshot_mode == RDB_SNAPSHOT_THREAD && rdbUseThreads())
+        return rdbSaveBackgroundThread(filename,rsi);
     openChildInfoPipe();
 
     start = ustime();
@@ -1145,6 +2159,28 @@ robj *rdbLoadCheckModuleValue(rio *rdb, char *modulename) {
     return createStringObject("module-dummy-value",18);
 }
 
+/* Convert the ziplist of a hash or a sorted set saved by an older version
+ * into a listpack with the same entries. The ziplist is freed. */
+static unsigned char *rdbZiplistToListpack(unsigned char *zl) {
+    unsigned char *lp = lpNew();
+    unsigned char *p = ziplistIndex(zl,0);
+    unsigned char *vstr;
+    unsigned int vlen;
+    long long vlong;
+    char buf[LONG_STR_SIZE];
+
+    while (ziplistGet(p,&vstr,&vlen,&vlong)) {
+        if (vstr == NULL) {
+            vlen = ll2string(buf,sizeof(buf),vlong);
+            vstr = (unsigned char*)buf;
+        }
+        lp = lpAppend(lp,vstr,vlen);
+        p = ziplistNext(zl,p);
+    }
+    zfree(zl);
+    return lp;
+}
+
 /* Load a Redis object of the specified type from the specified file.
  * On success a newly allocated object is returned, otherwise NULL. */
 robj *rdbLoadObject(int rdbtype, rio *rdb) {
@@ -1180,10 +2216,10 @@ robj *rdbLoadObject(int rdbtype, rio *rdb) {
         /* Use a regular set when there are too many entries. */
         if (len > server.set_max_intset_entries) {
             o = createSetObject();
-            /* It's faster to expand the dict to the right size asap in order
-             * to avoid rehashing */
+            /* It's faster to expand the hash table to the right size asap in
+             * order to avoid rehashing */
             if (len > DICT_HT_INITIAL_SIZE)
-                dictExpand(o->ptr,len);
+                hashtableExpand(o->ptr,len);
         } else {
             o = createIntsetObject();
         }
@@ -1202,14 +2238,14 @@ robj *rdbLoadObject(int rdbtype, rio *rdb) {
                     o->ptr = intsetAdd(o->ptr,llval,NULL);
                 } else {
                     setTypeConvert(o,OBJ_ENCODING_HT);
-                    dictExpand(o->ptr,len);
+                    hashtableExpand(o->ptr,len);
                 }
             }
 
             /* This will also be called when the set was just converted
              * to a regular hash table encoded set. */
             if (o->encoding == OBJ_ENCODING_HT) {
-                dictAdd((dict*)o->ptr,sdsele,NULL);
+                hashtableAdd((hashtable*)o->ptr,sdsele,NULL);
             } else {
                 sdsfree(sdsele);
             }
@@ -1221,14 +2257,14 @@ robj *rdbLoadObject(int rdbtype, rio *rdb) {
         zset *zs;
 
         if ((zsetlen = rdbLoadLen(rdb,NULL)) == RDB_LENERR) return NULL;
-        o = createZsetObject();
+        o = (zsetlen > server.zset_max_skiplist_entries) ?
+            createZsetBtreeObject() : createZsetObject();
         zs = o->ptr;
 
         /* Load every single element of the sorted set. */
         while(zsetlen--) {
             sds sdsele;
             double score;
-            zskiplistNode *znode;
 
             if ((sdsele = rdbGenericLoadStringObject(rdb,RDB_LOAD_SDS,NULL))
                 == NULL) return NULL;
@@ -1242,14 +2278,13 @@ robj *rdbLoadObject(int rdbtype, rio *rdb) {
             /* Don't care about integer-encoded strings. */
             if (sdslen(sdsele) > maxelelen) maxelelen = sdslen(sdsele);
 
-            znode = zslInsert(zs->zsl,score,sdsele);
-            dictAdd(zs->dict,sdsele,&znode->score);
+            if (zsetInsert(zs,score,sdsele) == C_ERR) sdsfree(sdsele);
         }
 
         /* Convert *after* loading, since sorted sets are not stored ordered. */
         if (zsetLength(o) <= server.zset_max_ziplist_entries &&
             maxelelen <= server.zset_max_ziplist_value)
-                zsetConvert(o,OBJ_ENCODING_ZIPLIST);
+                zsetConvert(o,OBJ_ENCODING_LISTPACK);
     } else if (rdbtype == RDB_TYPE_HASH) {
         uint64_t len;
         int ret;
@@ -1264,8 +2299,8 @@ robj *rdbLoadObject(int rdbtype, rio *rdb) {
         if (len > server.hash_max_ziplist_entries)
             hashTypeConvert(o, OBJ_ENCODING_HT);
 
-        /* Load every field and value into the ziplist */
-        while (o->encoding == OBJ_ENCODING_ZIPLIST && len > 0) {
+        /* Load every field and value into the listpack */
+        while (o->encoding == OBJ_ENCODING_LISTPACK && len > 0) {
             len--;
             /* Load raw strings */
             if ((field = rdbGenericLoadStringObject(rdb,RDB_LOAD_SDS,NULL))
@@ -1273,11 +2308,9 @@ robj *rdbLoadObject(int rdbtype, rio *rdb) {
             if ((value = rdbGenericLoadStringObject(rdb,RDB_LOAD_SDS,NULL))
                 == NULL) return NULL;
 
-            /* Add pair to ziplist */
-            o->ptr = ziplistPush(o->ptr, (unsigned char*)field,
-                    sdslen(field), ZIPLIST_TAIL);
-            o->ptr = ziplistPush(o->ptr, (unsigned char*)value,
-                    sdslen(value), ZIPLIST_TAIL);
+            /* Add pair to listpack */
+            o->ptr = lpAppend(o->ptr, (unsigned char*)field, sdslen(field));
+            o->ptr = lpAppend(o->ptr, (unsigned char*)value, sdslen(value));
 
             /* Convert to hash table if size threshold is exceeded */
             if (sdslen(field) > server.hash_max_ziplist_value ||
@@ -1302,7 +2335,7 @@ robj *rdbLoadObject(int rdbtype, rio *rdb) {
                 == NULL) return NULL;
 
             /* Add pair to hash table */
-            ret = dictAdd((dict*)o->ptr, field, value);
+            ret = hashtableAdd((hashtable*)o->ptr, field, value);
             if (ret == DICT_ERR) {
                 rdbExitReportCorruptRDB("Duplicate keys detected");
             }
@@ -1316,17 +2349,57 @@ robj *rdbLoadObject(int rdbtype, rio *rdb) {
         quicklistSetOptions(o->ptr, server.list_max_ziplist_size,
                             server.list_compress_depth);
 
+        /* The nodes of old lists are ziplists: append their values, so
+         * that they get stored into listpacks. */
         while (len--) {
             unsigned char *zl =
                 rdbGenericLoadStringObject(rdb,RDB_LOAD_PLAIN,NULL);
             if (zl == NULL) return NULL;
-            quicklistAppendZiplist(o->ptr, zl);
+            quicklistAppendValuesFromZiplist(o->ptr, zl);
         }
+    } else if (rdbtype == RDB_TYPE_LIST_QUICKLIST_2) {
+        if ((len = rdbLoadLen(rdb,NULL)) == RDB_LENERR) return NULL;
+        o = createQuicklistObject();
+        quicklistSetOptions(o->ptr, server.list_max_ziplist_size,
+                            server.list_compress_depth);
+
+        while (len--) {
+            uint64_t container;
+            unsigned char *lp;
+
+            if ((container = rdbLoadLen(rdb,NULL)) == RDB_LENERR) return NULL;
+            if (container != QUICKLIST_NODE_CONTAINER_PACKED)
+                rdbExitReportCorruptRDB("Unknown quicklist node container %llu",
+                    (unsigned long long)container);
+            lp = rdbGenericLoadStringObject(rdb,RDB_LOAD_PLAIN,NULL);
+            if (lp == NULL) return NULL;
+            if (lpFirst(lp) == NULL) {
+                /* Empty nodes are never saved, but skip them anyway. */
+                zfree(lp);
+                continue;
+            }
+            quicklistAppendListpack(o->ptr, lp);
+        }
+    } else if (rdbtype == RDB_TYPE_STRING_BITMAP) {
+        size_t blen;
+        roaring *r;
+        unsigned char *blob =
+            rdbGenericLoadStringObject(rdb,RDB_LOAD_PLAIN,&blen);
+        if (blob == NULL) return NULL;
+
+        /* The blob is validated, since it may come from RESTORE. */
+        if ((r = roaringDeserialize(blob,blen)) == NULL)
+            rdbExitReportCorruptRDB("Invalid compressed bitmap");
+        zfree(blob);
+        o = createObject(OBJ_STRING,r);
+        o->encoding = OBJ_ENCODING_BITMAP;
     } else if (rdbtype == RDB_TYPE_HASH_ZIPMAP  ||
                rdbtype == RDB_TYPE_LIST_ZIPLIST ||
                rdbtype == RDB_TYPE_SET_INTSET   ||
                rdbtype == RDB_TYPE_ZSET_ZIPLIST ||
-               rdbtype == RDB_TYPE_HASH_ZIPLIST)
+               rdbtype == RDB_TYPE_HASH_ZIPLIST ||
+               rdbtype == RDB_TYPE_ZSET_LISTPACK ||
+               rdbtype == RDB_TYPE_HASH_LISTPACK)
     {
         unsigned char *encoded =
             rdbGenericLoadStringObject(rdb,RDB_LOAD_PLAIN,NULL);
@@ -1341,10 +2414,10 @@ robj *rdbLoadObject(int rdbtype, rio *rdb) {
          * converted. */
         switch(rdbtype) {
             case RDB_TYPE_HASH_ZIPMAP:
-                /* Convert to ziplist encoded hash. This must be deprecated
+                /* Convert to listpack encoded hash. This must be deprecated
                  * when loading dumps created by Redis 2.4 gets deprecated. */
                 {
-                    unsigned char *zl = ziplistNew();
+                    unsigned char *lp = lpNew();
                     unsigned char *zi = zipmapRewind(o->ptr);
                     unsigned char *fstr, *vstr;
                     unsigned int flen, vlen;
@@ -1353,14 +2426,15 @@ robj *rdbLoadObject(int rdbtype, rio *rdb) {
                     while ((zi = zipmapNext(zi, &fstr, &flen, &vstr, &vlen)) != NULL) {
                         if (flen > maxlen) maxlen = flen;
                         if (vlen > maxlen) maxlen = vlen;
-                        zl = ziplistPush(zl, fstr, flen, ZIPLIST_TAIL);
-                        zl = ziplistPush(zl, vstr, vlen, ZIPLIST_TAIL);
+                        lp = lpAppend(lp, fstr, flen);
+                        lp = lpAppend(lp, vstr, vlen);
                     }
 
                     zfree(o->ptr);
-                    o->ptr = zl;
+                    o->ptr = lpSetFingerprints(lp,
+                                               server.listpack_fingerprints);
                     o->type = OBJ_HASH;
-                    o->encoding = OBJ_ENCODING_ZIPLIST;
+                    o->encoding = OBJ_ENCODING_LISTPACK;
 
                     if (hashTypeLength(o) > server.hash_max_ziplist_entries ||
                         maxlen > server.hash_max_ziplist_value)
@@ -1381,14 +2455,26 @@ robj *rdbLoadObject(int rdbtype, rio *rdb) {
                     setTypeConvert(o,OBJ_ENCODING_HT);
                 break;
             case RDB_TYPE_ZSET_ZIPLIST:
+            case RDB_TYPE_ZSET_LISTPACK:
+                if (rdbtype == RDB_TYPE_ZSET_ZIPLIST)
+                    o->ptr = rdbZiplistToListpack(o->ptr);
+                o->ptr = lpSetFingerprints(o->ptr,
+                                           server.listpack_fingerprints);
                 o->type = OBJ_ZSET;
-                o->encoding = OBJ_ENCODING_ZIPLIST;
+                o->encoding = OBJ_ENCODING_LISTPACK;
                 if (zsetLength(o) > server.zset_max_ziplist_entries)
-                    zsetConvert(o,OBJ_ENCODING_SKIPLIST);
+                    zsetConvert(o,
+                        zsetLength(o) > server.zset_max_skiplist_entries ?
+                        OBJ_ENCODING_BTREE : OBJ_ENCODING_SKIPLIST);
                 break;
             case RDB_TYPE_HASH_ZIPLIST:
+            case RDB_TYPE_HASH_LISTPACK:
+                if (rdbtype == RDB_TYPE_HASH_ZIPLIST)
+                    o->ptr = rdbZiplistToListpack(o->ptr);
+                o->ptr = lpSetFingerprints(o->ptr,
+                                           server.listpack_fingerprints);
                 o->type = OBJ_HASH;
-                o->encoding = OBJ_ENCODING_ZIPLIST;
+                o->encoding = OBJ_ENCODING_LISTPACK;
                 if (hashTypeLength(o) > server.hash_max_ziplist_entries)
                     hashTypeConvert(o, OBJ_ENCODING_HT);
                 break;
@@ -1447,16 +2533,26 @@ void startLoading(FILE *fp) {
     struct stat sb;
 
     /* Load the DB */
-    server.loading = 1;
-    server.loading_start_time = time(NULL);
-    server.loading_loaded_bytes = 0;
     if (fstat(fileno(fp), &sb) == -1) {
-        server.loading_total_bytes = 0;
+        startLoadingStream(0,0);
     } else {
-        server.loading_total_bytes = sb.st_size;
+        startLoadingStream(sb.st_size,0);
     }
 }
 
+/* Like startLoading() for a stream of 'size' bytes, or 0 if the size is
+ * not known. If 'async' is true the dataset is loaded into other DBs while
+ * the current one is served, so the commands are not refused. */
+void startLoadingStream(off_t size, int async) {
+    if (async)
+        server.async_loading = 1;
+    else
+        server.loading = 1;
+    server.loading_start_time = time(NULL);
+    server.loading_loaded_bytes = 0;
+    server.loading_total_bytes = size;
+}
+
 /* Refresh the loading progress info */
 void loadingProgress(off_t pos) {
     server.loading_loaded_bytes = pos;
@@ -1467,6 +2563,7 @@ void loadingProgress(off_t pos) {
 /* Loading finished */
 void stopLoading(void) {
     server.loading = 0;
+    server.async_loading = 0;
 }
 
 /* Track loading progress in order to serve client's from time to time
@@ -1488,14 +2585,486 @@ void rdbLoadProgressCallback(rio *r, const void *buf, size_t len) {
     }
 }
 
+/*-----------------------------------------------------------------------------
+ * Parallel loading
+ *
+ * When rdb-load-threads is greater than one, rdbLoadRio() doesn't decode the
+ * values itself: the main thread reads the keys, and just copies the values
+ * as they are serialized into batches, only parsing the lengths needed to
+ * find where every value ends. The batches are decoded with rdbLoadObject()
+ * by the threads of a work queue (decompressing the strings, converting the
+ * encodings and creating the objects), then the main thread adds the keys of
+ * every batch to the DB, in file order, so that the result is exactly the
+ * same of the serial loading.
+ *
+ * The chunks of files saved with rdb-chunked are loaded the same way, but
+ * since every chunk can be parsed on its own, a chunk is queued as a single
+ * batch: the threads verify its checksum and parse the keys too, so that
+ * the main thread only reads the chunk and adds its keys to the DB.
+ *
+ * Module values are always decoded by the main thread (see rdbUseThreads()).
+ *----------------------------------------------------------------------------*/
+
+#define RDB_LOAD_BATCH_KEYS 256             /* Max keys in a batch. */
+#define RDB_LOAD_BATCH_BYTES (1024*1024)    /* Max serialized bytes. */
+
+typedef struct rdbLoadJob {
+    redisDb *db;
+    robj *key;
+    robj *val;              /* Decoded value, NULL on errors. */
+    int type;
+    long long expiretime;
+    size_t offset;          /* Offset of the value in the batch buffer. */
+} rdbLoadJob;
+
+typedef struct rdbLoadBatch {
+    rdbLoadJob *jobs;
+    int count, size;
+    sds buf;                /* Serialized values, or payload of the chunk. */
+    int chunk;              /* True if 'buf' is the payload of a chunk. */
+    int compressed;         /* True if the payload is compressed with zstd. */
+    /* Chunk parsing state. */
+    redisDb *db;            /* DB of the keys of the chunk. */
+    uint64_t keys;          /* Keys of the chunk still to parse. */
+    uint64_t crc;           /* Checksum of the payload. */
+    size_t pos;             /* Where the parsing stopped. */
+    long long now;          /* Expired keys are skipped, unless -1. */
+    char *error;            /* Set if the chunk is corrupted. */
+    long long decode_usec;  /* Time spent decoding the batch. */
+} rdbLoadBatch;
+
+typedef struct rdbLoader {
+    rdbWorkQueue *queue;        /* Batches being decoded. */
+    /* Stats for the log. */
+    long long start_usec, keys, decode_usec, insert_usec;
+} rdbLoader;
+
+/* Append 'len' bytes read from 'rdb' to the batch. */
+static int rdbLoadCopy(rio *rdb, rdbLoadBatch *b, size_t len) {
+    size_t oldlen = sdslen(b->buf);
+
+    b->buf = sdsMakeRoomFor(b->buf,len);
+    if (rioRead(rdb,b->buf+oldlen,len) == 0) return -1;
+    sdssetlen(b->buf,oldlen+len);
+    return 0;
+}
+
+/* Like rdbLoadLenByRef(), but the length is also appended to the batch. */
+static int rdbLoadCopyLen(rio *rdb, rdbLoadBatch *b, int *isencoded, uint64_t *lenptr) {
+    unsigned char buf[9];
+    size_t buflen = 1;
+    int type;
+
+    if (isencoded) *isencoded = 0;
+    if (rioRead(rdb,buf,1) == 0) return -1;
+    type = (buf[0]&0xC0)>>6;
+    if (type == RDB_ENCVAL) {
+        if (isencoded) *isencoded = 1;
+        *lenptr = buf[0]&0x3F;
+    } else if (type == RDB_6BITLEN) {
+        *lenptr = buf[0]&0x3F;
+    } else if (type == RDB_14BITLEN) {
+        if (rioRead(rdb,buf+1,1) == 0) return -1;
+        *lenptr = ((buf[0]&0x3F)<<8)|buf[1];
+        buflen = 2;
+    } else if (buf[0] == RDB_32BITLEN) {
+        uint32_t len;
+        if (rioRead(rdb,buf+1,4) == 0) return -1;
+        memcpy(&len,buf+1,4);
+        *lenptr = ntohl(len);
+        buflen = 5;
+    } else if (buf[0] == RDB_64BITLEN) {
+        uint64_t len;
+        if (rioRead(rdb,buf+1,8) == 0) return -1;
+        memcpy(&len,buf+1,8);
+        *lenptr = ntohu64(len);
+        buflen = 9;
+    } else {
+        rdbExitReportCorruptRDB(
+            "Unknown length encoding %d in rdbLoadCopyLen()",type);
+        return -1; /* Never reached. */
+    }
+    b->buf = sdscatlen(b->buf,buf,buflen);
+    return 0;
+}
+
+/* Append to the batch a string serialized as rdbGenericLoadStringObject()
+ * expects it, without decoding it. */
+static int rdbLoadCopyString(rio *rdb, rdbLoadBatch *b) {
+    int isencoded;
+    uint64_t len, clen;
+
+    if (rdbLoadCopyLen(rdb,b,&isencoded,&len) == -1) return -1;
+    if (isencoded) {
+        switch(len) {
+        case RDB_ENC_INT8: return rdbLoadCopy(rdb,b,1);
+        case RDB_ENC_INT16: return rdbLoadCopy(rdb,b,2);
+        case RDB_ENC_INT32: return rdbLoadCopy(rdb,b,4);
+        case RDB_ENC_LZF:
+            if (rdbLoadCopyLen(rdb,b,NULL,&clen) == -1) return -1;
+            if (rdbLoadCopyLen(rdb,b,NULL,&len) == -1) return -1;
+            return rdbLoadCopy(rdb,b,clen);
+        default:
+            rdbExitReportCorruptRDB("Unknown RDB string encoding type %d",len);
+        }
+    }
+    return rdbLoadCopy(rdb,b,len);
+}
+
+/* Append to the batch a value of the specified type, serialized as
+ * rdbLoadObject() expects it. Module values are not supported. */
+static int rdbLoadCopyObject(int rdbtype, rio *rdb, rdbLoadBatch *b) {
+    uint64_t len, clen;
+    int fields = 1;
+    unsigned char dlen;
+
+    switch(rdbtype) {
+    case RDB_TYPE_STRING:
+    case RDB_TYPE_STRING_BITMAP:
+    case RDB_TYPE_HASH_ZIPMAP:
+    case RDB_TYPE_LIST_ZIPLIST:
+    case RDB_TYPE_SET_INTSET:
+    case RDB_TYPE_ZSET_ZIPLIST:
+    case RDB_TYPE_HASH_ZIPLIST:
+    case RDB_TYPE_HASH_LISTPACK:
+    case RDB_TYPE_ZSET_LISTPACK:
+        return rdbLoadCopyString(rdb,b);
+    case RDB_TYPE_LIST:
+    case RDB_TYPE_SET:
+    case RDB_TYPE_ZSET:
+    case RDB_TYPE_ZSET_2:
+    case RDB_TYPE_LIST_QUICKLIST:
+    case RDB_TYPE_LIST_QUICKLIST_2:
+        break;
+    case RDB_TYPE_HASH:
+        fields = 2;
+        break;
+    default:
+        rdbExitReportCorruptRDB("Unknown RDB encoding type %d",rdbtype);
+    }
+
+    if (rdbLoadCopyLen(rdb,b,NULL,&len) == -1) return -1;
+    while(len--) {
+        /* The container of the quicklist node. */
+        if (rdbtype == RDB_TYPE_LIST_QUICKLIST_2 &&
+            rdbLoadCopyLen(rdb,b,NULL,&clen) == -1) return -1;
+        if (rdbLoadCopyString(rdb,b) == -1) return -1;
+        if (fields == 2 && rdbLoadCopyString(rdb,b) == -1) return -1;
+        if (rdbtype == RDB_TYPE_ZSET_2) {
+            if (rdbLoadCopy(rdb,b,sizeof(double)) == -1) return -1;
+        } else if (rdbtype == RDB_TYPE_ZSET) {
+            /* See rdbLoadDoubleValue(). */
+            if (rioRead(rdb,&dlen,1) == 0) return -1;
+            b->buf = sdscatlen(b->buf,&dlen,1);
+            if (dlen < 253 && rdbLoadCopy(rdb,b,dlen) == -1) return -1;
+        }
+    }
+    return 0;
+}
+
+/* Append a job to the batch. */
+static rdbLoadJob *rdbLoadBatchAddJob(rdbLoadBatch *b) {
+    if (b->count == b->size) {
+        b->size = b->size ? b->size*2 : RDB_LOAD_BATCH_KEYS;
+        b->jobs = zrealloc(b->jobs,sizeof(rdbLoadJob)*b->size);
+    }
+    return b->jobs+b->count++;
+}
+
+/* Parse the keys of a chunk, starting where the parsing stopped. Threads
+ * other than the main thread stop at the first module value, leaving the
+ * rest of the chunk to the main thread. */
+static void rdbLoadDecodeChunk(rdbLoadBatch *b, rio *r, int mainthread) {
+    if (b->pos == 0 && !rdbVerifyChunk(b->buf,b->crc)) {
+        b->error = "Chunk CRC error";
+        return;
+    }
+    if (b->compressed) {
+        if (rdbDecompressChunk(&b->buf) == -1) {
+            b->error = "Invalid zstd compressed chunk";
+            return;
+        }
+        b->compressed = 0;
+        rioInitWithBuffer(r,b->buf);
+    }
+    r->io.buffer.pos = b->pos;
+    while(b->keys) {
+        long long expiretime = -1;
+        rdbLoadJob *job;
+        robj *key, *val;
+        int type;
+
+        b->pos = r->io.buffer.pos;
+        if ((type = rdbLoadType(r)) == -1) goto eoferr;
+        if (type == RDB_OPCODE_EXPIRETIME_MS) {
+            if ((expiretime = rdbLoadMillisecondTime(r)) == -1) goto eoferr;
+            if ((type = rdbLoadType(r)) == -1) goto eoferr;
+        }
+        if (!rdbIsObjectType(type)) {
+            b->error = "Invalid object type in chunk";
+            return;
+        }
+        if (!mainthread && (type == RDB_TYPE_MODULE || type == RDB_TYPE_MODULE_2))
+            return;
+        if ((key = rdbLoadStringObject(r)) == NULL) goto eoferr;
+        if ((val = rdbLoadObject(type,r)) == NULL) {
+            decrRefCount(key);
+            goto eoferr;
+        }
+        b->keys--;
+        if (b->now != -1 && expiretime != -1 && expiretime < b->now) {
+            decrRefCount(key);
+            decrRefCount(val);
+            continue;
+        }
+        job = rdbLoadBatchAddJob(b);
+        job->db = b->db;
+        job->key = key;
+        job->val = val;
+        job->type = type;
+        job->expiretime = expiretime;
+    }
+    b->pos = r->io.buffer.pos;
+    if (b->pos != sdslen(b->buf))
+        b->error = "Chunk payload longer than its keys";
+    return;
+
+eoferr:
+    b->error = "Short read parsing a chunk";
+}
+
+/* Decode a batch: called by the threads of the work queue, and by the main
+ * thread for the rest of the chunks holding module values. */
+static void rdbLoadDecode(rdbLoadBatch *b, int mainthread) {
+    long long start = ustime();
+    rio r;
+    int j;
+
+    rioInitWithBuffer(&r,b->buf);
+    if (b->chunk) {
+        rdbLoadDecodeChunk(b,&r,mainthread);
+    } else {
+        for (j = 0; j < b->count; j++) {
+            rdbLoadJob *job = b->jobs+j;
+
+            if (job->val) continue;
+            r.io.buffer.pos = job->offset;
+            job->val = rdbLoadObject(job->type,&r);
+        }
+    }
+    b->decode_usec += ustime()-start;
+}
+
+static void rdbLoadDecodeBatch(void *job) {
+    rdbLoadDecode(job,0);
+}
+
+static void rdbLoadBatchFree(void *job) {
+    rdbLoadBatch *b = job;
+    int j;
+
+    /* Keys not added to the DB, if the loading was interrupted. */
+    for (j = 0; j < b->count; j++) {
+        decrRefCount(b->jobs[j].key);
+        if (b->jobs[j].val) decrRefCount(b->jobs[j].val);
+    }
+    zfree(b->jobs);
+    sdsfree(b->buf);
+    zfree(b);
+}
+
+/* Create a loader with 'numthreads' threads, including the main thread. */
+static rdbLoader *rdbLoaderCreate(int numthreads) {
+    rdbLoader *l = zcalloc(sizeof(*l));
+    int j;
+
+    l->queue = rdbWorkQueueCreate(numthreads,rdbLoadDecodeBatch);
+    for (j = 0; j < l->queue->numjobs; j++) {
+        rdbLoadBatch *b = zcalloc(sizeof(*b));
+
+        b->buf = sdsempty();
+        l->queue->jobs[j] = b;
+    }
+    l->start_usec = ustime();
+    return l;
+}
+
+/* Add the keys of a decoded batch to the DB, then reset the batch. Returns
+ * C_ERR if a value could not be decoded. */
+static int rdbLoaderInsertBatch(rdbLoader *l, rdbLoadBatch *b) {
+    long long start;
+    int j;
+
+    while(1) {
+        if (b->error) rdbExitReportCorruptRDB("%s",b->error);
+
+        start = ustime();
+        for (j = 0; j < b->count; j++) {
+            rdbLoadJob *job = b->jobs+j;
+
+            if (job->val == NULL) return C_ERR;
+            dbAdd(job->db,job->key,job->val);
+            if (job->expiretime != -1)
+                setExpire(NULL,job->db,job->key,job->expiretime);
+            decrRefCount(job->key);
+        }
+        l->insert_usec += ustime()-start;
+        l->keys += b->count;
+        b->count = 0;
+
+        /* The thread stopped at a module value: parse the rest here. */
+        if (!b->chunk || b->keys == 0) break;
+        rdbLoadDecode(b,1);
+    }
+    l->decode_usec += b->decode_usec;
+
+    sdsclear(b->buf);
+    b->chunk = 0;
+    b->compressed = 0;
+    b->keys = 0;
+    b->pos = 0;
+    b->decode_usec = 0;
+    return C_OK;
+}
+
+/* Add to the DB the batches already decoded, in file order. If 'all' is
+ * true wait for all the queued batches, otherwise only wait for the oldest
+ * one if no batch is free. */
+static int rdbLoaderInsertBatches(rdbLoader *l, int all) {
+    rdbWorkQueue *q = l->queue;
+    rdbLoadBatch *b;
+
+    while((b = rdbWorkQueueReady(q,all || rdbWorkQueueFull(q))) != NULL) {
+        int retval = rdbLoaderInsertBatch(l,b);
+
+        rdbWorkQueuePop(q);
+        if (retval == C_ERR) return C_ERR;
+    }
+    return C_OK;
+}
+
+/* Queue the batch being filled. */
+static int rdbLoaderQueueBatch(rdbLoader *l) {
+    rdbWorkQueuePush(l->queue);
+    return rdbLoaderInsertBatches(l,0);
+}
+
+/* Read the value of 'key' from 'rdb' into the batch being filled. The key
+ * is discarded if 'expired' is true. */
+static int rdbLoaderAddKey(rdbLoader *l, rio *rdb, redisDb *db, int type,
+                           robj *key, long long expiretime, int expired)
+{
+    rdbLoadBatch *b = rdbWorkQueueTail(l->queue);
+    size_t offset = sdslen(b->buf);
+    rdbLoadJob *job;
+    robj *val = NULL;
+
+    if (type == RDB_TYPE_MODULE || type == RDB_TYPE_MODULE_2) {
+        if ((val = rdbLoadObject(type,rdb)) == NULL) return C_ERR;
+    } else {
+        if (rdbLoadCopyObject(type,rdb,b) == -1) return C_ERR;
+    }
+    if (expired) {
+        sdssetlen(b->buf,offset);
+        decrRefCount(key);
+        if (val) decrRefCount(val);
+        return C_OK;
+    }
+
+    job = rdbLoadBatchAddJob(b);
+    job->db = db;
+    job->key = key;
+    job->val = val;
+    job->type = type;
+    job->expiretime = expiretime;
+    job->offset = offset;
+    if (b->count == RDB_LOAD_BATCH_KEYS || sdslen(b->buf) >= RDB_LOAD_BATCH_BYTES)
+        return rdbLoaderQueueBatch(l);
+    return C_OK;
+}
+
+/* Read a chunk, after its opcode, and queue it as a batch. The chunk is
+ * described in 'ci' on return, and its keys are added to the DB of 'dbarray'
+ * it belongs to. Expired keys are skipped unless 'now' is -1. */
+static int rdbLoaderAddChunk(rdbLoader *l, rio *rdb, redisDb *dbarray,
+                             rdbChunkInfo *ci, int compressed, long long now)
+{
+    rdbLoadBatch *b = rdbWorkQueueTail(l->queue);
+
+    /* The keys read before the chunk must be added to the DB first. */
+    if (b->count) {
+        if (rdbLoaderQueueBatch(l) == C_ERR) return C_ERR;
+        b = rdbWorkQueueTail(l->queue);
+    }
+    if (rdbLoadChunk(rdb,ci,&b->buf,&b->crc) == -1) return C_ERR;
+    if (ci->dbid >= (unsigned)server.dbnum) {
+        serverLog(LL_WARNING,
+            "FATAL: Data file was created with a Redis "
+            "server configured to handle more than %d "
+            "databases. Exiting\n", server.dbnum);
+        exit(1);
+    }
+    b->chunk = 1;
+    b->compressed = compressed;
+    b->db = dbarray+ci->dbid;
+    b->keys = ci->keys;
+    b->now = now;
+    b->error = NULL;
+    return rdbLoaderQueueBatch(l);
+}
+
+/* Add the remaining keys to the DB, and log the throughput of the loading
+ * phases. Returns C_ERR if a value could not be decoded. */
+static int rdbLoaderFinish(rdbLoader *l, rio *rdb) {
+    rdbWorkQueue *q = l->queue;
+    rdbLoadBatch *b = rdbWorkQueueTail(q);
+    long long elapsed, read_usec;
+
+    if (b->count && rdbLoaderQueueBatch(l) == C_ERR) return C_ERR;
+    if (rdbLoaderInsertBatches(l,1) == C_ERR) return C_ERR;
+
+    elapsed = ustime()-l->start_usec;
+    read_usec = elapsed-l->insert_usec-q->wait_usec;
+    serverLog(LL_NOTICE,
+        "RDB loaded by %d thread%s: %lld keys, %.2f MB in %.3f seconds. "
+        "Read %.2f MB/s, decoded %.0f keys/s per thread, "
+        "added %.0f keys/s to the DB, waited %.3f seconds for the threads.",
+        q->numthreads, q->numthreads == 1 ? "" : "s",
+        l->keys, (double)rdb->processed_bytes/(1024*1024),
+        (double)elapsed/1000000,
+        read_usec > 0 ? (double)rdb->processed_bytes*1000000/(1024*1024)/read_usec : 0,
+        l->decode_usec ? (double)l->keys*1000000/l->decode_usec : 0,
+        l->insert_usec ? (double)l->keys*1000000/l->insert_usec : 0,
+        (double)q->wait_usec/1000000);
+    return C_OK;
+}
+
+/* Stop the threads and release a loader, after rdbLoaderFinish(). */
+static void rdbLoaderRelease(rdbLoader *l) {
+    rdbWorkQueueRelease(l->queue,rdbLoadBatchFree);
+    zfree(l);
+}
+
 /* Load an RDB file from the rio stream 'rdb'. On success C_OK is returned,
  * otherwise C_ERR is returned and 'errno' is set accordingly. */
 int rdbLoadRio(rio *rdb, rdbSaveInfo *rsi) {
+    return rdbLoadRioWithDbs(rdb,rsi,server.db);
+}
+
+/* Like rdbLoadRio() but the keys are added to the 'dbarray' DBs, that may
+ * not be the ones of the server, see replication.c. A truncated or corrupted
+ * file is a fatal error, however if the backend of 'rdb' fails (for instance
+ * the connection with the master is lost), C_ERR is returned and the keys
+ * loaded so far are left in the DBs. */
+int rdbLoadRioWithDbs(rio *rdb, rdbSaveInfo *rsi, redisDb *dbarray) {
     uint64_t dbid;
     int type, rdbver;
-    redisDb *db = server.db+0;
+    redisDb *db = dbarray+0;
     char buf[1024];
     long long expiretime, now = mstime();
+    rdbLoader *loader = NULL;
+    rdbChunkIndex idx = {NULL,0,0};
+    size_t base = rdb->processed_bytes;
 
     rdb->update_cksum = rdbLoadProgressCallback;
     rdb->max_processing_chunk = server.loading_process_events_interval_bytes;
@@ -1507,11 +3076,13 @@ int rdbLoadRio(rio *rdb, rdbSaveInfo *rsi) {
         return C_ERR;
     }
     rdbver = atoi(buf+5);
-    if (rdbver < 1 || rdbver > RDB_VERSION) {
+    if (rdbver < 1 || rdbver > RDB_VERSION_CHUNKED) {
         serverLog(LL_WARNING,"Can't handle RDB format version %d",rdbver);
         errno = EINVAL;
         return C_ERR;
     }
+    if (server.rdb_load_threads > 1)
+        loader = rdbLoaderCreate(server.rdb_load_threads);
 
     while(1) {
         robj *key, *val;
@@ -1540,6 +3111,28 @@ int rdbLoadRio(rio *rdb, rdbSaveInfo *rsi) {
         } else if (type == RDB_OPCODE_EOF) {
             /* EOF: End of file, exit the main loop. */
             break;
+        } else if (type == RDB_OPCODE_CHUNK ||
+                   type == RDB_OPCODE_CHUNK_ZSTD)
+        {
+            /* CHUNK: keys of a DB that can be parsed on their own, always
+             * handed to the loader, even if it has a single thread. */
+            rdbChunkInfo ci;
+            if (!loader) loader = rdbLoaderCreate(server.rdb_load_threads);
+            if (rdbLoaderAddChunk(loader,rdb,dbarray,&ci,
+                    type == RDB_OPCODE_CHUNK_ZSTD,
+                    server.masterhost == NULL ? now : -1) == C_ERR)
+                goto eoferr;
+            ci.offset -= base;
+            rdbChunkIndexAdd(&idx,&ci);
+            continue; /* Read type again. */
+        } else if (type == RDB_OPCODE_CHUNK_INDEX) {
+            /* CHUNK_INDEX: offsets of the chunks, that must match the
+             * chunks we just loaded. */
+            int retval = rdbLoadChunkIndex(rdb,&idx);
+            if (retval == -1) goto eoferr;
+            if (retval == 0)
+                rdbExitReportCorruptRDB("The chunk index doesn't match the chunks");
+            continue; /* Read type again. */
         } else if (type == RDB_OPCODE_SELECTDB) {
             /* SELECTDB: Select the specified database. */
             if ((dbid = rdbLoadLen(rdb,NULL)) == RDB_LENERR)
@@ -1551,7 +3144,7 @@ int rdbLoadRio(rio *rdb, rdbSaveInfo *rsi) {
                     "databases. Exiting\n", server.dbnum);
                 exit(1);
             }
-            db = server.db+dbid;
+            db = dbarray+dbid;
             continue; /* Read type again. */
         } else if (type == RDB_OPCODE_RESIZEDB) {
             /* RESIZEDB: Hint about the size of the keys in the currently
@@ -1561,8 +3154,8 @@ int rdbLoadRio(rio *rdb, rdbSaveInfo *rsi) {
                 goto eoferr;
             if ((expires_size = rdbLoadLen(rdb,NULL)) == RDB_LENERR)
                 goto eoferr;
-            dictExpand(db->dict,db_size);
-            dictExpand(db->expires,expires_size);
+            hashtableExpand(db->dict,db_size);
+            hashtableExpand(db->expires,expires_size);
             continue; /* Read type again. */
         } else if (type == RDB_OPCODE_AUX) {
             /* AUX: generic string-string fields. Use to add state to RDB
@@ -1604,6 +3197,13 @@ int rdbLoadRio(rio *rdb, rdbSaveInfo *rsi) {
 
         /* Read key */
         if ((key = rdbLoadStringObject(rdb)) == NULL) goto eoferr;
+        if (loader) {
+            int expired = server.masterhost == NULL && expiretime != -1 &&
+                          expiretime < now;
+            if (rdbLoaderAddKey(loader,rdb,db,type,key,expiretime,expired)
+                == C_ERR) goto eoferr;
+            continue;
+        }
         /* Read value */
         if ((val = rdbLoadObject(type,rdb)) == NULL) goto eoferr;
         /* Check if the key already expired. This function is used when loading
@@ -1624,6 +3224,11 @@ int rdbLoadRio(rio *rdb, rdbSaveInfo *rsi) {
 
         decrRefCount(key);
     }
+    if (loader) {
+        if (rdbLoaderFinish(loader,rdb) == C_ERR) goto eoferr;
+        rdbLoaderRelease(loader);
+    }
+    rdbChunkIndexFree(&idx);
     /* Verify the checksum if RDB version is >= 5 */
     if (rdbver >= 5 && server.rdb_checksum) {
         uint64_t cksum, expected = rdb->cksum;
@@ -1640,6 +3245,13 @@ int rdbLoadRio(rio *rdb, rdbSaveInfo *rsi) {
     return C_OK;
 
 eoferr: /* unexpected end of file is handled here with a fatal exit */
+    if (rdb->flags & RIO_FLAG_READ_ERROR) {
+        serverLog(LL_WARNING,"Error reading the RDB stream: %s",
+            strerror(errno));
+        if (loader) rdbLoaderRelease(loader);
+        rdbChunkIndexFree(&idx);
+        return C_ERR;
+    }
     serverLog(LL_WARNING,"Short read or OOM loading DB. Unrecoverable error, aborting now.");
     rdbExitReportCorruptRDB("Unexpected EOF reading RDB file");
     return C_ERR; /* Just to avoid warning */
@@ -1823,7 +3435,7 @@ int rdbSaveToSlavesSockets(rdbSaveInfo *rsi) {
     long long start;
     int pipefds[2];
 
-    if (server.aof_child_pid != -1 || server.rdb_child_pid != -1) return C_ERR;
+    if (server.aof_child_pid != -1 || rdbSaveInProgress()) return C_ERR;
 
     /* Before to fork, create a pipe that will be used in order to
      * send back to the parent the IDs of the slaves that successfully
@@ -1973,7 +3585,7 @@ int rdbSaveToSlavesSockets(rdbSaveInfo *rsi) {
 }
 
 void saveCommand(client *c) {
-    if (server.rdb_child_pid != -1) {
+    if (rdbSaveInProgress()) {
         addReplyError(c,"Background save already in progress");
         return;
     }
@@ -1999,7 +3611,7 @@ void bgsaveCommand(client *c) {
         }
     }
 
-    if (server.rdb_child_pid != -1) {
+    if (rdbSaveInProgress()) {
         addReplyError(c,"Background save already in progress");
     } else if (server.aof_child_pid != -1) {
         if (schedule) {
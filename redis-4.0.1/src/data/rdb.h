@@ -37,8 +37,16 @@
 #include "server.h"
 
 /* The current RDB version. When the format changes in a way that is no longer
- * backward compatible this number gets incremented. */
-#define RDB_VERSION 8
+ * backward compatible this number gets incremented. Version 10 stores small
+ * hashes, sorted sets and the nodes of lists as listpacks, version 11 adds
+ * compressed bitmaps. */
+#define RDB_VERSION 11
+
+/* Version of the RDB files written with rdb-chunked enabled, or with the zstd
+ * rdb-compression-codec, where the keys are stored in independent chunks
+ * followed by an index of the chunks. It is the highest version the loading
+ * code is able to handle. */
+#define RDB_VERSION_CHUNKED 12
 
 /* Defines related to the dump file format. To store 32 bits lengths for short
  * keys requires a lot of space, so we check the most significant 2 bits of
@@ -89,12 +97,19 @@
 #define RDB_TYPE_ZSET_ZIPLIST  12
 #define RDB_TYPE_HASH_ZIPLIST  13
 #define RDB_TYPE_LIST_QUICKLIST 14
+#define RDB_TYPE_HASH_LISTPACK 15
+#define RDB_TYPE_ZSET_LISTPACK 16
+#define RDB_TYPE_LIST_QUICKLIST_2 17 /* Every node is preceded by its container. */
+#define RDB_TYPE_STRING_BITMAP 18 /* String encoded as a compressed bitmap. */
 /* NOTE: WHEN ADDING NEW RDB TYPE, UPDATE rdbIsObjectType() BELOW */
 
 /* Test if a type is an object type. */
-#define rdbIsObjectType(t) ((t >= 0 && t <= 7) || (t >= 9 && t <= 14))
+#define rdbIsObjectType(t) ((t >= 0 && t <= 7) || (t >= 9 && t <= 18))
 
 /* Special RDB opcodes (saved/loaded with rdbSaveType/rdbLoadType). */
+#define RDB_OPCODE_CHUNK_ZSTD 247
+#define RDB_OPCODE_CHUNK_INDEX 248
+#define RDB_OPCODE_CHUNK      249
 #define RDB_OPCODE_AUX        250
 #define RDB_OPCODE_RESIZEDB   251
 #define RDB_OPCODE_EXPIRETIME_MS 252
@@ -119,6 +134,68 @@
 #define RDB_SAVE_NONE 0
 #define RDB_SAVE_AOF_PREAMBLE (1<<0)
 
+/* Target number of keys in every chunk of the chunked format. */
+#define RDB_CHUNK_KEYS 1024
+
+/* True if the chunks are compressed with zstd as a whole, instead of
+ * compressing every string with LZF. This implies the chunked format. */
+#define rdbUseZstd() (server.rdb_compression && \
+                      server.rdb_compression_codec == RDB_CODEC_ZSTD)
+#define rdbUseChunks() (server.rdb_chunked || rdbUseZstd())
+
+/* True if a BGSAVE is in progress, either in a child or in the snapshot
+ * thread: only one of them can run at a time. */
+#define rdbSaveInProgress() (server.rdb_child_pid != -1 || \
+                             server.rdb_snapshot != NULL)
+
+/* Must be called before modifying the key 'key' (an sds string) of 'db', or
+ * adding it, so that the snapshot thread saves the old version of the key,
+ * if a snapshot is in progress. See rdbSnapshotBeforeWrite(). */
+#define rdbSnapshotKeyWrite(db,key) do { \
+    if (server.rdb_snapshot) rdbSnapshotBeforeWrite(db,key); \
+} while(0)
+
+/* A chunk of the chunked format, as stored in the chunk index. */
+typedef struct rdbChunkInfo {
+    uint64_t offset;    /* Offset of the chunk opcode in the file. */
+    uint64_t dbid;      /* DB of the keys of the chunk. */
+    uint64_t keys;      /* Number of keys in the chunk. */
+} rdbChunkInfo;
+
+typedef struct rdbChunkIndex {
+    rdbChunkInfo *chunks;
+    uint64_t count, size;
+} rdbChunkIndex;
+
+/* Ordered work queues, see rdb.c. */
+#define RDB_JOB_FREE 0          /* Being filled by the main thread. */
+#define RDB_JOB_QUEUED 1        /* Waiting for a thread. */
+#define RDB_JOB_PROCESSING 2    /* Being processed. */
+#define RDB_JOB_DONE 3          /* Ready to be used by the main thread. */
+
+#define RDB_JOBS_PER_THREAD 4   /* Jobs in the ring for every thread. */
+
+typedef struct rdbWorkQueue {
+    pthread_t threads[RDB_THREADS_MAX];
+    int numthreads;             /* Threads, including the main thread. */
+    pthread_mutex_t mutex;      /* Protects the state of the jobs. */
+    pthread_cond_t queued_cond; /* Signaled when a job is queued. */
+    pthread_cond_t done_cond;   /* Signaled when a job is processed. */
+    void **jobs;                /* Ring of jobs, allocated by the caller. */
+    int *state;                 /* State of every job. */
+    int numjobs;
+    int head;                   /* Oldest job not yet used. */
+    int tail;                   /* Job being filled. */
+    int next;                   /* Next job to process. */
+    int pending;                /* Jobs queued and not yet used. */
+    int exiting;
+    void (*process)(void *job); /* Processes a job, called by any thread. */
+    long long wait_usec;        /* Time the main thread waited for jobs. */
+} rdbWorkQueue;
+
+#define rdbWorkQueueTail(q) ((q)->jobs[(q)->tail])
+#define rdbWorkQueueFull(q) ((q)->pending == (q)->numjobs)
+
 int rdbSaveType(rio *rdb, unsigned char type);
 int rdbLoadType(rio *rdb);
 int rdbSaveTime(rio *rdb, time_t t);
@@ -137,6 +214,9 @@ ssize_t rdbSaveObject(rio *rdb, robj *o);
 size_t rdbSavedObjectLen(robj *o);
 robj *rdbLoadObject(int type, rio *rdb);
 void backgroundSaveDoneHandler(int exitcode, int bysignal);
+void rdbSnapshotBeforeWrite(redisDb *db, sds key);
+void rdbSnapshotAbort(void);
+void rdbSnapshotCron(void);
 int rdbSaveKeyValuePair(rio *rdb, robj *key, robj *val, long long expiretime, long long now);
 robj *rdbLoadStringObject(rio *rdb);
 int rdbSaveStringObject(rio *rdb, robj *obj);
@@ -147,5 +227,18 @@ int rdbLoadBinaryDoubleValue(rio *rdb, double *val);
 int rdbSaveBinaryFloatValue(rio *rdb, float val);
 int rdbLoadBinaryFloatValue(rio *rdb, float *val);
 int rdbLoadRio(rio *rdb, rdbSaveInfo *rsi);
+int rdbLoadRioWithDbs(rio *rdb, rdbSaveInfo *rsi, redisDb *dbarray);
+int rdbLoadChunk(rio *rdb, rdbChunkInfo *ci, sds *payload, uint64_t *crc);
+int rdbVerifyChunk(sds payload, uint64_t crc);
+int rdbDecompressChunk(sds *payload);
+void rdbChunkIndexAdd(rdbChunkIndex *idx, rdbChunkInfo *ci);
+void rdbChunkIndexFree(rdbChunkIndex *idx);
+int rdbLoadChunkIndex(rio *rdb, rdbChunkIndex *idx);
+int rdbUseThreads(void);
+rdbWorkQueue *rdbWorkQueueCreate(int numthreads, void (*process)(void *job));
+void rdbWorkQueuePush(rdbWorkQueue *q);
+void *rdbWorkQueueReady(rdbWorkQueue *q, int block);
+void rdbWorkQueuePop(rdbWorkQueue *q);
+void rdbWorkQueueRelease(rdbWorkQueue *q, void (*freejob)(void *job));
 
 #endif
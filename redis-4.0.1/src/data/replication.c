@@ -36,6 +36,8 @@
 #include <fcntl.h>
 #include <sys/socket.h>
 #include <sys/stat.h>
+#define ZSTD_STATIC_LINKING_ONLY /* For ZSTD_createCCtx_advanced(). */
+#include <zstd.h>
 
 void replicationDiscardCachedMaster(void);
 void replicationResurrectCachedMaster(int newfd);
@@ -72,13 +74,543 @@ char *replicationGetSlaveName(client *c) {
     return buf;
 }
 
+/* --------------------------- Compressed stream ---------------------------- */
+
+/* With repl-compression enabled the master sends the replication stream
+ * compressed to the slaves asking for it with REPLCONF compress, and keeps
+ * the replication backlog compressed as well.
+ *
+ * The stream is a sequence of frames, every frame made of a one byte type,
+ * the 32 bit little endian length of the payload, and the payload. The
+ * payloads are the output of a single zstd stream: the stream for the slaves
+ * is accumulated during an event loop iteration, and compressed and flushed
+ * before returning to the event loop, so that every frame can be decoded as
+ * soon as it is received, while zstd still finds the redundancy across the
+ * frames. Since a slave attaching to the stream can't decode data referring
+ * to what was sent before, the zstd frame is ended every time a slave
+ * starts to receive the stream.
+ *
+ * The backlog is a buffer of uncompressed data, that is compressed in a
+ * block on its own when it is full. Blocks are independent zstd frames, so
+ * on partial resynchronization they are sent as they are to the slaves
+ * receiving the compressed stream, and only the first one, containing the
+ * offset requested by the slave, is decompressed and compressed again. */
+
+#define REPL_FRAME_ZSTD 'Z'
+#define REPL_FRAME_HDR_LEN 5
+#define REPL_ZSTD_LEVEL 1
+#define REPL_BACKLOG_BLOCK_SIZE (64*1024) /* Uncompressed size of a block. */
+#define REPL_STREAM_FLUSH_SIZE (64*1024)  /* Flush the stream before the end
+                                             of the event loop iteration
+                                             when it gets bigger. */
+
+typedef struct replBacklogBlock {
+    long long off;      /* Replication offset of the first byte. */
+    size_t len;         /* Uncompressed length. */
+    size_t zlen;        /* Length of the zstd frame. */
+    char data[];
+} replBacklogBlock;
+
+/* Decoding state of the compressed stream received from the master. */
+typedef struct replStreamDecoder {
+    ZSTD_DCtx *dctx;
+    sds buf;            /* Received frames not yet decoded. */
+} replStreamDecoder;
+
+static ZSTD_CCtx *replBlockCCtx = NULL;  /* Compresses the backlog blocks. */
+static ZSTD_DCtx *replBlockDCtx = NULL;  /* Decompresses the backlog blocks. */
+static ZSTD_CCtx *replStreamCCtx = NULL; /* Compresses the stream. */
+static sds replStreamPending = NULL;     /* Stream not yet compressed. */
+static int replStreamFrameOpen = 0;      /* The zstd frame was not ended. */
+
+static void *replZstdAlloc(void *opaque, size_t size) {
+    UNUSED(opaque);
+    return zmalloc(size);
+}
+
+static void replZstdFree(void *opaque, void *ptr) {
+    UNUSED(opaque);
+    zfree(ptr);
+}
+
+static ZSTD_customMem replZstdMem = {replZstdAlloc,replZstdFree,NULL};
+
+static ZSTD_CCtx *replCreateCCtx(void) {
+    ZSTD_CCtx *cctx = ZSTD_createCCtx_advanced(replZstdMem);
+    ZSTD_CCtx_setParameter(cctx,ZSTD_c_compressionLevel,REPL_ZSTD_LEVEL);
+    /* TCP already checks the integrity of the stream. */
+    ZSTD_CCtx_setParameter(cctx,ZSTD_c_checksumFlag,0);
+    return cctx;
+}
+
+/* Compress 'len' bytes at 'p' as a zstd frame on its own, appending it to
+ * 'dst'. */
+static sds replCompressBlock(sds dst, char *p, size_t len) {
+    size_t bound = ZSTD_compressBound(len), zlen;
+
+    if (replBlockCCtx == NULL) replBlockCCtx = replCreateCCtx();
+    dst = sdsMakeRoomFor(dst,bound);
+    zlen = ZSTD_compress2(replBlockCCtx,dst+sdslen(dst),bound,p,len);
+    serverAssert(!ZSTD_isError(zlen));
+    sdsIncrLen(dst,zlen);
+    return dst;
+}
+
+/* Return a frame header for a payload of 'len' bytes. */
+static sds replFrameHeader(size_t len) {
+    unsigned char hdr[REPL_FRAME_HDR_LEN];
+    uint32_t len32 = len;
+
+    hdr[0] = REPL_FRAME_ZSTD;
+    memrev32ifbe(&len32);
+    memcpy(hdr+1,&len32,sizeof(len32));
+    return sdsnewlen(hdr,sizeof(hdr));
+}
+
+/* Size of the uncompressed buffer of the backlog, that only holds the data
+ * not yet compressed in a block. */
+static long long replicationBacklogBufferSize(void) {
+    return (server.repl_backlog_size/2 < REPL_BACKLOG_BLOCK_SIZE) ?
+            server.repl_backlog_size/2 : REPL_BACKLOG_BLOCK_SIZE;
+}
+
+/* Compress the full buffer of the backlog in a new block, and evict the
+ * oldest blocks to stay within the configured backlog size. */
+static void replicationBacklogAddBlock(void) {
+    long long bufsize = replicationBacklogBufferSize();
+    long long off = server.repl_backlog_off + server.repl_backlog_histlen -
+                    server.repl_backlog_idx;
+    replBacklogBlock *b;
+    sds z;
+
+    z = replCompressBlock(sdsempty(),server.repl_backlog->buf,
+                          server.repl_backlog_idx);
+    b = zmalloc(sizeof(*b)+sdslen(z));
+    b->off = off;
+    b->len = server.repl_backlog_idx;
+    b->zlen = sdslen(z);
+    memcpy(b->data,z,sdslen(z));
+    sdsfree(z);
+    listAddNodeTail(server.repl_backlog_blocks,b);
+    server.repl_backlog_zlen += b->zlen;
+    server.repl_backlog_idx = 0;
+
+    while (server.repl_backlog_zlen + bufsize > server.repl_backlog_size) {
+        listNode *ln = listFirst(server.repl_backlog_blocks);
+        replBacklogBlock *first = ln->value;
+
+        server.repl_backlog_histlen -= first->len;
+        server.repl_backlog_zlen -= first->zlen;
+        listDelNode(server.repl_backlog_blocks,ln);
+    }
+    server.repl_backlog_off = off + b->len - server.repl_backlog_histlen;
+}
+
+/* Free the compressed blocks of the backlog, if any. */
+static void freeReplicationBacklogBlocks(void) {
+    if (server.repl_backlog_blocks) listRelease(server.repl_backlog_blocks);
+    server.repl_backlog_blocks = NULL;
+    server.repl_backlog_zlen = 0;
+}
+
+/* Add the backlog from 'offset' to the output buffer of 'c', as it is or in
+ * compressed frames, depending on how the slave receives the stream. */
+static long long addReplyCompressedReplicationBacklog(client *c,
+                                                      long long offset)
+{
+    int compress = c->slave_capa & SLAVE_CAPA_COMPRESS;
+    long long tailoff, skip, sent = 0;
+    listNode *ln;
+    listIter li;
+
+    if (replBlockDCtx == NULL)
+        replBlockDCtx = ZSTD_createDCtx_advanced(replZstdMem);
+
+    listRewind(server.repl_backlog_blocks,&li);
+    while((ln = listNext(&li))) {
+        replBacklogBlock *b = ln->value;
+
+        if (b->off + (long long)b->len <= offset) continue;
+        if (compress && b->off >= offset) {
+            addReplySds(c,replFrameHeader(b->zlen));
+            addReplyString(c,b->data,b->zlen);
+        } else {
+            sds buf = sdsnewlen(NULL,b->len);
+            size_t retval;
+
+            retval = ZSTD_decompressDCtx(replBlockDCtx,buf,b->len,
+                                         b->data,b->zlen);
+            serverAssert(!ZSTD_isError(retval) && retval == b->len);
+            skip = (offset > b->off) ? offset - b->off : 0;
+            if (compress) {
+                sds z = replCompressBlock(sdsempty(),buf+skip,b->len-skip);
+                addReplySds(c,replFrameHeader(sdslen(z)));
+                addReplySds(c,z);
+            } else {
+                addReplyString(c,buf+skip,b->len-skip);
+            }
+            sdsfree(buf);
+        }
+        sent += b->len - ((offset > b->off) ? offset - b->off : 0);
+    }
+
+    /* Finally the data in the buffer, not yet compressed. */
+    tailoff = server.repl_backlog_off + server.repl_backlog_histlen -
+              server.repl_backlog_idx;
+    skip = (offset > tailoff) ? offset - tailoff : 0;
+    if (server.repl_backlog_idx - skip > 0) {
+        char *p = server.repl_backlog->buf + skip;
+        size_t len = server.repl_backlog_idx - skip;
+
+        if (compress) {
+            sds z = replCompressBlock(sdsempty(),p,len);
+            addReplySds(c,replFrameHeader(sdslen(z)));
+            addReplySds(c,z);
+        } else {
+            addReplyString(c,p,len);
+        }
+        sent += len;
+    }
+    return sent;
+}
+
+/* Add data to the replication backlog, and to the stream to send to the
+ * slaves receiving it compressed. */
+static void feedReplicationStream(void *ptr, size_t len) {
+    feedReplicationBacklog(ptr,len);
+    if (server.repl_compression && listLength(server.slaves)) {
+        if (replStreamPending == NULL) replStreamPending = sdsempty();
+        replStreamPending = sdscatlen(replStreamPending,ptr,len);
+    }
+}
+
+/* Compress the stream accumulated for the slaves receiving it compressed,
+ * and add it to their output buffers. If 'endframe' is true the zstd frame
+ * is ended, so that a slave starting to receive the stream after this call
+ * is able to decode it. */
+void replicationFlushCompressedStream(int endframe) {
+    ZSTD_EndDirective mode = endframe ? ZSTD_e_end : ZSTD_e_flush;
+    size_t pending = replStreamPending ? sdslen(replStreamPending) : 0;
+    size_t remaining;
+    ZSTD_inBuffer in;
+    int receivers = 0;
+    listNode *ln;
+    listIter li;
+    sds frame;
+
+    if (pending == 0 && !(endframe && replStreamFrameOpen)) return;
+
+    listRewind(server.slaves,&li);
+    while((ln = listNext(&li))) {
+        client *slave = ln->value;
+
+        if (slave->replstate != SLAVE_STATE_WAIT_BGSAVE_START &&
+            slave->slave_capa & SLAVE_CAPA_COMPRESS) receivers++;
+    }
+
+    if (receivers) {
+        if (replStreamCCtx == NULL) replStreamCCtx = replCreateCCtx();
+        in.src = replStreamPending;
+        in.size = pending;
+        in.pos = 0;
+        frame = sdsnewlen(NULL,REPL_FRAME_HDR_LEN);
+        do {
+            ZSTD_outBuffer out;
+
+            frame = sdsMakeRoomFor(frame,ZSTD_CStreamOutSize());
+            out.dst = frame+sdslen(frame);
+            out.size = sdsavail(frame);
+            out.pos = 0;
+            remaining = ZSTD_compressStream2(replStreamCCtx,&out,&in,mode);
+            serverAssert(!ZSTD_isError(remaining));
+            sdsIncrLen(frame,out.pos);
+        } while(remaining != 0);
+        replStreamFrameOpen = !endframe;
+
+        /* Now that we know the length we can fill the header. */
+        sds hdr = replFrameHeader(sdslen(frame)-REPL_FRAME_HDR_LEN);
+        memcpy(frame,hdr,REPL_FRAME_HDR_LEN);
+        sdsfree(hdr);
+
+        listRewind(server.slaves,&li);
+        while((ln = listNext(&li))) {
+            client *slave = ln->value;
+
+            if (slave->replstate != SLAVE_STATE_WAIT_BGSAVE_START &&
+                slave->slave_capa & SLAVE_CAPA_COMPRESS)
+                addReplyString(slave,frame,sdslen(frame));
+        }
+        server.stat_repl_stream_raw_bytes += pending;
+        server.stat_repl_stream_compressed_bytes += sdslen(frame);
+        sdsfree(frame);
+    } else if (replStreamFrameOpen) {
+        /* Nobody receives the stream: start from scratch the next time. */
+        ZSTD_CCtx_reset(replStreamCCtx,ZSTD_reset_session_only);
+        replStreamFrameOpen = 0;
+    }
+
+    /* Don't retain the memory used by a big command. */
+    if (replStreamPending && sdsalloc(replStreamPending) >
+                             REPL_STREAM_FLUSH_SIZE*2)
+    {
+        sdsfree(replStreamPending);
+        replStreamPending = NULL;
+    } else if (replStreamPending) {
+        sdsclear(replStreamPending);
+    }
+}
+
+/* Create the decoder for the compressed stream of the master 'c'. */
+static void replicationCreateStreamDecoder(client *c) {
+    replStreamDecoder *d = zmalloc(sizeof(*d));
+
+    d->dctx = ZSTD_createDCtx_advanced(replZstdMem);
+    d->buf = sdsempty();
+    c->repl_decoder = d;
+}
+
+void replicationFreeStreamDecoder(client *c) {
+    replStreamDecoder *d = c->repl_decoder;
+
+    if (d == NULL) return;
+    ZSTD_freeDCtx(d->dctx);
+    sdsfree(d->buf);
+    zfree(d);
+    c->repl_decoder = NULL;
+}
+
+/* Called with 'len' bytes received from the master 'c', that sends us the
+ * stream compressed: the complete frames are decoded at the end of the query
+ * buffer of the client, without updating its length, that is up to the
+ * caller. 'buf' may point to the free space of the query buffer.
+ *
+ * Returns the number of bytes of replication stream decoded, or -1 if the
+ * stream is corrupted. */
+long long replicationDecodeMasterStream(client *c, char *buf, size_t len) {
+    replStreamDecoder *d = c->repl_decoder;
+    size_t qblen = sdslen(c->querybuf), consumed = 0;
+    long long decoded = 0;
+
+    d->buf = sdscatlen(d->buf,buf,len);
+    while (sdslen(d->buf) - consumed >= REPL_FRAME_HDR_LEN) {
+        unsigned char *p = (unsigned char*)d->buf + consumed;
+        uint32_t flen;
+        ZSTD_inBuffer in;
+        ZSTD_outBuffer out;
+        size_t retval;
+
+        if (p[0] != REPL_FRAME_ZSTD) return -1;
+        memcpy(&flen,p+1,sizeof(flen));
+        memrev32ifbe(&flen);
+        if (sdslen(d->buf) - consumed - REPL_FRAME_HDR_LEN < flen) break;
+
+        /* Every frame was flushed by the master, so all the data it
+         * carries can be decoded right now. */
+        in.src = p+REPL_FRAME_HDR_LEN;
+        in.size = flen;
+        in.pos = 0;
+        do {
+            /* The length is updated while decoding since sdsMakeRoomFor()
+             * only preserves the bytes within the length. */
+            c->querybuf = sdsMakeRoomFor(c->querybuf,PROTO_IOBUF_LEN);
+            out.dst = c->querybuf+sdslen(c->querybuf);
+            out.size = sdsavail(c->querybuf);
+            out.pos = 0;
+            retval = ZSTD_decompressStream(d->dctx,&out,&in);
+            if (ZSTD_isError(retval)) {
+                sdssetlen(c->querybuf,qblen);
+                return -1;
+            }
+            sdsIncrLen(c->querybuf,out.pos);
+            decoded += out.pos;
+        } while(in.pos < in.size || out.pos == out.size);
+        consumed += REPL_FRAME_HDR_LEN+flen;
+    }
+    sdsrange(d->buf,consumed,-1);
+    sdssetlen(c->querybuf,qblen);
+    return decoded;
+}
+
+/* --------------------------- Replication buffer --------------------------- */
+
+/* Return true if the slave reads the stream from the replication buffer
+ * shared with the backlog, that is, without repl-compression, once the
+ * stream is produced for it. */
+static int slaveUsesReplicationBuffer(client *slave) {
+    return !server.repl_compression &&
+           slave->replstate != SLAVE_STATE_WAIT_BGSAVE_START;
+}
+
+/* Append data to the replication buffer. The slaves not yet referencing a
+ * block start reading it from the first byte appended. */
+static void feedReplicationBuffer(unsigned char *p, size_t len) {
+    long long offset = server.master_repl_offset - (long long)len + 1;
+    listNode *start_node = NULL, *ln;
+    size_t start_pos = 0;
+    int add_new_block = 0;
+    listIter li;
+
+    /* Schedule the slaves to write before appending the data, since
+     * prepareClientToWrite() only does it for clients that have nothing
+     * pending yet. */
+    listRewind(server.slaves,&li);
+    while((ln = listNext(&li))) {
+        client *slave = ln->value;
+        if (slaveUsesReplicationBuffer(slave)) prepareClientToWrite(slave);
+    }
+
+    while(len) {
+        replBufBlock *tail = NULL;
+        size_t thislen;
+
+        ln = listLast(server.repl_buffer_blocks);
+        if (ln) tail = ln->value;
+        if (tail == NULL || tail->used == tail->size) {
+            size_t size = (len > PROTO_REPLY_CHUNK_BYTES) ?
+                          len : PROTO_REPLY_CHUNK_BYTES;
+
+            tail = zmalloc(sizeof(*tail)+size);
+            tail->refcount = 0;
+            tail->repl_offset = offset;
+            tail->size = size;
+            tail->used = 0;
+            listAddNodeTail(server.repl_buffer_blocks,tail);
+            server.repl_buffer_mem += sizeof(*tail)+size;
+            ln = listLast(server.repl_buffer_blocks);
+            add_new_block = 1;
+        }
+        if (start_node == NULL) {
+            start_node = ln;
+            start_pos = tail->used;
+        }
+        thislen = tail->size - tail->used;
+        if (thislen > len) thislen = len;
+        memcpy(tail->buf+tail->used,p,thislen);
+        tail->used += thislen;
+        server.repl_backlog_histlen += thislen;
+        offset += thislen;
+        len -= thislen;
+        p += thislen;
+    }
+    if (start_node == NULL) return;
+
+    /* The backlog always references the first block. */
+    if (server.repl_backlog->ref_repl_buf_node == NULL) {
+        server.repl_backlog->ref_repl_buf_node = start_node;
+        ((replBufBlock*)start_node->value)->refcount++;
+    }
+
+    listRewind(server.slaves,&li);
+    while((ln = listNext(&li))) {
+        client *slave = ln->value;
+
+        if (!slaveUsesReplicationBuffer(slave)) continue;
+        if (slave->ref_repl_buf_node == NULL) {
+            slave->ref_repl_buf_node = start_node;
+            slave->ref_block_pos = start_pos;
+            ((replBufBlock*)start_node->value)->refcount++;
+        }
+        /* What the slave didn't send yet is its output buffer, check the
+         * limits once in a block. */
+        if (add_new_block) asyncCloseClientOnOutputBufferLimitReached(slave);
+    }
+    incrementalTrimReplicationBacklog(REPL_BUFFER_TRIM_BLOCKS_PER_CALL);
+}
+
+/* Release the oldest blocks of the replication buffer, up to 'max_blocks',
+ * while they are only referenced by the backlog and it would still hold
+ * repl-backlog-size bytes without them. A block referenced by a slave is
+ * never released, so the backlog may temporarily be bigger than configured.
+ * The last block is always kept, in order to append to it. */
+void incrementalTrimReplicationBacklog(size_t max_blocks) {
+    if (server.repl_backlog == NULL) return;
+
+    while(max_blocks-- && listLength(server.repl_buffer_blocks) > 1) {
+        listNode *first = listFirst(server.repl_buffer_blocks);
+        replBufBlock *fo = first->value, *next = first->next->value;
+
+        if (fo->refcount != 1) break;
+        if (server.repl_backlog_histlen - (long long)fo->used <
+            server.repl_backlog_size) break;
+
+        next->refcount++;
+        server.repl_backlog->ref_repl_buf_node = first->next;
+        server.repl_backlog_histlen -= fo->used;
+        server.repl_backlog_off += fo->used;
+        server.repl_buffer_mem -= sizeof(*fo)+fo->size;
+        listDelNode(server.repl_buffer_blocks,first);
+    }
+}
+
+/* Drop the reference of the slave 'c' to the replication buffer, if any. */
+void releaseReplicationBufferRef(client *c) {
+    if (c->ref_repl_buf_node == NULL) return;
+    ((replBufBlock*)c->ref_repl_buf_node->value)->refcount--;
+    c->ref_repl_buf_node = NULL;
+    c->ref_block_pos = 0;
+}
+
+/* Make the slave 'dst' read the replication buffer from the same position
+ * of the slave 'src'. */
+void copyReplicationBufferRef(client *dst, client *src) {
+    releaseReplicationBufferRef(dst);
+    if (src->ref_repl_buf_node == NULL) return;
+    dst->ref_repl_buf_node = src->ref_repl_buf_node;
+    dst->ref_block_pos = src->ref_block_pos;
+    ((replBufBlock*)dst->ref_repl_buf_node->value)->refcount++;
+}
+
+/* Return the amount of bytes of the replication buffer the slave 'c' has
+ * still to send. */
+size_t getSlaveReplicationBufferPending(client *c) {
+    replBufBlock *o;
+
+    if (c->ref_repl_buf_node == NULL) return 0;
+    o = c->ref_repl_buf_node->value;
+    return server.master_repl_offset + 1 - (o->repl_offset+c->ref_block_pos);
+}
+
+/* Make the slave 'c' send the replication buffer starting from 'offset',
+ * that must be inside the backlog. No data is copied. Returns the amount of
+ * bytes the slave will send. */
+static long long addReplyReplicationBufferBacklog(client *c, long long offset) {
+    long long skip = offset - server.repl_backlog_off;
+    replBufBlock *o = NULL;
+    listNode *ln;
+    listIter li;
+
+    serverLog(LL_DEBUG, "[PSYNC] Skipping: %lld", skip);
+    listRewind(server.repl_buffer_blocks,&li);
+    while((ln = listNext(&li))) {
+        o = ln->value;
+        if (offset < o->repl_offset + (long long)o->used) break;
+    }
+    /* The slave already has all the backlog: it will start with the next
+     * data appended. */
+    if (ln == NULL) return 0;
+
+    prepareClientToWrite(c);
+    releaseReplicationBufferRef(c);
+    c->ref_repl_buf_node = ln;
+    c->ref_block_pos = offset - o->repl_offset;
+    o->refcount++;
+    return server.repl_backlog_histlen - skip;
+}
+
 /* ---------------------------------- MASTER -------------------------------- */
 
 void createReplicationBacklog(void) {
     serverAssert(server.repl_backlog == NULL);
-    server.repl_backlog = zmalloc(server.repl_backlog_size);
+    server.repl_backlog = zmalloc(sizeof(replBacklog));
+    server.repl_backlog->ref_repl_buf_node = NULL;
+    server.repl_backlog->buf = NULL;
     server.repl_backlog_histlen = 0;
     server.repl_backlog_idx = 0;
+    if (server.repl_compression) {
+        server.repl_backlog->buf = zmalloc(replicationBacklogBufferSize());
+        server.repl_backlog_blocks = listCreate();
+        listSetFreeMethod(server.repl_backlog_blocks,zfree);
+    }
 
     /* We don't have any data inside our buffer, but virtually the first
      * byte we have is the next byte that will be generated for the
@@ -88,35 +620,47 @@ void createReplicationBacklog(void) {
 
 /* This function is called when the user modifies the replication backlog
  * size at runtime. It is up to the function to both update the
- * server.repl_backlog_size and to resize the buffer and setup it so that
- * it contains the same data as the previous one (possibly less data, but
- * the most recent bytes, or the same data and more free space in case the
- * buffer is enlarged). */
+ * server.repl_backlog_size and to resize the backlog so that it contains
+ * the same data as the previous one (possibly less data, but the most recent
+ * bytes). */
 void resizeReplicationBacklog(long long newsize) {
     if (newsize < CONFIG_REPL_BACKLOG_MIN_SIZE)
         newsize = CONFIG_REPL_BACKLOG_MIN_SIZE;
     if (server.repl_backlog_size == newsize) return;
 
     server.repl_backlog_size = newsize;
-    if (server.repl_backlog != NULL) {
-        /* What we actually do is to flush the old buffer and realloc a new
-         * empty one. It will refill with new data incrementally.
-         * The reason is that copying a few gigabytes adds latency and even
-         * worse often we need to alloc additional space before freeing the
-         * old buffer. */
-        zfree(server.repl_backlog);
-        server.repl_backlog = zmalloc(server.repl_backlog_size);
-        server.repl_backlog_histlen = 0;
-        server.repl_backlog_idx = 0;
-        /* Next byte we have is... the next since the buffer is empty. */
-        server.repl_backlog_off = server.master_repl_offset+1;
+    if (server.repl_backlog == NULL) return;
+
+    /* The replication buffer just keeps more blocks, or releases the
+     * oldest ones. */
+    if (!server.repl_compression) {
+        incrementalTrimReplicationBacklog(SIZE_MAX);
+        return;
     }
+
+    /* With repl-compression what we actually do is to flush the old buffer
+     * and realloc a new empty one. It will refill with new data
+     * incrementally. */
+    zfree(server.repl_backlog->buf);
+    server.repl_backlog->buf = zmalloc(replicationBacklogBufferSize());
+    server.repl_backlog_histlen = 0;
+    server.repl_backlog_idx = 0;
+    listEmpty(server.repl_backlog_blocks);
+    server.repl_backlog_zlen = 0;
+    /* Next byte we have is... the next since the buffer is empty. */
+    server.repl_backlog_off = server.master_repl_offset+1;
 }
 
 void freeReplicationBacklog(void) {
     serverAssert(listLength(server.slaves) == 0);
+    if (server.repl_backlog == NULL) return;
+    /* Without slaves only the backlog references the replication buffer. */
+    listEmpty(server.repl_buffer_blocks);
+    server.repl_buffer_mem = 0;
+    zfree(server.repl_backlog->buf);
     zfree(server.repl_backlog);
     server.repl_backlog = NULL;
+    freeReplicationBacklogBlocks();
 }
 
 /* Add data to the replication backlog.
@@ -128,27 +672,34 @@ void feedReplicationBacklog(void *ptr, size_t len) {
 
     server.master_repl_offset += len;
 
-    /* This is a circular buffer, so write as much data we can at every
-     * iteration and rewind the "idx" index if we reach the limit. */
+    /* Without repl-compression the backlog is the replication buffer the
+     * slaves send the stream from. */
+    if (!server.repl_compression) {
+        feedReplicationBuffer(p,len);
+        return;
+    }
+
+    /* With repl-compression the buffer is compressed in a block every
+     * time it gets full. */
+    long long bufsize = replicationBacklogBufferSize();
+
     while(len) {
-        size_t thislen = server.repl_backlog_size - server.repl_backlog_idx;
+        size_t thislen = bufsize - server.repl_backlog_idx;
         if (thislen > len) thislen = len;
-        memcpy(server.repl_backlog+server.repl_backlog_idx,p,thislen);
+        memcpy(server.repl_backlog->buf+server.repl_backlog_idx,p,
+               thislen);
         server.repl_backlog_idx += thislen;
-        if (server.repl_backlog_idx == server.repl_backlog_size)
-            server.repl_backlog_idx = 0;
+        server.repl_backlog_histlen += thislen;
         len -= thislen;
         p += thislen;
-        server.repl_backlog_histlen += thislen;
+        if (server.repl_backlog_idx == bufsize)
+            replicationBacklogAddBlock();
     }
-    if (server.repl_backlog_histlen > server.repl_backlog_size)
-        server.repl_backlog_histlen = server.repl_backlog_size;
-    /* Set the offset of the first byte we have in the backlog. */
     server.repl_backlog_off = server.master_repl_offset -
                               server.repl_backlog_histlen + 1;
 }
 
-/* Wrapper for feedReplicationBacklog() that takes Redis string objects
+/* Wrapper for feedReplicationStream() that takes Redis string objects
  * as input. */
 void feedReplicationBacklogWithObject(robj *o) {
     char llstr[LONG_STR_SIZE];
@@ -162,7 +713,7 @@ void feedReplicationBacklogWithObject(robj *o) {
         len = sdslen(o->ptr);
         p = o->ptr;
     }
-    feedReplicationBacklog(p,len);
+    feedReplicationStream(p,len);
 }
 
 /* Propagate write commands to slaves, and populate the replication backlog
@@ -210,11 +761,13 @@ void replicationFeedSlaves(list *slaves, int dictid, robj **argv, int argc) {
         /* Add the SELECT command into the backlog. */
         if (server.repl_backlog) feedReplicationBacklogWithObject(selectcmd);
 
-        /* Send it to slaves. */
+        /* Send it to slaves, unless they read it from the replication
+         * buffer. */
         listRewind(slaves,&li);
-        while((ln = listNext(&li))) {
+        while(server.repl_compression && (ln = listNext(&li))) {
             client *slave = ln->value;
             if (slave->replstate == SLAVE_STATE_WAIT_BGSAVE_START) continue;
+            if (slave->slave_capa & SLAVE_CAPA_COMPRESS) continue;
             addReply(slave,selectcmd);
         }
 
@@ -232,7 +785,7 @@ void replicationFeedSlaves(list *slaves, int dictid, robj **argv, int argc) {
         len = ll2string(aux+1,sizeof(aux)-1,argc);
         aux[len+1] = '\r';
         aux[len+2] = '\n';
-        feedReplicationBacklog(aux,len+3);
+        feedReplicationStream(aux,len+3);
 
         for (j = 0; j < argc; j++) {
             long objlen = stringObjectLen(argv[j]);
@@ -244,20 +797,25 @@ void replicationFeedSlaves(list *slaves, int dictid, robj **argv, int argc) {
             len = ll2string(aux+1,sizeof(aux)-1,objlen);
             aux[len+1] = '\r';
             aux[len+2] = '\n';
-            feedReplicationBacklog(aux,len+3);
+            feedReplicationStream(aux,len+3);
             feedReplicationBacklogWithObject(argv[j]);
-            feedReplicationBacklog(aux+len+1,2);
+            feedReplicationStream(aux+len+1,2);
         }
     }
 
-    /* Write the command to every slave. */
+    /* Write the command to every slave. Without repl-compression they all
+     * send it from the replication buffer, fed above with the backlog. */
     listRewind(slaves,&li);
-    while((ln = listNext(&li))) {
+    while(server.repl_compression && (ln = listNext(&li))) {
         client *slave = ln->value;
 
         /* Don't feed slaves that are still waiting for BGSAVE to start */
         if (slave->replstate == SLAVE_STATE_WAIT_BGSAVE_START) continue;
 
+        /* Slaves receiving the stream compressed get it from
+         * replicationFlushCompressedStream(). */
+        if (slave->slave_capa & SLAVE_CAPA_COMPRESS) continue;
+
         /* Feed slaves that are waiting for the initial SYNC (so these commands
          * are queued in the output buffer until the initial SYNC completes),
          * or are already in sync with the master. */
@@ -270,6 +828,8 @@ void replicationFeedSlaves(list *slaves, int dictid, robj **argv, int argc) {
         for (j = 0; j < argc; j++)
             addReplyBulk(slave,argv[j]);
     }
+    if (replStreamPending && sdslen(replStreamPending) > REPL_STREAM_FLUSH_SIZE)
+        replicationFlushCompressedStream(0);
 }
 
 /* This function is used in order to proxy what we receive from our master
@@ -289,15 +849,18 @@ void replicationFeedSlavesFromMasterStream(list *slaves, char *buf, size_t bufle
         printf("\n");
     }
 
-    if (server.repl_backlog) feedReplicationBacklog(buf,buflen);
+    if (server.repl_backlog) feedReplicationStream(buf,buflen);
     listRewind(slaves,&li);
-    while((ln = listNext(&li))) {
+    while(server.repl_compression && (ln = listNext(&li))) {
         client *slave = ln->value;
 
         /* Don't feed slaves that are still waiting for BGSAVE to start */
         if (slave->replstate == SLAVE_STATE_WAIT_BGSAVE_START) continue;
+        if (slave->slave_capa & SLAVE_CAPA_COMPRESS) continue;
         addReplyString(slave,buf,buflen);
     }
+    if (replStreamPending && sdslen(replStreamPending) > REPL_STREAM_FLUSH_SIZE)
+        replicationFlushCompressedStream(0);
 }
 
 void replicationFeedMonitors(client *c, list *monitors, int dictid, robj **argv, int argc) {
@@ -342,8 +905,6 @@ void replicationFeedMonitors(client *c, list *monitors, int dictid, robj **argv,
 /* Feed the slave 'c' with the replication backlog starting from the
  * specified 'offset' up to the end of the backlog. */
 long long addReplyReplicationBacklog(client *c, long long offset) {
-    long long j, skip, len;
-
     serverLog(LL_DEBUG, "[PSYNC] Slave request offset: %lld", offset);
 
     if (server.repl_backlog_histlen == 0) {
@@ -357,38 +918,10 @@ long long addReplyReplicationBacklog(client *c, long long offset) {
              server.repl_backlog_off);
     serverLog(LL_DEBUG, "[PSYNC] History len: %lld",
              server.repl_backlog_histlen);
-    serverLog(LL_DEBUG, "[PSYNC] Current index: %lld",
-             server.repl_backlog_idx);
-
-    /* Compute the amount of bytes we need to discard. */
-    skip = offset - server.repl_backlog_off;
-    serverLog(LL_DEBUG, "[PSYNC] Skipping: %lld", skip);
-
-    /* Point j to the oldest byte, that is actually our
-     * server.repl_backlog_off byte. */
-    j = (server.repl_backlog_idx +
-        (server.repl_backlog_size-server.repl_backlog_histlen)) %
-        server.repl_backlog_size;
-    serverLog(LL_DEBUG, "[PSYNC] Index of first byte: %lld", j);
 
-    /* Discard the amount of data to seek to the specified 'offset'. */
-    j = (j + skip) % server.repl_backlog_size;
-
-    /* Feed slave with data. Since it is a circular buffer we have to
-     * split the reply in two parts if we are cross-boundary. */
-    len = server.repl_backlog_histlen - skip;
-    serverLog(LL_DEBUG, "[PSYNC] Reply total length: %lld", len);
-    while(len) {
-        long long thislen =
-            ((server.repl_backlog_size - j) < len) ?
-            (server.repl_backlog_size - j) : len;
-
-        serverLog(LL_DEBUG, "[PSYNC] addReply() length: %lld", thislen);
-        addReplySds(c,sdsnewlen(server.repl_backlog + j, thislen));
-        len -= thislen;
-        j = 0;
-    }
-    return server.repl_backlog_histlen - skip;
+    if (server.repl_compression)
+        return addReplyCompressedReplicationBacklog(c,offset);
+    return addReplyReplicationBufferBacklog(c,offset);
 }
 
 /* Return the offset to provide as reply to the PSYNC command received
@@ -419,6 +952,11 @@ int replicationSetupSlaveForFullResync(client *slave, long long offset) {
     char buf[128];
     int buflen;
 
+    /* The slave must not receive the stream that precedes its start,
+     * and must start to decode it from a new zstd frame. */
+    if (slave->slave_capa & SLAVE_CAPA_COMPRESS)
+        replicationFlushCompressedStream(1);
+
     slave->psync_initial_offset = offset;
     slave->replstate = SLAVE_STATE_WAIT_BGSAVE_END;
     /* We are going to accumulate the incremental changes for this
@@ -646,6 +1184,12 @@ void syncCommand(client *c) {
     serverLog(LL_NOTICE,"Slave %s asks for synchronization",
         replicationGetSlaveName(c));
 
+    /* Whatever way the slave starts to receive the compressed stream, it
+     * must start from a new zstd frame, after the stream accumulated so
+     * far for the other slaves. */
+    if (c->slave_capa & SLAVE_CAPA_COMPRESS)
+        replicationFlushCompressedStream(1);
+
     /* Try a partial resynchronization if this is a PSYNC command.
      * If it fails, we continue with usual full resynchronization, however
      * when this happens masterTryPartialResynchronization() already
@@ -698,7 +1242,7 @@ void syncCommand(client *c) {
     }
 
     /* CASE 1: BGSAVE is in progress, with disk target. */
-    if (server.rdb_child_pid != -1 &&
+    if (rdbSaveInProgress() &&
         server.rdb_child_type == RDB_CHILD_TYPE_DISK)
     {
         /* Ok a background save is in progress. Let's check if it is a good
@@ -714,8 +1258,12 @@ void syncCommand(client *c) {
             if (slave->replstate == SLAVE_STATE_WAIT_BGSAVE_END) break;
         }
         /* To attach this slave, we check that it has at least all the
-         * capabilities of the slave that triggered the current BGSAVE. */
-        if (ln && ((c->slave_capa & slave->slave_capa) == slave->slave_capa)) {
+         * capabilities of the slave that triggered the current BGSAVE,
+         * and that it receives the stream in the same way. */
+        if (ln && ((c->slave_capa & slave->slave_capa) == slave->slave_capa) &&
+            (c->slave_capa & SLAVE_CAPA_COMPRESS) ==
+            (slave->slave_capa & SLAVE_CAPA_COMPRESS))
+        {
             /* Perfect, the server is already registering differences for
              * another slave. Set the right state, and copy the buffer. */
             copyClientOutputBuffer(c,slave);
@@ -806,6 +1354,18 @@ void replconfCommand(client *c) {
                 c->slave_capa |= SLAVE_CAPA_EOF;
             else if (!strcasecmp(c->argv[j+1]->ptr,"psync2"))
                 c->slave_capa |= SLAVE_CAPA_PSYNC2;
+        } else if (!strcasecmp(c->argv[j]->ptr,"compress")) {
+            /* REPLCONF compress zstd is used by the slave to receive the
+             * stream compressed. It is refused if repl-compression is not
+             * enabled, so that the slave knows how the stream is sent. */
+            if (!server.repl_compression ||
+                strcasecmp(c->argv[j+1]->ptr,"zstd"))
+            {
+                addReplyError(c,"Replication stream compression is not "
+                                "enabled");
+                return;
+            }
+            c->slave_capa |= SLAVE_CAPA_COMPRESS;
         } else if (!strcasecmp(c->argv[j]->ptr,"ack")) {
             /* REPLCONF ACK is used by slave to inform the master the amount
              * of replication stream that it processed so far. It is an
@@ -1085,6 +1645,8 @@ void replicationCreateMasterClient(int fd, int dbid) {
      * PSYNC capable, so we flag it accordingly. */
     if (server.master->reploff == -1)
         server.master->flags |= CLIENT_PRE_PSYNC;
+    if (fd != -1 && server.master_compress)
+        replicationCreateStreamDecoder(server.master);
     if (dbid != -1) selectDb(server.master,dbid);
 }
 
@@ -1100,6 +1662,159 @@ void restartAOF() {
     }
 }
 
+/* Returns true if the RDB the master is about to send should be loaded
+ * directly from the socket, according to repl-diskless-load. The keys can't
+ * be loaded into other DBs in cluster mode, since the map of the keys of
+ * every slot refers to the keys of the server, so in cluster mode the RDB
+ * is only loaded from the socket if the dataset is empty. */
+static int useDisklessLoad(void) {
+    if (server.repl_diskless_load == REPL_DISKLESS_LOAD_SWAPDB &&
+        !server.cluster_enabled) return 1;
+    return server.repl_diskless_load != REPL_DISKLESS_LOAD_DISABLED &&
+           dbTotalServerKeyCount() == 0;
+}
+
+/* Final setup of the connected slave <- master link, once the RDB sent
+ * by the master was loaded. */
+static void replicationFinishFullSync(rdbSaveInfo *rsi, int aof_is_enabled) {
+    replicationCreateMasterClient(server.repl_transfer_s,rsi->repl_stream_db);
+    server.repl_state = REPL_STATE_CONNECTED;
+    /* After a full resynchroniziation we use the replication ID and
+     * offset of the master. The secondary ID / offset are cleared since
+     * we are starting a new history. */
+    memcpy(server.replid,server.master->replid,sizeof(server.replid));
+    server.master_repl_offset = server.master->reploff;
+    clearReplicationId2();
+    /* Let's create the replication backlog if needed. Slaves need to
+     * accumulate the backlog regardless of the fact they have sub-slaves
+     * or not, in order to behave correctly if they are promoted to
+     * masters after a failover. */
+    if (server.repl_backlog == NULL) createReplicationBacklog();
+
+    serverLog(LL_NOTICE, "MASTER <-> SLAVE sync: Finished with success");
+    /* Restart the AOF subsystem now that we finished the sync. This
+     * will trigger an AOF rewrite, and when done will start appending
+     * to the new file. */
+    if (aof_is_enabled) restartAOF();
+}
+
+/* Load the RDB sent by the master directly from the socket, without saving
+ * it to disk first. 'eofmark' is the delimiter announced by the master, or
+ * NULL if the size of the payload was announced instead.
+ *
+ * With repl-diskless-load swapdb the keys are loaded into temporary DBs,
+ * while the clients are still served the current dataset, that is only
+ * replaced when the whole RDB was loaded: if the transfer fails, the slave
+ * keeps the old dataset. Otherwise the dataset is flushed before loading,
+ * like when the RDB is saved to disk first. */
+static void readSyncBulkPayloadDiskless(int fd, char *eofmark) {
+    int aof_is_enabled = server.aof_state != AOF_OFF;
+    int async = server.repl_diskless_load == REPL_DISKLESS_LOAD_SWAPDB &&
+                !server.cluster_enabled;
+    int flags = server.repl_slave_lazy_flush ? EMPTYDB_ASYNC :
+                                               EMPTYDB_NO_FLAGS;
+    off_t size = eofmark ? 0 : server.repl_transfer_size;
+    redisDb *dbarray = server.db, *tempDb = NULL;
+    rdbSaveInfo rsi = RDB_SAVE_INFO_INIT;
+    rio rdb;
+    sds leftover;
+    int retval;
+
+    /* Delete the readable handler, otherwise it will get called recursively
+     * since the loading processes the events from time to time. */
+    aeDeleteFileEvent(server.el,fd,AE_READABLE);
+    if (async) {
+        tempDb = dbarray = initTempDb();
+    } else {
+        serverLog(LL_NOTICE, "MASTER <-> SLAVE sync: Flushing old data");
+        if (aof_is_enabled) stopAppendOnly();
+        signalFlushedDb(-1);
+        emptyDb(-1,flags,replicationEmptyDbCallback);
+    }
+    serverLog(LL_NOTICE, "MASTER <-> SLAVE sync: Loading DB in memory from "
+        "the socket%s", async ? ", serving the old data meanwhile" : "");
+
+    rioInitWithConn(&rdb,fd,size,server.repl_timeout*1000);
+    startLoadingStream(size,async);
+    retval = rdbLoadRioWithDbs(&rdb,&rsi,dbarray);
+    if (retval == C_OK) {
+        char buf[CONFIG_RUN_ID_SIZE];
+
+        /* Make sure the payload ends where the master said it would. */
+        if (eofmark) {
+            if (rioRead(&rdb,buf,CONFIG_RUN_ID_SIZE) == 0 ||
+                memcmp(buf,eofmark,CONFIG_RUN_ID_SIZE) != 0)
+            {
+                serverLog(LL_WARNING,"Replication stream EOF marker is broken");
+                retval = C_ERR;
+            }
+        } else if (rioTell(&rdb) != size) {
+            serverLog(LL_WARNING,"The RDB payload received from the master "
+                "is longer than the RDB it contains");
+            retval = C_ERR;
+        }
+    }
+    stopLoading();
+    server.stat_net_input_bytes += rdb.io.conn.read_so_far;
+    leftover = rioFreeConn(&rdb);
+
+    if (retval != C_OK) {
+        serverLog(LL_WARNING,"Failed trying to load the MASTER synchronization DB from the socket");
+        sdsfree(leftover);
+        if (async) {
+            discardTempDb(tempDb,flags);
+        } else {
+            emptyDb(-1,flags,replicationEmptyDbCallback);
+        }
+        cancelReplicationHandshake();
+        /* Re-enable the AOF if we disabled it earlier, in order to restore
+         * the original configuration. */
+        if (!async && aof_is_enabled) restartAOF();
+        return;
+    }
+
+    if (async) {
+        /* The AOF may have been switched while loading. */
+        aof_is_enabled = server.aof_state != AOF_OFF;
+        serverLog(LL_NOTICE, "MASTER <-> SLAVE sync: Swapping the old data "
+            "with the new one");
+        if (aof_is_enabled) stopAppendOnly();
+        signalFlushedDb(-1);
+        swapMainDbWithTempDb(tempDb);
+        discardTempDb(tempDb,flags);
+    }
+    replicationFinishFullSync(&rsi,aof_is_enabled);
+
+    /* What the master sent after the RDB is the replication stream: it is
+     * accounted exactly like if it was read by readQueryFromClient(), and
+     * processed now, since the master may not send anything else for a
+     * while. */
+    if (sdslen(leftover)) {
+        client *m = server.master;
+        size_t qblen = sdslen(m->querybuf);
+        long long nread = sdslen(leftover);
+
+        if (m->repl_decoder) {
+            nread = replicationDecodeMasterStream(m,leftover,nread);
+        } else {
+            m->querybuf = sdsMakeRoomFor(m->querybuf,nread);
+            memcpy(m->querybuf+qblen,leftover,nread);
+        }
+        if (nread == -1) {
+            serverLog(LL_WARNING,"Invalid compressed replication stream "
+                                 "received from the MASTER");
+            freeClientAsync(m);
+        } else {
+            m->pending_querybuf = sdscatlen(m->pending_querybuf,
+                                            m->querybuf+qblen,nread);
+            sdsIncrLen(m->querybuf,nread);
+            m->read_reploff += nread;
+            processMasterInputBuffer(m);
+        }
+    }
+    sdsfree(leftover);
+}
+
 /* Asynchronously read the SYNC payload we receive from a master */
 #define REPL_MAX_WRITTEN_BEFORE_FSYNC (1024*1024*8) /* 8 MB */
 void readSyncBulkPayload(aeEventLoop *el, int fd, void *privdata, int mask) {
@@ -1171,6 +1886,12 @@ void readSyncBulkPayload(aeEventLoop *el, int fd, void *privdata, int mask) {
         return;
     }
 
+    /* No temp file: load the RDB as it is read from the socket. */
+    if (server.repl_transfer_fd == -1) {
+        readSyncBulkPayloadDiskless(fd,usemark ? eofmark : NULL);
+        return;
+    }
+
     /* Read bulk data */
     if (usemark) {
         readlen = sizeof(buf);
@@ -1272,28 +1993,11 @@ void readSyncBulkPayload(aeEventLoop *el, int fd, void *privdata, int mask) {
             if (aof_is_enabled) restartAOF();
             return;
         }
-        /* Final setup of the connected slave <- master link */
         zfree(server.repl_transfer_tmpfile);
         close(server.repl_transfer_fd);
-        replicationCreateMasterClient(server.repl_transfer_s,rsi.repl_stream_db);
-        server.repl_state = REPL_STATE_CONNECTED;
-        /* After a full resynchroniziation we use the replication ID and
-         * offset of the master. The secondary ID / offset are cleared since
-         * we are starting a new history. */
-        memcpy(server.replid,server.master->replid,sizeof(server.replid));
-        server.master_repl_offset = server.master->reploff;
-        clearReplicationId2();
-        /* Let's create the replication backlog if needed. Slaves need to
-         * accumulate the backlog regardless of the fact they have sub-slaves
-         * or not, in order to behave correctly if they are promoted to
-         * masters after a failover. */
-        if (server.repl_backlog == NULL) createReplicationBacklog();
-
-        serverLog(LL_NOTICE, "MASTER <-> SLAVE sync: Finished with success");
-        /* Restart the AOF subsystem now that we finished the sync. This
-         * will trigger an AOF rewrite, and when done will start appending
-         * to the new file. */
-        if (aof_is_enabled) restartAOF();
+        server.repl_transfer_tmpfile = NULL;
+        server.repl_transfer_fd = -1;
+        replicationFinishFullSync(&rsi,aof_is_enabled);
     }
     return;
 
@@ -1738,6 +2442,32 @@ void syncWithMaster(aeEventLoop *el, int fd, void *privdata, int mask) {
                                   "REPLCONF capa: %s", err);
         }
         sdsfree(err);
+        server.master_compress = 0;
+        server.repl_state = server.repl_compression ?
+                            REPL_STATE_SEND_COMPRESS : REPL_STATE_SEND_PSYNC;
+    }
+
+    /* Ask the master to send the replication stream compressed, only if
+     * repl-compression is enabled here too. Masters not supporting it, or
+     * not configured to do it, reply with an error and send the stream as
+     * it is. */
+    if (server.repl_state == REPL_STATE_SEND_COMPRESS) {
+        err = sendSynchronousCommand(SYNC_CMD_WRITE,fd,"REPLCONF",
+                "compress","zstd",NULL);
+        if (err) goto write_error;
+        sdsfree(err);
+        server.repl_state = REPL_STATE_RECEIVE_COMPRESS;
+        return;
+    }
+
+    /* Receive REPLCONF compress reply. */
+    if (server.repl_state == REPL_STATE_RECEIVE_COMPRESS) {
+        err = sendSynchronousCommand(SYNC_CMD_READ,fd,NULL);
+        server.master_compress = err[0] != '-';
+        if (server.master_compress)
+            serverLog(LL_NOTICE,"Master accepted to send the replication "
+                                "stream compressed.");
+        sdsfree(err);
         server.repl_state = REPL_STATE_SEND_PSYNC;
     }
 
@@ -1799,17 +2529,20 @@ void syncWithMaster(aeEventLoop *el, int fd, void *privdata, int mask) {
         }
     }
 
-    /* Prepare a suitable temp file for bulk transfer */
-    while(maxtries--) {
-        snprintf(tmpfile,256,
-            "temp-%d.%ld.rdb",(int)server.unixtime,(long int)getpid());
-        dfd = open(tmpfile,O_CREAT|O_WRONLY|O_EXCL,0644);
-        if (dfd != -1) break;
-        sleep(1);
-    }
-    if (dfd == -1) {
-        serverLog(LL_WARNING,"Opening the temp file needed for MASTER <-> SLAVE synchronization: %s",strerror(errno));
-        goto error;
+    /* Prepare a suitable temp file for bulk transfer, unless the RDB is
+     * going to be loaded directly from the socket. */
+    if (!useDisklessLoad()) {
+        while(maxtries--) {
+            snprintf(tmpfile,256,
+                "temp-%d.%ld.rdb",(int)server.unixtime,(long int)getpid());
+            dfd = open(tmpfile,O_CREAT|O_WRONLY|O_EXCL,0644);
+            if (dfd != -1) break;
+            sleep(1);
+        }
+        if (dfd == -1) {
+            serverLog(LL_WARNING,"Opening the temp file needed for MASTER <-> SLAVE synchronization: %s",strerror(errno));
+            goto error;
+        }
     }
 
     /* Setup the non blocking download of the bulk file. */
@@ -1828,7 +2561,7 @@ void syncWithMaster(aeEventLoop *el, int fd, void *privdata, int mask) {
     server.repl_transfer_last_fsync_off = 0;
     server.repl_transfer_fd = dfd;
     server.repl_transfer_lastio = server.unixtime;
-    server.repl_transfer_tmpfile = zstrdup(tmpfile);
+    server.repl_transfer_tmpfile = dfd != -1 ? zstrdup(tmpfile) : NULL;
     return;
 
 error:
@@ -1888,9 +2621,13 @@ void undoConnectWithMaster(void) {
 void replicationAbortSyncTransfer(void) {
     serverAssert(server.repl_state == REPL_STATE_TRANSFER);
     undoConnectWithMaster();
-    close(server.repl_transfer_fd);
-    unlink(server.repl_transfer_tmpfile);
-    zfree(server.repl_transfer_tmpfile);
+    if (server.repl_transfer_fd != -1) {
+        close(server.repl_transfer_fd);
+        unlink(server.repl_transfer_tmpfile);
+        zfree(server.repl_transfer_tmpfile);
+        server.repl_transfer_fd = -1;
+        server.repl_transfer_tmpfile = NULL;
+    }
 }
 
 /* This function aborts a non blocking replication attempt if there is one
@@ -2126,6 +2863,7 @@ void replicationCacheMaster(client *c) {
     sdsclear(server.master->querybuf);
     sdsclear(server.master->pending_querybuf);
     server.master->read_reploff = server.master->reploff;
+    replicationFreeStreamDecoder(server.master);
     if (c->flags & CLIENT_MULTI) discardTransaction(c);
     listEmpty(c->reply);
     c->bufpos = 0;
@@ -2193,6 +2931,8 @@ void replicationResurrectCachedMaster(int newfd) {
     server.master = server.cached_master;
     server.cached_master = NULL;
     server.master->fd = newfd;
+    if (server.master_compress)
+        replicationCreateStreamDecoder(server.master);
     server.master->flags &= ~(CLIENT_CLOSE_AFTER_REPLY|CLIENT_CLOSE_ASAP);
     server.master->authenticated = 1;
     server.master->lastinteraction = server.unixtime;
@@ -2595,6 +3335,10 @@ void replicationCron(void) {
         }
     }
 
+    /* Release the blocks of the replication buffer that were held by
+     * disconnected slaves. */
+    incrementalTrimReplicationBacklog(REPL_BUFFER_TRIM_BLOCKS_PER_CALL*100);
+
     /* If this is a master without attached slaves and there is a replication
      * backlog active, in order to reclaim memory we can free it after some
      * (configured) time. Note that this cannot be done for slaves: slaves
@@ -2631,7 +3375,7 @@ void replicationCron(void) {
      * In case of diskless replication, we make sure to wait the specified
      * number of seconds (according to configuration) so that other slaves
      * have the time to arrive before we start streaming. */
-    if (server.rdb_child_pid == -1 && server.aof_child_pid == -1) {
+    if (!rdbSaveInProgress() && server.aof_child_pid == -1) {
         time_t idle, max_idle = 0;
         int slaves_waiting = 0;
         int mincapa = -1;
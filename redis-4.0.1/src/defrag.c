@@ -125,7 +125,9 @@ robj *activeDefragStringOb(robj* ob, int *defragged) {
                 ret->ptr = (void*)((intptr_t)ret + ofs);
                 (*defragged)++;
             }
-        } else if (ob->encoding!=OBJ_ENCODING_INT) {
+        } else if (ob->encoding!=OBJ_ENCODING_INT &&
+                   ob->encoding!=OBJ_ENCODING_BITMAP)
+        {
             serverPanic("Unknown string encoding");
         }
     }
@@ -187,6 +189,47 @@ int dictDefragTables(dict** dictRef) {
     return defragged;
 }
 
+/* Defrag helper for the overflow buckets of a chain, starting from the
+ * reference to the first one. Returns a stat of how many pointers were moved. */
+int hashtableDefragChain(hashtableBucket **bucketref) {
+    int defragged = 0;
+    while(*bucketref) {
+        hashtableBucket *newb = activeDefragAlloc(*bucketref);
+        if (newb)
+            defragged++, *bucketref = newb;
+        bucketref = &(*bucketref)->child;
+    }
+    return defragged;
+}
+
+/* Defrag helper for hashtable main allocations (hashtable struct, bucket
+ * arrays and overflow buckets). Like dictDefragTables() it receives a
+ * pointer to the hashtable* and implicitly updates it when the struct itself
+ * was moved. The entries live inside the buckets, so there is nothing else
+ * to defrag but the keys and values. */
+int hashtableDefragTables(hashtable** htRef) {
+    hashtable *h = *htRef;
+    hashtableBucket *newbuckets;
+    unsigned long idx;
+    int defragged = 0, table;
+    /* handle the hashtable struct */
+    hashtable *newh = activeDefragAlloc(h);
+    if (newh)
+        defragged++, *htRef = h = newh;
+    for (table = 0; table <= 1; table++) {
+        hashtableTable *t = &h->ht[table];
+        if (t->buckets == NULL) continue;
+        /* handle the bucket array */
+        newbuckets = activeDefragAlloc(t->buckets);
+        if (newbuckets)
+            defragged++, t->buckets = newbuckets;
+        /* and the overflow buckets, if any */
+        for (idx = 0; t->children && idx < t->size; idx++)
+            defragged += hashtableDefragChain(&t->buckets[idx].child);
+    }
+    return defragged;
+}
+
 /* Internal function used by zslDefrag */
 void zslUpdateNode(zskiplist *zsl, zskiplistNode *oldnode, zskiplistNode *newnode, zskiplistNode **update) {
     int i;
@@ -205,13 +248,12 @@ void zslUpdateNode(zskiplist *zsl, zskiplistNode *oldnode, zskiplistNode *newnod
 }
 
 /* Defrag helper for sorted set.
- * Update the robj pointer, defrag the skiplist struct and return the new score
- * reference. We may not access oldele pointer (not even the pointer stored in
+ * Update the robj pointer and defrag the skiplist node, returning 1 if it was
+ * moved. We may not access oldele pointer (not even the pointer stored in
  * the skiplist), as it was already freed. Newele may be null, in which case we
  * only need to defrag the skiplist, but not update the obj pointer.
- * When return value is non-NULL, it is the score reference that must be updated
- * in the dict record. */
-double *zslDefrag(zskiplist *zsl, double score, sds oldele, sds newele) {
+ * The dict stores the scores by value, so it doesn't need to be updated. */
+int zslDefrag(zskiplist *zsl, double score, sds oldele, sds newele) {
     zskiplistNode *update[ZSKIPLIST_MAXLEVEL], *x, *newx;
     int i;
     sds ele = newele? newele: oldele;
@@ -241,62 +283,79 @@ double *zslDefrag(zskiplist *zsl, double score, sds oldele, sds newele) {
     newx = activeDefragAlloc(x);
     if (newx) {
         zslUpdateNode(zsl, x, newx, update);
-        return &newx->score;
+        return 1;
     }
-    return NULL;
+    return 0;
 }
 
-/* Utility function that replaces an old key pointer in the dictionary with a
- * new pointer. Additionally, we try to defrag the dictEntry in that dict.
- * Oldkey mey be a dead pointer and should not be accessed (we get a
- * pre-calculated hash value). Newkey may be null if the key pointer wasn't
- * moved. Return value is the the dictEntry if found, or NULL if not found.
- * NOTE: this is very ugly code, but it let's us avoid the complication of
- * doing a scan on another dict. */
-dictEntry* replaceSateliteDictKeyPtrAndOrDefragDictEntry(dict *d, sds oldkey, sds newkey, unsigned int hash, int *defragged) {
-    dictEntry **deref = dictFindEntryRefByPtrAndHash(d, oldkey, hash);
-    if (deref) {
-        dictEntry *de = *deref;
-        dictEntry *newde = activeDefragAlloc(de);
-        if (newde) {
-            de = *deref = newde;
-            (*defragged)++;
-        }
-        if (newkey)
-            de->key = newkey;
-        return de;
+/* Defrag helper for the B+tree of sorted sets: defrag the node at the
+ * specified height and all the nodes and separators below it. Leaves are
+ * relinked to their neighbours here, while the caller is responsible of
+ * updating the pointer to the node, which is returned if it was moved.
+ * The elements are shared with the dict and are handled by the caller. */
+void *zbtDefragNode(zbtree *zbt, void *node, int height, int *defragged) {
+    zbtreeInner *in;
+    void *newnode, *newchild;
+    sds newsep;
+    unsigned int i;
+
+    if (height == 1) {
+        zbtreeLeaf *leaf = activeDefragAlloc(node);
+        if (leaf == NULL) return NULL;
+        if (leaf->prev)
+            leaf->prev->next = leaf;
+        else
+            zbt->head = leaf;
+        if (leaf->next)
+            leaf->next->prev = leaf;
+        else
+            zbt->tail = leaf;
+        (*defragged)++;
+        return leaf;
     }
-    return NULL;
+
+    in = node;
+    if ((newnode = activeDefragAlloc(in)))
+        (*defragged)++, in = newnode;
+    for (i = 0; i < in->count; i++) {
+        if (in->eles[i] && (newsep = activeDefragSds(in->eles[i])))
+            (*defragged)++, in->eles[i] = newsep;
+        if ((newchild = zbtDefragNode(zbt,in->children[i],height-1,defragged)))
+            in->children[i] = newchild;
+    }
+    return newnode;
 }
 
 /* for each key we scan in the main dict, this function will attempt to defrag
  * all the various pointers it has. Returns a stat of how many pointers were
  * moved. */
-int defragKey(redisDb *db, dictEntry *de) {
-    sds keysds = dictGetKey(de);
+int defragKey(redisDb *db, hashtableEntry *e) {
+    sds keysds = hashtableGetKey(e);
     robj *newob, *ob;
     unsigned char *newzl;
     dict *d;
     dictIterator *di;
+    dictEntry *de;
+    hashtableIterator *hi;
+    hashtableEntry *he, *ee = NULL;
     int defragged = 0;
     sds newsds;
 
+    /* The expires index shares the key name: find its entry before the
+     * name is moved, since the old pointer can't be compared after that. */
+    if (keyGetExpire(keysds) != -1) ee = hashtableFind(db->expires, keysds);
+
     /* Try to defrag the key name. */
     newsds = activeDefragSds(keysds);
-    if (newsds)
-        defragged++, de->key = newsds;
-    if (dictSize(db->expires)) {
-         /* Dirty code:
-          * I can't search in db->expires for that key after i already released
-          * the pointer it holds it won't be able to do the string compare */
-        unsigned int hash = dictGetHash(db->dict, de->key);
-        replaceSateliteDictKeyPtrAndOrDefragDictEntry(db->expires, keysds, newsds, hash, &defragged);
+    if (newsds) {
+        defragged++, e->key = newsds;
+        if (ee) ee->key = newsds;
     }
 
     /* Try to defrag robj and / or string value. */
-    ob = dictGetVal(de);
+    ob = hashtableGetVal(e);
     if ((newob = activeDefragStringOb(ob, &defragged))) {
-        de->v.val = newob;
+        e->v.val = newob;
         ob = newob;
     }
 
@@ -321,28 +380,23 @@ int defragKey(redisDb *db, dictEntry *de) {
                     node = newnode;
                     defragged++;
                 }
-                if ((newzl = activeDefragAlloc(node->zl)))
-                    defragged++, node->zl = newzl;
+                if ((newzl = activeDefragAlloc(node->entry)))
+                    defragged++, node->entry = newzl;
                 node = node->next;
             }
-        } else if (ob->encoding == OBJ_ENCODING_ZIPLIST) {
-            if ((newzl = activeDefragAlloc(ob->ptr)))
-                defragged++, ob->ptr = newzl;
         } else {
             serverPanic("Unknown list encoding");
         }
     } else if (ob->type == OBJ_SET) {
         if (ob->encoding == OBJ_ENCODING_HT) {
-            d = ob->ptr;
-            di = dictGetIterator(d);
-            while((de = dictNext(di)) != NULL) {
-                sds sdsele = dictGetKey(de);
+            hi = hashtableGetIterator(ob->ptr);
+            while((he = hashtableNext(hi)) != NULL) {
+                sds sdsele = hashtableGetKey(he);
                 if ((newsds = activeDefragSds(sdsele)))
-                    defragged++, de->key = newsds;
-                defragged += dictIterDefragEntry(di);
+                    defragged++, he->key = newsds;
             }
-            dictReleaseIterator(di);
-            dictDefragTables((dict**)&ob->ptr);
+            hashtableReleaseIterator(hi);
+            defragged += hashtableDefragTables((hashtable**)&ob->ptr);
         } else if (ob->encoding == OBJ_ENCODING_INTSET) {
             intset *is = ob->ptr;
             intset *newis = activeDefragAlloc(is);
@@ -352,7 +406,7 @@ int defragKey(redisDb *db, dictEntry *de) {
             serverPanic("Unknown set encoding");
         }
     } else if (ob->type == OBJ_ZSET) {
-        if (ob->encoding == OBJ_ENCODING_ZIPLIST) {
+        if (ob->encoding == OBJ_ENCODING_LISTPACK) {
             if ((newzl = activeDefragAlloc(ob->ptr)))
                 defragged++, ob->ptr = newzl;
         } else if (ob->encoding == OBJ_ENCODING_SKIPLIST) {
@@ -369,14 +423,32 @@ int defragKey(redisDb *db, dictEntry *de) {
             d = zs->dict;
             di = dictGetIterator(d);
             while((de = dictNext(di)) != NULL) {
-                double* newscore;
                 sds sdsele = dictGetKey(de);
                 if ((newsds = activeDefragSds(sdsele)))
                     defragged++, de->key = newsds;
-                newscore = zslDefrag(zs->zsl, *(double*)dictGetVal(de), sdsele, newsds);
-                if (newscore) {
-                    dictSetVal(d, de, newscore);
-                    defragged++;
+                defragged += zslDefrag(zs->zsl, dictGetDoubleVal(de), sdsele, newsds);
+                defragged += dictIterDefragEntry(di);
+            }
+            dictReleaseIterator(di);
+            dictDefragTables(&zs->dict);
+        } else if (ob->encoding == OBJ_ENCODING_BTREE) {
+            zset *zs = (zset*)ob->ptr;
+            zset *newzs;
+            zbtree *newzbt;
+            void *newroot;
+            if ((newzs = activeDefragAlloc(zs)))
+                defragged++, ob->ptr = zs = newzs;
+            if ((newzbt = activeDefragAlloc(zs->zbt)))
+                defragged++, zs->zbt = newzbt;
+            if ((newroot = zbtDefragNode(zs->zbt, zs->zbt->root, zs->zbt->height, &defragged)))
+                zs->zbt->root = newroot;
+            d = zs->dict;
+            di = dictGetIterator(d);
+            while((de = dictNext(di)) != NULL) {
+                sds sdsele = dictGetKey(de);
+                if ((newsds = activeDefragSds(sdsele))) {
+                    defragged++, de->key = newsds;
+                    zbtReplaceElement(zs->zbt, dictGetDoubleVal(de), sdsele, newsds);
                 }
                 defragged += dictIterDefragEntry(di);
             }
@@ -386,23 +458,21 @@ int defragKey(redisDb *db, dictEntry *de) {
             serverPanic("Unknown sorted set encoding");
         }
     } else if (ob->type == OBJ_HASH) {
-        if (ob->encoding == OBJ_ENCODING_ZIPLIST) {
+        if (ob->encoding == OBJ_ENCODING_LISTPACK) {
             if ((newzl = activeDefragAlloc(ob->ptr)))
                 defragged++, ob->ptr = newzl;
         } else if (ob->encoding == OBJ_ENCODING_HT) {
-            d = ob->ptr;
-            di = dictGetIterator(d);
-            while((de = dictNext(di)) != NULL) {
-                sds sdsele = dictGetKey(de);
+            hi = hashtableGetIterator(ob->ptr);
+            while((he = hashtableNext(hi)) != NULL) {
+                sds sdsele = hashtableGetKey(he);
                 if ((newsds = activeDefragSds(sdsele)))
-                    defragged++, de->key = newsds;
-                sdsele = dictGetVal(de);
+                    defragged++, he->key = newsds;
+                sdsele = hashtableGetVal(he);
                 if ((newsds = activeDefragSds(sdsele)))
-                    defragged++, de->v.val = newsds;
-                defragged += dictIterDefragEntry(di);
+                    defragged++, he->v.val = newsds;
             }
-            dictReleaseIterator(di);
-            dictDefragTables((dict**)&ob->ptr);
+            hashtableReleaseIterator(hi);
+            defragged += hashtableDefragTables((hashtable**)&ob->ptr);
         } else {
             serverPanic("Unknown hash encoding");
         }
@@ -415,9 +485,9 @@ int defragKey(redisDb *db, dictEntry *de) {
     return defragged;
 }
 
-/* Defrag scan callback for the main db dictionary. */
-void defragScanCallback(void *privdata, const dictEntry *de) {
-    int defragged = defragKey((redisDb*)privdata, (dictEntry*)de);
+/* Defrag scan callback for the main db hash table. */
+void defragScanCallback(void *privdata, hashtableEntry *e) {
+    int defragged = defragKey((redisDb*)privdata, e);
     server.stat_active_defrag_hits += defragged;
     if(defragged)
         server.stat_active_defrag_key_hits++;
@@ -425,16 +495,14 @@ void defragScanCallback(void *privdata, const dictEntry *de) {
         server.stat_active_defrag_key_misses++;
 }
 
-/* Defrag scan callback for for each hash table bicket,
- * used in order to defrag the dictEntry allocations. */
-void defragDictBucketCallback(void *privdata, dictEntry **bucketref) {
+/* Defrag scan callback for each overflow bucket of the main db hash table,
+ * the entries themselves are stored inside the buckets. */
+void defragBucketCallback(void *privdata, hashtableBucket **bucketref) {
+    hashtableBucket *newb;
     UNUSED(privdata);
-    while(*bucketref) {
-        dictEntry *de = *bucketref, *newde;
-        if ((newde = activeDefragAlloc(de))) {
-            *bucketref = newde;
-        }
-        bucketref = &(*bucketref)->next;
+    if ((newb = activeDefragAlloc(*bucketref))) {
+        *bucketref = newb;
+        server.stat_active_defrag_hits++;
     }
 }
 
@@ -486,6 +554,8 @@ void activeDefragCycle(void) {
 
     if (server.aof_child_pid!=-1 || server.rdb_child_pid!=-1)
         return; /* Defragging memory while there's a fork will just do damage. */
+    if (server.rdb_snapshot)
+        return; /* Moving keys the snapshot thread may be reading. */
 
     /* Once a second, check if we the fragmentation justfies starting a scan
      * or making it more aggressive. */
@@ -555,7 +625,7 @@ void activeDefragCycle(void) {
         }
 
         do {
-            cursor = dictScan(db->dict, cursor, defragScanCallback, defragDictBucketCallback, db);
+            cursor = hashtableScan(db->dict, cursor, defragScanCallback, defragBucketCallback, db);
             /* Once in 16 scan iterations, or 1000 pointer reallocations
              * (if we have a lot of pointers in one hash bucket), check if we
              * reached the tiem limit. */
@@ -0,0 +1,413 @@
+/* Linux io_uring based ae.c module, falling back to epoll(7) at runtime.
+ *
+ * Copyright (c) 2009-2012, Salvatore Sanfilippo <antirez at gmail dot com>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *   * Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *   * Neither the name of Redis nor the names of its contributors may be used
+ *     to endorse or promote products derived from this software without
+ *     specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/* With epoll every iteration of the event loop costs an epoll_wait() call
+ * plus one epoll_ctl() call every time the interest of a file descriptor
+ * changes, for instance when a client gets a reply to write and later when
+ * the reply was sent.
+ *
+ * Here readiness is instead requested with one shot IORING_OP_POLL_ADD
+ * operations, one per file descriptor and direction. Registrations,
+ * removals, the poll operations to re-arm after an event fired, and the
+ * timeout of the iteration are all queued in the submission ring, so that a
+ * single io_uring_enter() call per iteration submits everything and waits
+ * for the completions. Since fired polls are re-armed on the next call, the
+ * semantics are the same level triggered ones of the other backends.
+ *
+ * When the kernel does not support io_uring (or lacks the features we need)
+ * the module silently uses epoll instead, see aeApiCreate(). */
+
+#include <stdint.h>
+#include <sys/epoll.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <linux/io_uring.h>
+
+/* user_data of completions we are not interested in: removals and
+ * timeouts. Poll operations use fd | direction << 32 | generation << 33. */
+#define AE_URING_IGNORE ((uint64_t)-1)
+#define AE_URING_READ 0
+#define AE_URING_WRITE 1
+#define AE_URING_ENTRIES 1024
+
+typedef struct aeUringFdState {
+    unsigned int gen[2];    /* Generation of the poll of each direction. */
+    int pending;            /* AE_(READABLE|WRITABLE) polls in flight. */
+} aeUringFdState;
+
+typedef struct aeApiState {
+    int ringfd;             /* io_uring fd, -1 when using epoll. */
+    /* Submission ring. */
+    unsigned *sq_head, *sq_tail, *sq_mask, *sq_array;
+    unsigned sq_entries;
+    struct io_uring_sqe *sqes;
+    /* Completion ring. */
+    unsigned *cq_head, *cq_tail, *cq_mask;
+    struct io_uring_cqe *cqes;
+    void *sq_ptr, *cq_ptr;
+    size_t sq_size, cq_size, sqes_size;
+    aeUringFdState *fds;
+    int numfired;           /* Events returned by the last aeApiPoll(). */
+    struct __kernel_timespec ts;
+    /* epoll fallback. */
+    int epfd;
+    struct epoll_event *events;
+} aeApiState;
+
+/* Backend in use by the last event loop created, for aeApiName(). */
+static int aeUringActive = 0;
+
+static int aeUringSetup(aeApiState *state, int setsize) {
+    struct io_uring_params p;
+    unsigned cq_entries = 1;
+
+    /* Every registered fd may have a poll in flight in both directions:
+     * size the completion ring so that it can hold all of them. */
+    while (cq_entries < (unsigned)setsize*2) cq_entries <<= 1;
+    memset(&p,0,sizeof(p));
+    p.flags = IORING_SETUP_CQSIZE;
+    p.cq_entries = cq_entries;
+    state->ringfd = syscall(__NR_io_uring_setup,AE_URING_ENTRIES,&p);
+    if (state->ringfd == -1) return -1;
+    if (!(p.features & IORING_FEAT_NODROP)) goto err;
+
+    state->sq_size = p.sq_off.array + p.sq_entries*sizeof(unsigned);
+    state->cq_size = p.cq_off.cqes + p.cq_entries*sizeof(struct io_uring_cqe);
+    state->sqes_size = p.sq_entries*sizeof(struct io_uring_sqe);
+    state->sq_ptr = mmap(NULL,state->sq_size,PROT_READ|PROT_WRITE,
+        MAP_SHARED|MAP_POPULATE,state->ringfd,IORING_OFF_SQ_RING);
+    if (state->sq_ptr == MAP_FAILED) goto err;
+    state->cq_ptr = mmap(NULL,state->cq_size,PROT_READ|PROT_WRITE,
+        MAP_SHARED|MAP_POPULATE,state->ringfd,IORING_OFF_CQ_RING);
+    if (state->cq_ptr == MAP_FAILED) goto err_sq;
+    state->sqes = mmap(NULL,state->sqes_size,PROT_READ|PROT_WRITE,
+        MAP_SHARED|MAP_POPULATE,state->ringfd,IORING_OFF_SQES);
+    if (state->sqes == MAP_FAILED) goto err_cq;
+
+    state->sq_head = (unsigned*)((char*)state->sq_ptr + p.sq_off.head);
+    state->sq_tail = (unsigned*)((char*)state->sq_ptr + p.sq_off.tail);
+    state->sq_mask = (unsigned*)((char*)state->sq_ptr + p.sq_off.ring_mask);
+    state->sq_array = (unsigned*)((char*)state->sq_ptr + p.sq_off.array);
+    state->sq_entries = p.sq_entries;
+    state->cq_head = (unsigned*)((char*)state->cq_ptr + p.cq_off.head);
+    state->cq_tail = (unsigned*)((char*)state->cq_ptr + p.cq_off.tail);
+    state->cq_mask = (unsigned*)((char*)state->cq_ptr + p.cq_off.ring_mask);
+    state->cqes = (struct io_uring_cqe*)((char*)state->cq_ptr + p.cq_off.cqes);
+    return 0;
+
+err_cq:
+    munmap(state->cq_ptr,state->cq_size);
+err_sq:
+    munmap(state->sq_ptr,state->sq_size);
+err:
+    close(state->ringfd);
+    state->ringfd = -1;
+    return -1;
+}
+
+static int aeApiCreate(aeEventLoop *eventLoop) {
+    aeApiState *state = zmalloc(sizeof(aeApiState));
+
+    if (!state) return -1;
+    memset(state,0,sizeof(*state));
+    state->epfd = -1;
+    if (aeUringSetup(state,eventLoop->setsize) == 0) {
+        state->fds = zmalloc(sizeof(aeUringFdState)*eventLoop->setsize);
+        memset(state->fds,0,sizeof(aeUringFdState)*eventLoop->setsize);
+    } else {
+        state->events = zmalloc(sizeof(struct epoll_event)*eventLoop->setsize);
+        state->epfd = epoll_create(1024); /* 1024 is just a hint for the kernel */
+        if (state->epfd == -1) {
+            zfree(state->events);
+            zfree(state);
+            return -1;
+        }
+    }
+    aeUringActive = state->ringfd != -1;
+    eventLoop->apidata = state;
+    return 0;
+}
+
+static int aeApiResize(aeEventLoop *eventLoop, int setsize) {
+    aeApiState *state = eventLoop->apidata;
+
+    if (state->ringfd == -1) {
+        state->events = zrealloc(state->events,
+            sizeof(struct epoll_event)*setsize);
+    } else {
+        /* The completion ring can't be resized, but if it gets too small
+         * the kernel just queues the completions in excess (we require
+         * IORING_FEAT_NODROP), so there is nothing to do but to resize
+         * our own per fd state. */
+        state->fds = zrealloc(state->fds,sizeof(aeUringFdState)*setsize);
+        if (setsize > eventLoop->setsize)
+            memset(state->fds+eventLoop->setsize,0,
+                sizeof(aeUringFdState)*(setsize-eventLoop->setsize));
+        if (state->numfired > setsize) state->numfired = setsize;
+    }
+    return 0;
+}
+
+static void aeApiFree(aeEventLoop *eventLoop) {
+    aeApiState *state = eventLoop->apidata;
+
+    if (state->ringfd == -1) {
+        close(state->epfd);
+        zfree(state->events);
+    } else {
+        munmap(state->sqes,state->sqes_size);
+        munmap(state->cq_ptr,state->cq_size);
+        munmap(state->sq_ptr,state->sq_size);
+        close(state->ringfd);
+        zfree(state->fds);
+    }
+    zfree(state);
+}
+
+/* Return the number of entries queued but not yet consumed by the kernel. */
+static unsigned aeUringQueued(aeApiState *state) {
+    return *state->sq_tail - __atomic_load_n(state->sq_head,__ATOMIC_ACQUIRE);
+}
+
+/* Get a free submission entry, submitting what is queued to make room
+ * if the submission ring is full. Returns NULL on error. */
+static struct io_uring_sqe *aeUringGetSqe(aeApiState *state) {
+    unsigned tail = *state->sq_tail, idx;
+    struct io_uring_sqe *sqe;
+
+    if (aeUringQueued(state) == state->sq_entries) {
+        if (syscall(__NR_io_uring_enter,state->ringfd,
+                    aeUringQueued(state),0,0,NULL,0) == -1) return NULL;
+    }
+    idx = tail & *state->sq_mask;
+    sqe = &state->sqes[idx];
+    memset(sqe,0,sizeof(*sqe));
+    state->sq_array[idx] = idx;
+    __atomic_store_n(state->sq_tail,tail+1,__ATOMIC_RELEASE);
+    return sqe;
+}
+
+static uint64_t aeUringPollId(aeApiState *state, int fd, int dir) {
+    return (uint64_t)fd | ((uint64_t)dir << 32) |
+           ((uint64_t)state->fds[fd].gen[dir] << 33);
+}
+
+/* Queue a poll for the direction 'dir' of 'fd' if not already in flight. */
+static int aeUringPollAdd(aeApiState *state, int fd, int dir) {
+    int mask = dir == AE_URING_READ ? AE_READABLE : AE_WRITABLE;
+    struct io_uring_sqe *sqe;
+
+    if (state->fds[fd].pending & mask) return 0;
+    if ((sqe = aeUringGetSqe(state)) == NULL) return -1;
+    sqe->opcode = IORING_OP_POLL_ADD;
+    sqe->fd = fd;
+    sqe->poll32_events = dir == AE_URING_READ ? POLLIN : POLLOUT;
+    sqe->user_data = aeUringPollId(state,fd,dir);
+    state->fds[fd].pending |= mask;
+    return 0;
+}
+
+/* Queue the removal of the poll in flight for the direction 'dir' of 'fd',
+ * if any. Bumping the generation makes us ignore its completion even if
+ * the fd gets registered again before it is delivered. */
+static void aeUringPollRemove(aeApiState *state, int fd, int dir) {
+    int mask = dir == AE_URING_READ ? AE_READABLE : AE_WRITABLE;
+    struct io_uring_sqe *sqe;
+
+    if (!(state->fds[fd].pending & mask)) return;
+    if ((sqe = aeUringGetSqe(state)) != NULL) {
+        sqe->opcode = IORING_OP_POLL_REMOVE;
+        sqe->addr = aeUringPollId(state,fd,dir);
+        sqe->user_data = AE_URING_IGNORE;
+    }
+    state->fds[fd].gen[dir]++;
+    state->fds[fd].pending &= ~mask;
+}
+
+static int aeApiAddEvent(aeEventLoop *eventLoop, int fd, int mask) {
+    aeApiState *state = eventLoop->apidata;
+
+    if (state->ringfd == -1) {
+        struct epoll_event ee = {0}; /* avoid valgrind warning */
+        /* If the fd was already monitored for some event, we need a MOD
+         * operation. Otherwise we need an ADD operation. */
+        int op = eventLoop->events[fd].mask == AE_NONE ?
+                EPOLL_CTL_ADD : EPOLL_CTL_MOD;
+
+        ee.events = 0;
+        mask |= eventLoop->events[fd].mask; /* Merge old events */
+        if (mask & AE_READABLE) ee.events |= EPOLLIN;
+        if (mask & AE_WRITABLE) ee.events |= EPOLLOUT;
+        ee.data.fd = fd;
+        if (epoll_ctl(state->epfd,op,fd,&ee) == -1) return -1;
+        return 0;
+    }
+
+    if (mask & AE_READABLE && aeUringPollAdd(state,fd,AE_URING_READ) == -1)
+        return -1;
+    if (mask & AE_WRITABLE && aeUringPollAdd(state,fd,AE_URING_WRITE) == -1)
+        return -1;
+    return 0;
+}
+
+static void aeApiDelEvent(aeEventLoop *eventLoop, int fd, int delmask) {
+    aeApiState *state = eventLoop->apidata;
+
+    if (state->ringfd == -1) {
+        struct epoll_event ee = {0}; /* avoid valgrind warning */
+        int mask = eventLoop->events[fd].mask & (~delmask);
+
+        ee.events = 0;
+        if (mask & AE_READABLE) ee.events |= EPOLLIN;
+        if (mask & AE_WRITABLE) ee.events |= EPOLLOUT;
+        ee.data.fd = fd;
+        if (mask != AE_NONE) {
+            epoll_ctl(state->epfd,EPOLL_CTL_MOD,fd,&ee);
+        } else {
+            /* Note, Kernel < 2.6.9 requires a non null event pointer even for
+             * EPOLL_CTL_DEL. */
+            epoll_ctl(state->epfd,EPOLL_CTL_DEL,fd,&ee);
+        }
+        return;
+    }
+
+    if (delmask & AE_READABLE) aeUringPollRemove(state,fd,AE_URING_READ);
+    if (delmask & AE_WRITABLE) aeUringPollRemove(state,fd,AE_URING_WRITE);
+
+    /* The fd is usually closed right after it is no longer monitored, but
+     * the poll operations in flight hold a reference to the file, so that
+     * the connection would stay open until the next aeApiPoll() call: in
+     * this case submit the removals ASAP. */
+    if ((eventLoop->events[fd].mask & ~delmask) == AE_NONE &&
+        aeUringQueued(state))
+    {
+        syscall(__NR_io_uring_enter,state->ringfd,aeUringQueued(state),
+            0,0,NULL,0);
+    }
+}
+
+static int aeApiPollEpoll(aeEventLoop *eventLoop, struct timeval *tvp) {
+    aeApiState *state = eventLoop->apidata;
+    int retval, numevents = 0;
+
+    retval = epoll_wait(state->epfd,state->events,eventLoop->setsize,
+            tvp ? (tvp->tv_sec*1000 + tvp->tv_usec/1000) : -1);
+    if (retval > 0) {
+        int j;
+
+        numevents = retval;
+        for (j = 0; j < numevents; j++) {
+            int mask = 0;
+            struct epoll_event *e = state->events+j;
+
+            if (e->events & EPOLLIN) mask |= AE_READABLE;
+            if (e->events & EPOLLOUT) mask |= AE_WRITABLE;
+            if (e->events & EPOLLERR) mask |= AE_WRITABLE;
+            if (e->events & EPOLLHUP) mask |= AE_WRITABLE;
+            eventLoop->fired[j].fd = e->data.fd;
+            eventLoop->fired[j].mask = mask;
+        }
+    }
+    return numevents;
+}
+
+static int aeApiPoll(aeEventLoop *eventLoop, struct timeval *tvp) {
+    aeApiState *state = eventLoop->apidata;
+    unsigned head, tail, wait = 0, flags = 0;
+    int j, numevents = 0;
+
+    if (state->ringfd == -1) return aeApiPollEpoll(eventLoop,tvp);
+
+    /* Re-arm the polls that fired in the previous iteration, if the fd is
+     * still registered for that event. */
+    for (j = 0; j < state->numfired; j++) {
+        int fd = eventLoop->fired[j].fd, mask;
+
+        if (fd >= eventLoop->setsize) continue;
+        mask = eventLoop->fired[j].mask & eventLoop->events[fd].mask;
+        if (mask & AE_READABLE) aeUringPollAdd(state,fd,AE_URING_READ);
+        if (mask & AE_WRITABLE) aeUringPollAdd(state,fd,AE_URING_WRITE);
+    }
+
+    /* Wait for at least one completion unless the caller asked to return
+     * ASAP. The timeout operation completes when it expires or as soon as
+     * another operation completes, so it never outlives the iteration. */
+    if (tvp == NULL || tvp->tv_sec || tvp->tv_usec) {
+        wait = 1;
+        flags = IORING_ENTER_GETEVENTS;
+        if (tvp) {
+            struct io_uring_sqe *sqe = aeUringGetSqe(state);
+
+            if (sqe) {
+                state->ts.tv_sec = tvp->tv_sec;
+                state->ts.tv_nsec = tvp->tv_usec*1000;
+                sqe->opcode = IORING_OP_TIMEOUT;
+                sqe->addr = (unsigned long)&state->ts;
+                sqe->len = 1;
+                sqe->off = 1;
+                sqe->user_data = AE_URING_IGNORE;
+            } else {
+                wait = 0;
+            }
+        }
+    }
+    syscall(__NR_io_uring_enter,state->ringfd,aeUringQueued(state),
+        wait,flags,NULL,0);
+
+    /* Reap the completions. The ones we can't fit in the fired array are
+     * left in the ring for the next call. */
+    head = *state->cq_head;
+    tail = __atomic_load_n(state->cq_tail,__ATOMIC_ACQUIRE);
+    while (head != tail && numevents < eventLoop->setsize) {
+        struct io_uring_cqe *cqe = &state->cqes[head & *state->cq_mask];
+        uint64_t id = cqe->user_data;
+        int fd = (int)(id & 0xffffffff), dir = (id >> 32) & 1, mask;
+
+        head++;
+        if (id == AE_URING_IGNORE || fd >= eventLoop->setsize ||
+            (unsigned)(id >> 33) != (state->fds[fd].gen[dir] & 0x7fffffff))
+            continue;
+
+        /* Errors are reported as readiness too: the handler will get the
+         * error calling read() or write() on the fd. */
+        mask = dir == AE_URING_READ ? AE_READABLE : AE_WRITABLE;
+        state->fds[fd].pending &= ~mask;
+        eventLoop->fired[numevents].fd = fd;
+        eventLoop->fired[numevents].mask = mask;
+        numevents++;
+    }
+    __atomic_store_n(state->cq_head,head,__ATOMIC_RELEASE);
+    state->numfired = numevents;
+    return numevents;
+}
+
+static char *aeApiName(void) {
+    return aeUringActive ? "io_uring" : "epoll";
+}
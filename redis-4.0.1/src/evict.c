@@ -161,26 +161,26 @@ void evictionPoolAlloc(void) {
  * idle time are on the left, and keys with the higher idle time on the
  * right. */
 
-void evictionPoolPopulate(int dbid, dict *sampledict, dict *keydict, struct evictionPoolEntry *pool) {
+void evictionPoolPopulate(int dbid, hashtable *sampledict, hashtable *keydict, struct evictionPoolEntry *pool) {
     int j, k, count;
-    dictEntry *samples[server.maxmemory_samples];
+    hashtableEntry *samples[server.maxmemory_samples];
 
-    count = dictGetSomeKeys(sampledict,samples,server.maxmemory_samples);
+    count = hashtableGetSomeEntries(sampledict,samples,server.maxmemory_samples);
     for (j = 0; j < count; j++) {
         unsigned long long idle;
         sds key;
         robj *o;
-        dictEntry *de;
+        hashtableEntry *de;
 
         de = samples[j];
-        key = dictGetKey(de);
+        key = hashtableGetKey(de);
 
         /* If the dictionary we are sampling from is not the main
          * dictionary (but the expires one) we need to lookup the key
          * again in the key dictionary to obtain the value object. */
         if (server.maxmemory_policy != MAXMEMORY_VOLATILE_TTL) {
-            if (sampledict != keydict) de = dictFind(keydict, key);
-            o = dictGetVal(de);
+            if (sampledict != keydict) de = hashtableFind(keydict, key);
+            o = hashtableGetVal(de);
         }
 
         /* Calculate the idle time according to the policy. This is called
@@ -199,7 +199,7 @@ void evictionPoolPopulate(int dbid, dict *sampledict, dict *keydict, struct evic
             idle = 255-LFUDecrAndReturn(o);
         } else if (server.maxmemory_policy == MAXMEMORY_VOLATILE_TTL) {
             /* In this case the sooner the expire the better. */
-            idle = ULLONG_MAX - (long)dictGetVal(de);
+            idle = ULLONG_MAX - keyGetExpire(key);
         } else {
             serverPanic("Unknown eviction policy in evictionPoolPopulate()");
         }
@@ -365,9 +365,14 @@ size_t freeMemoryGetNotCountedMemory(void) {
         listRewind(server.slaves,&li);
         while((ln = listNext(&li))) {
             client *slave = listNodeValue(ln);
-            overhead += getClientOutputBufferMemoryUsage(slave);
+            overhead += getClientOutputBufferMemoryUsage(slave) -
+                        getSlaveReplicationBufferPending(slave);
         }
     }
+    /* The slaves share the replication buffer with the backlog: only the
+     * part that exceeds the backlog size is their output buffer. */
+    if ((long long)server.repl_buffer_mem > server.repl_backlog_size)
+        overhead += server.repl_buffer_mem - server.repl_backlog_size;
     if (server.aof_state != AOF_OFF) {
         overhead += sdslen(server.aof_buf)+aofRewriteBufferSize();
     }
@@ -413,8 +418,8 @@ int freeMemoryIfNeeded(void) {
         sds bestkey = NULL;
         int bestdbid;
         redisDb *db;
-        dict *dict;
-        dictEntry *de;
+        hashtable *dict;
+        hashtableEntry *de;
 
         if (server.maxmemory_policy & (MAXMEMORY_FLAG_LRU|MAXMEMORY_FLAG_LFU) ||
             server.maxmemory_policy == MAXMEMORY_VOLATILE_TTL)
@@ -431,7 +436,7 @@ int freeMemoryIfNeeded(void) {
                     db = server.db+i;
                     dict = (server.maxmemory_policy & MAXMEMORY_FLAG_ALLKEYS) ?
                             db->dict : db->expires;
-                    if ((keys = dictSize(dict)) != 0) {
+                    if ((keys = hashtableSize(dict)) != 0) {
                         evictionPoolPopulate(i, dict, db->dict, pool);
                         total_keys += keys;
                     }
@@ -444,10 +449,10 @@ int freeMemoryIfNeeded(void) {
                     bestdbid = pool[k].dbid;
 
                     if (server.maxmemory_policy & MAXMEMORY_FLAG_ALLKEYS) {
-                        de = dictFind(server.db[pool[k].dbid].dict,
+                        de = hashtableFind(server.db[pool[k].dbid].dict,
                             pool[k].key);
                     } else {
-                        de = dictFind(server.db[pool[k].dbid].expires,
+                        de = hashtableFind(server.db[pool[k].dbid].expires,
                             pool[k].key);
                     }
 
@@ -460,7 +465,7 @@ int freeMemoryIfNeeded(void) {
                     /* If the key exists, is our pick. Otherwise it is
                      * a ghost and we need to try the next element. */
                     if (de) {
-                        bestkey = dictGetKey(de);
+                        bestkey = hashtableGetKey(de);
                         break;
                     } else {
                         /* Ghost... Iterate again. */
@@ -481,9 +486,9 @@ int freeMemoryIfNeeded(void) {
                 db = server.db+j;
                 dict = (server.maxmemory_policy == MAXMEMORY_ALLKEYS_RANDOM) ?
                         db->dict : db->expires;
-                if (dictSize(dict) != 0) {
-                    de = dictGetRandomKey(dict);
-                    bestkey = dictGetKey(de);
+                if (hashtableSize(dict) != 0) {
+                    de = hashtableGetRandomEntry(dict);
+                    bestkey = hashtableGetKey(de);
                     bestdbid = j;
                     break;
                 }
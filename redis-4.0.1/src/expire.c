@@ -42,7 +42,7 @@
 
 /* Helper function for the activeExpireCycle() function.
  * This function will try to expire the key that is stored in the hash table
- * entry 'de' of the 'expires' hash table of a Redis database.
+ * entry 'de' of the 'expires' index of a Redis database.
  *
  * If the key is found to be expired, it is removed from the database and
  * 1 is returned. Otherwise no operation is performed and 0 is returned.
@@ -51,10 +51,10 @@
  *
  * The parameter 'now' is the current time in milliseconds as is passed
  * to the function to avoid too many gettimeofday() syscalls. */
-int activeExpireCycleTryExpire(redisDb *db, dictEntry *de, long long now) {
-    long long t = dictGetSignedIntegerVal(de);
+int activeExpireCycleTryExpire(redisDb *db, hashtableEntry *de, long long now) {
+    sds key = hashtableGetKey(de);
+    long long t = keyGetExpire(key);
     if (now > t) {
-        sds key = dictGetKey(de);
         robj *keyobj = createStringObject(key,sdslen(key));
 
         propagateExpire(db,keyobj,server.lazyfree_lazy_expire);
@@ -72,6 +72,159 @@ int activeExpireCycleTryExpire(redisDb *db, dictEntry *de, long long now) {
     }
 }
 
+/*-----------------------------------------------------------------------------
+ * Expire index
+ *
+ * Sampling random volatile keys is cheap, but when just a small fraction of
+ * a big number of volatile keys expires at a given time, the active expire
+ * cycle stops after finding few expired keys among the sampled ones, and the
+ * expired keys may use memory for a long time if they are not accessed.
+ *
+ * When active-expire-index is enabled every database also indexes its
+ * volatile keys by expire time in a radix tree, so that the active expire
+ * cycle deletes exactly the keys that are due, in expire order, with an
+ * effort proportional to the number of keys actually expired. The price is
+ * the memory of the index and updating it every time an expire is set or a
+ * volatile key is deleted.
+ *
+ * The keys of the radix tree are the expire time, as a big endian 64 bit
+ * integer so that they are sorted by time, followed by the key name.
+ *----------------------------------------------------------------------------*/
+
+#define EXPIRE_INDEX_STATIC_KEY 128  /* Keys encoded on the stack up to this. */
+#define EXPIRE_INDEX_MAX_STALE 1000  /* Max due keys counted for the stats. */
+
+/* Encode the index key of 'key' expiring at 'when' in 'buf' if it fits in
+ * EXPIRE_INDEX_STATIC_KEY bytes, otherwise in an allocated buffer, that the
+ * caller should free when different from 'buf'. */
+static unsigned char *expireIndexEncode(unsigned char *buf, sds key, long long when, size_t *len) {
+    size_t keylen = sdslen(key);
+    uint64_t t = htonu64((uint64_t)(when < 0 ? 0 : when));
+
+    *len = sizeof(t)+keylen;
+    if (*len > EXPIRE_INDEX_STATIC_KEY) buf = zmalloc(*len);
+    memcpy(buf,&t,sizeof(t));
+    memcpy(buf+sizeof(t),key,keylen);
+    return buf;
+}
+
+/* Return the expire time of an index key. */
+static long long expireIndexTime(unsigned char *ikey) {
+    uint64_t t;
+
+    memcpy(&t,ikey,sizeof(t));
+    return ntohu64(t);
+}
+
+/* Add the key 'key' expiring at 'when' to the expire index of 'db', if any. */
+void expireIndexAdd(redisDb *db, sds key, long long when) {
+    unsigned char buf[EXPIRE_INDEX_STATIC_KEY], *ikey;
+    size_t len;
+
+    if (db->expires_index == NULL) return;
+    ikey = expireIndexEncode(buf,key,when,&len);
+    raxInsert(db->expires_index,ikey,len,NULL,NULL);
+    if (ikey != buf) zfree(ikey);
+}
+
+/* Remove the key 'key' expiring at 'when' from the expire index of 'db', if
+ * any. Nothing is done if 'when' is -1, that is, for non volatile keys. */
+void expireIndexDel(redisDb *db, sds key, long long when) {
+    unsigned char buf[EXPIRE_INDEX_STATIC_KEY], *ikey;
+    size_t len;
+
+    if (db->expires_index == NULL || when == -1) return;
+    ikey = expireIndexEncode(buf,key,when,&len);
+    raxRemove(db->expires_index,ikey,len,NULL);
+    if (ikey != buf) zfree(ikey);
+}
+
+/* Enable or disable the expire index of all the databases. Enabling it
+ * requires to index all the volatile keys, so it blocks the server for a
+ * time proportional to their number. */
+void setActiveExpireIndex(int enabled) {
+    int j;
+
+    server.active_expire_index = enabled;
+    for (j = 0; j < server.dbnum; j++) {
+        redisDb *db = server.db+j;
+
+        if (!enabled && db->expires_index) {
+            raxFree(db->expires_index);
+            db->expires_index = NULL;
+        } else if (enabled && db->expires_index == NULL) {
+            hashtableIterator *hi = hashtableGetIterator(db->expires);
+            hashtableEntry *de;
+
+            db->expires_index = raxNew();
+            while((de = hashtableNext(hi)) != NULL) {
+                sds key = hashtableGetKey(de);
+                expireIndexAdd(db,key,keyGetExpire(key));
+            }
+            hashtableReleaseIterator(hi);
+        }
+    }
+}
+
+/* Count the keys of the expire index of 'db' that are due at 'now', up to
+ * EXPIRE_INDEX_MAX_STALE keys. */
+static long long expireIndexCountDue(redisDb *db, long long now) {
+    long long count = 0;
+    raxIterator ri;
+
+    raxStart(&ri,db->expires_index);
+    raxSeek(&ri,"^",NULL,0);
+    while (count < EXPIRE_INDEX_MAX_STALE && raxNext(&ri) &&
+           expireIndexTime(ri.key) < now) count++;
+    raxStop(&ri);
+    return count;
+}
+
+/* The active expire cycle of a database with an expire index: the keys that
+ * are due are deleted in batches of ACTIVE_EXPIRE_CYCLE_LOOKUPS_PER_LOOP keys
+ * in expire order, stopping at the first key that is not yet expired.
+ *
+ * Returns 1 if the time limit was reached before all the expired keys could
+ * be deleted, otherwise 0 is returned. */
+static int activeExpireIndexCycle(redisDb *db, long long start, long long timelimit) {
+    sds keys[ACTIVE_EXPIRE_CYCLE_LOOKUPS_PER_LOOP];
+    long long now = mstime(), elapsed;
+    raxIterator ri;
+    int j, count;
+
+    do {
+        /* Collect the keys first, the iterator can't be used while the
+         * keys are deleted from the index. */
+        count = 0;
+        raxStart(&ri,db->expires_index);
+        raxSeek(&ri,"^",NULL,0);
+        while (count < ACTIVE_EXPIRE_CYCLE_LOOKUPS_PER_LOOP &&
+               raxNext(&ri) && expireIndexTime(ri.key) < now)
+        {
+            keys[count++] = sdsnewlen(ri.key+sizeof(uint64_t),
+                                      ri.key_len-sizeof(uint64_t));
+        }
+        raxStop(&ri);
+
+        for (j = 0; j < count; j++) {
+            hashtableEntry *de = hashtableFind(db->expires,keys[j]);
+
+            serverAssert(de != NULL);
+            activeExpireCycleTryExpire(db,de,now);
+            sdsfree(keys[j]);
+        }
+
+        elapsed = ustime()-start;
+        if (elapsed > timelimit) {
+            latencyAddSampleIfNeeded("expire-cycle",elapsed/1000);
+            db->expires_stale = expireIndexCountDue(db,now);
+            return 1;
+        }
+    } while (count == ACTIVE_EXPIRE_CYCLE_LOOKUPS_PER_LOOP);
+    db->expires_stale = 0;
+    return 0;
+}
+
 /* Try to expire a few timed out keys. The algorithm used is adaptive and
  * will use few CPU cycles if there are few expiring keys, otherwise
  * it will get more aggressive to avoid that too much memory is used by
@@ -92,7 +245,10 @@ int activeExpireCycleTryExpire(redisDb *db, dictEntry *de, long long now) {
  *
  * If type is ACTIVE_EXPIRE_CYCLE_SLOW, that normal expire cycle is
  * executed, where the time limit is a percentage of the REDIS_HZ period
- * as specified by the ACTIVE_EXPIRE_CYCLE_SLOW_TIME_PERC define. */
+ * as specified by the ACTIVE_EXPIRE_CYCLE_SLOW_TIME_PERC define.
+ *
+ * Databases with an expire index don't sample keys at random, but delete
+ * the keys that are due in expire order, see activeExpireIndexCycle(). */
 
 void activeExpireCycle(int type) {
     /* This function has some global state in order to continue the work
@@ -149,30 +305,42 @@ void activeExpireCycle(int type) {
          * distribute the time evenly across DBs. */
         current_db++;
 
+        if (db->expires_index) {
+            if (activeExpireIndexCycle(db,start,timelimit)) {
+                timelimit_exit = 1;
+                server.stat_expired_time_cap_reached_count++;
+                return;
+            }
+            continue;
+        }
+
         /* Continue to expire if at the end of the cycle more than 25%
          * of the keys were expired. */
         do {
-            unsigned long num, slots;
+            unsigned long num, slots, sampled;
             long long now, ttl_sum;
             int ttl_samples;
 
             /* If there is nothing to expire try next DB ASAP. */
-            if ((num = dictSize(db->expires)) == 0) {
+            if ((num = hashtableSize(db->expires)) == 0) {
                 db->avg_ttl = 0;
+                db->expires_stale = 0;
                 break;
             }
-            slots = dictSlots(db->expires);
+            slots = hashtableBuckets(db->expires)*HASHTABLE_BUCKET_SLOTS;
             now = mstime();
 
             /* When there are less than 1% filled slots getting random
              * keys is expensive, so stop here waiting for better times...
              * The dictionary will be resized asap. */
-            if (num && slots > DICT_HT_INITIAL_SIZE &&
+            if (num &&
+                slots > HASHTABLE_INITIAL_BUCKETS*HASHTABLE_BUCKET_SLOTS &&
                 (num*100/slots < 1)) break;
 
             /* The main collection cycle. Sample random keys among keys
              * with an expire set, checking for expired ones. */
             expired = 0;
+            sampled = 0;
             ttl_sum = 0;
             ttl_samples = 0;
 
@@ -180,11 +348,12 @@ void activeExpireCycle(int type) {
                 num = ACTIVE_EXPIRE_CYCLE_LOOKUPS_PER_LOOP;
 
             while (num--) {
-                dictEntry *de;
+                hashtableEntry *de;
                 long long ttl;
 
-                if ((de = dictGetRandomKey(db->expires)) == NULL) break;
-                ttl = dictGetSignedIntegerVal(de)-now;
+                if ((de = hashtableGetRandomEntry(db->expires)) == NULL) break;
+                sampled++;
+                ttl = keyGetExpire(hashtableGetKey(de))-now;
                 if (activeExpireCycleTryExpire(db,de,now)) expired++;
                 if (ttl > 0) {
                     /* We want the average TTL of keys yet not expired. */
@@ -204,6 +373,12 @@ void activeExpireCycle(int type) {
                 db->avg_ttl = (db->avg_ttl/50)*49 + (avg_ttl/50);
             }
 
+            /* Estimate the keys already expired but not yet deleted with
+             * the ratio of expired keys in the last sample. */
+            if (sampled)
+                db->expires_stale = (long long)
+                    ((double)hashtableSize(db->expires)*expired/sampled);
+
             /* We can't block forever here even if there are many keys to
              * expire. So after a given amount of milliseconds return to the
              * caller waiting for the other active expire cycle. */
@@ -212,7 +387,10 @@ void activeExpireCycle(int type) {
                 long long elapsed = ustime()-start;
 
                 latencyAddSampleIfNeeded("expire-cycle",elapsed/1000);
-                if (elapsed > timelimit) timelimit_exit = 1;
+                if (elapsed > timelimit) {
+                    timelimit_exit = 1;
+                    server.stat_expired_time_cap_reached_count++;
+                }
             }
             if (timelimit_exit) return;
             /* We don't repeat the cycle if there are less than 25% of keys
@@ -278,7 +456,7 @@ void expireSlaveKeys(void) {
         while(dbids && dbid < server.dbnum) {
             if ((dbids & 1) != 0) {
                 redisDb *db = server.db+dbid;
-                dictEntry *expire = dictFind(db->expires,keyname);
+                hashtableEntry *expire = hashtableFind(db->expires,keyname);
                 int expired = 0;
 
                 if (expire &&
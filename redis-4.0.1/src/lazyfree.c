@@ -33,14 +33,16 @@ size_t lazyfreeGetFreeEffort(robj *obj) {
         quicklist *ql = obj->ptr;
         return ql->len;
     } else if (obj->type == OBJ_SET && obj->encoding == OBJ_ENCODING_HT) {
-        dict *ht = obj->ptr;
-        return dictSize(ht);
-    } else if (obj->type == OBJ_ZSET && obj->encoding == OBJ_ENCODING_SKIPLIST){
-        zset *zs = obj->ptr;
-        return zs->zsl->length;
+        hashtable *ht = obj->ptr;
+        return hashtableSize(ht);
+    } else if (obj->type == OBJ_ZSET && obj->encoding != OBJ_ENCODING_LISTPACK){
+        return zsetLength(obj);
     } else if (obj->type == OBJ_HASH && obj->encoding == OBJ_ENCODING_HT) {
-        dict *ht = obj->ptr;
-        return dictSize(ht);
+        hashtable *ht = obj->ptr;
+        return hashtableSize(ht);
+    } else if (obj->type == OBJ_STRING && obj->encoding == OBJ_ENCODING_BITMAP) {
+        roaring *r = obj->ptr;
+        return r->count;
     } else {
         return 1; /* Everything else is a single allocation. */
     }
@@ -52,16 +54,21 @@ size_t lazyfreeGetFreeEffort(robj *obj) {
  * will be reclaimed in a different bio.c thread. */
 #define LAZYFREE_THRESHOLD 64
 int dbAsyncDelete(redisDb *db, robj *key) {
-    /* Deleting an entry from the expires dict will not free the sds of
-     * the key, because it is shared with the main dictionary. */
-    if (dictSize(db->expires) > 0) dictDelete(db->expires,key->ptr);
+    rdbSnapshotKeyWrite(db,key->ptr);
+    /* Deleting an entry from the expires index will not free the sds of
+     * the key, because it is shared with the main hash table. */
+    if (hashtableSize(db->expires) > 0) {
+        if (db->expires_index) expireIndexDel(db,key->ptr,getExpire(db,key));
+        hashtableDelete(db->expires,key->ptr);
+    }
 
     /* If the value is composed of a few allocations, to free in a lazy way
      * is actually just slower... So under a certain limit we just free
      * the object synchronously. */
-    dictEntry *de = dictUnlink(db->dict,key->ptr);
-    if (de) {
-        robj *val = dictGetVal(de);
+    hashtableEntry de;
+    int found = hashtableUnlink(db->dict,key->ptr,&de) == DICT_OK;
+    if (found) {
+        robj *val = hashtableGetVal(&de);
         size_t free_effort = lazyfreeGetFreeEffort(val);
 
         /* If releasing the object is too much work, let's put it into the
@@ -69,14 +76,14 @@ int dbAsyncDelete(redisDb *db, robj *key) {
         if (free_effort > LAZYFREE_THRESHOLD) {
             atomicIncr(lazyfree_objects,1);
             bioCreateBackgroundJob(BIO_LAZY_FREE,val,NULL,NULL);
-            dictSetVal(db->dict,de,NULL);
+            hashtableSetVal(db->dict,&de,NULL);
         }
     }
 
     /* Release the key-val pair, or just the key if we set the val
      * field to NULL in order to lazy free it later. */
-    if (de) {
-        dictFreeUnlinkedEntry(db->dict,de);
+    if (found) {
+        hashtableFreeUnlinkedEntry(db->dict,&de);
         if (server.cluster_enabled) slotToKeyDel(key);
         return 1;
     } else {
@@ -88,11 +95,19 @@ int dbAsyncDelete(redisDb *db, robj *key) {
  * create a new empty set of hash tables and scheduling the old ones for
  * lazy freeing. */
 void emptyDbAsync(redisDb *db) {
-    dict *oldht1 = db->dict, *oldht2 = db->expires;
-    db->dict = dictCreate(&dbDictType,NULL);
-    db->expires = dictCreate(&keyptrDictType,NULL);
-    atomicIncr(lazyfree_objects,dictSize(oldht1));
+    hashtable *oldht1 = db->dict;
+    hashtable *oldht2 = db->expires;
+    rax *oldindex = db->expires_index;
+    unshareClientsReplyObjects();
+    db->dict = hashtableCreate(&dbDictType,NULL);
+    db->expires = hashtableCreate(&keyptrDictType,NULL);
+    atomicIncr(lazyfree_objects,hashtableSize(oldht1));
     bioCreateBackgroundJob(BIO_LAZY_FREE,NULL,oldht1,oldht2);
+    if (oldindex) {
+        db->expires_index = raxNew();
+        atomicIncr(lazyfree_objects,oldindex->numele);
+        bioCreateBackgroundJob(BIO_LAZY_FREE,NULL,NULL,oldindex);
+    }
 }
 
 /* Empty the slots-keys map of Redis CLuster by creating a new empty one
@@ -119,15 +134,15 @@ void lazyfreeFreeObjectFromBioThread(robj *o) {
  * when the database was logically deleted. 'sl' is a skiplist used by
  * Redis Cluster in order to take the hash slots -> keys mapping. This
  * may be NULL if Redis Cluster is disabled. */
-void lazyfreeFreeDatabaseFromBioThread(dict *ht1, dict *ht2) {
-    size_t numkeys = dictSize(ht1);
-    dictRelease(ht1);
-    dictRelease(ht2);
+void lazyfreeFreeDatabaseFromBioThread(hashtable *ht1, hashtable *ht2) {
+    size_t numkeys = hashtableSize(ht1);
+    hashtableRelease(ht1);
+    hashtableRelease(ht2);
     atomicDecr(lazyfree_objects,numkeys);
 }
 
-/* Release the skiplist mapping Redis Cluster keys to slots in the
- * lazyfree thread. */
+/* Release the skiplist mapping Redis Cluster keys to slots, or the expire
+ * index of a DB, in the lazyfree thread. */
 void lazyfreeFreeSlotsMapFromBioThread(rax *rt) {
     size_t len = rt->numele;
     raxFree(rt);
@@ -32,8 +32,26 @@
 #include <sys/uio.h>
 #include <math.h>
 #include <ctype.h>
+#include <limits.h>
+
+/* Max number of buffers we gather in a single writev(2) call. */
+#ifndef IOV_MAX
+#define IOV_MAX 1024
+#endif
 
 static void setProtocolError(const char *errstr, client *c, int pos);
+int postponeClientRead(client *c);
+static void freeClientSentReplies(client *c);
+
+/* Operation the I/O threads (and the main thread, for its own share of
+ * clients) are currently performing. While it is not IO_THREADS_OP_IDLE the
+ * code path is possibly running outside the main thread, so it must not
+ * touch global state: clients are freed asynchronously and are not queued
+ * in server.clients_pending_write. See the "Threaded I/O" section. */
+#define IO_THREADS_OP_IDLE 0
+#define IO_THREADS_OP_READ 1
+#define IO_THREADS_OP_WRITE 2
+static volatile int io_threads_op = IO_THREADS_OP_IDLE;
 
 /* Return the size consumed from the allocator, for the specified SDS string,
  * including internal fragmentation. This function is used in order to compute
@@ -54,13 +72,16 @@ size_t getStringObjectSdsUsedMemory(robj *o) {
     }
 }
 
-/* Client.reply list dup and free methods. */
+/* Client.reply list dup and free methods. The list is composed of string
+ * objects: chunks of protocol owned by the list itself, or references to
+ * shared objects, see _addReplyObjectRefToList(). */
 void *dupClientReplyValue(void *o) {
-    return sdsdup(o);
+    return dupStringObject(o);
 }
 
 void freeClientReplyValue(void *o) {
-    sdsfree(o);
+    /* NULL is the placeholder used by addDeferredMultiBulkLength(). */
+    if (o) decrRefCount(o);
 }
 
 int listMatchObjects(void *a, void *b) {
@@ -117,8 +138,12 @@ client *createClient(int fd) {
     c->slave_listening_port = 0;
     c->slave_ip[0] = '\0';
     c->slave_capa = SLAVE_CAPA_NONE;
+    c->repl_decoder = NULL;
+    c->ref_repl_buf_node = NULL;
+    c->ref_block_pos = 0;
     c->reply = listCreate();
     c->reply_bytes = 0;
+    c->reply_sent = NULL;
     c->obuf_soft_limit_reached_time = 0;
     listSetFreeMethod(c->reply,freeClientReplyValue);
     listSetDupMethod(c->reply,dupClientReplyValue);
@@ -129,6 +154,7 @@ client *createClient(int fd) {
     c->bpop.numreplicas = 0;
     c->bpop.reploffset = 0;
     c->woff = 0;
+    c->aof_woff = 0;
     c->watched_keys = listCreate();
     c->pubsub_channels = dictCreate(&objectKeyPointerValueDictType,NULL);
     c->pubsub_patterns = listCreate();
@@ -183,6 +209,7 @@ int prepareClientToWrite(client *c) {
      * receive writes at this stage. */
     if (!clientHasPendingReplies(c) &&
         !(c->flags & CLIENT_PENDING_WRITE) &&
+        io_threads_op == IO_THREADS_OP_IDLE &&
         (c->replstate == REPL_STATE_NONE ||
          (c->replstate == SLAVE_STATE_ONLINE && !c->repl_put_online_on_ack)))
     {
@@ -196,6 +223,9 @@ int prepareClientToWrite(client *c) {
         listAddNodeHead(server.clients_pending_write,c);
     }
 
+    /* Note that when called from an I/O thread we don't queue the client:
+     * this is done by the main thread once the threads are done. */
+
     /* Authorize the caller to queue in the output buffer of this client. */
     return C_OK;
 }
@@ -221,29 +251,45 @@ int _addReplyToBuffer(client *c, const char *s, size_t len) {
     return C_OK;
 }
 
+/* Return the last node of the reply list if 'len' more bytes of protocol
+ * can be appended to it, otherwise NULL is returned. Only chunks owned by
+ * the list can be extended: not the placeholders set via
+ * addDeferredMultiBulkLength(), nor the shared objects we reference. */
+static robj *_replyListAppendableTail(client *c, size_t len) {
+    listNode *ln = listLast(c->reply);
+    robj *tail = ln ? listNodeValue(ln) : NULL;
+
+    if (tail && tail->refcount == 1 && tail->encoding == OBJ_ENCODING_RAW &&
+        sdslen(tail->ptr)+len <= PROTO_REPLY_CHUNK_BYTES) return tail;
+    return NULL;
+}
+
 void _addReplyObjectToList(client *c, robj *o) {
     if (c->flags & CLIENT_CLOSE_AFTER_REPLY) return;
 
-    if (listLength(c->reply) == 0) {
-        sds s = sdsdup(o->ptr);
-        listAddNodeTail(c->reply,s);
-        c->reply_bytes += sdslen(s);
+    robj *tail = _replyListAppendableTail(c,sdslen(o->ptr));
+    if (tail) {
+        tail->ptr = sdscatsds(tail->ptr,o->ptr);
     } else {
-        listNode *ln = listLast(c->reply);
-        sds tail = listNodeValue(ln);
-
-        /* Append to this object when possible. If tail == NULL it was
-         * set via addDeferredMultiBulkLength(). */
-        if (tail && sdslen(tail)+sdslen(o->ptr) <= PROTO_REPLY_CHUNK_BYTES) {
-            tail = sdscatsds(tail,o->ptr);
-            listNodeValue(ln) = tail;
-            c->reply_bytes += sdslen(o->ptr);
-        } else {
-            sds s = sdsdup(o->ptr);
-            listAddNodeTail(c->reply,s);
-            c->reply_bytes += sdslen(s);
-        }
+        listAddNodeTail(c->reply,createRawStringObject(o->ptr,sdslen(o->ptr)));
     }
+    c->reply_bytes += sdslen(o->ptr);
+    asyncCloseClientOnOutputBufferLimitReached(c);
+}
+
+/* Add the string object 'o' itself to the reply list, incrementing its
+ * reference count, so that the payload is sent from the object instead of
+ * being copied into the output buffers.
+ *
+ * This is safe since the code modifying string values in place always calls
+ * dbUnshareStringValue() first, which creates a copy of the value as long as
+ * we hold a reference to it. */
+void _addReplyObjectRefToList(client *c, robj *o) {
+    if (c->flags & CLIENT_CLOSE_AFTER_REPLY) return;
+
+    incrRefCount(o);
+    listAddNodeTail(c->reply,o);
+    c->reply_bytes += sdslen(o->ptr);
     asyncCloseClientOnOutputBufferLimitReached(c);
 }
 
@@ -255,24 +301,13 @@ void _addReplySdsToList(client *c, sds s) {
         return;
     }
 
-    if (listLength(c->reply) == 0) {
-        listAddNodeTail(c->reply,s);
-        c->reply_bytes += sdslen(s);
+    robj *tail = _replyListAppendableTail(c,sdslen(s));
+    c->reply_bytes += sdslen(s);
+    if (tail) {
+        tail->ptr = sdscatsds(tail->ptr,s);
+        sdsfree(s);
     } else {
-        listNode *ln = listLast(c->reply);
-        sds tail = listNodeValue(ln);
-
-        /* Append to this object when possible. If tail == NULL it was
-         * set via addDeferredMultiBulkLength(). */
-        if (tail && sdslen(tail)+sdslen(s) <= PROTO_REPLY_CHUNK_BYTES) {
-            tail = sdscatsds(tail,s);
-            listNodeValue(ln) = tail;
-            c->reply_bytes += sdslen(s);
-            sdsfree(s);
-        } else {
-            listAddNodeTail(c->reply,s);
-            c->reply_bytes += sdslen(s);
-        }
+        listAddNodeTail(c->reply,createObject(OBJ_STRING,s));
     }
     asyncCloseClientOnOutputBufferLimitReached(c);
 }
@@ -280,26 +315,13 @@ void _addReplySdsToList(client *c, sds s) {
 void _addReplyStringToList(client *c, const char *s, size_t len) {
     if (c->flags & CLIENT_CLOSE_AFTER_REPLY) return;
 
-    if (listLength(c->reply) == 0) {
-        sds node = sdsnewlen(s,len);
-        listAddNodeTail(c->reply,node);
-        c->reply_bytes += len;
+    robj *tail = _replyListAppendableTail(c,len);
+    if (tail) {
+        tail->ptr = sdscatlen(tail->ptr,s,len);
     } else {
-        listNode *ln = listLast(c->reply);
-        sds tail = listNodeValue(ln);
-
-        /* Append to this object when possible. If tail == NULL it was
-         * set via addDeferredMultiBulkLength(). */
-        if (tail && sdslen(tail)+len <= PROTO_REPLY_CHUNK_BYTES) {
-            tail = sdscatlen(tail,s,len);
-            listNodeValue(ln) = tail;
-            c->reply_bytes += len;
-        } else {
-            sds node = sdsnewlen(s,len);
-            listAddNodeTail(c->reply,node);
-            c->reply_bytes += len;
-        }
+        listAddNodeTail(c->reply,createRawStringObject(s,len));
     }
+    c->reply_bytes += len;
     asyncCloseClientOnOutputBufferLimitReached(c);
 }
 
@@ -339,6 +361,11 @@ void addReply(client *c, robj *obj) {
         if (_addReplyToBuffer(c,obj->ptr,sdslen(obj->ptr)) != C_OK)
             _addReplyObjectToList(c,obj);
         decrRefCount(obj);
+    } else if (obj->encoding == OBJ_ENCODING_BITMAP) {
+        /* Compressed bitmaps are big: send the decoded copy itself. */
+        obj = getDecodedObject(obj);
+        _addReplyObjectRefToList(c,obj);
+        decrRefCount(obj);
     } else {
         serverPanic("Wrong obj->encoding in addReply()");
     }
@@ -431,23 +458,26 @@ void *addDeferredMultiBulkLength(client *c) {
 /* Populate the length object and try gluing it to the next chunk. */
 void setDeferredMultiBulkLength(client *c, void *node, long length) {
     listNode *ln = (listNode*)node;
-    sds len, next;
+    robj *len, *next;
 
     /* Abort when *node is NULL: when the client should not accept writes
      * we return NULL in addDeferredMultiBulkLength() */
     if (node == NULL) return;
 
-    len = sdscatprintf(sdsnewlen("*",1),"%ld\r\n",length);
+    len = createObject(OBJ_STRING,
+        sdscatprintf(sdsnewlen("*",1),"%ld\r\n",length));
     listNodeValue(ln) = len;
-    c->reply_bytes += sdslen(len);
+    c->reply_bytes += sdslen(len->ptr);
     if (ln->next != NULL) {
         next = listNodeValue(ln->next);
 
-        /* Only glue when the next node is non-NULL (an sds in this case) */
-        if (next != NULL) {
-            len = sdscatsds(len,next);
+        /* Only glue when the next node is a chunk owned by the list, not
+         * a placeholder or a reference to a shared object. */
+        if (next != NULL && next->refcount == 1 &&
+            next->encoding == OBJ_ENCODING_RAW)
+        {
+            len->ptr = sdscatsds(len->ptr,next->ptr);
             listDelNode(c->reply,ln->next);
-            listNodeValue(ln) = len;
             /* No need to update c->reply_bytes: we are just moving the same
              * amount of bytes from one node to another. */
         }
@@ -525,6 +555,8 @@ void addReplyBulkLen(client *c, robj *obj) {
 
     if (sdsEncodedObject(obj)) {
         len = sdslen(obj->ptr);
+    } else if (obj->encoding == OBJ_ENCODING_BITMAP) {
+        len = roaringLen(obj->ptr);
     } else {
         long n = (long)obj->ptr;
 
@@ -545,10 +577,18 @@ void addReplyBulkLen(client *c, robj *obj) {
         addReplyLongLongWithPrefix(c,len,'$');
 }
 
-/* Add a Redis Object as a bulk reply */
+/* Add a Redis Object as a bulk reply. Big string values are not copied
+ * into the output buffers: the reply references the object itself. */
 void addReplyBulk(client *c, robj *obj) {
     addReplyBulkLen(c,obj);
-    addReply(c,obj);
+    if (sdsEncodedObject(obj) &&
+        sdslen(obj->ptr) >= PROTO_REPLY_MIN_REF_BYTES)
+    {
+        if (prepareClientToWrite(c) == C_OK)
+            _addReplyObjectRefToList(c,obj);
+    } else {
+        addReply(c,obj);
+    }
     addReply(c,shared.crlf);
 }
 
@@ -593,12 +633,45 @@ void copyClientOutputBuffer(client *dst, client *src) {
     memcpy(dst->buf,src->buf,src->bufpos);
     dst->bufpos = src->bufpos;
     dst->reply_bytes = src->reply_bytes;
+    copyReplicationBufferRef(dst,src);
+}
+
+/* Replace the shared objects referenced by the output buffers of the clients
+ * with private copies. This is needed before handing a database to the
+ * lazyfree thread, that would otherwise decrement the reference count of
+ * objects that the main thread may release at the same time. */
+void unshareClientsReplyObjects(void) {
+    listIter li, ri;
+    listNode *ln, *rn;
+
+    listRewind(server.clients,&li);
+    while((ln = listNext(&li))) {
+        client *c = listNodeValue(ln);
+
+        listRewind(c->reply,&ri);
+        while((rn = listNext(&ri))) {
+            robj *o = listNodeValue(rn);
+
+            if (o && o->refcount > 1) {
+                listNodeValue(rn) = dupStringObject(o);
+                decrRefCount(o);
+            }
+        }
+    }
 }
 
 /* Return true if the specified client has pending reply buffers to write to
- * the socket. */
+ * the socket. For slaves this includes the part of the replication buffer
+ * not yet sent. */
 int clientHasPendingReplies(client *c) {
-    return c->bufpos || listLength(c->reply);
+    if (c->bufpos || listLength(c->reply)) return 1;
+    if (c->ref_repl_buf_node) {
+        listNode *ln = listLast(server.repl_buffer_blocks);
+        replBufBlock *tail = listNodeValue(ln);
+
+        return ln != c->ref_repl_buf_node || c->ref_block_pos < tail->used;
+    }
+    return 0;
 }
 
 #define MAX_ACCEPTS_PER_CALL 1000
@@ -762,6 +835,14 @@ void unlinkClient(client *c) {
         c->flags &= ~CLIENT_PENDING_WRITE;
     }
 
+    /* Remove from the list of pending reads if needed. */
+    if (c->flags & CLIENT_PENDING_READ) {
+        ln = listSearchKey(server.clients_pending_read,c);
+        serverAssert(ln != NULL);
+        listDelNode(server.clients_pending_read,ln);
+        c->flags &= ~CLIENT_PENDING_READ;
+    }
+
     /* When client was just unblocked because of a blocking operation,
      * remove it from the list of unblocked clients. */
     if (c->flags & CLIENT_UNBLOCKED) {
@@ -802,6 +883,7 @@ void freeClient(client *c) {
     sdsfree(c->querybuf);
     sdsfree(c->pending_querybuf);
     c->querybuf = NULL;
+    replicationFreeStreamDecoder(c);
 
     /* Deallocate structures used to block on blocking ops. */
     if (c->flags & CLIENT_BLOCKED) unblockClient(c);
@@ -819,6 +901,7 @@ void freeClient(client *c) {
 
     /* Free data structures. */
     listRelease(c->reply);
+    freeClientSentReplies(c);
     freeClientArgv(c);
 
     /* Unlink the client: this will close the socket, remove the I/O
@@ -833,6 +916,7 @@ void freeClient(client *c) {
             if (c->repldbfd != -1) close(c->repldbfd);
             if (c->replpreamble) sdsfree(c->replpreamble);
         }
+        releaseReplicationBufferRef(c);
         list *l = (c->flags & CLIENT_MONITOR) ? server.monitors : server.slaves;
         ln = listSearchKey(l,c);
         serverAssert(ln != NULL);
@@ -871,9 +955,34 @@ void freeClient(client *c) {
  * a context where calling freeClient() is not possible, because the client
  * should be valid for the continuation of the flow of the program. */
 void freeClientAsync(client *c) {
+    /* We need to handle concurrent access to the server.clients_to_close list
+     * only in the freeClientAsync() function, since it's the only function
+     * that may access the list while Redis uses I/O threads. All the other
+     * accesses are in the context of the main thread while the other threads
+     * are idle. */
+    static pthread_mutex_t async_free_queue_mutex = PTHREAD_MUTEX_INITIALIZER;
+
     if (c->flags & CLIENT_CLOSE_ASAP || c->flags & CLIENT_LUA) return;
     c->flags |= CLIENT_CLOSE_ASAP;
+    if (server.io_threads_num == 1) {
+        /* no need to bother with locking if there's just one thread (the
+         * main thread) */
+        listAddNodeTail(server.clients_to_close,c);
+        return;
+    }
+    pthread_mutex_lock(&async_free_queue_mutex);
     listAddNodeTail(server.clients_to_close,c);
+    pthread_mutex_unlock(&async_free_queue_mutex);
+}
+
+/* Free the client right away if we are in the main thread, otherwise (when
+ * the I/O threads are working) schedule it to be freed by the main thread
+ * later. */
+static void freeClientFromIOContext(client *c) {
+    if (io_threads_op == IO_THREADS_OP_IDLE)
+        freeClient(c);
+    else
+        freeClientAsync(c);
 }
 
 void freeClientsInAsyncFreeQueue(void) {
@@ -887,15 +996,187 @@ void freeClientsInAsyncFreeQueue(void) {
     }
 }
 
+/* Remove the node 'ln', that was sent to the client, from the reply list.
+ *
+ * When called from an I/O thread, shared objects are not released but
+ * moved to c->reply_sent: other threads may be sending the same object to
+ * other clients at the same time, and the reference count is not updated
+ * atomically. The main thread releases them once the threads are done. */
+static void _delSentReplyNode(client *c, listNode *ln) {
+    robj *o = listNodeValue(ln);
+
+    if (io_threads_op != IO_THREADS_OP_IDLE && o->refcount > 1) {
+        if (c->reply_sent == NULL) {
+            c->reply_sent = listCreate();
+            listSetFreeMethod(c->reply_sent,decrRefCountVoid);
+        }
+        listAddNodeTail(c->reply_sent,o);
+        listNodeValue(ln) = NULL;
+    }
+    listDelNode(c->reply,ln);
+}
+
+/* Release the shared objects that I/O threads sent to the client. */
+static void freeClientSentReplies(client *c) {
+    if (c->reply_sent == NULL) return;
+    listRelease(c->reply_sent);
+    c->reply_sent = NULL;
+}
+
+/* Send the static reply buffer and as many nodes of the reply list as
+ * possible (up to IOV_MAX buffers or NET_MAX_WRITES_PER_EVENT bytes) with a
+ * single writev(2) call, then release what was fully sent. Empty nodes are
+ * skipped. Returns the writev() return value. */
+static ssize_t _writevToClient(int fd, client *c) {
+    struct iovec iov[IOV_MAX];
+    int iovcnt = 0;
+    size_t iov_bytes_len = 0;
+    size_t offset;
+    ssize_t nwritten, remaining;
+    listIter li;
+    listNode *ln;
+
+    /* The static buffer is always sent before the reply list. */
+    if (c->bufpos > 0) {
+        iov[iovcnt].iov_base = c->buf+c->sentlen;
+        iov[iovcnt].iov_len = c->bufpos-c->sentlen;
+        iov_bytes_len += iov[iovcnt++].iov_len;
+    }
+
+    /* c->sentlen refers to the first node only if the buffer is empty. */
+    offset = c->bufpos > 0 ? 0 : c->sentlen;
+    listRewind(c->reply,&li);
+    while((ln = listNext(&li)) && iovcnt < IOV_MAX &&
+          iov_bytes_len < NET_MAX_WRITES_PER_EVENT)
+    {
+        robj *o = listNodeValue(ln);
+        size_t objlen = sdslen(o->ptr);
+
+        if (objlen == 0) continue;
+        iov[iovcnt].iov_base = (char*)o->ptr+offset;
+        iov[iovcnt].iov_len = objlen-offset;
+        iov_bytes_len += iov[iovcnt++].iov_len;
+        offset = 0;
+    }
+
+    nwritten = writev(fd,iov,iovcnt);
+    if (nwritten <= 0) return nwritten;
+    atomicIncr(server.stat_writev_calls,1);
+    atomicIncr(server.stat_writev_iovecs,iovcnt);
+
+    /* Consume the static buffer first, then release the list nodes that
+     * were fully sent, remembering the offset inside the last one. */
+    remaining = nwritten;
+    if (c->bufpos > 0) {
+        ssize_t buflen = c->bufpos-c->sentlen;
+
+        if (remaining < buflen) {
+            c->sentlen += remaining;
+            return nwritten;
+        }
+        c->bufpos = 0;
+        c->sentlen = 0;
+        remaining -= buflen;
+    }
+    while(remaining > 0) {
+        ln = listFirst(c->reply);
+        robj *o = listNodeValue(ln);
+        size_t objlen = sdslen(o->ptr);
+
+        if (remaining < (ssize_t)(objlen-c->sentlen)) {
+            c->sentlen += remaining;
+            break;
+        }
+        remaining -= objlen-c->sentlen;
+        _delSentReplyNode(c,ln);
+        c->sentlen = 0;
+        c->reply_bytes -= objlen;
+    }
+    /* If there are no longer objects in the list, we expect
+     * the count of reply bytes to be exactly zero. */
+    if (listLength(c->reply) == 0)
+        serverAssert(c->reply_bytes == 0);
+    return nwritten;
+}
+
+/* Send the replication buffer to the slave 'c', from the block it references
+ * and up to IOV_MAX blocks or NET_MAX_WRITES_PER_EVENT bytes, with a single
+ * writev(2) call. The reference is then moved to the block to send next, so
+ * that the blocks already sent can be released. Returns the writev() return
+ * value. */
+static ssize_t _writeReplBufferToClient(int fd, client *c) {
+    struct iovec iov[IOV_MAX];
+    int iovcnt = 0;
+    size_t iov_bytes_len = 0, pos = c->ref_block_pos;
+    ssize_t nwritten, remaining;
+    int moved = 0;
+    listNode *ln = c->ref_repl_buf_node;
+    replBufBlock *o;
+
+    while(ln && iovcnt < IOV_MAX && iov_bytes_len < NET_MAX_WRITES_PER_EVENT) {
+        o = listNodeValue(ln);
+        if (o->used > pos) {
+            iov[iovcnt].iov_base = o->buf+pos;
+            iov[iovcnt].iov_len = o->used-pos;
+            iov_bytes_len += iov[iovcnt++].iov_len;
+        }
+        pos = 0;
+        ln = listNextNode(ln);
+    }
+
+    nwritten = writev(fd,iov,iovcnt);
+    if (nwritten <= 0) return nwritten;
+    atomicIncr(server.stat_writev_calls,1);
+    atomicIncr(server.stat_writev_iovecs,iovcnt);
+
+    remaining = nwritten;
+    ln = c->ref_repl_buf_node;
+    o = listNodeValue(ln);
+    while(1) {
+        size_t left = o->used-c->ref_block_pos;
+
+        if (remaining < (ssize_t)left) {
+            c->ref_block_pos += remaining;
+            break;
+        }
+        remaining -= left;
+        c->ref_block_pos = o->used;
+        if (listNextNode(ln) == NULL) break;
+
+        /* Move the reference to the next block. */
+        o->refcount--;
+        ln = listNextNode(ln);
+        o = listNodeValue(ln);
+        o->refcount++;
+        c->ref_repl_buf_node = ln;
+        c->ref_block_pos = 0;
+        moved = 1;
+    }
+    /* The blocks the slave sent may be no longer needed. */
+    if (moved)
+        incrementalTrimReplicationBacklog(REPL_BUFFER_TRIM_BLOCKS_PER_CALL);
+    return nwritten;
+}
+
 /* Write data in output buffers to client. Return C_OK if the client
- * is still valid after the call, C_ERR if it was freed. */
+ * is still valid after the call, C_ERR if it was freed.
+ *
+ * When the reply list is not empty, the static buffer and the list nodes are
+ * gathered into a single writev(2) call, so that replies split across many
+ * PROTO_REPLY_CHUNK_BYTES nodes, or many pipelined replies, cost just a few
+ * system calls. */
 int writeToClient(int fd, client *c, int handler_installed) {
     ssize_t nwritten = 0, totwritten = 0;
-    size_t objlen;
-    sds o;
+    robj *o;
 
     while(clientHasPendingReplies(c)) {
-        if (c->bufpos > 0) {
+        if (c->bufpos == 0 && listLength(c->reply) == 0) {
+            /* Slaves send the replication buffer once their own output
+             * buffers are empty. */
+            nwritten = _writeReplBufferToClient(fd,c);
+            if (nwritten <= 0) break;
+            totwritten += nwritten;
+        } else if (listLength(c->reply) == 0) {
             nwritten = write(fd,c->buf+c->sentlen,c->bufpos-c->sentlen);
             if (nwritten <= 0) break;
             c->sentlen += nwritten;
@@ -908,29 +1189,19 @@ int writeToClient(int fd, client *c, int handler_installed) {
                 c->sentlen = 0;
             }
         } else {
-            o = listNodeValue(listFirst(c->reply));
-            objlen = sdslen(o);
-
-            if (objlen == 0) {
-                listDelNode(c->reply,listFirst(c->reply));
-                continue;
+            /* Drop empty nodes on the head of the list, this way we never
+             * call writev() with nothing to send. */
+            if (c->bufpos == 0) {
+                o = listNodeValue(listFirst(c->reply));
+                if (sdslen(o->ptr) == 0) {
+                    _delSentReplyNode(c,listFirst(c->reply));
+                    continue;
+                }
             }
 
-            nwritten = write(fd, o + c->sentlen, objlen - c->sentlen);
+            nwritten = _writevToClient(fd,c);
             if (nwritten <= 0) break;
-            c->sentlen += nwritten;
             totwritten += nwritten;
-
-            /* If we fully sent the object on head go to the next one */
-            if (c->sentlen == objlen) {
-                listDelNode(c->reply,listFirst(c->reply));
-                c->sentlen = 0;
-                c->reply_bytes -= objlen;
-                /* If there are no longer objects in the list, we expect
-                 * the count of reply bytes to be exactly zero. */
-                if (listLength(c->reply) == 0)
-                    serverAssert(c->reply_bytes == 0);
-            }
         }
         /* Note that we avoid to send more than NET_MAX_WRITES_PER_EVENT
          * bytes, in a single threaded server it's a good idea to serve
@@ -944,14 +1215,14 @@ int writeToClient(int fd, client *c, int handler_installed) {
             (server.maxmemory == 0 ||
              zmalloc_used_memory() < server.maxmemory)) break;
     }
-    server.stat_net_output_bytes += totwritten;
+    atomicIncr(server.stat_net_output_bytes,totwritten);
     if (nwritten == -1) {
         if (errno == EAGAIN) {
             nwritten = 0;
         } else {
             serverLog(LL_VERBOSE,
                 "Error writing to client: %s", strerror(errno));
-            freeClient(c);
+            freeClientFromIOContext(c);
             return C_ERR;
         }
     }
@@ -968,7 +1239,7 @@ int writeToClient(int fd, client *c, int handler_installed) {
 
         /* Close connection after entire reply has been sent. */
         if (c->flags & CLIENT_CLOSE_AFTER_REPLY) {
-            freeClient(c);
+            freeClientFromIOContext(c);
             return C_ERR;
         }
     }
@@ -977,9 +1248,21 @@ int writeToClient(int fd, client *c, int handler_installed) {
 
 /* Write event handler. Just send data to the client. */
 void sendReplyToClient(aeEventLoop *el, int fd, void *privdata, int mask) {
+    client *c = privdata;
     UNUSED(el);
     UNUSED(mask);
-    writeToClient(fd,privdata,1);
+
+    /* The new replies must wait for the AOF fsync: stop polling the socket,
+     * the client is served with the other pending writes once it's done. */
+    if (clientWaitsAofFsync(c)) {
+        aeDeleteFileEvent(server.el,fd,AE_WRITABLE);
+        if (!(c->flags & CLIENT_PENDING_WRITE)) {
+            c->flags |= CLIENT_PENDING_WRITE;
+            listAddNodeHead(server.clients_pending_write,c);
+        }
+        return;
+    }
+    writeToClient(fd,c,1);
 }
 
 /* This function is called just before entering the event loop, in the hope
@@ -994,6 +1277,9 @@ int handleClientsWithPendingWrites(void) {
     listRewind(server.clients_pending_write,&li);
     while((ln = listNext(&li))) {
         client *c = listNodeValue(ln);
+
+        /* Replies waiting for the AOF fsync stay pending. */
+        if (clientWaitsAofFsync(c)) continue;
         c->flags &= ~CLIENT_PENDING_WRITE;
         listDelNode(server.clients_pending_write,ln);
 
@@ -1284,16 +1570,149 @@ int processMultibulkBuffer(client *c) {
     return C_ERR;
 }
 
+/* Commands looked ahead in the query buffer of the client being served,
+ * see lookaheadPipelinedCommands(). */
+static struct {
+    client *c;          /* Client the batch belongs to, or NULL. */
+    int count;          /* Number of commands in the batch. */
+    int next;           /* Index of the next command to execute. */
+    struct redisCommand *cmd[PROTO_PIPELINE_BATCH]; /* Resolved commands. */
+} pipelineBatch;
+
+/* Parse the multi bulk command at 'p' without consuming it. The first
+ * 'maxargs' arguments are returned by reference in 'argv' and 'argvlen',
+ * and the total number of arguments in 'argc'. The length of the command in
+ * bytes is returned, or zero if the 'len' bytes at 'p' don't start with a
+ * complete and valid multi bulk command. */
+static size_t peekMultibulkCommand(const char *p, size_t len, int maxargs,
+                                   const char **argv, size_t *argvlen,
+                                   int *argc)
+{
+    const char *s = p, *end = p+len, *newline;
+    long long ll, j;
+
+    if (len == 0 || *s != '*') return 0;
+    newline = memchr(s,'\r',end-s);
+    if (newline == NULL || newline+1 >= end) return 0;
+    if (!string2ll(s+1,newline-(s+1),&ll) || ll <= 0 || ll > 1024*1024)
+        return 0;
+    *argc = ll;
+    s = newline+2;
+
+    for (j = 0; j < *argc; j++) {
+        if (s >= end || *s != '$') return 0;
+        newline = memchr(s,'\r',end-s);
+        if (newline == NULL || newline+1 >= end) return 0;
+        if (!string2ll(s+1,newline-(s+1),&ll) || ll < 0 ||
+            ll > 512*1024*1024) return 0;
+        s = newline+2;
+        if ((size_t)(end-s) < (size_t)ll+2) return 0;
+        if (j < maxargs) {
+            argv[j] = s;
+            argvlen[j] = ll;
+        }
+        s += ll+2;
+    }
+    return s-p;
+}
+
+/* Called before a client executes a command when more data follows it in
+ * the query buffer, that is, when the client is sending pipelined commands.
+ *
+ * Up to PROTO_PIPELINE_BATCH complete commands are looked ahead in the
+ * query buffer: the command table is searched just once for every distinct
+ * command name, and the keys of all the commands are prefetched together
+ * with hashtablePrefetchBatch(), so that executing the batch does not pay
+ * the cache misses on the keyspace one command at a time. Nothing is
+ * consumed: the commands are parsed and executed as usual, using the command
+ * table entries resolved here, see nextPipelinedCommand(). */
+static void lookaheadPipelinedCommands(client *c) {
+    const char *p = c->querybuf, *argv[PROTO_PIPELINE_MAX_ARGS];
+    size_t len = sdslen(c->querybuf), cmdlen;
+    size_t argvlen[PROTO_PIPELINE_MAX_ARGS];
+    hashtable *keys = c->db->dict;
+    uint64_t hashes[PROTO_PIPELINE_BATCH*PROTO_PIPELINE_MAX_ARGS];
+    unsigned long numkeys = 0;
+    int argc, j;
+
+    pipelineBatch.c = c;
+    pipelineBatch.count = 0;
+    pipelineBatch.next = 0;
+    while(pipelineBatch.count < PROTO_PIPELINE_BATCH &&
+          (cmdlen = peekMultibulkCommand(p,len,PROTO_PIPELINE_MAX_ARGS,
+                                         argv,argvlen,&argc)))
+    {
+        struct redisCommand *cmd = NULL;
+
+        for (j = 0; j < pipelineBatch.count; j++) {
+            struct redisCommand *prev = pipelineBatch.cmd[j];
+
+            if (prev && strlen(prev->name) == argvlen[0] &&
+                !strncasecmp(prev->name,argv[0],argvlen[0]))
+            {
+                cmd = prev;
+                break;
+            }
+        }
+        if (cmd == NULL) {
+            sds name = sdsnewlen(argv[0],argvlen[0]);
+            cmd = lookupCommand(name);
+            sdsfree(name);
+        }
+        pipelineBatch.cmd[pipelineBatch.count++] = cmd;
+
+        if (cmd && cmd->firstkey > 0) {
+            int last = cmd->lastkey < 0 ? argc+cmd->lastkey : cmd->lastkey;
+
+            for (j = cmd->firstkey;
+                 j <= last && j < argc && j < PROTO_PIPELINE_MAX_ARGS;
+                 j += cmd->keystep)
+            {
+                hashes[numkeys++] = dictGenHashFunction(argv[j],argvlen[j]);
+            }
+        }
+        p += cmdlen;
+        len -= cmdlen;
+    }
+    if (numkeys) hashtablePrefetchBatch(keys,hashes,numkeys);
+}
+
+/* Return the command table entry of the command the client is about to
+ * execute if it was resolved by lookaheadPipelinedCommands(), otherwise
+ * NULL is returned and a new batch is looked ahead if more commands follow
+ * in the query buffer. */
+static struct redisCommand *nextPipelinedCommand(client *c) {
+    struct redisCommand *cmd;
+
+    if (pipelineBatch.c != c || pipelineBatch.next == pipelineBatch.count) {
+        if (c->reqtype == PROTO_REQ_MULTIBULK && sdslen(c->querybuf))
+            lookaheadPipelinedCommands(c);
+        return NULL;
+    }
+    cmd = pipelineBatch.cmd[pipelineBatch.next++];
+    if (cmd && strcasecmp(c->argv[0]->ptr,cmd->name)) cmd = NULL;
+    return cmd;
+}
+
 /* This function is called every time, in the client structure 'c', there is
  * more query buffer to process, because we read more data from the socket
  * or because a client was blocked and later reactivated, so there could be
- * pending query buffer, already representing a full command, to process. */
+ * pending query buffer, already representing a full command, to process.
+ *
+ * When called from an I/O thread (the client is flagged CLIENT_PENDING_READ)
+ * the function only parses the next command, flags the client with
+ * CLIENT_PENDING_COMMAND and returns: the command is executed later by the
+ * main thread, that calls this function again. */
 void processInputBuffer(client *c) {
-    server.current_client = c;
+    int io_thread = c->flags & CLIENT_PENDING_READ;
+
+    if (!io_thread) server.current_client = c;
     /* Keep processing while there is something in the input buffer */
-    while(sdslen(c->querybuf)) {
-        /* Return if clients are paused. */
-        if (!(c->flags & CLIENT_SLAVE) && clientsArePaused()) break;
+    while(sdslen(c->querybuf) || (c->flags & CLIENT_PENDING_COMMAND)) {
+        /* Return if clients are paused. Pausing is checked again by the
+         * main thread before executing a command parsed by an I/O thread. */
+        if (!io_thread && !(c->flags & CLIENT_SLAVE) && clientsArePaused())
+            break;
 
         /* Immediately abort if the client is in the middle of something. */
         if (c->flags & CLIENT_BLOCKED) break;
@@ -1305,48 +1724,81 @@ void processInputBuffer(client *c) {
          * The same applies for clients we want to terminate ASAP. */
         if (c->flags & (CLIENT_CLOSE_AFTER_REPLY|CLIENT_CLOSE_ASAP)) break;
 
-        /* Determine request type when unknown. */
-        if (!c->reqtype) {
-            if (c->querybuf[0] == '*') {
-                c->reqtype = PROTO_REQ_MULTIBULK;
+        if (c->flags & CLIENT_PENDING_COMMAND) {
+            /* The argument vector was already populated by an I/O thread. */
+            if (io_thread) break;
+            c->flags &= ~CLIENT_PENDING_COMMAND;
+        } else {
+            /* Determine request type when unknown. */
+            if (!c->reqtype) {
+                if (c->querybuf[0] == '*') {
+                    c->reqtype = PROTO_REQ_MULTIBULK;
+                } else {
+                    c->reqtype = PROTO_REQ_INLINE;
+                }
+            }
+
+            if (c->reqtype == PROTO_REQ_INLINE) {
+                if (processInlineBuffer(c) != C_OK) break;
+            } else if (c->reqtype == PROTO_REQ_MULTIBULK) {
+                if (processMultibulkBuffer(c) != C_OK) break;
             } else {
-                c->reqtype = PROTO_REQ_INLINE;
+                serverPanic("Unknown request type");
             }
-        }
 
-        if (c->reqtype == PROTO_REQ_INLINE) {
-            if (processInlineBuffer(c) != C_OK) break;
-        } else if (c->reqtype == PROTO_REQ_MULTIBULK) {
-            if (processMultibulkBuffer(c) != C_OK) break;
-        } else {
-            serverPanic("Unknown request type");
-        }
+            /* Multibulk processing could see a <= 0 length. */
+            if (c->argc == 0) {
+                resetClient(c);
+                continue;
+            }
 
-        /* Multibulk processing could see a <= 0 length. */
-        if (c->argc == 0) {
-            resetClient(c);
-        } else {
-            /* Only reset the client when the command was executed. */
-            if (processCommand(c) == C_OK) {
-                if (c->flags & CLIENT_MASTER && !(c->flags & CLIENT_MULTI)) {
-                    /* Update the applied replication offset of our master. */
-                    c->reploff = c->read_reploff - sdslen(c->querybuf);
-                }
+            /* If we are in the context of an I/O thread, we can't really
+             * execute the command here. All we can do is to flag the client
+             * as one that needs to process the command. */
+            if (io_thread) {
+                c->flags |= CLIENT_PENDING_COMMAND;
+                break;
+            }
+        }
 
-                /* Don't reset the client structure for clients blocked in a
-                 * module blocking command, so that the reply callback will
-                 * still be able to access the client argv and argc field.
-                 * The client will be reset in unblockClientFromModule(). */
-                if (!(c->flags & CLIENT_BLOCKED) || c->btype != BLOCKED_MODULE)
-                    resetClient(c);
+        /* Only reset the client when the command was executed. */
+        c->cmd = nextPipelinedCommand(c);
+        if (processCommand(c) == C_OK) {
+            if (c->flags & CLIENT_MASTER && !(c->flags & CLIENT_MULTI)) {
+                /* Update the applied replication offset of our master. */
+                c->reploff = c->read_reploff - sdslen(c->querybuf);
             }
-            /* freeMemoryIfNeeded may flush slave output buffers. This may
-             * result into a slave, that may be the active client, to be
-             * freed. */
-            if (server.current_client == NULL) break;
+
+            /* Don't reset the client structure for clients blocked in a
+             * module blocking command, so that the reply callback will
+             * still be able to access the client argv and argc field.
+             * The client will be reset in unblockClientFromModule(). */
+            if (!(c->flags & CLIENT_BLOCKED) || c->btype != BLOCKED_MODULE)
+                resetClient(c);
         }
+        /* freeMemoryIfNeeded may flush slave output buffers. This may
+         * result into a slave, that may be the active client, to be
+         * freed. */
+        if (server.current_client == NULL) break;
+    }
+    if (!io_thread) {
+        server.current_client = NULL;
+        pipelineBatch.c = NULL;
+    }
+}
+
+/* Like processInputBuffer(), for the client of our master: the part of the
+ * replication stream that was applied, that is still at the start of the
+ * pending buffer, is propagated to the sub-slaves and to the backlog. */
+void processMasterInputBuffer(client *c) {
+    size_t prev_offset = c->reploff;
+    processInputBuffer(c);
+    size_t applied = c->reploff - prev_offset;
+    if (applied) {
+        replicationFeedSlavesFromMasterStream(server.slaves,
+                c->pending_querybuf, applied);
+        sdsrange(c->pending_querybuf,applied,-1);
     }
-    server.current_client = NULL;
 }
 
 void readQueryFromClient(aeEventLoop *el, int fd, void *privdata, int mask) {
@@ -1356,6 +1808,10 @@ void readQueryFromClient(aeEventLoop *el, int fd, void *privdata, int mask) {
     UNUSED(el);
     UNUSED(mask);
 
+    /* Check if we want to read from the client later when exiting from
+     * the event loop. This is the case if threaded I/O is enabled. */
+    if (postponeClientRead(c)) return;
+
     readlen = PROTO_IOBUF_LEN;
     /* If this is a multi bulk request, and we are processing a bulk reply
      * that is large enough, try to maximize the probability that the query
@@ -1380,14 +1836,32 @@ void readQueryFromClient(aeEventLoop *el, int fd, void *privdata, int mask) {
             return;
         } else {
             serverLog(LL_VERBOSE, "Reading from client: %s",strerror(errno));
-            freeClient(c);
+            freeClientFromIOContext(c);
             return;
         }
     } else if (nread == 0) {
         serverLog(LL_VERBOSE, "Client closed connection");
-        freeClient(c);
+        freeClientFromIOContext(c);
         return;
-    } else if (c->flags & CLIENT_MASTER) {
+    }
+    atomicIncr(server.stat_net_input_bytes,nread);
+
+    /* If the master sends us the stream compressed, replace what we read
+     * with the part of the stream it carries. */
+    if (c->repl_decoder) {
+        long long decoded;
+
+        decoded = replicationDecodeMasterStream(c,c->querybuf+qblen,nread);
+        if (decoded == -1) {
+            serverLog(LL_WARNING,"Invalid compressed replication stream "
+                                 "received from the master");
+            freeClientAsync(c);
+            return;
+        }
+        nread = decoded;
+    }
+
+    if (c->flags & CLIENT_MASTER) {
         /* Append the query buffer to the pending (not applied) buffer
          * of the master. We'll use this buffer later in order to have a
          * copy of the string applied by the last command executed. */
@@ -1398,7 +1872,6 @@ void readQueryFromClient(aeEventLoop *el, int fd, void *privdata, int mask) {
     sdsIncrLen(c->querybuf,nread);
     c->lastinteraction = server.unixtime;
     if (c->flags & CLIENT_MASTER) c->read_reploff += nread;
-    server.stat_net_input_bytes += nread;
     if (sdslen(c->querybuf) > server.client_max_querybuf_len) {
         sds ci = catClientInfoString(sdsempty(),c), bytes = sdsempty();
 
@@ -1406,7 +1879,7 @@ void readQueryFromClient(aeEventLoop *el, int fd, void *privdata, int mask) {
         serverLog(LL_WARNING,"Closing client that reached max query buffer length: %s (qbuf initial bytes: %s)", ci, bytes);
         sdsfree(ci);
         sdsfree(bytes);
-        freeClient(c);
+        freeClientFromIOContext(c);
         return;
     }
 
@@ -1419,14 +1892,7 @@ void readQueryFromClient(aeEventLoop *el, int fd, void *privdata, int mask) {
     if (!(c->flags & CLIENT_MASTER)) {
         processInputBuffer(c);
     } else {
-        size_t prev_offset = c->reploff;
-        processInputBuffer(c);
-        size_t applied = c->reploff - prev_offset;
-        if (applied) {
-            replicationFeedSlavesFromMasterStream(server.slaves,
-                    c->pending_querybuf, applied);
-            sdsrange(c->pending_querybuf,applied,-1);
-        }
+        processMasterInputBuffer(c);
     }
 }
 
@@ -1805,17 +2271,20 @@ void rewriteClientCommandArgument(client *c, int i, robj *newval) {
  * The function returns the total sum of the length of all the objects
  * stored in the output list, plus the memory used to allocate every
  * list node. The static reply buffer is not taken into account since it
- * is allocated anyway.
+ * is allocated anyway. For slaves, the part of the replication buffer they
+ * still have to send is accounted as well, even if it is shared with the
+ * backlog and the other slaves.
  *
  * Note: this function is very fast so can be called as many time as
  * the caller wishes. The main usage of this function currently is
  * enforcing the client output length limits. */
 unsigned long getClientOutputBufferMemoryUsage(client *c) {
-    unsigned long list_item_size = sizeof(listNode)+5;
+    unsigned long list_item_size = sizeof(listNode)+sizeof(robj)+5;
     /* The +5 above means we assume an sds16 hdr, may not be true
      * but is not going to be a problem. */
 
-    return c->reply_bytes + (list_item_size*listLength(c->reply));
+    return c->reply_bytes + (list_item_size*listLength(c->reply)) +
+           getSlaveReplicationBufferPending(c);
 }
 
 /* Get the class of a client, used in order to enforce limits to different
@@ -1906,7 +2375,8 @@ int checkClientOutputBufferLimits(client *c) {
  * lower level functions pushing data inside the client output buffers. */
 void asyncCloseClientOnOutputBufferLimitReached(client *c) {
     serverAssert(c->reply_bytes < SIZE_MAX-(1024*64));
-    if (c->reply_bytes == 0 || c->flags & CLIENT_CLOSE_ASAP) return;
+    if ((c->reply_bytes == 0 && c->ref_repl_buf_node == NULL) ||
+        c->flags & CLIENT_CLOSE_ASAP) return;
     if (checkClientOutputBufferLimits(c)) {
         sds client = catClientInfoString(sdsempty(),c);
 
@@ -1996,6 +2466,9 @@ int clientsArePaused(void) {
     return server.clients_paused;
 }
 
+/* True while processEventsWhileBlocked() is running. */
+static int ProcessingEventsWhileBlocked = 0;
+
 /* This function is called by Redis in order to process a few events from
  * time to time while blocked into some not interruptible operation.
  * This allows to reply to clients with the -LOADING error while loading the
@@ -2011,6 +2484,13 @@ int clientsArePaused(void) {
 int processEventsWhileBlocked(void) {
     int iterations = 4; /* See the function top-comment. */
     int count = 0;
+
+    /* Note: when we are processing events while blocked (for instance during
+     * busy Lua scripts), we set a global flag. When such flag is set, we
+     * avoid handling the read part of clients using threaded I/O, since
+     * beforeSleep() is not called here and postponed reads would never be
+     * served. */
+    ProcessingEventsWhileBlocked = 1;
     while (iterations--) {
         int events = 0;
         events += aeProcessEvents(server.el, AE_FILE_EVENTS|AE_DONT_WAIT);
@@ -2018,5 +2498,334 @@ int processEventsWhileBlocked(void) {
         if (!events) break;
         count += events;
     }
+    ProcessingEventsWhileBlocked = 0;
+    return count;
+}
+
+/* ==========================================================================
+ * Threaded I/O
+ * ========================================================================== */
+
+/* When io-threads is greater than one, readQueryFromClient() does not read
+ * from the socket directly: the client is just flagged CLIENT_PENDING_READ
+ * and queued in server.clients_pending_read. Before re-entering the event
+ * loop the main thread splits the queue among the I/O threads and itself,
+ * every thread reads the socket and parses the first command of its clients,
+ * then the main thread waits for all the threads to finish and executes the
+ * parsed commands, so command execution is still single threaded. */
+
+/* Every I/O thread (the main thread has id 0) has a list of clients to
+ * serve and a counter of clients still to process, set by the main thread
+ * and cleared by the I/O thread once it is done. The mutex is only used
+ * to park the threads when there is no work to do. */
+static pthread_t io_threads[IO_THREADS_MAX_NUM];
+static pthread_mutex_t io_threads_mutex[IO_THREADS_MAX_NUM];
+static list *io_threads_list[IO_THREADS_MAX_NUM];
+static struct {
+    unsigned long pending;          /* Clients still to be processed. */
+    pthread_mutex_t pending_mutex;  /* Only used without atomic builtins. */
+} io_threads_state[IO_THREADS_MAX_NUM];
+
+static inline unsigned long getIOPendingCount(int i) {
+    unsigned long count = 0;
+    atomicGetWithSync(io_threads_state[i].pending,count);
     return count;
 }
+
+static inline void setIOPendingCount(int i, unsigned long count) {
+    atomicSetWithSync(io_threads_state[i].pending,count);
+}
+
+void *IOThreadMain(void *myid) {
+    /* The ID is the thread number (from 0 to server.io_threads_num-1), and is
+     * used by the thread to just manipulate a single sub-array of clients. */
+    long id = (unsigned long)myid;
+
+    while(1) {
+        /* Wait for start */
+        for (int j = 0; j < 1000000; j++) {
+            if (getIOPendingCount(id) != 0) break;
+        }
+
+        /* Give the main thread a chance to stop this thread. */
+        if (getIOPendingCount(id) == 0) {
+            pthread_mutex_lock(&io_threads_mutex[id]);
+            pthread_mutex_unlock(&io_threads_mutex[id]);
+            continue;
+        }
+
+        serverAssert(getIOPendingCount(id) != 0);
+
+        /* Process: note that the main thread will never touch our list
+         * before we drop the pending count to 0. */
+        listIter li;
+        listNode *ln;
+        listRewind(io_threads_list[id],&li);
+        while((ln = listNext(&li))) {
+            client *c = listNodeValue(ln);
+            if (io_threads_op == IO_THREADS_OP_WRITE) {
+                writeToClient(c->fd,c,0);
+            } else if (io_threads_op == IO_THREADS_OP_READ) {
+                readQueryFromClient(NULL,c->fd,c,0);
+            } else {
+                serverPanic("io_threads_op value is unknown");
+            }
+        }
+        listEmpty(io_threads_list[id]);
+        setIOPendingCount(id,0);
+    }
+}
+
+/* Initialize the data structures needed for threaded I/O. */
+void initThreadedIO(void) {
+    pthread_attr_t attr;
+    size_t stacksize;
+
+    server.io_threads_active = 0; /* We start with threads not active. */
+
+    /* The main thread always uses io_threads_list[0], even when
+     * threaded I/O is disabled. */
+    io_threads_list[0] = listCreate();
+
+    /* Don't spawn any thread if the user selected a single thread:
+     * we'll handle I/O directly from the main thread. */
+    if (server.io_threads_num == 1) return;
+
+    /* Set the stack size as by default it may be small in some system,
+     * exactly like bioInit() does for the background threads. */
+    pthread_attr_init(&attr);
+    pthread_attr_getstacksize(&attr,&stacksize);
+    if (!stacksize) stacksize = 1; /* The world is full of Solaris Fixes */
+    while (stacksize < REDIS_THREAD_STACK_SIZE) stacksize *= 2;
+    pthread_attr_setstacksize(&attr, stacksize);
+
+    /* Spawn and initialize the I/O threads. */
+    for (int i = 1; i < server.io_threads_num; i++) {
+        pthread_t tid;
+
+        io_threads_list[i] = listCreate();
+        pthread_mutex_init(&io_threads_mutex[i],NULL);
+        pthread_mutex_init(&io_threads_state[i].pending_mutex,NULL);
+        setIOPendingCount(i,0);
+        pthread_mutex_lock(&io_threads_mutex[i]); /* Thread will be stopped. */
+        if (pthread_create(&tid,&attr,IOThreadMain,(void*)(long)i) != 0) {
+            serverLog(LL_WARNING,"Fatal: Can't initialize IO thread.");
+            exit(1);
+        }
+        io_threads[i] = tid;
+    }
+}
+
+static void startThreadedIO(void) {
+    serverAssert(server.io_threads_active == 0);
+    for (int j = 1; j < server.io_threads_num; j++)
+        pthread_mutex_unlock(&io_threads_mutex[j]);
+    server.io_threads_active = 1;
+}
+
+static void stopThreadedIO(void) {
+    serverAssert(server.io_threads_active == 1);
+    for (int j = 1; j < server.io_threads_num; j++)
+        pthread_mutex_lock(&io_threads_mutex[j]);
+    server.io_threads_active = 0;
+}
+
+/* Return the number of threads that should serve a batch of 'pending'
+ * clients, starting or parking the I/O threads as needed. When there is
+ * not enough work to justify waking the threads (less than two clients per
+ * thread) the main thread serves the whole batch alone and the threads are
+ * stopped, so that they don't burn CPU spinning. */
+static int threadsForPendingClients(unsigned long pending) {
+    if (server.io_threads_num == 1) return 1;
+    if (pending < (unsigned long)server.io_threads_num*2) {
+        if (server.io_threads_active) stopThreadedIO();
+        return 1;
+    }
+    if (!server.io_threads_active) startThreadedIO();
+    return server.io_threads_num;
+}
+
+/* Split the clients in 'clients' among the first 'numthreads' threads, run
+ * 'op' on them, serving the main thread share directly, and wait for all
+ * the I/O threads to finish. */
+static void runThreadedIO(list *clients, int numthreads, int op) {
+    listIter li;
+    listNode *ln;
+    int item_id = 0;
+
+    listRewind(clients,&li);
+    while((ln = listNext(&li))) {
+        client *c = listNodeValue(ln);
+        int target_id = item_id % numthreads;
+        listAddNodeTail(io_threads_list[target_id],c);
+        item_id++;
+    }
+
+    /* Give the start condition to the waiting threads, by setting the
+     * pending count for each thread. */
+    io_threads_op = op;
+    for (int j = 1; j < numthreads; j++) {
+        int count = listLength(io_threads_list[j]);
+        setIOPendingCount(j,count);
+    }
+
+    /* Also use the main thread to process a slice of clients. */
+    listRewind(io_threads_list[0],&li);
+    while((ln = listNext(&li))) {
+        client *c = listNodeValue(ln);
+        if (op == IO_THREADS_OP_WRITE)
+            writeToClient(c->fd,c,0);
+        else
+            readQueryFromClient(NULL,c->fd,c,0);
+    }
+    listEmpty(io_threads_list[0]);
+
+    /* Wait for all the other threads to end their work. */
+    while(1) {
+        unsigned long pending = 0;
+        for (int j = 1; j < numthreads; j++)
+            pending += getIOPendingCount(j);
+        if (pending == 0) break;
+    }
+    io_threads_op = IO_THREADS_OP_IDLE;
+}
+
+/* Return 1 if we want to handle the client read later using threaded I/O.
+ * This is called by the readable handler of the event loop.
+ * As a side effect of calling this function the client is put in the
+ * pending read clients and flagged as such. */
+int postponeClientRead(client *c) {
+    if (server.io_threads_num > 1 &&
+        server.io_threads_do_reads &&
+        !ProcessingEventsWhileBlocked &&
+        !(c->flags & (CLIENT_MASTER|CLIENT_SLAVE|CLIENT_PENDING_READ)))
+    {
+        c->flags |= CLIENT_PENDING_READ;
+        listAddNodeHead(server.clients_pending_read,c);
+        return 1;
+    } else {
+        return 0;
+    }
+}
+
+/* When threaded I/O is also enabled for the reading + parsing side, the
+ * readable handler will just put normal clients into a queue of clients to
+ * process (instead of serving them synchronously). This function runs
+ * the queue using the I/O threads, and process them in order to accumulate
+ * the reads in the buffers, and also parse the first command available
+ * rendering it in the client structures. */
+int handleClientsWithPendingReadsUsingThreads(void) {
+    int processed = listLength(server.clients_pending_read);
+    if (processed == 0) return 0;
+
+    long long start = ustime();
+    runThreadedIO(server.clients_pending_read,
+                  threadsForPendingClients(processed),IO_THREADS_OP_READ);
+    server.stat_io_reads_processed += processed;
+    server.stat_io_reads_usec += ustime()-start;
+
+    /* Run the list of clients again to process the new buffers. */
+    while(listLength(server.clients_pending_read)) {
+        listNode *ln = listFirst(server.clients_pending_read);
+        client *c = listNodeValue(ln);
+        c->flags &= ~CLIENT_PENDING_READ;
+        listDelNode(server.clients_pending_read,ln);
+
+        /* Clients with errors were scheduled by the threads to be freed
+         * asynchronously: nothing more to do with them. */
+        if (c->flags & CLIENT_CLOSE_ASAP) continue;
+
+        /* The I/O threads never queue clients for writing (for instance
+         * when a protocol error was emitted): do it here if needed. */
+        if (clientHasPendingReplies(c) && !(c->flags & CLIENT_PENDING_WRITE)) {
+            c->flags |= CLIENT_PENDING_WRITE;
+            listAddNodeHead(server.clients_pending_write,c);
+        }
+
+        /* Execute the command parsed by the thread, if any, and go on with
+         * the rest of the pipeline in the query buffer. */
+        processInputBuffer(c);
+    }
+    return processed;
+}
+
+/* Like handleClientsWithPendingWrites(), but when there are enough clients
+ * with pending output the writes are fanned out to the I/O threads. The
+ * main thread waits for all the threads to be done before returning, so
+ * that the event loop is only re-entered once all the writes were
+ * performed. */
+int handleClientsWithPendingWritesUsingThreads(void) {
+    int processed = listLength(server.clients_pending_write);
+    if (processed == 0) return 0; /* Return ASAP if there are no clients. */
+
+    /* If I/O threads are disabled or we have few clients to serve, don't
+     * use I/O threads, but the boring synchronous code. */
+    int numthreads = threadsForPendingClients(processed);
+    if (numthreads == 1) return handleClientsWithPendingWrites();
+
+    long long start = ustime();
+    list *held = NULL;
+    listIter li;
+    listNode *ln;
+    listRewind(server.clients_pending_write,&li);
+    while((ln = listNext(&li))) {
+        client *c = listNodeValue(ln);
+
+        /* Replies waiting for the AOF fsync stay pending: they are moved
+         * back to the list once the other clients are served. */
+        if (clientWaitsAofFsync(c) && !(c->flags & CLIENT_CLOSE_ASAP)) {
+            if (held == NULL) held = listCreate();
+            listAddNodeTail(held,c);
+            listDelNode(server.clients_pending_write,ln);
+            continue;
+        }
+        c->flags &= ~CLIENT_PENDING_WRITE;
+
+        /* Remove clients from the list of pending writes since
+         * they are going to be closed ASAP. */
+        if (c->flags & CLIENT_CLOSE_ASAP) {
+            listDelNode(server.clients_pending_write,ln);
+            continue;
+        }
+
+        /* Slaves move their reference to the replication buffer blocks
+         * while writing, which is only safe in the main thread. */
+        if (c->ref_repl_buf_node) {
+            listDelNode(server.clients_pending_write,ln);
+            if (writeToClient(c->fd,c,0) == C_ERR) continue;
+            if (clientHasPendingReplies(c) &&
+                aeCreateFileEvent(server.el, c->fd, AE_WRITABLE,
+                    sendReplyToClient, c) == AE_ERR)
+            {
+                freeClientAsync(c);
+            }
+        }
+    }
+    runThreadedIO(server.clients_pending_write,numthreads,
+                  IO_THREADS_OP_WRITE);
+
+    /* Run the list of clients again to install the write handler where
+     * needed. */
+    listRewind(server.clients_pending_write,&li);
+    while((ln = listNext(&li))) {
+        client *c = listNodeValue(ln);
+        freeClientSentReplies(c);
+
+        /* Install the write handler if there are pending writes in some
+         * of the clients, unless the thread scheduled them to be freed. */
+        if (!(c->flags & CLIENT_CLOSE_ASAP) && clientHasPendingReplies(c) &&
+            aeCreateFileEvent(server.el, c->fd, AE_WRITABLE,
+                sendReplyToClient, c) == AE_ERR)
+        {
+            freeClientAsync(c);
+        }
+    }
+    listEmpty(server.clients_pending_write);
+    if (held) {
+        listJoin(server.clients_pending_write,held);
+        listRelease(held);
+    }
+    server.stat_io_writes_processed += processed;
+    server.stat_io_writes_usec += ustime()-start;
+    return processed;
+}
@@ -54,11 +54,15 @@ typedef long long mstime_t; /* millisecond time type. */
 #include "ae.h"      /* Event driven programming library */
 #include "sds.h"     /* Dynamic safe strings */
 #include "dict.h"    /* Hash tables */
+#include "hashtable.h" /* Cache line bucketed hash tables */
+#include "zbtree.h"  /* B+tree of big sorted sets */
 #include "adlist.h"  /* Linked lists */
 #include "zmalloc.h" /* total memory usage aware version of malloc/free */
 #include "anet.h"    /* Networking the easy way */
 #include "ziplist.h" /* Compact list data structure */
+#include "listpack.h" /* Compact list data structure, successor of the ziplist */
 #include "intset.h"  /* Compact integer set structure */
+#include "roaring.h" /* Compressed bitmaps of big sparse strings */
 #include "version.h" /* Version macro */
 #include "util.h"    /* Misc functions useful in many places */
 #include "latency.h" /* Latency monitor API */
@@ -96,6 +100,7 @@ typedef long long mstime_t; /* millisecond time type. */
 #define AOF_REWRITE_MIN_SIZE (64*1024*1024)
 #define AOF_REWRITE_ITEMS_PER_CMD 64
 #define AOF_READ_DIFF_INTERVAL_BYTES (1024*10)
+#define AOF_REWRITE_SEGMENT_KEYS 1024 /* Keys rewritten by every AOF job. */
 #define CONFIG_DEFAULT_SLOWLOG_LOG_SLOWER_THAN 10000
 #define CONFIG_DEFAULT_SLOWLOG_MAX_LEN 128
 #define CONFIG_DEFAULT_MAX_CLIENTS 10000
@@ -124,9 +129,15 @@ typedef long long mstime_t; /* millisecond time type. */
 #define CONFIG_DEFAULT_STOP_WRITES_ON_BGSAVE_ERROR 1
 #define CONFIG_DEFAULT_RDB_COMPRESSION 1
 #define CONFIG_DEFAULT_RDB_CHECKSUM 1
+#define CONFIG_DEFAULT_RDB_LOAD_THREADS 1 /* Load RDB files serially. */
+#define CONFIG_DEFAULT_RDB_SAVE_THREADS 1 /* Serialize chunks serially. */
+#define CONFIG_DEFAULT_RDB_CHUNKED 0
+#define RDB_THREADS_MAX 64
 #define CONFIG_DEFAULT_RDB_FILENAME "dump.rdb"
 #define CONFIG_DEFAULT_REPL_DISKLESS_SYNC 0
 #define CONFIG_DEFAULT_REPL_DISKLESS_SYNC_DELAY 5
+#define CONFIG_DEFAULT_REPL_DISKLESS_LOAD REPL_DISKLESS_LOAD_DISABLED
+#define CONFIG_DEFAULT_REPL_COMPRESSION 0
 #define CONFIG_DEFAULT_SLAVE_SERVE_STALE_DATA 1
 #define CONFIG_DEFAULT_SLAVE_READ_ONLY 1
 #define CONFIG_DEFAULT_SLAVE_ANNOUNCE_IP NULL
@@ -140,8 +151,12 @@ typedef long long mstime_t; /* millisecond time type. */
 #define CONFIG_DEFAULT_AOF_NO_FSYNC_ON_REWRITE 0
 #define CONFIG_DEFAULT_AOF_LOAD_TRUNCATED 1
 #define CONFIG_DEFAULT_AOF_USE_RDB_PREAMBLE 0
+#define CONFIG_DEFAULT_AOF_USE_MANIFEST 0
+#define CONFIG_DEFAULT_AOF_GROUP_COMMIT 0
+#define CONFIG_DEFAULT_AOF_FSYNC_DELAY 0
 #define CONFIG_DEFAULT_ACTIVE_REHASHING 1
 #define CONFIG_DEFAULT_AOF_REWRITE_INCREMENTAL_FSYNC 1
+#define CONFIG_DEFAULT_AOF_REWRITE_THREADS 1 /* Rewrite the keys serially. */
 #define CONFIG_DEFAULT_MIN_SLAVES_TO_WRITE 0
 #define CONFIG_DEFAULT_MIN_SLAVES_MAX_LAG 10
 #define NET_IP_STR_LEN 46 /* INET6_ADDRSTRLEN is 46, but we need to be sure */
@@ -153,6 +168,7 @@ typedef long long mstime_t; /* millisecond time type. */
 #define CONFIG_DEFAULT_LAZYFREE_LAZY_EVICTION 0
 #define CONFIG_DEFAULT_LAZYFREE_LAZY_EXPIRE 0
 #define CONFIG_DEFAULT_LAZYFREE_LAZY_SERVER_DEL 0
+#define CONFIG_DEFAULT_ACTIVE_EXPIRE_INDEX 0
 #define CONFIG_DEFAULT_ALWAYS_SHOW_LOGO 0
 #define CONFIG_DEFAULT_ACTIVE_DEFRAG 0
 #define CONFIG_DEFAULT_DEFRAG_THRESHOLD_LOWER 10 /* don't defrag when fragmentation is below 10% */
@@ -160,6 +176,13 @@ typedef long long mstime_t; /* millisecond time type. */
 #define CONFIG_DEFAULT_DEFRAG_IGNORE_BYTES (100<<20) /* don't defrag if frag overhead is below 100mb */
 #define CONFIG_DEFAULT_DEFRAG_CYCLE_MIN 25 /* 25% CPU min (at lower threshold) */
 #define CONFIG_DEFAULT_DEFRAG_CYCLE_MAX 75 /* 75% CPU max (at upper threshold) */
+#define CONFIG_DEFAULT_IO_THREADS_NUM 1 /* Single threaded by default */
+#define CONFIG_DEFAULT_IO_THREADS_DO_READS 0 /* Read + parse from threads? */
+#define IO_THREADS_MAX_NUM 128
+
+/* Make sure we have enough stack to perform all the things we do in the
+ * main thread, both in the bio.c and in the I/O threads. */
+#define REDIS_THREAD_STACK_SIZE (1024*1024*4)
 
 #define ACTIVE_EXPIRE_CYCLE_LOOKUPS_PER_LOOP 20 /* Loopkups per loop. */
 #define ACTIVE_EXPIRE_CYCLE_FAST_DURATION 1000 /* Microseconds */
@@ -178,8 +201,11 @@ typedef long long mstime_t; /* millisecond time type. */
 #define PROTO_MAX_QUERYBUF_LEN  (1024*1024*1024) /* 1GB max query buffer. */
 #define PROTO_IOBUF_LEN         (1024*16)  /* Generic I/O buffer size */
 #define PROTO_REPLY_CHUNK_BYTES (16*1024) /* 16k output buffer */
+#define PROTO_REPLY_MIN_REF_BYTES (4*1024) /* Min bulk sent by reference */
 #define PROTO_INLINE_MAX_SIZE   (1024*64) /* Max size of inline reads */
 #define PROTO_MBULK_BIG_ARG     (1024*32)
+#define PROTO_PIPELINE_BATCH    16 /* Pipelined commands looked ahead. */
+#define PROTO_PIPELINE_MAX_ARGS 16 /* Args of each one searched for keys. */
 #define LONG_STR_SIZE      21          /* Bytes needed for long -> str + '\0' */
 #define AOF_AUTOSYNC_BYTES (1024*1024*32) /* fdatasync every 32MB */
 
@@ -248,6 +274,13 @@ typedef long long mstime_t; /* millisecond time type. */
 #define CLIENT_LUA_DEBUG (1<<25)  /* Run EVAL in debug mode. */
 #define CLIENT_LUA_DEBUG_SYNC (1<<26)  /* EVAL debugging without fork() */
 #define CLIENT_MODULE (1<<27) /* Non connected client used by some module. */
+#define CLIENT_PENDING_READ (1<<28) /* The client has pending reads and was put
+                                       in the list of clients we can read
+                                       from. */
+#define CLIENT_PENDING_COMMAND (1<<29) /* Used in threaded I/O to signal after
+                                          we return single threaded that the
+                                          client has already pending commands
+                                          to be executed. */
 
 /* Client block type (btype field in client structure)
  * if CLIENT_BLOCKED flag is set. */
@@ -270,6 +303,11 @@ typedef long long mstime_t; /* millisecond time type. */
                                     buffer configuration. Just the first
                                     three: normal, slave, pubsub. */
 
+/* How a slave loads the RDB received from the master */
+#define REPL_DISKLESS_LOAD_DISABLED 0   /* Save it to disk, then load it. */
+#define REPL_DISKLESS_LOAD_WHEN_DB_EMPTY 1 /* Parse the socket if no keys. */
+#define REPL_DISKLESS_LOAD_SWAPDB 2     /* Parse the socket into other DBs. */
+
 /* Slave replication state. Used in server.repl_state for slaves to remember
  * what to do next. */
 #define REPL_STATE_NONE 0 /* No active replication */
@@ -285,11 +323,13 @@ typedef long long mstime_t; /* millisecond time type. */
 #define REPL_STATE_RECEIVE_IP 9 /* Wait for REPLCONF reply */
 #define REPL_STATE_SEND_CAPA 10 /* Send REPLCONF capa */
 #define REPL_STATE_RECEIVE_CAPA 11 /* Wait for REPLCONF reply */
-#define REPL_STATE_SEND_PSYNC 12 /* Send PSYNC */
-#define REPL_STATE_RECEIVE_PSYNC 13 /* Wait for PSYNC reply */
+#define REPL_STATE_SEND_COMPRESS 12 /* Send REPLCONF compress */
+#define REPL_STATE_RECEIVE_COMPRESS 13 /* Wait for REPLCONF reply */
+#define REPL_STATE_SEND_PSYNC 14 /* Send PSYNC */
+#define REPL_STATE_RECEIVE_PSYNC 15 /* Wait for PSYNC reply */
 /* --- End of handshake states --- */
-#define REPL_STATE_TRANSFER 14 /* Receiving .rdb from master */
-#define REPL_STATE_CONNECTED 15 /* Connected to master */
+#define REPL_STATE_TRANSFER 16 /* Receiving .rdb from master */
+#define REPL_STATE_CONNECTED 17 /* Connected to master */
 
 /* State of slaves from the POV of the master. Used in client->replstate.
  * In SEND_BULK and ONLINE state the slave receives new updates
@@ -304,6 +344,11 @@ typedef long long mstime_t; /* millisecond time type. */
 #define SLAVE_CAPA_NONE 0
 #define SLAVE_CAPA_EOF (1<<0)    /* Can parse the RDB EOF streaming format. */
 #define SLAVE_CAPA_PSYNC2 (1<<1) /* Supports PSYNC2 protocol. */
+#define SLAVE_CAPA_COMPRESS (1<<2) /* Receives the compressed stream. */
+
+/* Max blocks of the replication buffer released at once, see
+ * incrementalTrimReplicationBacklog(). */
+#define REPL_BUFFER_TRIM_BLOCKS_PER_CALL 16
 
 /* Synchronous read timeout - slave side */
 #define CONFIG_REPL_SYNCIO_TIMEOUT 5
@@ -341,12 +386,25 @@ typedef long long mstime_t; /* millisecond time type. */
 #define AOF_FSYNC_EVERYSEC 2
 #define CONFIG_DEFAULT_AOF_FSYNC AOF_FSYNC_EVERYSEC
 
+/* RDB strings compression codecs */
+#define RDB_CODEC_LZF 0
+#define RDB_CODEC_ZSTD 1
+#define CONFIG_DEFAULT_RDB_COMPRESSION_CODEC RDB_CODEC_LZF
+
+/* How BGSAVE takes a snapshot of the dataset */
+#define RDB_SNAPSHOT_FORK 0
+#define RDB_SNAPSHOT_THREAD 1
+#define CONFIG_DEFAULT_RDB_SNAPSHOT_MODE RDB_SNAPSHOT_FORK
+#define CONFIG_DEFAULT_RDB_KEY_SAVE_DELAY 0
+
 /* Zip structure related defaults */
 #define OBJ_HASH_MAX_ZIPLIST_ENTRIES 512
 #define OBJ_HASH_MAX_ZIPLIST_VALUE 64
 #define OBJ_SET_MAX_INTSET_ENTRIES 512
 #define OBJ_ZSET_MAX_ZIPLIST_ENTRIES 128
 #define OBJ_ZSET_MAX_ZIPLIST_VALUE 64
+#define OBJ_ZSET_MAX_SKIPLIST_ENTRIES 1024
+#define OBJ_LISTPACK_FINGERPRINTS 1
 
 /* List defaults */
 #define OBJ_LIST_MAX_ZIPLIST_SIZE -2
@@ -355,6 +413,9 @@ typedef long long mstime_t; /* millisecond time type. */
 /* HyperLogLog defines */
 #define CONFIG_DEFAULT_HLL_SPARSE_MAX_BYTES 3000
 
+/* Bitmaps defines */
+#define CONFIG_DEFAULT_BITMAP_RAW_MAX_BYTES 4096
+
 /* Sets operations codes */
 #define SET_OP_UNION 0
 #define SET_OP_DIFF 1
@@ -570,11 +631,14 @@ typedef struct RedisModuleDigest {
 #define OBJ_ENCODING_HT 2      /* Encoded as hash table */
 #define OBJ_ENCODING_ZIPMAP 3  /* Encoded as zipmap */
 #define OBJ_ENCODING_LINKEDLIST 4 /* No longer used: old list encoding. */
-#define OBJ_ENCODING_ZIPLIST 5 /* Encoded as ziplist */
+#define OBJ_ENCODING_ZIPLIST 5 /* Old encoding, only used loading RDB files */
 #define OBJ_ENCODING_INTSET 6  /* Encoded as intset */
 #define OBJ_ENCODING_SKIPLIST 7  /* Encoded as skiplist */
 #define OBJ_ENCODING_EMBSTR 8  /* Embedded sds string encoding */
-#define OBJ_ENCODING_QUICKLIST 9 /* Encoded as linked list of ziplists */
+#define OBJ_ENCODING_QUICKLIST 9 /* Encoded as linked list of listpacks */
+#define OBJ_ENCODING_BTREE 10  /* Encoded as B+tree */
+#define OBJ_ENCODING_LISTPACK 11 /* Encoded as a listpack */
+#define OBJ_ENCODING_BITMAP 12 /* String encoded as a compressed bitmap */
 
 #define LRU_BITS 24
 #define LRU_CLOCK_MAX ((1<<LRU_BITS)-1) /* Max value of obj->lru */
@@ -608,13 +672,16 @@ struct evictionPoolEntry; /* Defined in evict.c */
  * by integers from 0 (the default database) up to the max configured
  * database. The database number is the 'id' field in the structure. */
 typedef struct redisDb {
-    dict *dict;                 /* The keyspace for this DB */
-    dict *expires;              /* Timeout of keys with a timeout set */
+    hashtable *dict;            /* The keyspace for this DB */
+    hashtable *expires;         /* Keys with a timeout set */
     dict *blocking_keys;        /* Keys with clients waiting for data (BLPOP)*/
     dict *ready_keys;           /* Blocked keys that received a PUSH */
     dict *watched_keys;         /* WATCHED keys for MULTI/EXEC CAS */
     int id;                     /* Database ID */
     long long avg_ttl;          /* Average TTL, just for stats */
+    rax *expires_index;         /* Volatile keys sorted by expire time, or
+                                   NULL if active-expire-index is off. */
+    long long expires_stale;    /* Estimated expired keys not yet deleted */
 } redisDb;
 
 /* Client MULTI/EXEC state */
@@ -670,6 +737,25 @@ typedef struct readyList {
     robj *key;
 } readyList;
 
+/* Without repl-compression the replication stream is stored in a list of
+ * blocks shared by the backlog and the slaves, that just reference the block
+ * they are sending and the position inside it: the data is appended once
+ * whatever the number of slaves. A block is released when no slave references
+ * it anymore and the backlog doesn't need it. See replication.c. */
+typedef struct replBufBlock {
+    int refcount;           /* Backlog and slaves referencing the block. */
+    long long repl_offset;  /* Replication offset of the first byte. */
+    size_t size, used;
+    char buf[];
+} replBufBlock;
+
+typedef struct replBacklog {
+    listNode *ref_repl_buf_node; /* First block of the replication buffer,
+                                    referenced by the backlog. */
+    char *buf;                   /* With repl-compression, the data not yet
+                                    compressed in a block. */
+} replBacklog;
+
 /* With multiplexing we need to take per-client state.
  * Clients are taken in a linked list. */
 typedef struct client {
@@ -690,6 +776,7 @@ typedef struct client {
     long bulklen;           /* Length of bulk argument in multi bulk request. */
     list *reply;            /* List of reply objects to send to the client. */
     unsigned long long reply_bytes; /* Tot bytes of objects in reply list. */
+    list *reply_sent;       /* Shared objects sent by I/O threads, to release. */
     size_t sentlen;         /* Amount of bytes already sent in the current
                                buffer or object being sent. */
     time_t ctime;           /* Client creation time. */
@@ -714,10 +801,16 @@ typedef struct client {
     int slave_listening_port; /* As configured with: SLAVECONF listening-port */
     char slave_ip[NET_IP_STR_LEN]; /* Optionally given by REPLCONF ip-address */
     int slave_capa;         /* Slave capabilities: SLAVE_CAPA_* bitwise OR. */
+    struct replStreamDecoder *repl_decoder; /* Decoder of the compressed
+                                               stream, if this is a master. */
+    listNode *ref_repl_buf_node; /* Block of the replication buffer being
+                                    sent, if this is a slave. */
+    size_t ref_block_pos;   /* Bytes of that block already sent. */
     multiState mstate;      /* MULTI/EXEC state */
     int btype;              /* Type of blocking op if CLIENT_BLOCKED. */
     blockingState bpop;     /* blocking state */
     long long woff;         /* Last write global replication offset. */
+    long long aof_woff;     /* Last write AOF offset, see aof.c. */
     list *watched_keys;     /* Keys WATCHED for MULTI/EXEC CAS */
     dict *pubsub_channels;  /* channels a client is interested in (SUBSCRIBE) */
     list *pubsub_patterns;  /* patterns a client is interested in (SUBSCRIBE) */
@@ -772,9 +865,13 @@ typedef struct zskiplist {
     int level;
 } zskiplist;
 
+/* Sorted sets encoded as skiplist or B+tree map elements to scores in the
+ * dict, scores stored by value, and keep the order in 'zsl' or 'zbt', the
+ * other one being NULL. */
 typedef struct zset {
     dict *dict;
     zskiplist *zsl;
+    zbtree *zbt;
 } zset;
 
 typedef struct clientBufferLimitsConfig {
@@ -854,6 +951,24 @@ typedef struct rdbSaveInfo {
 
 #define RDB_SAVE_INFO_INIT {-1,0,"000000000000000000000000000000",-1}
 
+/* When aof-use-manifest is enabled the AOF is made of a base file, written
+ * by the last rewrite, followed by incremental files containing the commands
+ * executed since then. The manifest lists them in the order they must be
+ * loaded, see aof.c for more information. */
+typedef struct aofInfo {
+    sds name;                   /* File name, relative to the working dir. */
+    long long seq;              /* Sequence number of the file. */
+} aofInfo;
+
+typedef struct aofManifest {
+    aofInfo *base;              /* Base file, NULL if there is none yet. */
+    list *incr;                 /* Incremental files, oldest first. */
+    long long base_seq;         /* Sequence number of the last base file. */
+    long long incr_seq;         /* Sequence number of the last incr file. */
+    aofInfo *pending;           /* Incr file of the rewrite enabling the AOF,
+                                   listed once its base is installed. */
+} aofManifest;
+
 /*-----------------------------------------------------------------------------
  * Global server state
  *----------------------------------------------------------------------------*/
@@ -914,6 +1029,7 @@ struct redisServer {
     list *clients;              /* List of active clients */
     list *clients_to_close;     /* Clients to close asynchronously */
     list *clients_pending_write; /* There is to write or install handler. */
+    list *clients_pending_read;  /* Client has pending read socket buffers. */
     list *slaves, *monitors;    /* List of slaves and MONITORs */
     client *current_client; /* Current client, only used on crash report */
     int clients_paused;         /* True if clients are currently paused */
@@ -922,8 +1038,13 @@ struct redisServer {
     dict *migrate_cached_sockets;/* MIGRATE cached sockets */
     uint64_t next_client_id;    /* Next client unique ID. Incremental. */
     int protected_mode;         /* Don't accept external connections. */
+    int io_threads_num;         /* Number of IO threads to use. */
+    int io_threads_do_reads;    /* Read and parse from IO threads? */
+    int io_threads_active;      /* Are the threads currently spinning? */
     /* RDB / AOF loading information */
     int loading;                /* We are loading data from disk if true */
+    int async_loading;          /* Loading the master RDB into other DBs
+                                   while serving the current dataset. */
     off_t loading_total_bytes;
     off_t loading_loaded_bytes;
     time_t loading_start_time;
@@ -937,6 +1058,8 @@ struct redisServer {
     long long stat_numcommands;     /* Number of processed commands */
     long long stat_numconnections;  /* Number of connections received */
     long long stat_expiredkeys;     /* Number of expired keys */
+    long long stat_expired_time_cap_reached_count; /* Active expire cycles
+                                                       that hit the time limit */
     long long stat_evictedkeys;     /* Number of evicted keys (maxmemory) */
     long long stat_keyspace_hits;   /* Number of successful lookups of keys */
     long long stat_keyspace_misses; /* Number of failed lookups of keys */
@@ -958,8 +1081,15 @@ struct redisServer {
     size_t resident_set_size;       /* RSS sampled in serverCron(). */
     long long stat_net_input_bytes; /* Bytes read from network. */
     long long stat_net_output_bytes; /* Bytes written to network. */
+    long long stat_io_reads_processed; /* Reads handed to the IO threads. */
+    long long stat_io_writes_processed; /* Writes handed to the IO threads. */
+    long long stat_io_reads_usec;   /* Time spent in threaded reads. */
+    long long stat_io_writes_usec;  /* Time spent in threaded writes. */
+    long long stat_writev_calls;    /* writev() calls sending client replies. */
+    long long stat_writev_iovecs;   /* Buffers sent by the above calls. */
     size_t stat_rdb_cow_bytes;      /* Copy on write bytes during RDB saving. */
     size_t stat_aof_cow_bytes;      /* Copy on write bytes during AOF rewrite. */
+    long long stat_aof_rewrite_keys_per_sec; /* Keys/s of the last AOF rewrite. */
     /* The following two are used to track instantaneous metrics, like
      * number of operations per second, network traffic. */
     struct {
@@ -973,6 +1103,7 @@ struct redisServer {
     int maxidletime;                /* Client timeout in seconds */
     int tcpkeepalive;               /* Set SO_KEEPALIVE if non-zero. */
     int active_expire_enabled;      /* Can be disabled for testing purposes. */
+    int active_expire_index;        /* Index volatile keys by expire time. */
     int active_defrag_enabled;
     size_t active_defrag_ignore_bytes; /* minimum amount of fragmentation waste to start active defrag */
     int active_defrag_threshold_lower; /* minimum percentage of fragmentation to start active defrag */
@@ -1007,10 +1138,25 @@ struct redisServer {
     int aof_lastbgrewrite_status;   /* C_OK or C_ERR */
     unsigned long aof_delayed_fsync;  /* delayed AOF fsync() counter */
     int aof_rewrite_incremental_fsync;/* fsync incrementally while rewriting? */
+    int aof_rewrite_threads;        /* Threads rewriting the keys in the child. */
     int aof_last_write_status;      /* C_OK or C_ERR */
     int aof_last_write_errno;       /* Valid if aof_last_write_status is ERR */
     int aof_load_truncated;         /* Don't stop on unexpected AOF EOF. */
     int aof_use_rdb_preamble;       /* Use RDB preamble on AOF rewrites. */
+    int aof_use_manifest;           /* Base and incremental files AOF. */
+    aofManifest *aof_manifest;      /* Files of the AOF if aof_use_manifest. */
+    off_t aof_fd_size;              /* Size of the file open as aof_fd. */
+    int aof_group_commit;           /* Reply after a background fsync. */
+    long long aof_fed_offset;       /* Bytes fed to the AOF buffer so far. */
+    long long aof_fsynced_offset;   /* Bytes known to be fsynced. */
+    int aof_group_commit_in_progress; /* A group commit fsync is running. */
+    long long aof_group_commit_offset; /* Offset covered by the fsync. */
+    int aof_group_commit_fd;        /* File descriptor being fsynced. */
+    long long aof_group_commit_start; /* Start of the fsync, in microseconds. */
+    int aof_group_commit_pipe[2];   /* Awakes the event loop once it's done. */
+    long long stat_aof_group_commits; /* Group commit fsyncs performed. */
+    int aof_fsync_delay;            /* Microseconds before a group commit
+                                       fsync, for tests. */
     /* AOF pipes used to communicate between parent and child during rewrite. */
     int aof_pipe_write_data_to_child;
     int aof_pipe_read_data_from_parent;
@@ -1029,7 +1175,14 @@ struct redisServer {
     int saveparamslen;              /* Number of saving points */
     char *rdb_filename;             /* Name of RDB file */
     int rdb_compression;            /* Use compression in RDB? */
+    int rdb_compression_codec;      /* Codec compressing RDB strings. */
     int rdb_checksum;               /* Use RDB checksum? */
+    int rdb_load_threads;           /* Threads decoding RDB values on load. */
+    int rdb_save_threads;           /* Threads serializing RDB chunks. */
+    int rdb_chunked;                /* Save RDB files as chunks of keys. */
+    int rdb_snapshot_mode;          /* BGSAVE forking or from a thread. */
+    int rdb_key_save_delay;         /* Microseconds per key saved, for tests. */
+    struct rdbSnapshot *rdb_snapshot; /* Snapshot thread state, or NULL. */
     time_t lastsave;                /* Unix time of last successful save */
     time_t lastbgsave_try;          /* Unix time of last attempted bgsave */
     time_t rdb_save_time_last;      /* Time used by last RDB save run. */
@@ -1045,6 +1198,8 @@ struct redisServer {
     struct {
         int process_type;           /* AOF or RDB child? */
         size_t cow_size;            /* Copy on write size. */
+        unsigned long long keys;    /* Keys written by the AOF rewrite, */
+        long long keys_usec;        /* and the time it took. */
         unsigned long long magic;   /* Magic value to make sure data is valid. */
     } child_info_data;
     /* Propagation of commands in AOF / replication */
@@ -1061,15 +1216,24 @@ struct redisServer {
     long long second_replid_offset; /* Accept offsets up to this for replid2. */
     int slaveseldb;                 /* Last SELECTed DB in replication output */
     int repl_ping_slave_period;     /* Master pings the slave every N seconds */
-    char *repl_backlog;             /* Replication backlog for partial syncs */
-    long long repl_backlog_size;    /* Backlog circular buffer size */
+    replBacklog *repl_backlog;      /* Replication backlog for partial syncs */
+    long long repl_backlog_size;    /* Backlog size */
     long long repl_backlog_histlen; /* Backlog actual data length */
-    long long repl_backlog_idx;     /* Backlog circular buffer current offset,
-                                       that is the next byte will'll write to.*/
+    long long repl_backlog_idx;     /* With repl-compression, bytes used in
+                                       repl_backlog->buf. */
     long long repl_backlog_off;     /* Replication "master offset" of first
                                        byte in the replication backlog buffer.*/
     time_t repl_backlog_time_limit; /* Time without slaves after the backlog
                                        gets released. */
+    int repl_compression;           /* Compress the stream and the backlog. */
+    list *repl_backlog_blocks;      /* Compressed part of the backlog, when
+                                       repl_compression is enabled. */
+    long long repl_backlog_zlen;    /* Bytes used by repl_backlog_blocks. */
+    list *repl_buffer_blocks;       /* Replication buffer shared by the
+                                       backlog and the slaves. */
+    size_t repl_buffer_mem;         /* Memory used by repl_buffer_blocks. */
+    long long stat_repl_stream_raw_bytes; /* Stream sent compressed... */
+    long long stat_repl_stream_compressed_bytes; /* ...and its size. */
     time_t repl_no_slaves_since;    /* We have no slaves since that time.
                                        Only valid if server.slaves len is 0. */
     int repl_min_slaves_to_write;   /* Min number of slaves to write. */
@@ -1082,6 +1246,7 @@ struct redisServer {
     char *masterhost;               /* Hostname of master */
     int masterport;                 /* Port of master */
     int repl_timeout;               /* Timeout after N seconds of master idle */
+    int repl_diskless_load;         /* REPL_DISKLESS_LOAD_* mode. */
     client *master;     /* Client that is master for this slave */
     client *cached_master; /* Cached master to be reused for PSYNC. */
     int repl_syncio_timeout; /* Timeout for synchronous I/O calls */
@@ -1105,6 +1270,7 @@ struct redisServer {
      * the server->master client structure. */
     char master_replid[CONFIG_RUN_ID_SIZE+1];  /* Master PSYNC runid. */
     long long master_initial_offset;           /* Master PSYNC offset. */
+    int master_compress;        /* Master agreed to send a compressed stream. */
     int repl_slave_lazy_flush;          /* Lazy FLUSHALL before loading DB? */
     /* Replication script cache. */
     dict *repl_scriptcache_dict;        /* SHA1 all slaves are aware of. */
@@ -1136,7 +1302,10 @@ struct redisServer {
     size_t set_max_intset_entries;
     size_t zset_max_ziplist_entries;
     size_t zset_max_ziplist_value;
+    size_t zset_max_skiplist_entries;
+    int listpack_fingerprints;  /* Fingerprints in hash and zset listpacks */
     size_t hll_sparse_max_bytes;
+    size_t bitmap_raw_max_bytes; /* Bit commands compress bigger strings */
     /* List parameters */
     int list_max_ziplist_size;
     int list_compress_depth;
@@ -1199,6 +1368,10 @@ struct redisServer {
     pthread_mutex_t lruclock_mutex;
     pthread_mutex_t next_client_id_mutex;
     pthread_mutex_t unixtime_mutex;
+    pthread_mutex_t stat_net_input_bytes_mutex;
+    pthread_mutex_t stat_net_output_bytes_mutex;
+    pthread_mutex_t stat_writev_calls_mutex;
+    pthread_mutex_t stat_writev_iovecs_mutex;
 };
 
 typedef struct pubsubPattern {
@@ -1261,7 +1434,7 @@ typedef struct {
     robj *subject;
     int encoding;
     int ii; /* intset iterator */
-    dictIterator *di;
+    hashtableIterator *di;
 } setTypeIterator;
 
 /* Structure to hold hash iteration abstraction. Note that iteration over
@@ -1274,8 +1447,8 @@ typedef struct {
 
     unsigned char *fptr, *vptr;
 
-    dictIterator *di;
-    dictEntry *de;
+    hashtableIterator *di;
+    hashtableEntry *de;
 } hashTypeIterator;
 
 #define OBJ_HASH_KEY 1
@@ -1298,6 +1471,7 @@ extern double R_Zero, R_PosInf, R_NegInf, R_Nan;
 extern dictType hashDictType;
 extern dictType replScriptCacheDictType;
 extern dictType keyptrDictType;
+extern dictType keylistDictType;
 extern dictType modulesDictType;
 
 /*-----------------------------------------------------------------------------
@@ -1339,10 +1513,13 @@ void sendReplyToClient(aeEventLoop *el, int fd, void *privdata, int mask);
 void *addDeferredMultiBulkLength(client *c);
 void setDeferredMultiBulkLength(client *c, void *node, long length);
 void processInputBuffer(client *c);
+void processMasterInputBuffer(client *c);
 void acceptHandler(aeEventLoop *el, int fd, void *privdata, int mask);
 void acceptTcpHandler(aeEventLoop *el, int fd, void *privdata, int mask);
 void acceptUnixHandler(aeEventLoop *el, int fd, void *privdata, int mask);
 void readQueryFromClient(aeEventLoop *el, int fd, void *privdata, int mask);
+void initThreadedIO(void);
+int handleClientsWithPendingReadsUsingThreads(void);
 void addReplyString(client *c, const char *s, size_t len);
 void addReplyBulk(client *c, robj *obj);
 void addReplyBulkCString(client *c, const char *s);
@@ -1358,6 +1535,7 @@ void addReplyHumanLongDouble(client *c, long double d);
 void addReplyLongLong(client *c, long long ll);
 void addReplyMultiBulkLen(client *c, long length);
 void copyClientOutputBuffer(client *dst, client *src);
+void unshareClientsReplyObjects(void);
 size_t sdsZmallocSize(sds s);
 size_t getStringObjectSdsUsedMemory(robj *o);
 void *dupClientReplyValue(void *o);
@@ -1382,7 +1560,13 @@ void pauseClients(mstime_t duration);
 int clientsArePaused(void);
 int processEventsWhileBlocked(void);
 int handleClientsWithPendingWrites(void);
+int handleClientsWithPendingWritesUsingThreads(void);
 int clientHasPendingReplies(client *c);
+int prepareClientToWrite(client *c);
+/* True if the reply of the client waits for a group commit fsync of the AOF
+ * covering its writes, see aof.c. */
+#define clientWaitsAofFsync(c) (server.aof_group_commit_in_progress && \
+                                (c)->aof_woff > server.aof_fsynced_offset)
 void unlinkClient(client *c);
 int writeToClient(int fd, client *c, int handler_installed);
 
@@ -1401,6 +1585,7 @@ void listTypeTryConversion(robj *subject, robj *value);
 void listTypePush(robj *subject, robj *value, int where);
 robj *listTypePop(robj *subject, int where);
 unsigned long listTypeLength(const robj *subject);
+void listTypeBeforeRead(redisDb *db, robj *key, robj *subject);
 listTypeIterator *listTypeInitIterator(robj *subject, long index, unsigned char direction);
 void listTypeReleaseIterator(listTypeIterator *li);
 int listTypeNext(listTypeIterator *li, listTypeEntry *entry);
@@ -1449,12 +1634,13 @@ size_t stringObjectLen(robj *o);
 robj *createStringObjectFromLongLong(long long value);
 robj *createStringObjectFromLongDouble(long double value, int humanfriendly);
 robj *createQuicklistObject(void);
-robj *createZiplistObject(void);
 robj *createSetObject(void);
 robj *createIntsetObject(void);
+robj *createBitmapObject(uint64_t len);
 robj *createHashObject(void);
 robj *createZsetObject(void);
-robj *createZsetZiplistObject(void);
+robj *createZsetListpackObject(void);
+robj *createZsetBtreeObject(void);
 robj *createModuleObject(moduleType *mt, void *value);
 int getLongFromObjectOrReply(client *c, robj *o, long *target, const char *msg);
 int checkType(client *c, robj *o, int type);
@@ -1505,9 +1691,17 @@ void clearReplicationId2(void);
 void chopReplicationBacklog(void);
 void replicationCacheMasterUsingMyself(void);
 void feedReplicationBacklog(void *ptr, size_t len);
+void replicationFlushCompressedStream(int endframe);
+long long replicationDecodeMasterStream(client *c, char *buf, size_t len);
+void replicationFreeStreamDecoder(client *c);
+void releaseReplicationBufferRef(client *c);
+void copyReplicationBufferRef(client *dst, client *src);
+size_t getSlaveReplicationBufferPending(client *c);
+void incrementalTrimReplicationBacklog(size_t max_blocks);
 
 /* Generic persistence functions */
 void startLoading(FILE *fp);
+void startLoadingStream(off_t size, int async);
 void loadingProgress(off_t pos);
 void stopLoading(void);
 
@@ -1520,7 +1714,10 @@ void flushAppendOnlyFile(int force);
 void feedAppendOnlyFile(struct redisCommand *cmd, int dictid, robj **argv, int argc);
 void aofRemoveTempFile(pid_t childpid);
 int rewriteAppendOnlyFileBackground(void);
-int loadAppendOnlyFile(char *filename);
+int loadAppendOnlyFiles(void);
+void aofOpenOnStartup(void);
+void aofInitGroupCommit(void);
+void aofGroupCommitFsynced(int err);
 void stopAppendOnly(void);
 int startAppendOnly(void);
 void backgroundRewriteDoneHandler(int exitcode, int bysignal);
@@ -1577,13 +1774,15 @@ unsigned char *zzlFirstInRange(unsigned char *zl, zrangespec *range);
 unsigned char *zzlLastInRange(unsigned char *zl, zrangespec *range);
 unsigned int zsetLength(const robj *zobj);
 void zsetConvert(robj *zobj, int encoding);
-void zsetConvertToZiplistIfNeeded(robj *zobj, size_t maxelelen);
+void zsetConvertToListpackIfNeeded(robj *zobj, size_t maxelelen);
+void zsetConvertToBtreeIfNeeded(robj *zobj);
+int zsetInsert(zset *zs, double score, sds ele);
 int zsetScore(robj *zobj, sds member, double *score);
 unsigned long zslGetRank(zskiplist *zsl, double score, sds o);
 int zsetAdd(robj *zobj, double score, sds ele, int *flags, double *newscore);
 long zsetRank(robj *zobj, sds ele, int reverse);
 int zsetDel(robj *zobj, sds ele);
-sds ziplistGetObject(unsigned char *sptr);
+sds zzlGetObject(unsigned char *sptr);
 int zslValueGteMin(double value, zrangespec *spec);
 int zslValueLteMax(double value, zrangespec *spec);
 void zslFreeLexRange(zlexrangespec *spec);
@@ -1596,6 +1795,14 @@ int zzlLexValueGteMin(unsigned char *p, zlexrangespec *spec);
 int zzlLexValueLteMax(unsigned char *p, zlexrangespec *spec);
 int zslLexValueGteMin(sds value, zlexrangespec *spec);
 int zslLexValueLteMax(sds value, zlexrangespec *spec);
+unsigned long zbtFirstInRange(zbtree *zbt, zrangespec *range, zbtreeIter *it);
+unsigned long zbtLastInRange(zbtree *zbt, zrangespec *range, zbtreeIter *it);
+unsigned long zbtFirstInLexRange(zbtree *zbt, zlexrangespec *range, zbtreeIter *it);
+unsigned long zbtLastInLexRange(zbtree *zbt, zlexrangespec *range, zbtreeIter *it);
+unsigned long zbtCountInRange(zbtree *zbt, zrangespec *range);
+unsigned long zbtCountInLexRange(zbtree *zbt, zlexrangespec *range);
+unsigned long zbtDeleteRangeByScore(zbtree *zbt, zrangespec *range, dict *dict);
+unsigned long zbtDeleteRangeByLex(zbtree *zbt, zlexrangespec *range, dict *dict);
 
 /* Core functions */
 int freeMemoryIfNeeded(void);
@@ -1623,6 +1830,7 @@ void serverLogFromHandler(int level, const char *msg);
 void usage(void);
 void updateDictResizePolicy(void);
 int htNeedsResize(dict *dict);
+int hashtableNeedsResize(hashtable *h);
 void populateCommandTable(void);
 void resetCommandTableStats(void);
 void adjustOpenFilesLimit(void);
@@ -1669,10 +1877,10 @@ unsigned long hashTypeLength(const robj *o);
 hashTypeIterator *hashTypeInitIterator(robj *subject);
 void hashTypeReleaseIterator(hashTypeIterator *hi);
 int hashTypeNext(hashTypeIterator *hi);
-void hashTypeCurrentFromZiplist(hashTypeIterator *hi, int what,
-                                unsigned char **vstr,
-                                unsigned int *vlen,
-                                long long *vll);
+void hashTypeCurrentFromListpack(hashTypeIterator *hi, int what,
+                                 unsigned char **vstr,
+                                 unsigned int *vlen,
+                                 long long *vll);
 sds hashTypeCurrentFromHashTable(hashTypeIterator *hi, int what);
 void hashTypeCurrentObject(hashTypeIterator *hi, int what, unsigned char **vstr, unsigned int *vlen, long long *vll);
 sds hashTypeCurrentObjectNewSds(hashTypeIterator *hi, int what);
@@ -1706,8 +1914,11 @@ void propagateExpire(redisDb *db, robj *key, int lazy);
 int expireIfNeeded(redisDb *db, robj *key);
 long long getExpire(redisDb *db, robj *key);
 void setExpire(client *c, redisDb *db, robj *key, long long when);
+/* Expire of a key of the main hash table, or -1, see setExpire(). */
+#define keyGetExpire(k) (sdsaux(k) ? *sdsaux(k) : -1)
 robj *lookupKey(redisDb *db, robj *key, int flags);
 robj *lookupKeyRead(redisDb *db, robj *key);
+int lookupKeysRead(redisDb *db, robj **keys, int count, robj **vals);
 robj *lookupKeyWrite(redisDb *db, robj *key);
 robj *lookupKeyReadOrReply(client *c, robj *key, robj *reply);
 robj *lookupKeyWriteOrReply(client *c, robj *key, robj *reply);
@@ -1728,6 +1939,10 @@ robj *dbUnshareStringValue(redisDb *db, robj *key, robj *o);
 #define EMPTYDB_NO_FLAGS 0      /* No flags. */
 #define EMPTYDB_ASYNC (1<<0)    /* Reclaim memory in another thread. */
 long long emptyDb(int dbnum, int flags, void(callback)(void*));
+long long dbTotalServerKeyCount(void);
+redisDb *initTempDb(void);
+void discardTempDb(redisDb *tempDb, int flags);
+void swapMainDbWithTempDb(redisDb *tempDb);
 
 int selectDb(client *c, int id);
 void signalModifiedKey(redisDb *db, robj *key);
@@ -1792,6 +2007,9 @@ void disconnectAllBlockedClients(void);
 
 /* expire.c -- Handling of expired keys */
 void activeExpireCycle(int type);
+void expireIndexAdd(redisDb *db, sds key, long long when);
+void expireIndexDel(redisDb *db, sds key, long long when);
+void setActiveExpireIndex(int enabled);
 void expireSlaveKeys(void);
 void rememberSlaveKeyWithExpire(redisDb *db, robj *key);
 void flushSlaveKeysWithExpireList(void);
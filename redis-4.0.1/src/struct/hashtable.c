@@ -0,0 +1,1254 @@
+/* Cache line bucketed hash tables.
+ *
+ * This is an alternative to dict.c for the big tables of the server, like
+ * the keyspace, where the memory used by the dictEntry structures and the
+ * pointer chasing along the chains matter.
+ *
+ * The table is an array of buckets of exactly 64 bytes (see hashtable.h),
+ * each holding up to HASHTABLE_BUCKET_SLOTS entries inline. Keys are placed
+ * in the bucket addressed by the low bits of their hash, and the most
+ * significant byte of the hash of every key is stored in the bucket header:
+ * a lookup reads a single cache line and only compares the keys whose tag
+ * matches. When all the slots of a bucket are taken, a new bucket is linked
+ * to it, so buckets are chains just like in dict.c, but a chain is rarely
+ * longer than two buckets since the table is expanded when it is filled at
+ * HASHTABLE_MAX_FILL percent.
+ *
+ * Everything else mirrors dict.c: two tables are used during the incremental
+ * rehashing, safe iterators suspend the rehashing, and since a key is always
+ * stored in the chain of the bucket addressed by its hash, the SCAN cursor
+ * offers the same guarantees of dictScan().
+ *
+ * Since the entries are stored inside the buckets, the hashtableEntry
+ * pointers returned by the API are only valid until the next operation that
+ * modifies the table (adding or deleting entries, rehashing, resizing).
+ * Lookups never move entries, so several entries can be looked up and then
+ * used together.
+ *
+ * Copyright (c) 2006-2012, Salvatore Sanfilippo <antirez at gmail dot com>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *   * Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *   * Neither the name of Redis nor the names of its contributors may be used
+ *     to endorse or promote products derived from this software without
+ *     specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "fmacros.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <limits.h>
+#include <sys/time.h>
+
+#include "hashtable.h"
+#include "zmalloc.h"
+#include "config.h"
+#include "redisassert.h"
+
+/* Like dict_can_resize in dict.c: when a child is saving the dataset the
+ * tables are only expanded if they get over-filled by the given ratio,
+ * that is, when every bucket has on average hashtable_force_resize_ratio
+ * full buckets chained. */
+static int hashtable_can_resize = 1;
+static unsigned int hashtable_force_resize_ratio = 2;
+
+/* While the rehashing is paused no entry is ever moved to a different chain,
+ * so that another thread can read a chain while the tables are used, as long
+ * as the chain itself is not modified. */
+static int hashtable_can_rehash = 1;
+
+/* The tag of a key is the most significant byte of its hash, since the
+ * least significant bits are used to address the bucket. */
+#define HASHTABLE_TAG(hash) ((uint8_t)((hash) >> 56))
+#define HASHTABLE_FULL_BUCKET ((1<<HASHTABLE_BUCKET_SLOTS)-1)
+#define hashtableSlotUsed(b,slot) ((b)->presence & (1<<(slot)))
+
+/* -------------------------- private prototypes ---------------------------- */
+
+static int _hashtableExpandIfNeeded(hashtable *h);
+static void _hashtableClear(hashtable *h, hashtableTable *t, void(callback)(void *));
+static hashtableEntry *_hashtableFindWithHash(hashtable *h, const void *key, uint64_t hash);
+
+/* ----------------------------- API implementation ------------------------- */
+
+/*重置hash表*/
+static void _hashtableReset(hashtableTable *t) {
+    t->buckets = NULL;
+    t->size = 0;
+    t->sizemask = 0;
+    t->used = 0;
+    t->children = 0;
+}
+
+/* Create a new hash table */
+/*创建hash表*/
+hashtable *hashtableCreate(dictType *type, void *privDataPtr) {
+    hashtable *h = zmalloc(sizeof(*h));
+
+    _hashtableReset(&h->ht[0]);
+    _hashtableReset(&h->ht[1]);
+    h->type = type;
+    h->privdata = privDataPtr;
+    h->rehashidx = -1;
+    h->iterators = 0;
+    return h;
+}
+
+/* Return the number of buckets needed to store 'size' entries without going
+ * over HASHTABLE_MAX_FILL. Like in dict.c it is always a power of two. */
+/*容纳size个元素需要的桶个数*/
+static unsigned long _hashtableBucketsFor(unsigned long size) {
+    unsigned long buckets = HASHTABLE_INITIAL_BUCKETS;
+
+    while (buckets*HASHTABLE_BUCKET_SLOTS*HASHTABLE_MAX_FILL/100 < size) {
+        if (buckets >= LONG_MAX/(HASHTABLE_BUCKET_SLOTS*100)) break;
+        buckets *= 2;
+    }
+    return buckets;
+}
+
+/* Resize the table to the minimal size that contains all the elements. */
+/*调整容量到包含所有元素的最小值*/
+int hashtableResize(hashtable *h) {
+    if (!hashtable_can_resize || hashtableIsRehashing(h)) return DICT_ERR;
+    return hashtableExpand(h, h->ht[0].used);
+}
+
+/* Expand or create the hash table so that it can hold 'size' entries. */
+/*扩充hash表*/
+int hashtableExpand(hashtable *h, unsigned long size) {
+    hashtableTable n;
+    unsigned long realsize = _hashtableBucketsFor(size);
+
+    /* The size is invalid if it is smaller than the number of
+     * elements already inside the hash table. */
+    if (hashtableIsRehashing(h) || h->ht[0].used > size)
+        return DICT_ERR;
+
+    /* Rehashing to the same table size is not useful. */
+    if (realsize == h->ht[0].size) return DICT_ERR;
+
+    n.size = realsize;
+    n.sizemask = realsize-1;
+    n.buckets = zcalloc(realsize*sizeof(hashtableBucket));
+    n.used = 0;
+    n.children = 0;
+
+    /* Is this the first initialization? If so it's not really a rehashing
+     * we just set the first hash table so that it can accept keys. */
+    if (h->ht[0].buckets == NULL) {
+        h->ht[0] = n;
+        return DICT_OK;
+    }
+
+    /* Prepare a second hash table for incremental rehashing */
+    h->ht[1] = n;
+    h->rehashidx = 0;
+    return DICT_OK;
+}
+
+/* Take a free slot in the chain of the bucket addressed by 'hash' in the
+ * table 't', linking a new bucket to the chain if all the slots are taken.
+ * The entry is returned with the tag already set but the key and value
+ * still to be filled by the caller. */
+/*在桶链中分配一个空闲slot*/
+static hashtableEntry *_hashtableInsert(hashtableTable *t, uint64_t hash) {
+    hashtableBucket *b = &t->buckets[hash & t->sizemask], *last;
+    int slot = 0;
+
+    do {
+        if (b->presence != HASHTABLE_FULL_BUCKET) {
+            while (hashtableSlotUsed(b,slot)) slot++;
+            break;
+        }
+        last = b;
+        b = b->child;
+    } while(b);
+
+    if (b == NULL) {
+        b = zcalloc(sizeof(*b));
+        last->child = b;
+        t->children++;
+    }
+    b->presence |= 1<<slot;
+    b->tags[slot] = HASHTABLE_TAG(hash);
+    t->used++;
+    return &b->entries[slot];
+}
+
+/* Performs N steps of incremental rehashing. Returns 1 if there are still
+ * keys to move from the old to the new hash table, otherwise 0 is returned,
+ * that is also the case when the rehashing is paused.
+ *
+ * Exactly like dictRehash() a step moves a whole bucket chain, and at max
+ * N*10 empty buckets are visited. */
+/*再hash*/
+int hashtableRehash(hashtable *h, int n) {
+    int empty_visits = n*10; /* Max number of empty buckets to visit. */
+    hashtableTable *t0 = &h->ht[0], *t1 = &h->ht[1];
+
+    if (!hashtableIsRehashing(h) || !hashtable_can_rehash) return 0;
+    while(n-- && t0->used != 0) {
+        hashtableBucket *head, *b, *next;
+        int slot;
+
+        /* Note that rehashidx can't overflow as we are sure there are more
+         * elements because ht[0].used != 0 */
+        assert(t0->size > (unsigned long)h->rehashidx);
+        head = &t0->buckets[h->rehashidx];
+        while(head->presence == 0 && head->child == NULL) {
+            h->rehashidx++;
+            if (--empty_visits == 0) return 1;
+            head = &t0->buckets[h->rehashidx];
+        }
+        /* Move all the keys in this chain from the old to the new table. */
+        for (b = head; b; b = next) {
+            for (slot = 0; slot < HASHTABLE_BUCKET_SLOTS; slot++) {
+                if (!hashtableSlotUsed(b,slot)) continue;
+                *_hashtableInsert(t1,dictHashKey(h,b->entries[slot].key)) =
+                    b->entries[slot];
+                t0->used--;
+            }
+            next = b->child;
+            if (b != head) {
+                zfree(b);
+                t0->children--;
+            }
+        }
+        memset(head,0,sizeof(*head));
+        h->rehashidx++;
+    }
+
+    /* Check if we already rehashed the whole table... */
+    if (t0->used == 0) {
+        /* Empty overflow buckets may be left by deletions performed while
+         * safe iterators were active. */
+        if (t0->children) _hashtableClear(h,t0,NULL);
+        zfree(t0->buckets);
+        *t0 = *t1;
+        _hashtableReset(t1);
+        h->rehashidx = -1;
+        return 0;
+    }
+
+    /* More to rehash... */
+    return 1;
+}
+
+/*计算当前时间毫秒值*/
+static long long hashtableTimeInMilliseconds(void) {
+    struct timeval tv;
+
+    gettimeofday(&tv,NULL);
+    return (((long long)tv.tv_sec)*1000)+(tv.tv_usec/1000);
+}
+
+/* Rehash for an amount of time between ms milliseconds and ms+1 milliseconds */
+/*再hash指定毫秒时间*/
+int hashtableRehashMilliseconds(hashtable *h, int ms) {
+    long long start = hashtableTimeInMilliseconds();
+    int rehashes = 0;
+
+    while(hashtableRehash(h,100)) {
+        rehashes += 100;
+        if (hashtableTimeInMilliseconds()-start > ms) break;
+    }
+    return rehashes;
+}
+
+/* Perform a step of rehashing, only if there are no safe iterators bound
+ * to the table, like _dictRehashStep() does. */
+/*没有迭代器情况下再hash一次*/
+static void _hashtableRehashStep(hashtable *h) {
+    if (h->iterators == 0) hashtableRehash(h,1);
+}
+
+/* Add an element to the target hash table */
+/*添加新key-value对*/
+int hashtableAdd(hashtable *h, void *key, void *val) {
+    hashtableEntry *e = hashtableAddRaw(h,key,NULL);
+
+    if (!e) return DICT_ERR;
+    hashtableSetVal(h, e, val);
+    return DICT_OK;
+}
+
+/* Low level add or find, with the same semantics of dictAddRaw(): the new
+ * entry is returned with the key set and the value to be set by the caller,
+ * or NULL is returned and '*existing' is populated if the key already
+ * exists. */
+/*添加key，如果key已存在就赋值给existing返回NULL*/
+hashtableEntry *hashtableAddRaw(hashtable *h, void *key, hashtableEntry **existing) {
+    hashtableEntry *e;
+    uint64_t hash;
+
+    if (existing) *existing = NULL;
+    if (hashtableIsRehashing(h)) _hashtableRehashStep(h);
+    if (_hashtableExpandIfNeeded(h) == DICT_ERR) return NULL;
+
+    hash = dictHashKey(h, key);
+    if ((e = _hashtableFindWithHash(h, key, hash)) != NULL) {
+        if (existing) *existing = e;
+        return NULL;
+    }
+
+    /* If we are rehashing, new entries always go to the new table. */
+    e = _hashtableInsert(&h->ht[hashtableIsRehashing(h) ? 1 : 0], hash);
+    hashtableSetKey(h, e, key);
+    e->v.val = NULL;
+    return e;
+}
+
+/* Add or Overwrite, see dictReplace(). Return 1 if the key was added from
+ * scratch, 0 if there was already an element with such key and
+ * hashtableReplace() just performed a value update operation. */
+/*替换指定key的值，key不存在则添加*/
+int hashtableReplace(hashtable *h, void *key, void *val) {
+    hashtableEntry *e, *existing, auxentry;
+
+    e = hashtableAddRaw(h,key,&existing);
+    if (e) {
+        hashtableSetVal(h, e, val);
+        return 1;
+    }
+
+    /* Set the new value and free the old one, in this order, as the value
+     * could be exactly the same as the previous one. */
+    auxentry = *existing;
+    hashtableSetVal(h, existing, val);
+    hashtableFreeVal(h, &auxentry);
+    return 0;
+}
+
+/* Fill the hole left at 'slot' of the bucket 'hole' by a deleted entry with
+ * an entry taken from the last bucket of the chain starting at 'head', and
+ * free such bucket once it is empty, so that chains shrink back as keys are
+ * deleted. The entry stays in the same chain, so SCAN is not affected. */
+/*删除元素后压缩桶链*/
+static void _hashtableCompactChain(hashtableTable *t, hashtableBucket *head,
+                                   hashtableBucket *hole, int slot)
+{
+    hashtableBucket *parent = NULL, *tail = head;
+    int j;
+
+    if (head->child == NULL) return;
+    while (tail->child) {
+        parent = tail;
+        tail = tail->child;
+    }
+    if (tail != hole) {
+        for (j = HASHTABLE_BUCKET_SLOTS-1; j >= 0; j--)
+            if (hashtableSlotUsed(tail,j)) break;
+        if (j >= 0) {
+            hole->entries[slot] = tail->entries[j];
+            hole->tags[slot] = tail->tags[j];
+            hole->presence |= 1<<slot;
+            tail->presence &= ~(1<<j);
+        }
+    }
+    if (tail->presence == 0) {
+        parent->child = NULL;
+        zfree(tail);
+        t->children--;
+    }
+}
+
+/* Search and remove an element. This is an helper function for
+ * hashtableDelete() and hashtableUnlink(). */
+/*通用删除操作*/
+static int hashtableGenericDelete(hashtable *h, const void *key,
+                                  hashtableEntry *unlinked)
+{
+    uint64_t hash;
+    uint8_t tag;
+    int table, slot;
+
+    if (hashtableSize(h) == 0) return DICT_ERR;
+    if (hashtableIsRehashing(h)) _hashtableRehashStep(h);
+    hash = dictHashKey(h, key);
+    tag = HASHTABLE_TAG(hash);
+
+    for (table = 0; table <= 1; table++) {
+        hashtableTable *t = &h->ht[table];
+        hashtableBucket *head = &t->buckets[hash & t->sizemask], *b;
+
+        for (b = head; b; b = b->child) {
+            for (slot = 0; slot < HASHTABLE_BUCKET_SLOTS; slot++) {
+                hashtableEntry *e = &b->entries[slot];
+
+                if (!hashtableSlotUsed(b,slot) || b->tags[slot] != tag)
+                    continue;
+                if (key != e->key && !dictCompareKeys(h, key, e->key))
+                    continue;
+                if (unlinked) {
+                    *unlinked = *e;
+                } else {
+                    hashtableFreeKey(h, e);
+                    hashtableFreeVal(h, e);
+                }
+                b->presence &= ~(1<<slot);
+                t->used--;
+                /* Safe iterators may be positioned in the chain: entries
+                 * are not moved until they are released. */
+                if (h->iterators == 0) _hashtableCompactChain(t,head,b,slot);
+                return DICT_OK;
+            }
+        }
+        if (!hashtableIsRehashing(h)) break;
+    }
+    return DICT_ERR; /* not found */
+}
+
+/* Remove an element, returning DICT_OK on success or DICT_ERR if the
+ * element was not found. */
+/*删除key*/
+int hashtableDelete(hashtable *h, const void *key) {
+    return hashtableGenericDelete(h,key,NULL);
+}
+
+/* Remove an element from the table without releasing its key and value,
+ * like dictUnlink(). Since entries live inside the table, the removed entry
+ * is copied into 'unlinked', to be released later with
+ * hashtableFreeUnlinkedEntry(). Returns DICT_ERR if the key was not found. */
+/*将entry从hash表中移除并复制到unlinked中*/
+int hashtableUnlink(hashtable *h, const void *key, hashtableEntry *unlinked) {
+    return hashtableGenericDelete(h,key,unlinked);
+}
+
+/* Release the key and value of an entry removed with hashtableUnlink(). */
+/*释放已移除的entry的key和value*/
+void hashtableFreeUnlinkedEntry(hashtable *h, hashtableEntry *e) {
+    hashtableFreeKey(h, e);
+    hashtableFreeVal(h, e);
+}
+
+/* Destroy an entire table */
+/*清空一张hash表*/
+static void _hashtableClear(hashtable *h, hashtableTable *t,
+                            void(callback)(void *))
+{
+    unsigned long i;
+    int slot;
+
+    for (i = 0; i < t->size && (t->used > 0 || t->children > 0); i++) {
+        hashtableBucket *head = &t->buckets[i], *b, *next;
+
+        if (callback && (i & 65535) == 0) callback(h->privdata);
+        for (b = head; b; b = next) {
+            for (slot = 0; slot < HASHTABLE_BUCKET_SLOTS; slot++) {
+                if (!hashtableSlotUsed(b,slot)) continue;
+                hashtableFreeKey(h, &b->entries[slot]);
+                hashtableFreeVal(h, &b->entries[slot]);
+                t->used--;
+            }
+            next = b->child;
+            if (b != head) {
+                zfree(b);
+                t->children--;
+            }
+        }
+    }
+    zfree(t->buckets);
+    _hashtableReset(t);
+}
+
+/* Clear & Release the hash table */
+/*释放hash表*/
+void hashtableRelease(hashtable *h) {
+    _hashtableClear(h,&h->ht[0],NULL);
+    _hashtableClear(h,&h->ht[1],NULL);
+    zfree(h);
+}
+
+/*清空hash表*/
+void hashtableEmpty(hashtable *h, void(callback)(void*)) {
+    _hashtableClear(h,&h->ht[0],callback);
+    _hashtableClear(h,&h->ht[1],callback);
+    h->rehashidx = -1;
+    h->iterators = 0;
+}
+
+/* Search 'key', whose hash value is 'hash'. */
+static hashtableEntry *_hashtableFindWithHash(hashtable *h, const void *key,
+                                              uint64_t hash)
+{
+    uint8_t tag = HASHTABLE_TAG(hash);
+    int table, slot;
+
+    for (table = 0; table <= 1; table++) {
+        hashtableTable *t = &h->ht[table];
+        hashtableBucket *b = &t->buckets[hash & t->sizemask];
+
+        do {
+            for (slot = 0; slot < HASHTABLE_BUCKET_SLOTS; slot++) {
+                hashtableEntry *e = &b->entries[slot];
+
+                if (hashtableSlotUsed(b,slot) && b->tags[slot] == tag &&
+                    (key == e->key || dictCompareKeys(h, key, e->key)))
+                    return e;
+            }
+            b = b->child;
+        } while(b);
+        if (!hashtableIsRehashing(h)) break;
+    }
+    return NULL;
+}
+
+/* Unlike dictFind() no rehashing step is performed, so that lookups never
+ * invalidate the entries returned by previous lookups. The rehashing makes
+ * progress anyway with writes and hashtableRehashMilliseconds(). */
+/*根据key查找entry*/
+hashtableEntry *hashtableFind(hashtable *h, const void *key) {
+    if (hashtableSize(h) == 0) return NULL;
+    return _hashtableFindWithHash(h, key, dictHashKey(h, key));
+}
+
+/*根据key获取值*/
+void *hashtableFetchValue(hashtable *h, const void *key) {
+    hashtableEntry *e = hashtableFind(h,key);
+
+    return e ? hashtableGetVal(e) : NULL;
+}
+
+/* Lookup 'count' keys at once: entries[j] is set to the entry of keys[j],
+ * or NULL. The result is the same as calling hashtableFind() for every key,
+ * but the keys are hashed and their buckets prefetched in groups of
+ * HASHTABLE_FIND_BATCH before any key is compared, so that the cache misses
+ * of the different keys overlap instead of being paid one after the other. */
+/*批量查找多个key*/
+void hashtableFindBatch(hashtable *h, const void **keys,
+                        hashtableEntry **entries, unsigned long count)
+{
+    uint64_t hashes[HASHTABLE_FIND_BATCH];
+    unsigned long i, j, n;
+
+    if (hashtableSize(h) == 0) {
+        for (j = 0; j < count; j++) entries[j] = NULL;
+        return;
+    }
+    for (i = 0; i < count; i += n) {
+        n = count-i;
+        if (n > HASHTABLE_FIND_BATCH) n = HASHTABLE_FIND_BATCH;
+        for (j = 0; j < n; j++) hashes[j] = dictHashKey(h, keys[i+j]);
+        hashtablePrefetchBatch(h, hashes, n);
+        for (j = 0; j < n; j++)
+            entries[i+j] = _hashtableFindWithHash(h, keys[i+j], hashes[j]);
+    }
+}
+
+/* Prefetch what a lookup of the keys with the specified hash values will
+ * access: first the buckets of all the keys, then the keys whose tag
+ * matches, which are the only keys a lookup compares. Every step only
+ * accesses memory prefetched by the previous one, so the loads of the
+ * different keys are issued back to back. No entry is chased, since the
+ * entries are stored in the bucket itself. */
+/*分阶段预取多个hash值对应的桶和key*/
+void hashtablePrefetchBatch(hashtable *h, uint64_t *hashes,
+                            unsigned long count)
+{
+    unsigned long j;
+    int table, slot;
+
+    if (hashtableSize(h) == 0) return;
+    for (j = 0; j < count; j++) {
+        for (table = 0; table <= 1; table++) {
+            hashtableTable *t = &h->ht[table];
+
+            redis_prefetch(&t->buckets[hashes[j] & t->sizemask]);
+            if (!hashtableIsRehashing(h)) break;
+        }
+    }
+    for (j = 0; j < count; j++) {
+        uint8_t tag = HASHTABLE_TAG(hashes[j]);
+
+        for (table = 0; table <= 1; table++) {
+            hashtableTable *t = &h->ht[table];
+            hashtableBucket *b = &t->buckets[hashes[j] & t->sizemask];
+
+            for (slot = 0; slot < HASHTABLE_BUCKET_SLOTS; slot++) {
+                if (hashtableSlotUsed(b,slot) && b->tags[slot] == tag)
+                    redis_prefetch(b->entries[slot].key);
+            }
+            if (b->child) redis_prefetch(b->child);
+            if (!hashtableIsRehashing(h)) break;
+        }
+    }
+}
+
+/* A fingerprint of the state of the table, used to detect the misuse of
+ * unsafe iterators, exactly like dictFingerprint(). */
+/*生成hash表状态指纹标识*/
+static long long hashtableFingerprint(hashtable *h) {
+    long long integers[6], hash = 0;
+    int j;
+
+    integers[0] = (long) h->ht[0].buckets;
+    integers[1] = h->ht[0].size;
+    integers[2] = h->ht[0].used;
+    integers[3] = (long) h->ht[1].buckets;
+    integers[4] = h->ht[1].size;
+    integers[5] = h->ht[1].used;
+
+    for (j = 0; j < 6; j++) {
+        hash += integers[j];
+        /* For the hashing step we use Tomas Wang's 64 bit integer hash. */
+        hash = (~hash) + (hash << 21); // hash = (hash << 21) - hash - 1;
+        hash = hash ^ (hash >> 24);
+        hash = (hash + (hash << 3)) + (hash << 8); // hash * 265
+        hash = hash ^ (hash >> 14);
+        hash = (hash + (hash << 2)) + (hash << 4); // hash * 21
+        hash = hash ^ (hash >> 28);
+        hash = hash + (hash << 31);
+    }
+    return hash;
+}
+
+/*创建迭代器*/
+hashtableIterator *hashtableGetIterator(hashtable *h) {
+    hashtableIterator *iter = zmalloc(sizeof(*iter));
+
+    iter->h = h;
+    iter->table = 0;
+    iter->index = -1;
+    iter->safe = 0;
+    iter->bucket = NULL;
+    iter->slot = 0;
+    return iter;
+}
+
+/*创建安全迭代器*/
+hashtableIterator *hashtableGetSafeIterator(hashtable *h) {
+    hashtableIterator *i = hashtableGetIterator(h);
+
+    i->safe = 1;
+    return i;
+}
+
+/* Return the next entry, or NULL when the iteration is complete. With a
+ * safe iterator it is valid to delete the returned entry: while safe
+ * iterators exist deleted entries leave a hole in their bucket instead of
+ * being replaced by other entries of the chain. */
+/*迭代器遍历*/
+hashtableEntry *hashtableNext(hashtableIterator *iter) {
+    while (1) {
+        if (iter->bucket == NULL) {
+            hashtableTable *t = &iter->h->ht[iter->table];
+
+            if (iter->index == -1 && iter->table == 0) {
+                if (iter->safe)
+                    iter->h->iterators++;
+                else
+                    iter->fingerprint = hashtableFingerprint(iter->h);
+            }
+            iter->index++;
+            if (iter->index >= (long) t->size) {
+                if (hashtableIsRehashing(iter->h) && iter->table == 0) {
+                    iter->table++;
+                    iter->index = 0;
+                    t = &iter->h->ht[1];
+                } else {
+                    break;
+                }
+            }
+            iter->bucket = &t->buckets[iter->index];
+            iter->slot = 0;
+        }
+        while (iter->slot < HASHTABLE_BUCKET_SLOTS) {
+            int slot = iter->slot++;
+
+            if (hashtableSlotUsed(iter->bucket,slot))
+                return &iter->bucket->entries[slot];
+        }
+        iter->bucket = iter->bucket->child;
+        iter->slot = 0;
+    }
+    return NULL;
+}
+
+/*释放迭代器*/
+void hashtableReleaseIterator(hashtableIterator *iter) {
+    if (!(iter->index == -1 && iter->table == 0)) {
+        if (iter->safe)
+            iter->h->iterators--;
+        else
+            assert(iter->fingerprint == hashtableFingerprint(iter->h));
+    }
+    zfree(iter);
+}
+
+/* Return the number of entries in the chain starting at 'b'. */
+/*桶链中的元素个数*/
+static int _hashtableChainEntries(hashtableBucket *b) {
+    int count = 0, slot;
+
+    for (; b; b = b->child)
+        for (slot = 0; slot < HASHTABLE_BUCKET_SLOTS; slot++)
+            if (hashtableSlotUsed(b,slot)) count++;
+    return count;
+}
+
+/* Return a random entry from the hash table, see dictGetRandomKey(). */
+/*随机一个entry*/
+hashtableEntry *hashtableGetRandomEntry(hashtable *h) {
+    hashtableBucket *head, *b;
+    unsigned long idx;
+    int count, pick, slot;
+
+    if (hashtableSize(h) == 0) return NULL;
+    if (hashtableIsRehashing(h)) _hashtableRehashStep(h);
+    do {
+        if (hashtableIsRehashing(h)) {
+            /* We are sure there are no elements in indexes from 0
+             * to rehashidx-1 */
+            idx = h->rehashidx + (random() % (h->ht[0].size +
+                                              h->ht[1].size -
+                                              h->rehashidx));
+            head = (idx >= h->ht[0].size) ?
+                   &h->ht[1].buckets[idx - h->ht[0].size] :
+                   &h->ht[0].buckets[idx];
+        } else {
+            head = &h->ht[0].buckets[random() & h->ht[0].sizemask];
+        }
+        count = _hashtableChainEntries(head);
+    } while(count == 0);
+
+    /* Select a random entry of the chain. */
+    pick = random() % count;
+    for (b = head; b; b = b->child) {
+        for (slot = 0; slot < HASHTABLE_BUCKET_SLOTS; slot++) {
+            if (hashtableSlotUsed(b,slot) && pick-- == 0)
+                return &b->entries[slot];
+        }
+    }
+    return NULL; /* Not reached. */
+}
+
+/* Sample the table returning up to 'count' entries from random locations,
+ * with the same semantics and limits of dictGetSomeKeys(). */
+/*随机选择n个entry*/
+unsigned int hashtableGetSomeEntries(hashtable *h, hashtableEntry **des,
+                                     unsigned int count)
+{
+    unsigned long j; /* internal hash table id, 0 or 1. */
+    unsigned long tables; /* 1 or 2 tables? */
+    unsigned long stored = 0, maxsizemask;
+    unsigned long maxsteps;
+
+    if (hashtableSize(h) < count) count = hashtableSize(h);
+    if (count == 0) return 0;
+    maxsteps = count*10;
+
+    /* Try to do a rehashing work proportional to 'count'. */
+    for (j = 0; j < count; j++) {
+        if (hashtableIsRehashing(h))
+            _hashtableRehashStep(h);
+        else
+            break;
+    }
+
+    tables = hashtableIsRehashing(h) ? 2 : 1;
+    maxsizemask = h->ht[0].sizemask;
+    if (tables > 1 && maxsizemask < h->ht[1].sizemask)
+        maxsizemask = h->ht[1].sizemask;
+
+    /* Pick a random point inside the larger table. */
+    unsigned long i = random() & maxsizemask;
+    unsigned long emptylen = 0; /* Continuous empty buckets so far. */
+    while(stored < count && maxsteps--) {
+        for (j = 0; j < tables; j++) {
+            hashtableBucket *b;
+            int slot, found = 0;
+
+            /* Up to the rehashing index there are no populated buckets in
+             * ht[0], see dictGetSomeKeys(). */
+            if (tables == 2 && j == 0 && i < (unsigned long) h->rehashidx) {
+                if (i >= h->ht[1].size) i = h->rehashidx;
+                continue;
+            }
+            if (i >= h->ht[j].size) continue; /* Out of range for this table. */
+            for (b = &h->ht[j].buckets[i]; b; b = b->child) {
+                for (slot = 0; slot < HASHTABLE_BUCKET_SLOTS; slot++) {
+                    if (!hashtableSlotUsed(b,slot)) continue;
+                    found = 1;
+                    *des++ = &b->entries[slot];
+                    if (++stored == count) return stored;
+                }
+            }
+
+            /* Count contiguous empty buckets, and jump to other
+             * locations if they reach 'count' (with a minimum of 5). */
+            if (!found) {
+                emptylen++;
+                if (emptylen >= 5 && emptylen > count) {
+                    i = random() & maxsizemask;
+                    emptylen = 0;
+                }
+            } else {
+                emptylen = 0;
+            }
+        }
+        i = (i+1) & maxsizemask;
+    }
+    return stored;
+}
+
+/* Function to reverse bits. Algorithm from:
+ * http://graphics.stanford.edu/~seander/bithacks.html#ReverseParallel */
+/*反转所有位*/
+static unsigned long rev(unsigned long v) {
+    unsigned long s = 8 * sizeof(v); // bit size; must be power of 2
+    unsigned long mask = ~0;
+    while ((s >>= 1) > 0) {
+        mask ^= (mask << s);
+        v = ((v >> s) & mask) | ((v << s) & ~mask);
+    }
+    return v;
+}
+
+/* Emit all the entries in the chain starting at 'head'. The overflow
+ * buckets are passed to 'bucketfn' first, that may reallocate them. */
+/*遍历桶链中所有元素*/
+static void _hashtableScanChain(hashtableBucket *head,
+                                hashtableScanFunction *fn,
+                                hashtableScanBucketFunction *bucketfn,
+                                void *privdata)
+{
+    hashtableBucket **ref, *b;
+    int slot;
+
+    if (bucketfn) {
+        for (ref = &head->child; *ref; ref = &(*ref)->child)
+            bucketfn(privdata, ref);
+    }
+    for (b = head; b; b = b->child) {
+        for (slot = 0; slot < HASHTABLE_BUCKET_SLOTS; slot++) {
+            if (hashtableSlotUsed(b,slot)) fn(privdata, &b->entries[slot]);
+        }
+    }
+}
+
+/* Emit all the entries in the chain starting at 'head', that is a bucket
+ * of one of the two tables of a hash table. */
+/*遍历一条桶链中的元素*/
+void hashtableScanChain(hashtableBucket *head, hashtableScanFunction *fn,
+                        void *privdata)
+{
+    _hashtableScanChain(head,fn,NULL,privdata);
+}
+
+/* hashtableScan() iterates the elements of the table with the reverse
+ * binary cursor of dictScan(), see the long comment there for how it
+ * works. The same guarantees hold, since an entry always lives in the chain
+ * of the bucket addressed by its hash: all the elements present for the
+ * whole iteration are returned, possibly more than once.
+ *
+ * The callback receives the entry itself, so it is allowed to update the
+ * key and value pointers (this is used by the active defragmentation), but
+ * not to add or delete entries. */
+/*遍历hash表*/
+unsigned long hashtableScan(hashtable *h,
+                            unsigned long v,
+                            hashtableScanFunction *fn,
+                            hashtableScanBucketFunction *bucketfn,
+                            void *privdata)
+{
+    hashtableTable *t0, *t1;
+    unsigned long m0, m1;
+
+    if (hashtableSize(h) == 0) return 0;
+
+    if (!hashtableIsRehashing(h)) {
+        t0 = &(h->ht[0]);
+        m0 = t0->sizemask;
+
+        /* Emit entries at cursor */
+        _hashtableScanChain(&t0->buckets[v & m0],fn,bucketfn,privdata);
+    } else {
+        t0 = &h->ht[0];
+        t1 = &h->ht[1];
+
+        /* Make sure t0 is the smaller and t1 is the bigger table */
+        if (t0->size > t1->size) {
+            t0 = &h->ht[1];
+            t1 = &h->ht[0];
+        }
+
+        m0 = t0->sizemask;
+        m1 = t1->sizemask;
+
+        /* Emit entries at cursor */
+        _hashtableScanChain(&t0->buckets[v & m0],fn,bucketfn,privdata);
+
+        /* Iterate over indices in larger table that are the expansion
+         * of the index pointed to by the cursor in the smaller table */
+        do {
+            /* Emit entries at cursor */
+            _hashtableScanChain(&t1->buckets[v & m1],fn,bucketfn,privdata);
+
+            /* Increment bits not covered by the smaller mask */
+            v = (((v | m0) + 1) & ~m0) | (v & m0);
+
+            /* Continue while bits covered by mask difference is non-zero */
+        } while (v & (m0 ^ m1));
+    }
+
+    /* Set unmasked bits so incrementing the reversed cursor
+     * operates on the masked bits of the smaller table */
+    v |= ~m0;
+
+    /* Increment the reverse cursor */
+    v = rev(v);
+    v++;
+    v = rev(v);
+
+    return v;
+}
+
+/* Call 'fn' for all the entries stored in the buckets from 'start' to 'end'
+ * (excluded), where the buckets of the second table, while rehashing, are
+ * numbered after the ones of the first table, so that hashtableBuckets()
+ * is the number of buckets. This allows to split the visit of the table in
+ * independent ranges of buckets, that different threads can visit at the
+ * same time, as long as the table is not modified.
+ *
+ * Returns the number of entries visited. */
+/*遍历指定范围的桶*/
+unsigned long hashtableScanBuckets(hashtable *h, unsigned long start,
+                                   unsigned long end,
+                                   hashtableScanFunction *fn, void *privdata)
+{
+    unsigned long idx, count = 0;
+    hashtableBucket *b;
+    int slot;
+
+    if (end > hashtableBuckets(h)) end = hashtableBuckets(h);
+    for (idx = start; idx < end; idx++) {
+        if (idx < h->ht[0].size)
+            b = &h->ht[0].buckets[idx];
+        else
+            b = &h->ht[1].buckets[idx-h->ht[0].size];
+        for (; b; b = b->child) {
+            for (slot = 0; slot < HASHTABLE_BUCKET_SLOTS; slot++) {
+                if (!hashtableSlotUsed(b,slot)) continue;
+                fn(privdata, &b->entries[slot]);
+                count++;
+            }
+        }
+    }
+    return count;
+}
+
+/* ------------------------- private functions ------------------------------ */
+
+/* Expand the hash table if needed */
+/*需要时扩充hash表*/
+static int _hashtableExpandIfNeeded(hashtable *h) {
+    unsigned long slots;
+
+    /* Incremental rehashing already in progress. Return. */
+    if (hashtableIsRehashing(h)) return DICT_OK;
+
+    /* If the hash table is empty expand it to the initial size. */
+    if (h->ht[0].size == 0) return hashtableExpand(h, 0);
+
+    /* Double the table when HASHTABLE_MAX_FILL is reached, unless resizing
+     * is disabled and the table is not yet over-filled. */
+    slots = h->ht[0].size*HASHTABLE_BUCKET_SLOTS;
+    if (h->ht[0].used >= slots*HASHTABLE_MAX_FILL/100 &&
+        (hashtable_can_resize ||
+         h->ht[0].used/slots > hashtable_force_resize_ratio))
+    {
+        return hashtableExpand(h, h->ht[0].used*2);
+    }
+    return DICT_OK;
+}
+
+/*打开调整大小开关*/
+void hashtableEnableResize(void) {
+    hashtable_can_resize = 1;
+}
+
+/*关闭调整大小开关*/
+void hashtableDisableResize(void) {
+    hashtable_can_resize = 0;
+}
+
+/*暂停所有hash表的再hash*/
+void hashtablePauseRehashing(void) {
+    hashtable_can_rehash = 0;
+}
+
+/*恢复所有hash表的再hash*/
+void hashtableResumeRehashing(void) {
+    hashtable_can_rehash = 1;
+}
+
+/* Return the memory used by the table itself, excluding keys and values. */
+/*hash表自身占用的内存*/
+size_t hashtableMemUsage(hashtable *h) {
+    return sizeof(*h) + sizeof(hashtableBucket) *
+        (h->ht[0].size + h->ht[0].children +
+         h->ht[1].size + h->ht[1].children);
+}
+
+/* ------------------------------- Debugging ---------------------------------*/
+
+#define HASHTABLE_STATS_VECTLEN 8
+static size_t _hashtableGetStatsHt(char *buf, size_t bufsize,
+                                   hashtableTable *t, int tableid)
+{
+    unsigned long i, nonempty = 0, chainlen, maxchainlen = 0;
+    unsigned long clvector[HASHTABLE_STATS_VECTLEN];
+    size_t l = 0;
+
+    if (t->used == 0) {
+        return snprintf(buf,bufsize,
+            "No stats available for empty dictionaries\n");
+    }
+
+    /* Compute stats: here the chain length is in buckets. */
+    for (i = 0; i < HASHTABLE_STATS_VECTLEN; i++) clvector[i] = 0;
+    for (i = 0; i < t->size; i++) {
+        hashtableBucket *b = &t->buckets[i];
+
+        if (b->presence == 0 && b->child == NULL) {
+            clvector[0]++;
+            continue;
+        }
+        nonempty++;
+        chainlen = 0;
+        for (; b; b = b->child) chainlen++;
+        clvector[(chainlen < HASHTABLE_STATS_VECTLEN) ? chainlen :
+                 (HASHTABLE_STATS_VECTLEN-1)]++;
+        if (chainlen > maxchainlen) maxchainlen = chainlen;
+    }
+
+    /* Generate human readable stats. */
+    l += snprintf(buf+l,bufsize-l,
+        "Hash table %d stats (%s):\n"
+        " table size: %ld\n"
+        " number of elements: %ld\n"
+        " bucket size: %d slots, %d bytes\n"
+        " overflow buckets: %ld\n"
+        " max chain length: %ld\n"
+        " avg entries per used bucket: %.02f\n"
+        " Chain length distribution (buckets):\n",
+        tableid, (tableid == 0) ? "main hash table" : "rehashing target",
+        t->size, t->used, HASHTABLE_BUCKET_SLOTS,
+        (int)sizeof(hashtableBucket), t->children, maxchainlen,
+        (float)t->used/nonempty);
+
+    for (i = 0; i < HASHTABLE_STATS_VECTLEN; i++) {
+        if (clvector[i] == 0) continue;
+        if (l >= bufsize) break;
+        l += snprintf(buf+l,bufsize-l,
+            "   %s%ld: %ld (%.02f%%)\n",
+            (i == HASHTABLE_STATS_VECTLEN-1)?">= ":"",
+            i, clvector[i], ((float)clvector[i]/t->size)*100);
+    }
+
+    /* Unlike snprintf(), return the number of characters actually written. */
+    if (bufsize) buf[bufsize-1] = '\0';
+    return strlen(buf);
+}
+
+/*调试用，取得hash表当前状态*/
+void hashtableGetStats(char *buf, size_t bufsize, hashtable *h) {
+    size_t l;
+    char *orig_buf = buf;
+    size_t orig_bufsize = bufsize;
+
+    l = _hashtableGetStatsHt(buf,bufsize,&h->ht[0],0);
+    buf += l;
+    bufsize -= l;
+    if (hashtableIsRehashing(h) && bufsize > 0) {
+        _hashtableGetStatsHt(buf,bufsize,&h->ht[1],1);
+    }
+    /* Make sure there is a NULL term at the end. */
+    if (orig_bufsize) orig_buf[orig_bufsize-1] = '\0';
+}
+
+/* ---------------------------------- Test ---------------------------------- */
+
+#ifdef REDIS_TEST
+#define UNUSED(x) (void)(x)
+
+/* The test keys are integers stored in the key pointer itself. */
+static uint64_t testHashCallback(const void *key) {
+    uintptr_t k = (uintptr_t)key;
+    return dictGenHashFunction(&k,sizeof(k));
+}
+
+static dictType testType = {
+    testHashCallback,           /* hash function */
+    NULL,                       /* key dup */
+    NULL,                       /* val dup */
+    NULL,                       /* key compare */
+    NULL,                       /* key destructor */
+    NULL                        /* val destructor */
+};
+
+static void testScanCallback(void *privdata, hashtableEntry *e) {
+    unsigned char *seen = privdata;
+    seen[(uintptr_t)e->key]++;
+}
+
+#define TEST_KEYS 100000
+#define KEY(j) ((void*)(uintptr_t)(j))
+
+int hashtableTest(int argc, char **argv) {
+    hashtable *h = hashtableCreate(&testType,NULL);
+    hashtableIterator *iter;
+    hashtableEntry *e, *batch[16];
+    unsigned char *seen;
+    unsigned long j, count, cursor;
+    const void *keys[16];
+
+    UNUSED(argc);
+    UNUSED(argv);
+    assert(sizeof(hashtableBucket) == 64);
+
+    printf("Add and find: ");
+    for (j = 1; j <= TEST_KEYS; j++)
+        assert(hashtableAdd(h,KEY(j),KEY(j*2)) == DICT_OK);
+    assert(hashtableAdd(h,KEY(1),NULL) == DICT_ERR);
+    assert(hashtableSize(h) == TEST_KEYS);
+    for (j = 1; j <= TEST_KEYS; j++)
+        assert(hashtableFetchValue(h,KEY(j)) == KEY(j*2));
+    assert(hashtableFind(h,KEY(TEST_KEYS+1)) == NULL);
+    printf("[ok]\n");
+
+    printf("Batch lookup: ");
+    for (j = 0; j < 16; j++) keys[j] = KEY(j*(TEST_KEYS/8)+1);
+    hashtableFindBatch(h,keys,batch,16);
+    for (j = 0; j < 16; j++) {
+        if ((uintptr_t)keys[j] <= TEST_KEYS)
+            assert(batch[j] && batch[j]->key == keys[j]);
+        else
+            assert(batch[j] == NULL);
+    }
+    printf("[ok]\n");
+
+    printf("Replace: ");
+    assert(hashtableReplace(h,KEY(1),KEY(3)) == 0);
+    assert(hashtableFetchValue(h,KEY(1)) == KEY(3));
+    assert(hashtableReplace(h,KEY(TEST_KEYS+1),KEY(3)) == 1);
+    assert(hashtableDelete(h,KEY(TEST_KEYS+1)) == DICT_OK);
+    printf("[ok]\n");
+
+    printf("Delete half of the keys: ");
+    for (j = 1; j <= TEST_KEYS; j += 2)
+        assert(hashtableDelete(h,KEY(j)) == DICT_OK);
+    assert(hashtableDelete(h,KEY(1)) == DICT_ERR);
+    assert(hashtableSize(h) == TEST_KEYS/2);
+    for (j = 1; j <= TEST_KEYS; j++)
+        assert((hashtableFind(h,KEY(j)) != NULL) == (j % 2 == 0));
+    printf("[ok]\n");
+
+    printf("Scan while rehashing: ");
+    seen = zcalloc(TEST_KEYS*3);
+    cursor = 0;
+    count = 0;
+    /* Shrink the table and then grow it again while scanning: the keys
+     * present for the whole scan must all be returned. */
+    assert(hashtableResize(h) == DICT_OK);
+    do {
+        cursor = hashtableScan(h,cursor,testScanCallback,NULL,seen);
+        hashtableAdd(h,KEY(TEST_KEYS+1+count),NULL);
+        if (count % 2) hashtableDelete(h,KEY(TEST_KEYS+count));
+        count++;
+    } while(cursor && count < TEST_KEYS*2-1);
+    for (j = 2; j <= TEST_KEYS; j += 2) assert(seen[j] >= 1);
+    zfree(seen);
+    printf("[ok]\n");
+
+    printf("Safe iterator deleting every entry: ");
+    count = 0;
+    iter = hashtableGetSafeIterator(h);
+    while((e = hashtableNext(iter)) != NULL) {
+        assert(hashtableDelete(h,e->key) == DICT_OK);
+        count++;
+    }
+    hashtableReleaseIterator(iter);
+    assert(hashtableSize(h) == 0);
+    printf("[ok]\n");
+
+    printf("Random entries and sampling: ");
+    for (j = 1; j <= 1000; j++) hashtableAdd(h,KEY(j),NULL);
+    for (j = 0; j < 1000; j++) {
+        e = hashtableGetRandomEntry(h);
+        assert((uintptr_t)e->key >= 1 && (uintptr_t)e->key <= 1000);
+    }
+    assert(hashtableGetSomeEntries(h,batch,16) > 0);
+    hashtableResize(h);
+    while(hashtableIsRehashing(h)) hashtableRehash(h,100);
+    count = 0;
+    iter = hashtableGetIterator(h);
+    while(hashtableNext(iter) != NULL) count++;
+    hashtableReleaseIterator(iter);
+    assert(count == 1000);
+    printf("[ok]\n");
+
+    printf("Scan ranges of buckets while rehashing: ");
+    for (j = 1001; j <= 5000; j++) hashtableAdd(h,KEY(j),NULL);
+    if (!hashtableIsRehashing(h)) hashtableExpand(h,hashtableSize(h)*4);
+    assert(hashtableIsRehashing(h));
+    seen = zcalloc(5001);
+    count = 0;
+    for (j = 0; j < hashtableBuckets(h); j += 7)
+        count += hashtableScanBuckets(h,j,j+7,testScanCallback,seen);
+    assert(count == 5000);
+    for (j = 1; j <= 5000; j++) assert(seen[j] == 1);
+    zfree(seen);
+    printf("[ok]\n");
+
+    printf("Chains don't change while the rehashing is paused: ");
+    {
+        long rehashidx = h->rehashidx;
+        unsigned long idx;
+        int t;
+
+        hashtablePauseRehashing();
+        for (j = 1; j <= 1000; j++) {
+            assert(hashtableFind(h,KEY(j)) != NULL);
+            hashtableGetRandomEntry(h);
+        }
+        assert(hashtableRehash(h,100) == 0 && h->rehashidx == rehashidx);
+        seen = zcalloc(5001);
+        for (t = 0; t <= 1; t++) {
+            for (idx = 0; idx < h->ht[t].size; idx++)
+                hashtableScanChain(&h->ht[t].buckets[idx],testScanCallback,seen);
+        }
+        for (j = 1; j <= 5000; j++) assert(seen[j] == 1);
+        zfree(seen);
+        hashtableResumeRehashing();
+        assert(hashtableRehash(h,100) == 1 && h->rehashidx != rehashidx);
+    }
+    printf("[ok]\n");
+
+    hashtableRelease(h);
+    return 0;
+}
+#endif
@@ -0,0 +1,250 @@
+/* Cache line bucketed hash tables.
+ *
+ * This file implements in-memory hash tables with the same interface and
+ * guarantees of dict.c (dictType callbacks, safe iterators, incremental
+ * rehashing, SCAN cursors), but without allocating an entry for every
+ * element: entries are stored inline in 64 bytes buckets, together with a
+ * byte of the hash of every key, and a bucket only links to another bucket
+ * when it overflows. See the source code for more information.
+ *
+ * Copyright (c) 2006-2012, Salvatore Sanfilippo <antirez at gmail dot com>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *   * Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *   * Neither the name of Redis nor the names of its contributors may be used
+ *     to endorse or promote products derived from this software without
+ *     specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <stdint.h>
+#include <stddef.h>
+#include "dict.h"
+
+#ifndef __HASHTABLE_H
+#define __HASHTABLE_H
+
+/* Number of entries stored in every bucket. */
+#define HASHTABLE_BUCKET_SLOTS 3
+/* Initial number of buckets of every table. */
+#define HASHTABLE_INITIAL_BUCKETS 2
+/* Percentage of the slots filled before the table is expanded. Like dict.c
+ * the table is doubled when it holds as many entries as slots: filling it
+ * less saves some overflow buckets but wastes the whole table right after
+ * every doubling. */
+#define HASHTABLE_MAX_FILL 100
+/* Number of keys hashtableFindBatch() prefetches together. */
+#define HASHTABLE_FIND_BATCH 16
+
+/*hash表元素，直接存放在桶中*/
+typedef struct hashtableEntry {
+    /*元素key*/
+    void *key;
+    /*元素值*/
+    union {
+        void *val;
+        uint64_t u64;
+        int64_t s64;
+        double d;
+    } v;
+} hashtableEntry;
+
+/* A bucket is exactly a cache line: a bitmap of the slots in use, the most
+ * significant byte of the hash of every key (so that most of the keys that
+ * don't match are skipped without accessing them), a link to an overflow
+ * bucket, only used when more than HASHTABLE_BUCKET_SLOTS keys collide, and
+ * the entries themselves. The version uses what would otherwise be padding:
+ * it is only meaningful in the first bucket of a chain, where it is used by
+ * the snapshot thread to track which chains were already saved (see rdb.c). */
+/*hash桶，大小为一个cache line*/
+typedef struct hashtableBucket {
+    /*已使用的slot位图*/
+    uint8_t presence;
+    /*每个key的hash值最高字节*/
+    uint8_t tags[HASHTABLE_BUCKET_SLOTS];
+    /*桶链的快照版本号*/
+    uint32_t version;
+    /*溢出桶*/
+    struct hashtableBucket *child;
+    /*元素*/
+    hashtableEntry entries[HASHTABLE_BUCKET_SLOTS];
+} hashtableBucket;
+
+/*hash表*/
+typedef struct hashtableTable {
+    /*桶数组*/
+    hashtableBucket *buckets;
+    /*桶个数*/
+    unsigned long size;
+    /*桶个数掩码*/
+    unsigned long sizemask;
+    /*元素个数*/
+    unsigned long used;
+    /*溢出桶个数*/
+    unsigned long children;
+} hashtableTable;
+
+typedef struct hashtable {
+    /*类型，与dict共用*/
+    dictType *type;
+    void *privdata;
+    /*两张hash表*/
+    hashtableTable ht[2];
+    /*重新hash的桶下标*/
+    long rehashidx; /* rehashing not in progress if rehashidx == -1 */
+    /*安全迭代器数目*/
+    unsigned long iterators; /* number of safe iterators currently running */
+} hashtable;
+
+/* Like for dict.c, a safe iterator allows to call hashtableAdd(),
+ * hashtableDelete() and so forth while iterating, otherwise only
+ * hashtableNext() should be called while iterating. */
+/*hash表迭代器*/
+typedef struct hashtableIterator {
+    hashtable *h;
+    /*迭代的桶下标*/
+    long index;
+    int table, safe;
+    /*当前桶和slot*/
+    hashtableBucket *bucket;
+    int slot;
+    /* unsafe iterator fingerprint for misuse detection. */
+    long long fingerprint;
+} hashtableIterator;
+
+typedef void (hashtableScanFunction)(void *privdata, hashtableEntry *e);
+typedef void (hashtableScanBucketFunction)(void *privdata, hashtableBucket **bucketref);
+
+/* ------------------------------- Macros ------------------------------------*/
+/*设置entry value*/
+#define hashtableSetVal(h, entry, _val_) do { \
+    if ((h)->type->valDup) \
+        (entry)->v.val = (h)->type->valDup((h)->privdata, _val_); \
+    else \
+        (entry)->v.val = (_val_); \
+} while(0)
+
+/*设置entry key*/
+#define hashtableSetKey(h, entry, _key_) do { \
+    if ((h)->type->keyDup) \
+        (entry)->key = (h)->type->keyDup((h)->privdata, _key_); \
+    else \
+        (entry)->key = (_key_); \
+} while(0)
+
+/*设置有符号整数值*/
+#define hashtableSetSignedIntegerVal(entry, _val_) \
+    do { (entry)->v.s64 = _val_; } while(0)
+
+/*释放entry value*/
+#define hashtableFreeVal(h, entry) \
+    if ((h)->type->valDestructor) \
+        (h)->type->valDestructor((h)->privdata, (entry)->v.val)
+
+/*释放entry key*/
+#define hashtableFreeKey(h, entry) \
+    if ((h)->type->keyDestructor) \
+        (h)->type->keyDestructor((h)->privdata, (entry)->key)
+
+/*取得key*/
+#define hashtableGetKey(e) ((e)->key)
+/*取得指针值*/
+#define hashtableGetVal(e) ((e)->v.val)
+/*取得有符号整数值*/
+#define hashtableGetSignedIntegerVal(e) ((e)->v.s64)
+/*两张hash表总桶数*/
+#define hashtableBuckets(h) ((h)->ht[0].size+(h)->ht[1].size)
+/*两张hash表总元素个数*/
+#define hashtableSize(h) ((h)->ht[0].used+(h)->ht[1].used)
+/*是否正在重新hash*/
+#define hashtableIsRehashing(h) ((h)->rehashidx != -1)
+
+/* API */
+/*创建hash表*/
+hashtable *hashtableCreate(dictType *type, void *privDataPtr);
+/*扩充容量到至少容纳size个元素*/
+int hashtableExpand(hashtable *h, unsigned long size);
+/*添加新key-value对*/
+int hashtableAdd(hashtable *h, void *key, void *val);
+/*添加key，如果key已存在就赋值给existing返回NULL*/
+hashtableEntry *hashtableAddRaw(hashtable *h, void *key, hashtableEntry **existing);
+/*替换指定key的值，key不存在则添加*/
+int hashtableReplace(hashtable *h, void *key, void *val);
+/*删除key*/
+int hashtableDelete(hashtable *h, const void *key);
+/*将entry从hash表中移除并复制到unlinked中，不释放key和value*/
+int hashtableUnlink(hashtable *h, const void *key, hashtableEntry *unlinked);
+/*释放已移除的entry的key和value*/
+void hashtableFreeUnlinkedEntry(hashtable *h, hashtableEntry *e);
+/*释放hash表*/
+void hashtableRelease(hashtable *h);
+/*清空hash表并调用回调函数*/
+void hashtableEmpty(hashtable *h, void(callback)(void*));
+/*根据key查找entry*/
+hashtableEntry *hashtableFind(hashtable *h, const void *key);
+/*批量查找多个key，分阶段预取以隐藏cache miss*/
+void hashtableFindBatch(hashtable *h, const void **keys, hashtableEntry **entries, unsigned long count);
+/*根据key获取值*/
+void *hashtableFetchValue(hashtable *h, const void *key);
+/*调整容量到包含所有元素的最小值*/
+int hashtableResize(hashtable *h);
+/*创建迭代器*/
+hashtableIterator *hashtableGetIterator(hashtable *h);
+/*创建安全迭代器*/
+hashtableIterator *hashtableGetSafeIterator(hashtable *h);
+/*迭代器遍历entry*/
+hashtableEntry *hashtableNext(hashtableIterator *iter);
+/*释放迭代器*/
+void hashtableReleaseIterator(hashtableIterator *iter);
+/*随机取得一个entry*/
+hashtableEntry *hashtableGetRandomEntry(hashtable *h);
+/*随机获取指定个数entry*/
+unsigned int hashtableGetSomeEntries(hashtable *h, hashtableEntry **des, unsigned int count);
+/*调试用，取得hash表当前状态*/
+void hashtableGetStats(char *buf, size_t bufsize, hashtable *h);
+/*hash表自身占用的内存*/
+size_t hashtableMemUsage(hashtable *h);
+/*打开调整大小开关*/
+void hashtableEnableResize(void);
+/*关闭调整大小开关*/
+void hashtableDisableResize(void);
+/*暂停所有hash表的再hash*/
+void hashtablePauseRehashing(void);
+/*恢复所有hash表的再hash*/
+void hashtableResumeRehashing(void);
+/*再hash*/
+int hashtableRehash(hashtable *h, int n);
+/*再hash指定时间*/
+int hashtableRehashMilliseconds(hashtable *h, int ms);
+/*遍历hash表*/
+unsigned long hashtableScan(hashtable *h, unsigned long v, hashtableScanFunction *fn, hashtableScanBucketFunction *bucketfn, void *privdata);
+/*遍历指定范围的桶*/
+unsigned long hashtableScanBuckets(hashtable *h, unsigned long start, unsigned long end, hashtableScanFunction *fn, void *privdata);
+/*遍历一条桶链中的元素*/
+void hashtableScanChain(hashtableBucket *head, hashtableScanFunction *fn, void *privdata);
+/*分阶段预取多个hash值对应的桶和key*/
+void hashtablePrefetchBatch(hashtable *h, uint64_t *hashes, unsigned long count);
+
+#ifdef REDIS_TEST
+int hashtableTest(int argc, char *argv[]);
+#endif
+
+#endif /* __HASHTABLE_H */
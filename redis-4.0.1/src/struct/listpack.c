@@ -0,0 +1,1242 @@
+/* Listpack -- A list of strings serialization format
+ *
+ * The listpack stores a list of strings and integers in a single allocation,
+ * like the ziplist, and it is used in its place by small hashes, small sorted
+ * sets and by the nodes of the quicklist.
+ *
+ * The ziplist prefixes every entry with the length of the previous one, so
+ * that it can be traversed backward. When an entry grows past 253 bytes the
+ * length of the next entry header grows from 1 to 5 bytes, which can make
+ * the next one grow in turn: an insertion or a deletion can update all the
+ * entries of the list (see __ziplistCascadeUpdate()). The listpack instead
+ * stores the length of every entry at the end of the entry itself, so the
+ * size of an entry never depends on its neighbours.
+ *
+ * ----------------------------------------------------------------------------
+ *
+ * LISTPACK OVERALL LAYOUT
+ * =======================
+ *
+ * <total bytes> <num elements> <entry> <entry> ... <entry> <end>
+ *
+ * <uint32_t total bytes> is the size of the whole listpack, header and end
+ * byte included, stored in little endian.
+ *
+ * <uint16_t num elements> is the number of entries, in little endian. When
+ * there are 65535 entries or more the field is set to 65535 and the listpack
+ * needs to be traversed to know how many entries it holds.
+ *
+ * <end> is a single byte set to 255.
+ *
+ * The most significant bit of <total bytes> is set when the listpack has
+ * fingerprints (see below), so a listpack can't be larger than 2GB.
+ *
+ * LISTPACK ENTRIES
+ * ================
+ *
+ * <encoding+data> <backlen>
+ *
+ * The encoding tells the type and the length of the data that follows, or
+ * stores the data itself for small integers:
+ *
+ * |0xxxxxxx| unsigned integer from 0 to 127.
+ * |10xxxxxx| string of up to 63 bytes, xxxxxx is the length.
+ * |110xxxxx|yyyyyyyy| 13 bit signed integer.
+ * |1110xxxx|yyyyyyyy| string of up to 4095 bytes, the length is 12 bits.
+ * |11110000|<4 bytes length>| string of up to 2^32-1 bytes.
+ * |11110001|<2 bytes>| 16 bit signed integer.
+ * |11110010|<3 bytes>| 24 bit signed integer.
+ * |11110011|<4 bytes>| 32 bit signed integer.
+ * |11110100|<8 bytes>| 64 bit signed integer.
+ * |11111111| end of the listpack.
+ *
+ * All the multi bytes lengths and integers are stored in little endian, and
+ * the integers in two's complement. Strings are stored as integers whenever
+ * they are the canonical representation of a 64 bit signed integer.
+ *
+ * <backlen> is the length of <encoding+data>, stored in 1 to 5 bytes of 7
+ * bits each, so that it can be parsed from right to left: the most
+ * significant 7 bits are stored in the first byte, and every byte but the
+ * first one has the most significant bit set, meaning that more bytes
+ * follow on the left.
+ *
+ * FINGERPRINTS
+ * ============
+ *
+ * <total bytes> <num elements> <entry> ... <entry> <end> <fp> ... <fp>
+ *
+ * Looking up a field of a small hash or an element of a small sorted set
+ * means decoding and comparing every entry in turn. A listpack can carry
+ * after its end byte an array with a one byte hash of every entry, that
+ * lpFind() scans 16 or 32 entries at a time with SSE2 or AVX2 (a scalar
+ * loop elsewhere), so that only the entries whose hash matches are
+ * compared. The entries before them are just skipped over.
+ *
+ * The hash of an integer entry is the one of its canonical string, so that
+ * the string looked up can be hashed without knowing how it is encoded.
+ * The array is kept up to date by all the functions modifying the
+ * listpack, and it is dropped when the listpack reaches 65535 entries, as
+ * the number of entries is not known anymore. The array is counted in
+ * <total bytes>. See lpSetFingerprints().
+ *
+ * Copyright (c) 2009-2012, Salvatore Sanfilippo <antirez at gmail dot com>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *   * Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *   * Neither the name of Redis nor the names of its contributors may be used
+ *     to endorse or promote products derived from this software without
+ *     specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <limits.h>
+#include "config.h"
+#include "zmalloc.h"
+#include "util.h"
+#include "listpack.h"
+#include "redisassert.h"
+
+/*头部长度：总字节数和元素个数*/
+#define LP_HDR_SIZE 6
+/*元素个数超过65534时需要遍历listpack才能得到*/
+#define LP_HDR_NUMELE_UNKNOWN UINT16_MAX
+/*结束符*/
+#define LP_EOF 0xFF
+#define LP_MAX_INT_ENCODING_LEN 9
+#define LP_MAX_STR_HEADER_LEN 5
+#define LP_MAX_BACKLEN_SIZE 5
+/*整数转换为字符串需要的缓冲区大小*/
+#define LP_INTBUF_SIZE 21
+
+/*编码类型*/
+#define LP_ENCODING_7BIT_UINT 0
+#define LP_ENCODING_7BIT_UINT_MASK 0x80
+#define LP_ENCODING_IS_7BIT_UINT(byte) (((byte)&LP_ENCODING_7BIT_UINT_MASK)==LP_ENCODING_7BIT_UINT)
+
+#define LP_ENCODING_6BIT_STR 0x80
+#define LP_ENCODING_6BIT_STR_MASK 0xC0
+#define LP_ENCODING_IS_6BIT_STR(byte) (((byte)&LP_ENCODING_6BIT_STR_MASK)==LP_ENCODING_6BIT_STR)
+
+#define LP_ENCODING_13BIT_INT 0xC0
+#define LP_ENCODING_13BIT_INT_MASK 0xE0
+#define LP_ENCODING_IS_13BIT_INT(byte) (((byte)&LP_ENCODING_13BIT_INT_MASK)==LP_ENCODING_13BIT_INT)
+
+#define LP_ENCODING_12BIT_STR 0xE0
+#define LP_ENCODING_12BIT_STR_MASK 0xF0
+#define LP_ENCODING_IS_12BIT_STR(byte) (((byte)&LP_ENCODING_12BIT_STR_MASK)==LP_ENCODING_12BIT_STR)
+
+#define LP_ENCODING_32BIT_STR 0xF0
+#define LP_ENCODING_16BIT_INT 0xF1
+#define LP_ENCODING_24BIT_INT 0xF2
+#define LP_ENCODING_32BIT_INT 0xF3
+#define LP_ENCODING_64BIT_INT 0xF4
+
+#define LP_ENCODING_6BIT_STR_LEN(p) ((p)[0] & 0x3F)
+#define LP_ENCODING_12BIT_STR_LEN(p) ((((uint32_t)(p)[0] & 0xF) << 8) | (p)[1])
+#define LP_ENCODING_32BIT_STR_LEN(p) ((uint32_t)(p)[1] | \
+                                      ((uint32_t)(p)[2] << 8) | \
+                                      ((uint32_t)(p)[3] << 16) | \
+                                      ((uint32_t)(p)[4] << 24))
+
+/*总字节数的最高位表示listpack带有指纹数组*/
+#define LP_FINGERPRINTS_FLAG 0x80
+#define LP_MAX_BYTES INT32_MAX
+
+/*读写头部，设置总字节数时保留指纹标志*/
+#define lpGetTotalBytes(p) ((uint32_t)(p)[0] | \
+                            ((uint32_t)(p)[1] << 8) | \
+                            ((uint32_t)(p)[2] << 16) | \
+                            ((uint32_t)((p)[3] & 0x7f) << 24))
+#define lpGetNumElements(p) ((uint32_t)(p)[4] | ((uint32_t)(p)[5] << 8))
+#define lpSetTotalBytes(p,v) do { \
+    (p)[0] = (v) & 0xff; \
+    (p)[1] = ((v) >> 8) & 0xff; \
+    (p)[2] = ((v) >> 16) & 0xff; \
+    (p)[3] = (((v) >> 24) & 0x7f) | ((p)[3] & LP_FINGERPRINTS_FLAG); \
+} while(0)
+#define lpSetNumElements(p,v) do { \
+    (p)[4] = (v) & 0xff; \
+    (p)[5] = ((v) >> 8) & 0xff; \
+} while(0)
+
+/* Create a new, empty listpack. */
+unsigned char *lpNew(void) {
+    unsigned char *lp = zmalloc(LP_HDR_SIZE+1);
+
+    lp[3] = 0;
+    lpSetTotalBytes(lp,LP_HDR_SIZE+1);
+    lpSetNumElements(lp,0);
+    lp[LP_HDR_SIZE] = LP_EOF;
+    return lp;
+}
+
+/* Store the encoding of the integer 'v' in 'buf', returning its length:
+ * the smallest encoding able to represent it is used. */
+static unsigned long lpEncodeInteger(unsigned char *buf, long long v) {
+    uint64_t uv = (uint64_t)v;
+    unsigned long bytes, j;
+
+    if (v >= 0 && v <= 127) {
+        buf[0] = v;
+        return 1;
+    } else if (v >= -4096 && v <= 4095) {
+        buf[0] = ((uv >> 8) & 0x1F) | LP_ENCODING_13BIT_INT;
+        buf[1] = uv & 0xff;
+        return 2;
+    } else if (v >= -32768 && v <= 32767) {
+        buf[0] = LP_ENCODING_16BIT_INT;
+        bytes = 2;
+    } else if (v >= -8388608 && v <= 8388607) {
+        buf[0] = LP_ENCODING_24BIT_INT;
+        bytes = 3;
+    } else if (v >= INT32_MIN && v <= INT32_MAX) {
+        buf[0] = LP_ENCODING_32BIT_INT;
+        bytes = 4;
+    } else {
+        buf[0] = LP_ENCODING_64BIT_INT;
+        bytes = 8;
+    }
+    for (j = 0; j < bytes; j++) buf[j+1] = (uv >> (j*8)) & 0xff;
+    return bytes+1;
+}
+
+/* Store the encoding of a string of 'len' bytes in 'buf', that is, the
+ * header preceding the string itself. Returns the length of the header. */
+static unsigned long lpEncodeStringHeader(unsigned char *buf, uint32_t len) {
+    if (len < 64) {
+        buf[0] = len | LP_ENCODING_6BIT_STR;
+        return 1;
+    } else if (len < 4096) {
+        buf[0] = (len >> 8) | LP_ENCODING_12BIT_STR;
+        buf[1] = len & 0xff;
+        return 2;
+    } else {
+        buf[0] = LP_ENCODING_32BIT_STR;
+        buf[1] = len & 0xff;
+        buf[2] = (len >> 8) & 0xff;
+        buf[3] = (len >> 16) & 0xff;
+        buf[4] = (len >> 24) & 0xff;
+        return 5;
+    }
+}
+
+/* Store in 'buf' the backlen of an entry whose encoding and data take 'l'
+ * bytes, returning the number of bytes used. When 'buf' is NULL the
+ * length is just returned. */
+static unsigned long lpEncodeBacklen(unsigned char *buf, uint64_t l) {
+    unsigned long bytes, j;
+
+    if (l < 128) bytes = 1;
+    else if (l < 16384) bytes = 2;
+    else if (l < 2097152) bytes = 3;
+    else if (l < 268435456) bytes = 4;
+    else bytes = 5;
+
+    if (buf) {
+        for (j = 0; j < bytes; j++) {
+            buf[j] = (l >> (7*(bytes-1-j))) & 127;
+            if (j) buf[j] |= 128;
+        }
+    }
+    return bytes;
+}
+
+/* Decode the backlen ending at 'p', the last byte of an entry. */
+static uint64_t lpDecodeBacklen(unsigned char *p) {
+    uint64_t val = 0;
+    unsigned int shift = 0;
+
+    do {
+        val |= (uint64_t)(p[0] & 127) << shift;
+        if (!(p[0] & 128)) break;
+        shift += 7;
+        p--;
+    } while (shift < 35);
+    return val;
+}
+
+/* Length of the encoding and the data of the entry at 'p', the backlen
+ * excluded. */
+static uint32_t lpCurrentEncodedSize(unsigned char *p) {
+    if (LP_ENCODING_IS_7BIT_UINT(p[0])) return 1;
+    if (LP_ENCODING_IS_6BIT_STR(p[0])) return 1+LP_ENCODING_6BIT_STR_LEN(p);
+    if (LP_ENCODING_IS_13BIT_INT(p[0])) return 2;
+    if (LP_ENCODING_IS_12BIT_STR(p[0])) return 2+LP_ENCODING_12BIT_STR_LEN(p);
+    switch(p[0]) {
+    case LP_ENCODING_16BIT_INT: return 3;
+    case LP_ENCODING_24BIT_INT: return 4;
+    case LP_ENCODING_32BIT_INT: return 5;
+    case LP_ENCODING_64BIT_INT: return 9;
+    case LP_ENCODING_32BIT_STR: return 5+LP_ENCODING_32BIT_STR_LEN(p);
+    case LP_EOF: return 1;
+    }
+    assert(NULL && "Invalid listpack encoding");
+    return 0;
+}
+
+/* Return the address of the entry following the one at 'p', or of the
+ * end byte. */
+static inline unsigned char *lpSkip(unsigned char *p) {
+    uint32_t entrylen = lpCurrentEncodedSize(p);
+    return p+entrylen+lpEncodeBacklen(NULL,entrylen);
+}
+
+/* Return 1 if the listpack has the array of the fingerprints. */
+int lpHasFingerprints(unsigned char *lp) {
+    return (lp[3] & LP_FINGERPRINTS_FLAG) != 0;
+}
+
+/* Return the address of the end byte, that is followed by the fingerprints
+ * when there are any. */
+static inline unsigned char *lpEnd(unsigned char *lp) {
+    uint32_t bytes = lpGetTotalBytes(lp);
+
+    if (lpHasFingerprints(lp)) bytes -= lpGetNumElements(lp);
+    return lp+bytes-1;
+}
+
+/* Return the next entry, or NULL if 'p' is the last one. */
+unsigned char *lpNext(unsigned char *lp, unsigned char *p) {
+    ((void) lp);
+    p = lpSkip(p);
+    return p[0] == LP_EOF ? NULL : p;
+}
+
+/* Return the previous entry, or NULL if 'p' is the first one. 'p' can be
+ * the end byte as well, to get the last entry. */
+unsigned char *lpPrev(unsigned char *lp, unsigned char *p) {
+    uint64_t prevlen;
+
+    if (p-lp == LP_HDR_SIZE) return NULL;
+    p--; /* The last byte of the backlen of the previous entry. */
+    prevlen = lpDecodeBacklen(p);
+    prevlen += lpEncodeBacklen(NULL,prevlen);
+    return p-prevlen+1;
+}
+
+/* Return the first entry, or NULL if the listpack is empty. */
+unsigned char *lpFirst(unsigned char *lp) {
+    unsigned char *p = lp+LP_HDR_SIZE;
+    return p[0] == LP_EOF ? NULL : p;
+}
+
+/* Return the last entry, or NULL if the listpack is empty. */
+unsigned char *lpLast(unsigned char *lp) {
+    return lpPrev(lp,lpEnd(lp));
+}
+
+/* Return the number of entries. When the header doesn't hold the number
+ * the listpack is traversed, and the header is updated if the number fits
+ * into it again. */
+unsigned long lpLength(unsigned char *lp) {
+    uint32_t numele = lpGetNumElements(lp);
+    unsigned long count = 0;
+    unsigned char *p;
+
+    if (numele != LP_HDR_NUMELE_UNKNOWN) return numele;
+    for (p = lp+LP_HDR_SIZE; p[0] != LP_EOF; p = lpSkip(p)) count++;
+    if (count < LP_HDR_NUMELE_UNKNOWN) lpSetNumElements(lp,count);
+    return count;
+}
+
+/* Return the total size of the listpack in bytes. */
+size_t lpBytes(unsigned char *lp) {
+    return lpGetTotalBytes(lp);
+}
+
+/* Get the value of the entry at 'p'. Strings are returned by reference
+ * setting '*sval' and '*slen', otherwise '*sval' is set to NULL and the
+ * integer is stored in '*lval'. Returns 0 if 'p' is NULL or the end of the
+ * listpack, otherwise 1. */
+unsigned int lpGet(unsigned char *p, unsigned char **sval, unsigned int *slen, long long *lval) {
+    uint64_t uv;
+    unsigned int bits, j;
+
+    if (p == NULL || p[0] == LP_EOF) return 0;
+    if (sval) *sval = NULL;
+
+    if (LP_ENCODING_IS_7BIT_UINT(p[0])) {
+        if (lval) *lval = p[0];
+        return 1;
+    } else if (LP_ENCODING_IS_6BIT_STR(p[0])) {
+        if (sval) {
+            *sval = p+1;
+            *slen = LP_ENCODING_6BIT_STR_LEN(p);
+        }
+        return 1;
+    } else if (LP_ENCODING_IS_13BIT_INT(p[0])) {
+        uv = ((uint64_t)(p[0] & 0x1F) << 8) | p[1];
+        bits = 13;
+    } else if (LP_ENCODING_IS_12BIT_STR(p[0])) {
+        if (sval) {
+            *sval = p+2;
+            *slen = LP_ENCODING_12BIT_STR_LEN(p);
+        }
+        return 1;
+    } else if (p[0] == LP_ENCODING_32BIT_STR) {
+        if (sval) {
+            *sval = p+5;
+            *slen = LP_ENCODING_32BIT_STR_LEN(p);
+        }
+        return 1;
+    } else {
+        switch(p[0]) {
+        case LP_ENCODING_16BIT_INT: bits = 16; break;
+        case LP_ENCODING_24BIT_INT: bits = 24; break;
+        case LP_ENCODING_32BIT_INT: bits = 32; break;
+        case LP_ENCODING_64BIT_INT: bits = 64; break;
+        default: assert(NULL && "Invalid listpack encoding"); return 0;
+        }
+        uv = 0;
+        for (j = 0; j < bits/8; j++) uv |= (uint64_t)p[j+1] << (j*8);
+    }
+
+    /* Sign extension of the two's complement representation. */
+    if (bits < 64 && (uv & (1ULL << (bits-1))))
+        uv |= ~((1ULL << bits)-1);
+    if (lval) *lval = (long long)uv;
+    return 1;
+}
+
+/* Fingerprint of the string 's' of 'len' bytes: FNV-1a folded to 8 bits. */
+static inline unsigned char lpFingerprint(const unsigned char *s, size_t len) {
+    uint32_t h = 2166136261U;
+    size_t j;
+
+    for (j = 0; j < len; j++) {
+        h ^= s[j];
+        h *= 16777619U;
+    }
+    h ^= h >> 16;
+    return (h ^ (h >> 8)) & 0xff;
+}
+
+/* Fingerprint of the entry at 'p'. Integers are hashed as strings. */
+static unsigned char lpEntryFingerprint(unsigned char *p) {
+    unsigned char *sval, buf[LP_INTBUF_SIZE];
+    unsigned int slen;
+    long long lval;
+
+    lpGet(p,&sval,&slen,&lval);
+    if (sval) return lpFingerprint(sval,slen);
+    slen = ll2string((char*)buf,sizeof(buf),lval);
+    return lpFingerprint(buf,slen);
+}
+
+/* Return the index of the entry at 'p', or the number of entries if 'p' is
+ * the end byte, walking from the nearest end of the listpack. Only used
+ * when the number of entries is known. */
+static unsigned long lpEntryIndex(unsigned char *lp, unsigned char *p) {
+    unsigned char *end = lpEnd(lp), *q;
+    unsigned long index;
+
+    if (p-lp < end-p) {
+        for (q = lp+LP_HDR_SIZE, index = 0; q != p; q = lpSkip(q)) index++;
+    } else {
+        index = lpGetNumElements(lp);
+        for (q = end; q != p; q = lpPrev(lp,q)) index--;
+    }
+    return index;
+}
+
+/* Add the array of the fingerprints to the listpack if 'enable' is true,
+ * or remove it otherwise. Nothing is done when the listpack already has
+ * the requested layout, or when it has 65535 entries or more. Returns the
+ * listpack, that may have been reallocated. */
+unsigned char *lpSetFingerprints(unsigned char *lp, int enable) {
+    uint32_t bytes = lpGetTotalBytes(lp), numele = lpGetNumElements(lp);
+    unsigned char *p, *fps;
+
+    if (!enable == !lpHasFingerprints(lp)) return lp;
+    if (enable) {
+        if (numele == LP_HDR_NUMELE_UNKNOWN) numele = lpLength(lp);
+        if (numele >= LP_HDR_NUMELE_UNKNOWN) return lp;
+        assert((uint64_t)bytes+numele <= LP_MAX_BYTES);
+        lp = zrealloc(lp,bytes+numele);
+        fps = lp+bytes;
+        for (p = lp+LP_HDR_SIZE; p[0] != LP_EOF; p = lpSkip(p))
+            *fps++ = lpEntryFingerprint(p);
+        lp[3] |= LP_FINGERPRINTS_FLAG;
+        lpSetTotalBytes(lp,bytes+numele);
+    } else {
+        lp[3] &= ~LP_FINGERPRINTS_FLAG;
+        lpSetTotalBytes(lp,bytes-numele);
+        lp = zrealloc(lp,bytes-numele);
+    }
+    return lp;
+}
+
+/* Return a copy of the listpack. */
+unsigned char *lpDup(unsigned char *lp) {
+    size_t bytes = lpGetTotalBytes(lp);
+    unsigned char *copy = zmalloc(bytes);
+
+    memcpy(copy,lp,bytes);
+    return copy;
+}
+
+/* Insert the string 'ele' of 'size' bytes before or after the entry at 'p'
+ * (according to 'where', LP_BEFORE or LP_AFTER), or replace the entry at
+ * 'p' with it (LP_REPLACE). When 'ele' is NULL the entry at 'p' is deleted.
+ * 'p' can be the end byte in order to append.
+ *
+ * If 'newp' is not NULL it is set to the address of the new entry, or for
+ * a deletion of the entry that followed the deleted one (NULL if it was
+ * the last one). Returns the listpack, that may have been reallocated. */
+unsigned char *lpInsert(unsigned char *lp, unsigned char *ele, uint32_t size, unsigned char *p, int where, unsigned char **newp) {
+    unsigned char hdr[LP_MAX_INT_ENCODING_LEN];
+    unsigned char backlen[LP_MAX_BACKLEN_SIZE];
+    unsigned long hdrlen = 0, datalen = 0, backlen_size = 0;
+    unsigned long poff, replaced_len = 0, index = 0;
+    uint64_t old_bytes, new_bytes;
+    uint32_t numele = lpGetNumElements(lp);
+    long long v;
+    unsigned char *dst, *fps, fp = 0;
+    int fingerprints = lpHasFingerprints(lp);
+
+    if (ele == NULL) where = LP_REPLACE;
+    if (where == LP_AFTER) {
+        p = lpSkip(p);
+        where = LP_BEFORE;
+    }
+    poff = p-lp;
+    if (fingerprints && where == LP_BEFORE &&
+        numele+1 == LP_HDR_NUMELE_UNKNOWN)
+    {
+        /* The number of entries won't be known anymore. */
+        lp = lpSetFingerprints(lp,0);
+        p = lp+poff;
+        fingerprints = 0;
+    }
+    if (fingerprints) {
+        index = lpEntryIndex(lp,p);
+        if (ele) fp = lpFingerprint(ele,size);
+    }
+
+    /* Encode the new entry, as an integer if possible. */
+    if (ele) {
+        if (size > 0 && size <= 20 && string2ll((char*)ele,size,&v)) {
+            hdrlen = lpEncodeInteger(hdr,v);
+        } else {
+            hdrlen = lpEncodeStringHeader(hdr,size);
+            datalen = size;
+        }
+        backlen_size = lpEncodeBacklen(backlen,hdrlen+datalen);
+    }
+    if (where == LP_REPLACE) {
+        replaced_len = lpCurrentEncodedSize(p);
+        replaced_len += lpEncodeBacklen(NULL,replaced_len);
+    }
+
+    old_bytes = lpGetTotalBytes(lp);
+    if (fingerprints && ele == NULL) {
+        /* Drop the fingerprint of the deleted entry first: the array is
+         * moved along with the tail of the listpack, without its last
+         * byte. */
+        fps = lp+old_bytes-numele;
+        memmove(fps+index,fps+index+1,numele-index-1);
+        old_bytes--;
+    }
+    new_bytes = old_bytes+hdrlen+datalen+backlen_size-replaced_len;
+    if (fingerprints && where == LP_BEFORE) new_bytes++;
+    assert(new_bytes <= LP_MAX_BYTES);
+
+    /* Make room for the new entry, or shrink the listpack after moving the
+     * tail over the replaced entry. */
+    if (new_bytes > old_bytes) lp = zrealloc(lp,new_bytes);
+    dst = lp+poff;
+    memmove(dst+hdrlen+datalen+backlen_size,dst+replaced_len,
+            old_bytes-poff-replaced_len);
+    if (new_bytes < old_bytes) lp = zrealloc(lp,new_bytes);
+    dst = lp+poff;
+
+    if (ele) {
+        memcpy(dst,hdr,hdrlen);
+        memcpy(dst+hdrlen,ele,datalen);
+        memcpy(dst+hdrlen+datalen,backlen,backlen_size);
+    }
+    if (newp) *newp = (dst[0] == LP_EOF) ? NULL : dst;
+
+    if (fingerprints && ele) {
+        if (where == LP_BEFORE) {
+            /* The array was moved to the end but the last byte. */
+            fps = lp+new_bytes-1-numele;
+            memmove(fps+index+1,fps+index,numele-index);
+        } else {
+            fps = lp+new_bytes-numele;
+        }
+        fps[index] = fp;
+    }
+
+    lpSetTotalBytes(lp,new_bytes);
+    if (numele != LP_HDR_NUMELE_UNKNOWN) {
+        if (ele == NULL) numele--;
+        else if (where == LP_BEFORE) numele++;
+        lpSetNumElements(lp,numele);
+    }
+    return lp;
+}
+
+/* Add an entry at the tail of the listpack. */
+unsigned char *lpAppend(unsigned char *lp, unsigned char *ele, uint32_t size) {
+    return lpInsert(lp,ele,size,lpEnd(lp),LP_BEFORE,NULL);
+}
+
+/* Add an entry at the head of the listpack. */
+unsigned char *lpPrepend(unsigned char *lp, unsigned char *ele, uint32_t size) {
+    return lpInsert(lp,ele,size,lp+LP_HDR_SIZE,LP_BEFORE,NULL);
+}
+
+/* Delete the entry at 'p'. See lpInsert() for 'newp'. */
+unsigned char *lpDelete(unsigned char *lp, unsigned char *p, unsigned char **newp) {
+    return lpInsert(lp,NULL,0,p,LP_REPLACE,newp);
+}
+
+/* Return the entry at the specified index, where 0 is the first entry and
+ * -1 the last one, or NULL if the index is out of range. The listpack is
+ * traversed from the nearest end. */
+unsigned char *lpSeek(unsigned char *lp, long index) {
+    unsigned long numele = lpLength(lp);
+    unsigned char *p;
+
+    if (index < 0) index = (long)numele+index;
+    if (index < 0 || (unsigned long)index >= numele) return NULL;
+
+    if ((unsigned long)index < numele/2) {
+        p = lp+LP_HDR_SIZE;
+        while (index--) p = lpSkip(p);
+    } else {
+        p = lpLast(lp);
+        index = numele-index-1;
+        while (index--) p = lpPrev(lp,p);
+    }
+    return p;
+}
+
+/* Delete 'num' entries starting at the specified index (see lpSeek()). */
+unsigned char *lpDeleteRange(unsigned char *lp, long index, unsigned long num) {
+    unsigned char *first, *tail, *fps;
+    unsigned long deleted = 0;
+    uint32_t bytes, numele;
+
+    if (num == 0 || (first = lpSeek(lp,index)) == NULL) return lp;
+    tail = first;
+    while (deleted < num && tail[0] != LP_EOF) {
+        tail = lpSkip(tail);
+        deleted++;
+    }
+
+    bytes = lpGetTotalBytes(lp);
+    numele = lpGetNumElements(lp);
+    if (lpHasFingerprints(lp)) {
+        /* The index is in range, since lpSeek() found the entry. */
+        if (index < 0) index += numele;
+        fps = lp+bytes-numele;
+        memmove(fps+index,fps+index+deleted,numele-index-deleted);
+        bytes -= deleted;
+    }
+    memmove(first,tail,lp+bytes-tail);
+    bytes -= tail-first;
+    lpSetTotalBytes(lp,bytes);
+    if (numele != LP_HDR_NUMELE_UNKNOWN)
+        lpSetNumElements(lp,numele-deleted);
+    return zrealloc(lp,bytes);
+}
+
+/* Merge the listpacks 'first' and 'second', appending the entries of
+ * 'second' to the ones of 'first'. The bigger listpack is reallocated to
+ * hold the result, while the other one is freed and its pointer set to
+ * NULL. The fingerprints of both are dropped. Returns the merged listpack,
+ * or NULL if the merge is impossible. */
+unsigned char *lpMerge(unsigned char **first, unsigned char **second) {
+    unsigned char *target;
+    size_t first_bytes, second_bytes, lpbytes;
+    unsigned long numele;
+
+    if (first == NULL || *first == NULL || second == NULL || *second == NULL)
+        return NULL;
+    if (*first == *second) return NULL;
+
+    *first = lpSetFingerprints(*first,0);
+    *second = lpSetFingerprints(*second,0);
+    first_bytes = lpGetTotalBytes(*first);
+    second_bytes = lpGetTotalBytes(*second);
+    numele = lpLength(*first)+lpLength(*second);
+    /* One header and one end byte less. */
+    lpbytes = first_bytes+second_bytes-LP_HDR_SIZE-1;
+    assert(lpbytes <= LP_MAX_BYTES);
+
+    if (first_bytes >= second_bytes) {
+        /* [FIRST - END] [SECOND - HEADER] */
+        target = zrealloc(*first,lpbytes);
+        memcpy(target+first_bytes-1,*second+LP_HDR_SIZE,
+               second_bytes-LP_HDR_SIZE);
+        zfree(*second);
+        *first = target;
+        *second = NULL;
+    } else {
+        /* Move the entries of the second listpack to the right, then copy
+         * the ones of the first in the space left. */
+        target = zrealloc(*second,lpbytes);
+        memmove(target+first_bytes-1,target+LP_HDR_SIZE,
+                second_bytes-LP_HDR_SIZE);
+        memcpy(target+LP_HDR_SIZE,*first+LP_HDR_SIZE,
+               first_bytes-LP_HDR_SIZE-1);
+        zfree(*first);
+        *first = NULL;
+        *second = target;
+    }
+
+    lpSetTotalBytes(target,lpbytes);
+    if (numele > LP_HDR_NUMELE_UNKNOWN) numele = LP_HDR_NUMELE_UNKNOWN;
+    lpSetNumElements(target,numele);
+    return target;
+}
+
+/* Return 1 if the entry at 'p' is equal to the string 's' of 'slen' bytes.
+ * Integers are compared by value, like in ziplistCompare(). */
+unsigned int lpCompare(unsigned char *p, unsigned char *s, unsigned int slen) {
+    unsigned char *sval;
+    unsigned int len;
+    long long lval, v;
+
+    if (!lpGet(p,&sval,&len,&lval)) return 0;
+    if (sval) return len == slen && memcmp(sval,s,slen) == 0;
+    if (slen == 0 || slen > 20 || !string2ll((char*)s,slen,&v)) return 0;
+    return lval == v;
+}
+
+/* Return a bitmap where the bit j is set if the fingerprint fps[j] is equal
+ * to 'fp', for the first 'count' fingerprints (at most 64). */
+static inline uint64_t lpMatchFingerprintsScalar(const unsigned char *fps, unsigned long count, unsigned char fp) {
+    uint64_t mask = 0;
+    unsigned long j;
+
+    for (j = 0; j < count; j++) mask |= (uint64_t)(fps[j] == fp) << j;
+    return mask;
+}
+
+#ifdef HAVE_X86_SIMD
+#include <immintrin.h>
+
+static uint64_t lpMatchFingerprintsSSE2(const unsigned char *fps, unsigned long count, unsigned char fp) {
+    __m128i needle = _mm_set1_epi8((char)fp);
+    uint64_t mask = 0;
+    unsigned long j;
+
+    for (j = 0; j+16 <= count; j += 16) {
+        __m128i v = _mm_loadu_si128((const __m128i*)(fps+j));
+        uint16_t m = _mm_movemask_epi8(_mm_cmpeq_epi8(v,needle));
+        mask |= (uint64_t)m << j;
+    }
+    if (j < count) mask |= lpMatchFingerprintsScalar(fps+j,count-j,fp) << j;
+    return mask;
+}
+
+__attribute__((target("avx2")))
+static uint64_t lpMatchFingerprintsAVX2(const unsigned char *fps, unsigned long count, unsigned char fp) {
+    __m256i needle = _mm256_set1_epi8((char)fp);
+    uint64_t mask = 0;
+    unsigned long j;
+
+    for (j = 0; j+32 <= count; j += 32) {
+        __m256i v = _mm256_loadu_si256((const __m256i*)(fps+j));
+        uint32_t m = _mm256_movemask_epi8(_mm256_cmpeq_epi8(v,needle));
+        mask |= (uint64_t)m << j;
+    }
+    /* Not calling the SSE2 kernel for the rest, since switching between
+     * AVX and legacy SSE instructions is slow on many CPUs. */
+    if (j+16 <= count) {
+        __m128i v = _mm_loadu_si128((const __m128i*)(fps+j));
+        uint16_t m = _mm_movemask_epi8(_mm_cmpeq_epi8(v,
+                                       _mm256_castsi256_si128(needle)));
+        mask |= (uint64_t)m << j;
+        j += 16;
+    }
+    if (j < count) mask |= lpMatchFingerprintsScalar(fps+j,count-j,fp) << j;
+    return mask;
+}
+#endif
+
+typedef uint64_t lpMatchFingerprintsProc(const unsigned char *fps, unsigned long count, unsigned char fp);
+static lpMatchFingerprintsProc lpMatchFingerprintsResolve;
+static lpMatchFingerprintsProc *lpMatchFingerprints = lpMatchFingerprintsResolve;
+
+/* Select the best kernel for this CPU the first time it is called. */
+static uint64_t lpMatchFingerprintsResolve(const unsigned char *fps, unsigned long count, unsigned char fp) {
+#ifdef HAVE_X86_SIMD
+    __builtin_cpu_init();
+    lpMatchFingerprints = __builtin_cpu_supports("avx2") ?
+        lpMatchFingerprintsAVX2 : lpMatchFingerprintsSSE2;
+#else
+    lpMatchFingerprints = lpMatchFingerprintsScalar;
+#endif
+    return lpMatchFingerprints(fps,count,fp);
+}
+
+/* Bitmap of the entries compared by lpFind() among the 64 starting at the
+ * index 'base', that is, the ones at an index multiple of 'step'. */
+static uint64_t lpStrideMask(unsigned long base, unsigned long step) {
+    uint64_t mask = 0;
+    unsigned long j;
+
+    for (j = (step - base % step) % step; j < 64; j += step)
+        mask |= (uint64_t)1 << j;
+    return mask;
+}
+
+static inline unsigned int lpCountTrailingZeros(uint64_t v) {
+#if defined(__GNUC__)
+    return __builtin_ctzll(v);
+#else
+    unsigned int n = 0;
+    while (!(v & 1)) {
+        v >>= 1;
+        n++;
+    }
+    return n;
+#endif
+}
+
+/* lpFind() from the first entry of a listpack with fingerprints. Only the
+ * entries with the same fingerprint of 'vstr' are compared, the others are
+ * just skipped. Every candidate is reached from the previous one, or from
+ * the end of the listpack when it is nearer. */
+static unsigned char *lpFindWithFingerprints(unsigned char *lp, unsigned char *vstr, unsigned int vlen, unsigned int skip) {
+    unsigned long numele = lpGetNumElements(lp), index = 0, base, target;
+    unsigned long step = (unsigned long)skip+1;
+    unsigned char *end = lpEnd(lp), *fps = end+1, *p = lp+LP_HDR_SIZE;
+    unsigned char fp = lpFingerprint(vstr,vlen);
+    uint64_t mask, stride = lpStrideMask(0,step);
+
+    for (base = 0; base < numele; base += 64) {
+        mask = lpMatchFingerprints(fps+base,
+            numele-base < 64 ? numele-base : 64,fp);
+        if (64 % step) stride = lpStrideMask(base,step);
+        mask &= stride;
+        while (mask) {
+            target = base+lpCountTrailingZeros(mask);
+            mask &= mask-1;
+            if (numele-target < target-index) {
+                p = end;
+                index = numele;
+            }
+            while (index < target) {
+                p = lpSkip(p);
+                index++;
+            }
+            while (index > target) {
+                p = lpPrev(lp,p);
+                index--;
+            }
+            if (lpCompare(p,vstr,vlen)) return p;
+        }
+    }
+    return NULL;
+}
+
+/* Find the entry equal to the string 'vstr' of 'vlen' bytes, starting at
+ * 'p' and skipping 'skip' entries after every comparison, so that only the
+ * keys of the fields of a hash, or the elements of a sorted set are
+ * compared. Returns NULL if no entry matches. The fingerprints are used
+ * when the search starts at the first entry. */
+unsigned char *lpFind(unsigned char *lp, unsigned char *p, unsigned char *vstr, unsigned int vlen, unsigned int skip) {
+    unsigned int skipcnt = 0, len;
+    /* 0: not known yet, 1: 'vstr' is an integer, 2: it is not. */
+    int vencoding = 0;
+    long long vll = 0, lval;
+    unsigned char *sval;
+
+    if (p == lp+LP_HDR_SIZE && lpHasFingerprints(lp))
+        return lpFindWithFingerprints(lp,vstr,vlen,skip);
+    while (p && p[0] != LP_EOF) {
+        if (skipcnt == 0) {
+            lpGet(p,&sval,&len,&lval);
+            if (sval) {
+                if (len == vlen && memcmp(sval,vstr,vlen) == 0) return p;
+            } else {
+                /* Try to encode the string as an integer only once, the
+                 * first time an integer entry is found. */
+                if (vencoding == 0) {
+                    vencoding = (vlen > 0 && vlen <= 20 &&
+                                 string2ll((char*)vstr,vlen,&vll)) ? 1 : 2;
+                }
+                if (vencoding == 1 && lval == vll) return p;
+            }
+            skipcnt = skip;
+        } else {
+            skipcnt--;
+        }
+        p = lpSkip(p);
+    }
+    return NULL;
+}
+
+/* Print the content of the listpack, for debugging. */
+void lpRepr(unsigned char *lp) {
+    unsigned char *p, *sval;
+    unsigned int len;
+    uint32_t entrylen;
+    long long lval;
+    int index = 0;
+
+    printf(
+        "{total bytes %u} "
+        "{num entries %lu} "
+        "{fingerprints %s}\n",
+        lpGetTotalBytes(lp),
+        lpLength(lp),
+        lpHasFingerprints(lp) ? "yes" : "no");
+    p = lpFirst(lp);
+    while (p) {
+        entrylen = lpCurrentEncodedSize(p);
+        printf(
+            "{\n"
+                "\taddr 0x%08lx,\n"
+                "\tindex %2d,\n"
+                "\toffset %5ld,\n"
+                "\tencoding+data len: %5u,\n"
+                "\tbacklen len: %2lu\n",
+            (long unsigned)p,
+            index,
+            (unsigned long) (p-lp),
+            entrylen,
+            lpEncodeBacklen(NULL,entrylen));
+        lpGet(p,&sval,&len,&lval);
+        if (sval) {
+            printf("\t[str]");
+            if (len > 40) {
+                if (fwrite(sval,40,1,stdout) == 0) perror("fwrite");
+                printf("...");
+            } else {
+                if (len && fwrite(sval,len,1,stdout) == 0) perror("fwrite");
+            }
+        } else {
+            printf("\t[int]%lld", lval);
+        }
+        printf("\n}\n");
+        p = lpNext(lp,p);
+        index++;
+    }
+    printf("{end}\n\n");
+}
+
+#ifdef REDIS_TEST
+#include <time.h>
+#include "sds.h"
+
+#define LISTPACK_TEST_OPS 20000
+#define LISTPACK_TEST_MAXLEN 500
+/* Random string that is an integer half of the times, of any length and
+ * sign, so that every encoding is used. */
+static sds lpTestRandomEle(void) {
+    static const long long ints[] = {0,1,-1,127,128,-4096,4095,-4097,4096,
+        32767,-32768,32768,8388607,-8388608,8388608,INT32_MAX,INT32_MIN,
+        (long long)INT32_MAX+1,LLONG_MAX,LLONG_MIN};
+    sds s;
+    size_t len, j;
+
+    switch(rand() % 4) {
+    case 0:
+        return sdsfromlonglong(ints[rand() % (sizeof(ints)/sizeof(ints[0]))]);
+    case 1:
+        return sdsfromlonglong(((long long)rand()<<32|rand())>>(rand()%64));
+    case 2:
+        len = rand() % 70;
+        break;
+    default:
+        len = (rand() % 10 == 0) ? 4000+rand()%5000 : rand()%300;
+        break;
+    }
+    s = sdsnewlen(NULL,len);
+    for (j = 0; j < len; j++) s[j] = 'a'+rand()%26;
+    return s;
+}
+
+/* Check the listpack against the array of the expected entries, iterating
+ * in both directions, and its fingerprints if it has them. */
+static void lpTestVerify(unsigned char *lp, sds *model, long count) {
+    unsigned char *p, *sval, *fps = lpEnd(lp)+1;
+    unsigned int slen;
+    long long lval;
+    char buf[LP_INTBUF_SIZE];
+    long j;
+
+    assert(lpLength(lp) == (unsigned long)count);
+    p = lpFirst(lp);
+    for (j = 0; j < count; j++) {
+        assert(p != NULL);
+        assert(lpGet(p,&sval,&slen,&lval));
+        if (sval == NULL) {
+            slen = ll2string(buf,sizeof(buf),lval);
+            sval = (unsigned char*)buf;
+        }
+        assert(slen == sdslen(model[j]) && memcmp(sval,model[j],slen) == 0);
+        assert(lpCompare(p,(unsigned char*)model[j],sdslen(model[j])));
+        if (lpHasFingerprints(lp))
+            assert(fps[j] == lpFingerprint((unsigned char*)model[j],
+                                           sdslen(model[j])));
+        p = lpNext(lp,p);
+    }
+    assert(p == NULL);
+    assert(!lpHasFingerprints(lp) ||
+           lpEnd(lp)+1+count == lp+lpGetTotalBytes(lp));
+    p = lpLast(lp);
+    for (j = count-1; j >= 0; j--) {
+        assert(p != NULL && p == lpSeek(lp,j));
+        p = lpPrev(lp,p);
+    }
+    assert(p == NULL);
+}
+
+/* Time lpFind() on listpacks laid out like hashes of 'fields' fields,
+ * looking up existing fields in random order and missing ones, without
+ * fingerprints and with every kernel available. */
+static void lpTestBenchmarkFind(void) {
+    static const unsigned long sizes[] = {8,64,512};
+    const char *names[] = {"none","scalar","sse2","avx2"};
+    lpMatchFingerprintsProc *kernels[4] = {NULL,lpMatchFingerprintsScalar};
+    int nkernels = 2, k, hit;
+    unsigned long fields, j, i, lookups;
+    unsigned char *lp;
+    char buf[64];
+    clock_t start;
+    long long elapsed;
+
+#ifdef HAVE_X86_SIMD
+    kernels[nkernels++] = lpMatchFingerprintsSSE2;
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2"))
+        kernels[nkernels++] = lpMatchFingerprintsAVX2;
+#endif
+
+    printf("Find benchmark, ns per lookup (hit/miss):\n");
+    for (i = 0; i < sizeof(sizes)/sizeof(sizes[0]); i++) {
+        fields = sizes[i];
+        lookups = 20000000/fields;
+        lp = lpNew();
+        for (j = 0; j < fields; j++) {
+            lp = lpAppend(lp,(unsigned char*)buf,
+                          snprintf(buf,sizeof(buf),"field:%lu",j));
+            lp = lpAppend(lp,(unsigned char*)buf,
+                          snprintf(buf,sizeof(buf),"value:%lu",j*7));
+        }
+        printf("  %4lu fields:", fields);
+        for (k = 0; k < nkernels; k++) {
+            lp = lpSetFingerprints(lp,k != 0);
+            if (k) lpMatchFingerprints = kernels[k];
+            printf(" %s", names[k]);
+            for (hit = 1; hit >= 0; hit--) {
+                start = clock();
+                for (j = 0; j < lookups; j++) {
+                    int len = snprintf(buf,sizeof(buf),"%s:%lu",
+                        hit ? "field" : "other", (j*2654435761UL)%fields);
+                    unsigned char *p = lpFind(lp,lpFirst(lp),
+                        (unsigned char*)buf,len,1);
+                    assert((p != NULL) == hit);
+                }
+                elapsed = (long long)(clock()-start)*1000000000/CLOCKS_PER_SEC;
+                printf("%s%lld", hit ? " " : "/", elapsed/(long long)lookups);
+            }
+        }
+        printf("\n");
+        zfree(lp);
+    }
+    lpMatchFingerprints = lpMatchFingerprintsResolve;
+}
+
+int listpackTest(int argc, char *argv[]) {
+    sds model[LISTPACK_TEST_MAXLEN*4];
+    unsigned char *lp, *lp2, *p, *newp, *sval;
+    unsigned int slen;
+    long long lval;
+    long count = 0, j, idx, num;
+    int op, fingerprints;
+    sds ele;
+
+    ((void) argc);
+    ((void) argv);
+    srand(time(NULL));
+
+    printf("Integer encodings: ");
+    lp = lpNew();
+    {
+        long long ints[] = {0,127,128,-1,-4096,4095,-4097,32767,-32768,
+            8388607,-8388608,INT32_MAX,INT32_MIN,LLONG_MAX,LLONG_MIN};
+        size_t sizes[] = {1,1,2,2,2,2,3,3,3,4,4,5,5,9,9};
+        size_t k, before;
+
+        for (k = 0; k < sizeof(ints)/sizeof(ints[0]); k++) {
+            char buf[LP_INTBUF_SIZE];
+            int len = ll2string(buf,sizeof(buf),ints[k]);
+
+            before = lpBytes(lp);
+            lp = lpAppend(lp,(unsigned char*)buf,len);
+            assert(lpBytes(lp)-before == sizes[k]+1);
+            assert(lpGet(lpLast(lp),&sval,&slen,&lval));
+            assert(sval == NULL && lval == ints[k]);
+        }
+        /* Not canonical integers are stored as strings. */
+        lp = lpAppend(lp,(unsigned char*)"007",3);
+        assert(lpGet(lpLast(lp),&sval,&slen,&lval) && sval && slen == 3);
+    }
+    zfree(lp);
+    lp = NULL;
+    printf("[ok]\n");
+
+    for (fingerprints = 0; fingerprints <= 1; fingerprints++) {
+        printf("Random operations against a model%s: ",
+            fingerprints ? " (fingerprints)" : "");
+        for (j = 0; j < count; j++) sdsfree(model[j]);
+        count = 0;
+        zfree(lp);
+        lp = lpSetFingerprints(lpNew(),fingerprints);
+        for (j = 0; j < LISTPACK_TEST_OPS; j++) {
+            op = rand() % 7;
+            if (count == LISTPACK_TEST_MAXLEN) op = 3;
+            if (count == 0) op = 0;
+            switch(op) {
+            case 0: /* Append. */
+                ele = lpTestRandomEle();
+                lp = lpAppend(lp,(unsigned char*)ele,sdslen(ele));
+                model[count++] = ele;
+                break;
+            case 1: /* Prepend. */
+                ele = lpTestRandomEle();
+                lp = lpPrepend(lp,(unsigned char*)ele,sdslen(ele));
+                memmove(model+1,model,sizeof(sds)*count);
+                model[0] = ele;
+                count++;
+                break;
+            case 2: /* Insert after a random entry. */
+                ele = lpTestRandomEle();
+                idx = rand() % count;
+                lp = lpInsert(lp,(unsigned char*)ele,sdslen(ele),lpSeek(lp,idx),
+                              LP_AFTER,&newp);
+                assert(lpCompare(newp,(unsigned char*)ele,sdslen(ele)));
+                memmove(model+idx+2,model+idx+1,sizeof(sds)*(count-idx-1));
+                model[idx+1] = ele;
+                count++;
+                break;
+            case 3: /* Delete a random entry. */
+                idx = rand() % count;
+                lp = lpDelete(lp,lpSeek(lp,idx),&newp);
+                assert(newp == lpSeek(lp,idx));
+                sdsfree(model[idx]);
+                memmove(model+idx,model+idx+1,sizeof(sds)*(count-idx-1));
+                count--;
+                break;
+            case 4: /* Replace a random entry. */
+                ele = lpTestRandomEle();
+                idx = rand() % count;
+                lp = lpInsert(lp,(unsigned char*)ele,sdslen(ele),lpSeek(lp,idx),
+                              LP_REPLACE,NULL);
+                sdsfree(model[idx]);
+                model[idx] = ele;
+                break;
+            case 5: /* Delete a range. */
+                idx = rand() % count;
+                num = rand() % 5;
+                lp = lpDeleteRange(lp,idx,num);
+                if (num > count-idx) num = count-idx;
+                for (op = 0; op < num; op++) sdsfree(model[idx+op]);
+                memmove(model+idx,model+idx+num,sizeof(sds)*(count-idx-num));
+                count -= num;
+                break;
+            case 6: /* Drop and rebuild the fingerprints. */
+                if (!fingerprints) break;
+                lp = lpSetFingerprints(lp,0);
+                lpTestVerify(lp,model,count);
+                lp = lpSetFingerprints(lp,1);
+                break;
+            }
+            if (j % 100 == 0) lpTestVerify(lp,model,count);
+        }
+        lpTestVerify(lp,model,count);
+        printf("[ok]\n");
+
+        printf("Find with skip%s: ", fingerprints ? " (fingerprints)" : "");
+        for (j = 0; j < count; j++) {
+            /* The first equal entry, and the first one at an even index. */
+            for (idx = 0; sdscmp(model[idx],model[j]); idx++);
+            for (num = 0; num < count && sdscmp(model[num],model[j]); num += 2);
+            p = lpFind(lp,lpFirst(lp),(unsigned char*)model[j],
+                       sdslen(model[j]),0);
+            assert(p == lpSeek(lp,idx));
+            p = lpFind(lp,lpFirst(lp),(unsigned char*)model[j],
+                       sdslen(model[j]),1);
+            assert(p == (num < count ? lpSeek(lp,num) : NULL));
+        }
+        p = lpFind(lp,lpFirst(lp),(unsigned char*)"not-there",9,1);
+        assert(p == NULL);
+        printf("[ok]\n");
+    }
+
+    printf("Merge: ");
+    for (op = 0; op < 2; op++) {
+        lp2 = lpNew();
+        num = op ? 3 : count*2;
+        for (j = 0; j < num; j++) {
+            model[count+j] = sdsfromlonglong(j*1000);
+            lp2 = lpAppend(lp2,(unsigned char*)model[count+j],
+                           sdslen(model[count+j]));
+        }
+        assert(lpMerge(&lp,&lp2) != NULL);
+        if (lp == NULL) {
+            lp = lp2;
+        } else {
+            assert(lp2 == NULL);
+        }
+        count += num;
+        lpTestVerify(lp,model,count);
+    }
+    printf("[ok]\n");
+
+    printf("More than 65535 entries: ");
+    lp2 = lpNew();
+    for (j = 0; j < 70000; j++) lp2 = lpAppend(lp2,(unsigned char*)"x",1);
+    assert(lpLength(lp2) == 70000);
+    lp2 = lpDeleteRange(lp2,0,10000);
+    assert(lpLength(lp2) == 60000);
+    assert(lpGetNumElements(lp2) == 60000);
+    zfree(lp2);
+    lp2 = lpSetFingerprints(lpNew(),1);
+    for (j = 0; j < 70000; j++) lp2 = lpAppend(lp2,(unsigned char*)"x",1);
+    assert(!lpHasFingerprints(lp2));
+    lp2 = lpDeleteRange(lp2,0,10000);
+    lp2 = lpSetFingerprints(lp2,1);
+    assert(lpHasFingerprints(lp2) && lpLength(lp2) == 60000);
+    assert(lpFind(lp2,lpFirst(lp2),(unsigned char*)"x",1,0) == lpFirst(lp2));
+    assert(lpFind(lp2,lpFirst(lp2),(unsigned char*)"y",1,0) == NULL);
+    zfree(lp2);
+    printf("[ok]\n");
+
+    lpTestBenchmarkFind();
+
+    for (j = 0; j < count; j++) sdsfree(model[j]);
+    zfree(lp);
+    return 0;
+}
+#endif
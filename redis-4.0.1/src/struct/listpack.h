@@ -0,0 +1,92 @@
+/* Listpack -- A list of strings serialization format
+ *
+ * The listpack is the packed encoding of small hashes, sorted sets and of
+ * the nodes of the quicklist. Unlike the ziplist every entry stores its own
+ * length at its end, instead of the length of the previous entry, so that
+ * inserting or deleting an entry never changes the entries around it.
+ * See the source code for more information.
+ *
+ * Copyright (c) 2009-2012, Salvatore Sanfilippo <antirez at gmail dot com>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *   * Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *   * Neither the name of Redis nor the names of its contributors may be used
+ *     to endorse or promote products derived from this software without
+ *     specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef __LISTPACK_H
+#define __LISTPACK_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+/* Where lpInsert() stores the new entry, relative to the given one. */
+#define LP_BEFORE 0
+#define LP_AFTER 1
+#define LP_REPLACE 2
+
+/*创建空的listpack*/
+unsigned char *lpNew(void);
+/*在指定节点之前、之后插入，或者替换指定节点，ele为NULL时删除节点*/
+unsigned char *lpInsert(unsigned char *lp, unsigned char *ele, uint32_t size, unsigned char *p, int where, unsigned char **newp);
+/*在尾部和头部添加节点*/
+unsigned char *lpAppend(unsigned char *lp, unsigned char *ele, uint32_t size);
+unsigned char *lpPrepend(unsigned char *lp, unsigned char *ele, uint32_t size);
+/*删除节点，newp指向被删除节点之后的节点*/
+unsigned char *lpDelete(unsigned char *lp, unsigned char *p, unsigned char **newp);
+/*从下标index开始删除num个节点*/
+unsigned char *lpDeleteRange(unsigned char *lp, long index, unsigned long num);
+/*合并两个listpack，未被使用的一个被释放并置为NULL*/
+unsigned char *lpMerge(unsigned char **first, unsigned char **second);
+/*节点个数*/
+unsigned long lpLength(unsigned char *lp);
+/*占用的字节数*/
+size_t lpBytes(unsigned char *lp);
+/*第一个和最后一个节点，为空时返回NULL*/
+unsigned char *lpFirst(unsigned char *lp);
+unsigned char *lpLast(unsigned char *lp);
+/*后一个和前一个节点，不存在时返回NULL*/
+unsigned char *lpNext(unsigned char *lp, unsigned char *p);
+unsigned char *lpPrev(unsigned char *lp, unsigned char *p);
+/*根据下标取得节点，负数从尾部开始*/
+unsigned char *lpSeek(unsigned char *lp, long index);
+/*取得节点的值，字符串保存在sval和slen中，整数保存在lval中*/
+unsigned int lpGet(unsigned char *p, unsigned char **sval, unsigned int *slen, long long *lval);
+/*比较节点和字符串是否相等*/
+unsigned int lpCompare(unsigned char *p, unsigned char *s, unsigned int slen);
+/*从p开始查找字符串，每次比较后跳过skip个节点*/
+unsigned char *lpFind(unsigned char *lp, unsigned char *p, unsigned char *vstr, unsigned int vlen, unsigned int skip);
+/*添加或删除指纹数组，指纹用于加速lpFind*/
+unsigned char *lpSetFingerprints(unsigned char *lp, int enable);
+/*是否带有指纹数组*/
+int lpHasFingerprints(unsigned char *lp);
+/*复制listpack*/
+unsigned char *lpDup(unsigned char *lp);
+/*打印listpack*/
+void lpRepr(unsigned char *lp);
+
+#ifdef REDIS_TEST
+int listpackTest(int argc, char *argv[]);
+#endif
+
+#endif /* __LISTPACK_H */
@@ -0,0 +1,832 @@
+/* Compressed bitmaps, used to encode big and sparse strings written by the
+ * bit commands.
+ *
+ * A string of N bytes is a bitmap of N*8 bits, and setting a single bit at
+ * offset 2^32-1 makes it 512MB long. Here the bits are split in chunks of
+ * ROARING_CHUNK_BITS bits, and only the chunks with bits set are stored, in
+ * an array of containers sorted by chunk number. Like in Roaring bitmaps
+ * there are two kinds of containers:
+ *
+ * - Chunks with up to ROARING_ARRAY_MAX bits set are a sorted array of the
+ *   16 bit positions of those bits in the chunk.
+ * - Chunks with more bits set are a bitmap of ROARING_CHUNK_BYTES bytes,
+ *   that are the bytes of the string itself.
+ *
+ * So a container never takes more than ROARING_CHUNK_BYTES, and the kind of
+ * a container only depends on the number of bits set in it, that is kept
+ * up to date: containers change kind when it crosses ROARING_ARRAY_MAX.
+ * Containers with no bits set are removed.
+ *
+ * The bitmap also has the length of the string, so that the commands work
+ * exactly like with the string: no bit is set at or past the length.
+ *
+ * Serialized format (all the integers are little endian):
+ *
+ * <len:8 bytes> <count:4 bytes> <container> ... <container>
+ *
+ * Where every container is:
+ *
+ * <key:2 bytes> <card:4 bytes> <card positions of 2 bytes, or the bitmap>
+ *
+ * Copyright (c) 2009-2012, Salvatore Sanfilippo <antirez at gmail dot com>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *   * Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *   * Neither the name of Redis nor the names of its contributors may be used
+ *     to endorse or promote products derived from this software without
+ *     specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "roaring.h"
+#include "zmalloc.h"
+#include "endianconv.h"
+
+#define ROARING_HDR_SIZE 12
+#define ROARING_CONTAINER_HDR_SIZE 6
+
+#define roaringIsBitmap(c) ((c)->card > ROARING_ARRAY_MAX)
+#define roaringBitmapGet(data,pos) \
+    (((unsigned char*)(data))[(pos)>>3] & (0x80>>((pos)&7)))
+#define roaringBitmapSet(data,pos) \
+    (((unsigned char*)(data))[(pos)>>3] |= (0x80>>((pos)&7)))
+#define roaringBitmapClear(data,pos) \
+    (((unsigned char*)(data))[(pos)>>3] &= ~(0x80>>((pos)&7)))
+
+/* ----------------------------- Helpers ---------------------------------- */
+
+static inline uint32_t roaringPopcount64(uint64_t x) {
+    x = x-((x>>1) & 0x5555555555555555ULL);
+    x = (x & 0x3333333333333333ULL)+((x>>2) & 0x3333333333333333ULL);
+    x = (x+(x>>4)) & 0x0f0f0f0f0f0f0f0fULL;
+    return (x*0x0101010101010101ULL)>>56;
+}
+
+/* Number of bits set in 'len' bytes. */
+static uint32_t roaringPopcount(const unsigned char *p, size_t len) {
+    uint32_t bits = 0;
+    uint64_t w;
+
+    while (len >= 8) {
+        memcpy(&w,p,8);
+        bits += roaringPopcount64(w);
+        p += 8;
+        len -= 8;
+    }
+    while (len--) bits += roaringPopcount64(*p++);
+    return bits;
+}
+
+/* Return the index of the first container with a key not smaller than
+ * 'key', or the number of containers if there is none. */
+static uint32_t roaringSearch(roaring *r, uint32_t key) {
+    uint32_t lo = 0, hi = r->count, mid;
+
+    while (lo < hi) {
+        mid = lo+(hi-lo)/2;
+        if (r->containers[mid].key < key)
+            lo = mid+1;
+        else
+            hi = mid;
+    }
+    return lo;
+}
+
+/* Return the container of the chunk 'key', or NULL if it's empty. */
+static roaringContainer *roaringFind(roaring *r, uint32_t key) {
+    uint32_t idx = roaringSearch(r,key);
+
+    if (idx == r->count || r->containers[idx].key != key) return NULL;
+    return r->containers+idx;
+}
+
+/* Return the index of the first position not smaller than 'pos' in the
+ * array of 'card' positions. */
+static uint32_t roaringArraySearch(const uint16_t *a, uint32_t card, uint32_t pos) {
+    uint32_t lo = 0, hi = card, mid;
+
+    while (lo < hi) {
+        mid = lo+(hi-lo)/2;
+        if (a[mid] < pos)
+            lo = mid+1;
+        else
+            hi = mid;
+    }
+    return lo;
+}
+
+/* Add an empty container for the chunk 'key' at the index 'idx'. */
+static roaringContainer *roaringInsertContainer(roaring *r, uint32_t idx, uint32_t key) {
+    roaringContainer *c;
+
+    r->containers = zrealloc(r->containers,sizeof(roaringContainer)*(r->count+1));
+    c = r->containers+idx;
+    memmove(c+1,c,sizeof(roaringContainer)*(r->count-idx));
+    r->count++;
+    c->key = key;
+    c->card = 0;
+    c->data = NULL;
+    return c;
+}
+
+/* Remove the container at the index 'idx'. */
+static void roaringRemoveContainer(roaring *r, uint32_t idx) {
+    roaringContainer *c = r->containers+idx;
+
+    zfree(c->data);
+    memmove(c,c+1,sizeof(roaringContainer)*(r->count-idx-1));
+    r->count--;
+    if (r->count == 0) {
+        zfree(r->containers);
+        r->containers = NULL;
+    } else {
+        r->containers = zrealloc(r->containers,
+            sizeof(roaringContainer)*r->count);
+    }
+}
+
+/* Fill the data of 'c' with the bits set in the chunk 'buf', that has
+ * c->card bits set. */
+static void roaringFillContainer(roaringContainer *c, const unsigned char *buf) {
+    uint16_t *a;
+    uint32_t i, j, n = 0;
+    uint64_t w;
+
+    if (roaringIsBitmap(c)) {
+        c->data = zmalloc(ROARING_CHUNK_BYTES);
+        memcpy(c->data,buf,ROARING_CHUNK_BYTES);
+        return;
+    }
+    a = c->data = zmalloc(sizeof(uint16_t)*c->card);
+    for (i = 0; i < ROARING_CHUNK_BYTES && n < c->card; i += 8) {
+        memcpy(&w,buf+i,8);
+        if (w == 0) continue;
+        for (j = i*8; j < (i+8)*8; j++)
+            if (roaringBitmapGet(buf,j)) a[n++] = j;
+    }
+}
+
+/* Convert the array container 'c' to a bitmap. */
+static void roaringArrayToBitmap(roaringContainer *c) {
+    uint16_t *a = c->data;
+    unsigned char *bitmap = zcalloc(ROARING_CHUNK_BYTES);
+    uint32_t i;
+
+    for (i = 0; i < c->card; i++) roaringBitmapSet(bitmap,a[i]);
+    zfree(a);
+    c->data = bitmap;
+}
+
+/* Convert the bitmap container 'c', that has now c->card bits set, to an
+ * array. */
+static void roaringBitmapToArray(roaringContainer *c) {
+    unsigned char *bitmap = c->data;
+
+    roaringFillContainer(c,bitmap);
+    zfree(bitmap);
+}
+
+/* ----------------------------- API --------------------------------------- */
+
+/* Create a bitmap of 'len' bytes, all zero. */
+roaring *roaringNew(uint64_t len) {
+    roaring *r = zmalloc(sizeof(*r));
+
+    r->len = len;
+    r->count = 0;
+    r->containers = NULL;
+    return r;
+}
+
+void roaringFree(roaring *r) {
+    uint32_t i;
+
+    for (i = 0; i < r->count; i++) zfree(r->containers[i].data);
+    zfree(r->containers);
+    zfree(r);
+}
+
+roaring *roaringDup(roaring *r) {
+    roaring *dup = roaringNew(r->len);
+    uint32_t i;
+    size_t size;
+
+    if (r->count == 0) return dup;
+    dup->count = r->count;
+    dup->containers = zmalloc(sizeof(roaringContainer)*r->count);
+    memcpy(dup->containers,r->containers,sizeof(roaringContainer)*r->count);
+    for (i = 0; i < r->count; i++) {
+        roaringContainer *c = dup->containers+i;
+
+        size = roaringIsBitmap(c) ? ROARING_CHUNK_BYTES :
+                                    sizeof(uint16_t)*c->card;
+        c->data = zmalloc(size);
+        memcpy(c->data,r->containers[i].data,size);
+    }
+    return dup;
+}
+
+/* Create a bitmap with the bits of the string 's' of 'len' bytes. */
+roaring *roaringFromString(const unsigned char *s, uint64_t len) {
+    roaring *r = roaringNew(len);
+    unsigned char buf[ROARING_CHUNK_BYTES];
+    uint64_t off, n;
+
+    for (off = 0; off < len; off += ROARING_CHUNK_BYTES) {
+        n = len-off < ROARING_CHUNK_BYTES ? len-off : ROARING_CHUNK_BYTES;
+        if (n == ROARING_CHUNK_BYTES) {
+            roaringSetChunk(r,off/ROARING_CHUNK_BYTES,s+off);
+        } else {
+            memcpy(buf,s+off,n);
+            memset(buf+n,0,ROARING_CHUNK_BYTES-n);
+            roaringSetChunk(r,off/ROARING_CHUNK_BYTES,buf);
+        }
+    }
+    return r;
+}
+
+uint64_t roaringLen(roaring *r) {
+    return r->len;
+}
+
+/* Make the bitmap at least 'len' bytes long. */
+void roaringGrow(roaring *r, uint64_t len) {
+    if (len > r->len) r->len = len;
+}
+
+int roaringGetBit(roaring *r, uint64_t bit) {
+    roaringContainer *c;
+    uint32_t pos = bit & (ROARING_CHUNK_BITS-1), i;
+
+    if (bit >= r->len*8) return 0;
+    if ((c = roaringFind(r,bit/ROARING_CHUNK_BITS)) == NULL) return 0;
+    if (roaringIsBitmap(c)) return roaringBitmapGet(c->data,pos) != 0;
+    i = roaringArraySearch(c->data,c->card,pos);
+    return i < c->card && ((uint16_t*)c->data)[i] == pos;
+}
+
+/* Set or clear a bit, returning its old value. The bit must be inside the
+ * length of the bitmap, see roaringGrow(). */
+int roaringSetBit(roaring *r, uint64_t bit, int on) {
+    uint32_t key = bit/ROARING_CHUNK_BITS, idx, i;
+    uint32_t pos = bit & (ROARING_CHUNK_BITS-1);
+    roaringContainer *c;
+    uint16_t *a;
+    int old;
+
+    idx = roaringSearch(r,key);
+    if (idx == r->count || r->containers[idx].key != key) {
+        if (!on) return 0;
+        c = roaringInsertContainer(r,idx,key);
+        c->card = 1;
+        a = c->data = zmalloc(sizeof(uint16_t));
+        a[0] = pos;
+        return 0;
+    }
+    c = r->containers+idx;
+
+    if (roaringIsBitmap(c)) {
+        old = roaringBitmapGet(c->data,pos) != 0;
+        if (old == on) return old;
+        if (on) {
+            roaringBitmapSet(c->data,pos);
+            c->card++;
+        } else {
+            roaringBitmapClear(c->data,pos);
+            c->card--;
+            if (c->card == ROARING_ARRAY_MAX) roaringBitmapToArray(c);
+        }
+        return old;
+    }
+
+    a = c->data;
+    i = roaringArraySearch(a,c->card,pos);
+    old = i < c->card && a[i] == pos;
+    if (old == on) return old;
+    if (on) {
+        if (c->card == ROARING_ARRAY_MAX) {
+            roaringArrayToBitmap(c);
+            roaringBitmapSet(c->data,pos);
+        } else {
+            a = c->data = zrealloc(a,sizeof(uint16_t)*(c->card+1));
+            memmove(a+i+1,a+i,sizeof(uint16_t)*(c->card-i));
+            a[i] = pos;
+        }
+        c->card++;
+    } else if (c->card == 1) {
+        roaringRemoveContainer(r,idx);
+    } else {
+        memmove(a+i,a+i+1,sizeof(uint16_t)*(c->card-i-1));
+        c->card--;
+        c->data = zrealloc(a,sizeof(uint16_t)*c->card);
+    }
+    return old;
+}
+
+/* Copy 'len' bytes starting at the byte 'start' to 'buf'. The bytes past
+ * the length of the bitmap are zero. */
+void roaringGetRange(roaring *r, uint64_t start, unsigned char *buf, size_t len) {
+    uint64_t end = start+len, base, from, to;
+    uint32_t idx, i;
+    roaringContainer *c;
+    unsigned char *dst;
+    uint16_t *a;
+
+    memset(buf,0,len);
+    for (idx = roaringSearch(r,start/ROARING_CHUNK_BYTES); idx < r->count; idx++) {
+        c = r->containers+idx;
+        base = (uint64_t)c->key*ROARING_CHUNK_BYTES;
+        if (base >= end) break;
+
+        /* The bytes [from,to) of the chunk are in the range. */
+        from = start > base ? start-base : 0;
+        to = end-base < ROARING_CHUNK_BYTES ? end-base : ROARING_CHUNK_BYTES;
+        dst = buf+(base+from-start);
+        if (roaringIsBitmap(c)) {
+            memcpy(dst,(unsigned char*)c->data+from,to-from);
+        } else {
+            a = c->data;
+            for (i = roaringArraySearch(a,c->card,from*8);
+                 i < c->card && a[i] < to*8; i++)
+            {
+                dst[(a[i]>>3)-from] |= 0x80>>(a[i]&7);
+            }
+        }
+    }
+}
+
+/* Write the 'len' bytes of 'buf' at the byte 'start', that must be inside
+ * the length of the bitmap. Only the bits that change are written, one by
+ * one, so this is meant for a few bytes, like a BITFIELD operation. */
+void roaringSetRange(roaring *r, uint64_t start, const unsigned char *buf, size_t len) {
+    unsigned char old[16];
+    size_t i, n;
+    int j;
+
+    while (len) {
+        n = len < sizeof(old) ? len : sizeof(old);
+        roaringGetRange(r,start,old,n);
+        for (i = 0; i < n; i++) {
+            if (old[i] == buf[i]) continue;
+            for (j = 0; j < 8; j++) {
+                if ((old[i] ^ buf[i]) & (0x80>>j))
+                    roaringSetBit(r,(start+i)*8+j,(buf[i]>>(7-j)) & 1);
+            }
+        }
+        start += n;
+        buf += n;
+        len -= n;
+    }
+}
+
+/* Copy the ROARING_CHUNK_BYTES bytes of the chunk 'key' to 'buf'. If no bit
+ * is set in the chunk 0 is returned and 'buf' is left untouched. */
+int roaringGetChunk(roaring *r, uint32_t key, unsigned char *buf) {
+    if (roaringFind(r,key) == NULL) return 0;
+    roaringGetRange(r,(uint64_t)key*ROARING_CHUNK_BYTES,buf,ROARING_CHUNK_BYTES);
+    return 1;
+}
+
+/* Replace the chunk 'key' with the ROARING_CHUNK_BYTES bytes of 'buf'. The
+ * bits past the length of the bitmap must be zero. */
+void roaringSetChunk(roaring *r, uint32_t key, const unsigned char *buf) {
+    uint32_t idx = roaringSearch(r,key), card;
+    roaringContainer *c;
+
+    card = roaringPopcount(buf,ROARING_CHUNK_BYTES);
+    if (idx < r->count && r->containers[idx].key == key) {
+        c = r->containers+idx;
+        if (card == 0) {
+            roaringRemoveContainer(r,idx);
+            return;
+        }
+        if (roaringIsBitmap(c) && card > ROARING_ARRAY_MAX) {
+            memcpy(c->data,buf,ROARING_CHUNK_BYTES);
+            c->card = card;
+            return;
+        }
+        zfree(c->data);
+    } else {
+        if (card == 0) return;
+        c = roaringInsertContainer(r,idx,key);
+    }
+    c->card = card;
+    roaringFillContainer(c,buf);
+}
+
+/* Return the number of bits set between the bytes 'start' and 'end',
+ * both included. */
+uint64_t roaringCount(roaring *r, uint64_t start, uint64_t end) {
+    uint64_t startbit = start*8, endbit = end*8+8, base, from, to;
+    uint64_t count = 0;
+    uint32_t idx;
+    roaringContainer *c;
+
+    for (idx = roaringSearch(r,start/ROARING_CHUNK_BYTES); idx < r->count; idx++) {
+        c = r->containers+idx;
+        base = (uint64_t)c->key*ROARING_CHUNK_BITS;
+        if (base >= endbit) break;
+
+        /* The bits [from,to) of the chunk are in the range, both are
+         * multiple of 8. */
+        from = startbit > base ? startbit-base : 0;
+        to = endbit-base < ROARING_CHUNK_BITS ? endbit-base : ROARING_CHUNK_BITS;
+        if (from == 0 && to == ROARING_CHUNK_BITS) {
+            count += c->card;
+        } else if (roaringIsBitmap(c)) {
+            count += roaringPopcount((unsigned char*)c->data+from/8,(to-from)/8);
+        } else {
+            count += roaringArraySearch(c->data,c->card,to)-
+                     roaringArraySearch(c->data,c->card,from);
+        }
+    }
+    return count;
+}
+
+/* Return the position of the first bit with value 'bit' between the bytes
+ * 'start' and 'end', both included, or -1 if there is none. */
+int64_t roaringBitpos(roaring *r, int bit, uint64_t start, uint64_t end) {
+    uint64_t pos = start*8, endbit = end*8+8, base;
+    uint32_t idx = roaringSearch(r,start/ROARING_CHUNK_BYTES), from, i;
+    roaringContainer *c;
+    unsigned char *bitmap, skip = bit ? 0 : 0xff;
+    uint16_t *a;
+
+    while (pos < endbit) {
+        /* A chunk without container has all the bits clear. */
+        if (idx == r->count || r->containers[idx].key != pos/ROARING_CHUNK_BITS) {
+            if (!bit) return pos;
+            if (idx == r->count) return -1;
+            pos = (uint64_t)r->containers[idx].key*ROARING_CHUNK_BITS;
+            continue;
+        }
+        c = r->containers+idx;
+        base = (uint64_t)c->key*ROARING_CHUNK_BITS;
+        from = pos-base; /* Always a multiple of 8. */
+
+        if (roaringIsBitmap(c)) {
+            bitmap = c->data;
+            for (i = from/8; i < ROARING_CHUNK_BYTES && bitmap[i] == skip; i++);
+            if (i < ROARING_CHUNK_BYTES) {
+                for (from = i*8; !roaringBitmapGet(bitmap,from) != !bit; from++);
+                return base+from < endbit ? (int64_t)(base+from) : -1;
+            }
+        } else {
+            a = c->data;
+            i = roaringArraySearch(a,c->card,from);
+            if (bit) {
+                if (i < c->card)
+                    return base+a[i] < endbit ? (int64_t)(base+a[i]) : -1;
+            } else {
+                while (i < c->card && a[i] == from) {
+                    i++;
+                    from++;
+                }
+                if (from < ROARING_CHUNK_BITS)
+                    return base+from < endbit ? (int64_t)(base+from) : -1;
+            }
+        }
+        pos = base+ROARING_CHUNK_BITS;
+        idx++;
+    }
+    return -1;
+}
+
+/* Return the memory used by the bitmap. */
+size_t roaringAllocSize(roaring *r) {
+    size_t size = sizeof(*r)+sizeof(roaringContainer)*r->count;
+    uint32_t i;
+
+    for (i = 0; i < r->count; i++) {
+        roaringContainer *c = r->containers+i;
+        size += roaringIsBitmap(c) ? ROARING_CHUNK_BYTES :
+                                     sizeof(uint16_t)*c->card;
+    }
+    return size;
+}
+
+size_t roaringSerializedSize(roaring *r) {
+    size_t size = ROARING_HDR_SIZE+ROARING_CONTAINER_HDR_SIZE*r->count;
+    uint32_t i;
+
+    for (i = 0; i < r->count; i++) {
+        roaringContainer *c = r->containers+i;
+        size += roaringIsBitmap(c) ? ROARING_CHUNK_BYTES :
+                                     sizeof(uint16_t)*c->card;
+    }
+    return size;
+}
+
+/* Serialize the bitmap in 'buf', of roaringSerializedSize() bytes. */
+void roaringSerialize(roaring *r, unsigned char *buf) {
+    uint64_t len = r->len;
+    uint32_t count = r->count, card, i, j;
+    uint16_t key, pos;
+
+    memrev64ifbe(&len);
+    memrev32ifbe(&count);
+    memcpy(buf,&len,8);
+    memcpy(buf+8,&count,4);
+    buf += ROARING_HDR_SIZE;
+    for (i = 0; i < r->count; i++) {
+        roaringContainer *c = r->containers+i;
+
+        key = c->key;
+        card = c->card;
+        memrev16ifbe(&key);
+        memrev32ifbe(&card);
+        memcpy(buf,&key,2);
+        memcpy(buf+2,&card,4);
+        buf += ROARING_CONTAINER_HDR_SIZE;
+        if (roaringIsBitmap(c)) {
+            memcpy(buf,c->data,ROARING_CHUNK_BYTES);
+            buf += ROARING_CHUNK_BYTES;
+        } else {
+            for (j = 0; j < c->card; j++) {
+                pos = ((uint16_t*)c->data)[j];
+                memrev16ifbe(&pos);
+                memcpy(buf,&pos,2);
+                buf += 2;
+            }
+        }
+    }
+}
+
+/* Load a bitmap serialized by roaringSerialize(). The data is validated,
+ * since it may come from a corrupted file or a RESTORE payload: on error
+ * NULL is returned. */
+roaring *roaringDeserialize(const unsigned char *buf, size_t buflen) {
+    const unsigned char *end = buf+buflen;
+    roaring *r;
+    uint64_t len, bits;
+    uint32_t count, card, i, j;
+    uint16_t key, pos;
+
+    if (buflen < ROARING_HDR_SIZE) return NULL;
+    memcpy(&len,buf,8);
+    memcpy(&count,buf+8,4);
+    memrev64ifbe(&len);
+    memrev32ifbe(&count);
+    buf += ROARING_HDR_SIZE;
+    if (len > ROARING_MAX_BYTES ||
+        count > (len+ROARING_CHUNK_BYTES-1)/ROARING_CHUNK_BYTES) return NULL;
+
+    r = roaringNew(len);
+    r->containers = count ? zmalloc(sizeof(roaringContainer)*count) : NULL;
+    for (i = 0; i < count; i++) {
+        roaringContainer *c = r->containers+i;
+
+        if (end-buf < ROARING_CONTAINER_HDR_SIZE) goto err;
+        memcpy(&key,buf,2);
+        memcpy(&card,buf+2,4);
+        memrev16ifbe(&key);
+        memrev32ifbe(&card);
+        buf += ROARING_CONTAINER_HDR_SIZE;
+
+        /* Keys are sorted, and every container has bits set only inside the
+         * length of the bitmap. */
+        if ((i && key <= r->containers[i-1].key) ||
+            (uint64_t)key*ROARING_CHUNK_BYTES >= len ||
+            card == 0 || card > ROARING_CHUNK_BITS) goto err;
+        bits = (len-(uint64_t)key*ROARING_CHUNK_BYTES)*8;
+        if (bits > ROARING_CHUNK_BITS) bits = ROARING_CHUNK_BITS;
+        c->key = key;
+        c->card = card;
+        if (roaringIsBitmap(c)) {
+            if (end-buf < ROARING_CHUNK_BYTES) goto err;
+            if (roaringPopcount(buf,ROARING_CHUNK_BYTES) != card ||
+                roaringPopcount(buf+bits/8,ROARING_CHUNK_BYTES-bits/8) != 0)
+                goto err;
+            c->data = zmalloc(ROARING_CHUNK_BYTES);
+            memcpy(c->data,buf,ROARING_CHUNK_BYTES);
+            buf += ROARING_CHUNK_BYTES;
+        } else {
+            if ((size_t)(end-buf) < sizeof(uint16_t)*card) goto err;
+            c->data = zmalloc(sizeof(uint16_t)*card);
+            for (j = 0; j < card; j++) {
+                memcpy(&pos,buf,2);
+                memrev16ifbe(&pos);
+                buf += 2;
+                if ((j && pos <= ((uint16_t*)c->data)[j-1]) || pos >= bits) {
+                    zfree(c->data);
+                    goto err;
+                }
+                ((uint16_t*)c->data)[j] = pos;
+            }
+        }
+        r->count++;
+    }
+    if (buf != end) goto err;
+    return r;
+
+err:
+    roaringFree(r);
+    return NULL;
+}
+
+#ifdef REDIS_TEST
+#include <sys/time.h>
+#include <time.h>
+
+#define UNUSED(x) (void)(x)
+#define assert(_e) ((_e)?(void)0:(_assert(#_e,__FILE__,__LINE__),exit(1)))
+static void _assert(char *estr, char *file, int line) {
+    printf("\n\n=== ASSERTION FAILED ===\n");
+    printf("==> %s:%d '%s' is not true\n",file,line,estr);
+}
+
+static long long usec(void) {
+    struct timeval tv;
+    gettimeofday(&tv,NULL);
+    return (((long long)tv.tv_sec)*1000000)+tv.tv_usec;
+}
+
+/* Check the bitmap against the string 's' of the same length. */
+static void roaringTestVerify(roaring *r, unsigned char *s, uint64_t len) {
+    unsigned char *buf = zmalloc(len+1);
+    uint32_t i;
+
+    assert(r->len == len);
+    roaringGetRange(r,0,buf,len);
+    assert(memcmp(buf,s,len) == 0);
+    for (i = 0; i < r->count; i++) {
+        roaringContainer *c = r->containers+i;
+        assert(c->card > 0);
+        assert(i == 0 || c->key > r->containers[i-1].key);
+        assert(c->card == roaringPopcount(s+(uint64_t)c->key*ROARING_CHUNK_BYTES,
+            len-(uint64_t)c->key*ROARING_CHUNK_BYTES < ROARING_CHUNK_BYTES ?
+            len-(uint64_t)c->key*ROARING_CHUNK_BYTES : ROARING_CHUNK_BYTES));
+    }
+    zfree(buf);
+}
+
+static uint64_t naiveCount(unsigned char *s, uint64_t start, uint64_t end) {
+    return roaringPopcount(s+start,end-start+1);
+}
+
+static int64_t naiveBitpos(unsigned char *s, int bit, uint64_t start, uint64_t end) {
+    uint64_t j;
+
+    for (j = start*8; j < end*8+8; j++)
+        if (!roaringBitmapGet(s,j) == !bit) return j;
+    return -1;
+}
+
+int roaringTest(int argc, char **argv) {
+    uint64_t len = ROARING_CHUNK_BYTES*3+1000, bit, start, end;
+    unsigned char *s, buf[32];
+    roaring *r, *dup;
+    int i, j, on;
+
+    UNUSED(argc);
+    UNUSED(argv);
+    srand(time(NULL));
+
+    printf("Set and get bits: "); {
+        r = roaringNew(len);
+        s = zcalloc(len);
+        for (i = 0; i < 200000; i++) {
+            /* Dense and sparse areas, so that containers switch kind. */
+            if (rand() % 2)
+                bit = ROARING_CHUNK_BITS+rand() % 12000;
+            else
+                bit = (uint64_t)rand() % (len*8);
+            on = (i/50000) % 2 == 0 ? rand() % 4 != 0 : rand() % 4 == 0;
+            assert(roaringSetBit(r,bit,on) == (roaringBitmapGet(s,bit) != 0));
+            if (on) roaringBitmapSet(s,bit); else roaringBitmapClear(s,bit);
+            bit = (uint64_t)rand() % (len*8);
+            assert(roaringGetBit(r,bit) == (roaringBitmapGet(s,bit) != 0));
+            if (i % 10000 == 0) roaringTestVerify(r,s,len);
+        }
+        roaringTestVerify(r,s,len);
+        printf("OK\n");
+    }
+
+    printf("Count and bitpos: "); {
+        for (i = 0; i < 2000; i++) {
+            start = rand() % len;
+            end = start+rand() % (len-start);
+            if (i % 3 == 0) end = start+rand() % 16;
+            if (end >= len) end = len-1;
+            assert(roaringCount(r,start,end) == naiveCount(s,start,end));
+            for (j = 0; j < 2; j++)
+                assert(roaringBitpos(r,j,start,end) == naiveBitpos(s,j,start,end));
+        }
+        printf("OK\n");
+    }
+
+    printf("Ranges and chunks: "); {
+        for (i = 0; i < 2000; i++) {
+            size_t n = rand() % sizeof(buf);
+
+            start = rand() % (len-n);
+            roaringGetRange(r,start,buf,n);
+            assert(memcmp(buf,s+start,n) == 0);
+            for (j = 0; j < (int)n; j++) buf[j] = rand() % 3 ? 0 : rand();
+            roaringSetRange(r,start,buf,n);
+            memcpy(s+start,buf,n);
+        }
+        roaringTestVerify(r,s,len);
+
+        unsigned char *chunk = zmalloc(ROARING_CHUNK_BYTES);
+        memset(chunk,0xff,ROARING_CHUNK_BYTES);
+        roaringSetChunk(r,0,chunk);
+        memset(s,0xff,ROARING_CHUNK_BYTES);
+        memset(chunk,0,ROARING_CHUNK_BYTES);
+        roaringSetChunk(r,1,chunk);
+        memset(s+ROARING_CHUNK_BYTES,0,ROARING_CHUNK_BYTES);
+        roaringTestVerify(r,s,len);
+        assert(roaringGetChunk(r,1,chunk) == 0);
+        assert(roaringGetChunk(r,0,chunk) == 1);
+        assert(memcmp(chunk,s,ROARING_CHUNK_BYTES) == 0);
+        zfree(chunk);
+        printf("OK\n");
+    }
+
+    printf("Dup, string and serialization round trips: "); {
+        size_t size = roaringSerializedSize(r);
+        unsigned char *ser = zmalloc(size);
+
+        dup = roaringDup(r);
+        roaringTestVerify(dup,s,len);
+        roaringFree(dup);
+
+        dup = roaringFromString(s,len);
+        roaringTestVerify(dup,s,len);
+        roaringFree(dup);
+
+        roaringSerialize(r,ser);
+        dup = roaringDeserialize(ser,size);
+        assert(dup != NULL);
+        roaringTestVerify(dup,s,len);
+        roaringFree(dup);
+
+        /* Corrupted payloads are refused. */
+        assert(roaringDeserialize(ser,size-1) == NULL);
+        assert(roaringDeserialize(ser,5) == NULL);
+        ser[0] = 1; /* Length smaller than the containers. */
+        ser[1] = ser[2] = ser[3] = 0;
+        assert(roaringDeserialize(ser,size) == NULL);
+        zfree(ser);
+        printf("OK\n");
+    }
+
+    printf("Empty bitmaps: "); {
+        dup = roaringNew(0);
+        assert(roaringGetBit(dup,0) == 0);
+        assert(roaringBitpos(dup,1,0,0) == -1);
+        roaringGrow(dup,ROARING_MAX_BYTES);
+        assert(roaringSetBit(dup,ROARING_MAX_BYTES*8-1,1) == 0);
+        assert(roaringGetBit(dup,ROARING_MAX_BYTES*8-1) == 1);
+        assert(roaringBitpos(dup,1,0,ROARING_MAX_BYTES-1) ==
+               (int64_t)(ROARING_MAX_BYTES*8-1));
+        assert(roaringBitpos(dup,0,ROARING_MAX_BYTES-1,ROARING_MAX_BYTES-1) ==
+               (int64_t)(ROARING_MAX_BYTES*8-8));
+        assert(roaringCount(dup,0,ROARING_MAX_BYTES-1) == 1);
+        assert(roaringAllocSize(dup) < 100);
+        assert(roaringSetBit(dup,ROARING_MAX_BYTES*8-1,0) == 1);
+        assert(dup->count == 0);
+        roaringFree(dup);
+        printf("OK\n");
+    }
+
+    printf("Stress bitpos on sparse bitmaps: "); {
+        long long t;
+        int64_t pos;
+
+        dup = roaringNew(ROARING_MAX_BYTES);
+        for (i = 0; i < 1000; i++)
+            roaringSetBit(dup,(uint64_t)rand()*rand() % (ROARING_MAX_BYTES*8),1);
+        t = usec();
+        for (i = 0, pos = 0; i < 1000; i++)
+            pos += roaringBitpos(dup,1,rand() % ROARING_MAX_BYTES,ROARING_MAX_BYTES-1);
+        printf("1000 lookups in 1000 bits over 512MB: %lldusec\n",usec()-t);
+        roaringFree(dup);
+    }
+
+    roaringFree(r);
+    zfree(s);
+    return 0;
+}
+#endif
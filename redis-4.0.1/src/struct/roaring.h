@@ -0,0 +1,114 @@
+/* Compressed bitmaps, used to encode big and sparse strings written by the
+ * bit commands (SETBIT, BITFIELD, BITOP).
+ *
+ * The bits of the string are split in chunks of 65536 bits, and only the
+ * chunks with at least one bit set are stored, each in a container that is
+ * either a sorted array of the positions of the bits set, or a plain bitmap
+ * when that is smaller. See the source code for more information.
+ *
+ * Copyright (c) 2009-2012, Salvatore Sanfilippo <antirez at gmail dot com>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *   * Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *   * Neither the name of Redis nor the names of its contributors may be used
+ *     to endorse or promote products derived from this software without
+ *     specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef __ROARING_H
+#define __ROARING_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+/* Bits of every chunk, and the size of a bitmap container. */
+#define ROARING_CHUNK_BITS 65536
+#define ROARING_CHUNK_BYTES (ROARING_CHUNK_BITS/8)
+/* Containers with more bits set than this are bitmaps, since the array
+ * would take more than ROARING_CHUNK_BYTES. */
+#define ROARING_ARRAY_MAX 4096
+/* The chunk number is 16 bits, so 2^32 bits, like the 512MB strings. */
+#define ROARING_MAX_BYTES (1ULL<<29)
+
+/* Bits are numbered like in the strings: bit 0 is the most significant bit
+ * of the first byte, so a bitmap container has the same bytes of the
+ * string. */
+/*容器，保存一个块中被设置的位*/
+typedef struct roaringContainer {
+    /*块号，即位偏移除以ROARING_CHUNK_BITS*/
+    uint32_t key;
+    /*被设置的位数，不超过ROARING_ARRAY_MAX时data是有序的uint16_t位置数组，否则是位图*/
+    uint32_t card;
+    void *data;
+} roaringContainer;
+
+/*压缩位图*/
+typedef struct roaring {
+    /*对应字符串的字节长度*/
+    uint64_t len;
+    /*容器个数*/
+    uint32_t count;
+    /*按块号排序的容器，空块不保存*/
+    roaringContainer *containers;
+} roaring;
+
+/* API */
+/*创建长度为len字节、所有位为0的位图*/
+roaring *roaringNew(uint64_t len);
+/*释放位图*/
+void roaringFree(roaring *r);
+/*复制位图*/
+roaring *roaringDup(roaring *r);
+/*从字符串创建位图*/
+roaring *roaringFromString(const unsigned char *s, uint64_t len);
+/*对应字符串的字节长度*/
+uint64_t roaringLen(roaring *r);
+/*把长度扩展到len字节，新的位为0*/
+void roaringGrow(roaring *r, uint64_t len);
+/*取得一位*/
+int roaringGetBit(roaring *r, uint64_t bit);
+/*设置一位，返回原来的值，bit必须小于长度*/
+int roaringSetBit(roaring *r, uint64_t bit, int on);
+/*把从start字节开始的len个字节复制到buf，超出长度的部分为0*/
+void roaringGetRange(roaring *r, uint64_t start, unsigned char *buf, size_t len);
+/*把buf的len个字节写到start字节处，只适合少量字节*/
+void roaringSetRange(roaring *r, uint64_t start, const unsigned char *buf, size_t len);
+/*取得一个块的ROARING_CHUNK_BYTES字节，块为空时返回0且不修改buf*/
+int roaringGetChunk(roaring *r, uint32_t key, unsigned char *buf);
+/*用buf的ROARING_CHUNK_BYTES字节替换一个块*/
+void roaringSetChunk(roaring *r, uint32_t key, const unsigned char *buf);
+/*start和end字节之间（包括两端）被设置的位数*/
+uint64_t roaringCount(roaring *r, uint64_t start, uint64_t end);
+/*start和end字节之间第一个值为bit的位，没有时返回-1*/
+int64_t roaringBitpos(roaring *r, int bit, uint64_t start, uint64_t end);
+/*占用的内存*/
+size_t roaringAllocSize(roaring *r);
+/*序列化后的大小，以及序列化和反序列化，数据不合法时返回NULL*/
+size_t roaringSerializedSize(roaring *r);
+void roaringSerialize(roaring *r, unsigned char *buf);
+roaring *roaringDeserialize(const unsigned char *buf, size_t len);
+
+#ifdef REDIS_TEST
+int roaringTest(int argc, char *argv[]);
+#endif
+
+#endif
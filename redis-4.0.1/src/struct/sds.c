@@ -56,6 +56,13 @@ static inline int sdsHdrSize(char type) {
     return 0;
 }
 
+/* Size of the aux field allocated before the header, see sdsnewlenaux(). */
+/*计算附加字段大小*/
+static inline int sdsAuxSize(char flags) {
+    if ((flags&SDS_TYPE_MASK) == SDS_TYPE_5 || !(flags&SDS_AUX)) return 0;
+    return sizeof(int64_t);
+}
+
 /*动态字符串类型*/
 static inline char sdsReqType(size_t string_size) {
     if (string_size < 1<<5)
@@ -71,38 +78,30 @@ static inline char sdsReqType(size_t string_size) {
     return SDS_TYPE_64;
 }
 
-/* Create a new sds string with the content specified by the 'init' pointer
- * and 'initlen'.
- * If NULL is used for 'init' the string is initialized with zero bytes.
- *
- * The string is always null-termined (all the sds strings are, always) so
- * even if you create an sds string with:
- *
- * mystring = sdsnewlen("abc",3);
- *
- * You can print the string with printf() as there is an implicit \0 at the
- * end of the string. However the string is binary safe and can contain
- * \0 characters in the middle, as the length is stored in the sds header. */
-/*创建指定大小动态字符串，并用指定内容初始化*/
-sds sdsnewlen(const void *init, size_t initlen) {
+/* Implements sdsnewlen() and sdsnewlenaux(). */
+static sds _sdsnewlen(const void *init, size_t initlen, int aux) {
     void *sh;
     sds s;
     /*根据长度选择合适的动态字符串类型*/
     char type = sdsReqType(initlen);
     /* Empty strings are usually created in order to append. Use type 8
-     * since type 5 is not good at this. */
+     * since type 5 is not good at this. Type 5 has also no room for the
+     * SDS_AUX flag. */
     /*SDS_TYPE_5已废弃*/
-    if (type == SDS_TYPE_5 && initlen == 0) type = SDS_TYPE_8;
+    if (type == SDS_TYPE_5 && (initlen == 0 || aux)) type = SDS_TYPE_8;
     /*头部大小*/
     int hdrlen = sdsHdrSize(type);
+    int auxlen = aux ? sizeof(int64_t) : 0;
     unsigned char *fp; /* flags pointer. */
     /*分配空间*/
-    sh = s_malloc(hdrlen+initlen+1);
+    sh = s_malloc(auxlen+hdrlen+initlen+1);
+    if (sh == NULL) return NULL;
     if (!init)
         /*没有指定初始化内容，全部字节置0*/
-        memset(sh, 0, hdrlen+initlen+1);
-    if (sh == NULL) return NULL;
-    s = (char*)sh+hdrlen;
+        memset(sh, 0, auxlen+hdrlen+initlen+1);
+    else if (aux)
+        memset(sh, 0, auxlen);
+    s = (char*)sh+auxlen+hdrlen;
     fp = ((unsigned char*)s)-1;
     switch(type) {
         case SDS_TYPE_5: {
@@ -139,6 +138,7 @@ sds sdsnewlen(const void *init, size_t initlen) {
             break;
         }
     }
+    if (aux) *fp |= SDS_AUX;
     if (initlen && init)
         /*复制初始化内容*/
         memcpy(s, init, initlen);
@@ -147,6 +147,36 @@ sds sdsnewlen(const void *init, size_t initlen) {
     return s;
 }
 
+/* Create a new sds string with the content specified by the 'init' pointer
+ * and 'initlen'.
+ * If NULL is used for 'init' the string is initialized with zero bytes.
+ *
+ * The string is always null-termined (all the sds strings are, always) so
+ * even if you create an sds string with:
+ *
+ * mystring = sdsnewlen("abc",3);
+ *
+ * You can print the string with printf() as there is an implicit \0 at the
+ * end of the string. However the string is binary safe and can contain
+ * \0 characters in the middle, as the length is stored in the sds header. */
+/*创建指定大小动态字符串，并用指定内容初始化*/
+sds sdsnewlen(const void *init, size_t initlen) {
+    return _sdsnewlen(init, initlen, 0);
+}
+
+/* Like sdsnewlen(), but the string has an additional 64 bit field, allocated
+ * just before the header, that the caller can access with sdsaux() to store
+ * information related to the string without an additional allocation. The
+ * field is initialized to zero.
+ *
+ * Such strings are meant to be immutable: they can be freed with sdsfree()
+ * and used with all the functions not changing the string, but they can't
+ * be resized with sdsMakeRoomFor() and similar functions. */
+/*创建带附加字段的动态字符串*/
+sds sdsnewlenaux(const void *init, size_t initlen) {
+    return _sdsnewlen(init, initlen, 1);
+}
+
 /* Create an empty (zero length) sds string. Even in this case the string
  * always has an implicit null term. */
 /*创建空的动态字符串*/
@@ -171,7 +201,7 @@ sds sdsdup(const sds s) {
 /*释放动态字符串*/
 void sdsfree(sds s) {
     if (s == NULL) return;
-    s_free((char*)s-sdsHdrSize(s[-1]));
+    s_free((char*)s-sdsHdrSize(s[-1])-sdsAuxSize(s[-1]));
 }
 
 /* Set the sds string length to the length as obtained with strlen(), so
@@ -315,14 +345,14 @@ sds sdsRemoveFreeSpace(sds s) {
 /*动态字符串总空间大小*/
 size_t sdsAllocSize(sds s) {
     size_t alloc = sdsalloc(s);
-    return sdsHdrSize(s[-1])+alloc+1;
+    return sdsAuxSize(s[-1])+sdsHdrSize(s[-1])+alloc+1;
 }
 
 /* Return the pointer of the actual SDS allocation (normally SDS strings
  * are referenced by the start of the string buffer). */
 /*取得动态字符串分配的空间头地址*/
 void *sdsAllocPtr(sds s) {
-    return (void*) (s-sdsHdrSize(s[-1]));
+    return (void*) (s-sdsHdrSize(s[-1])-sdsAuxSize(s[-1]));
 }
 
 /* Increment the sds length and decrements the left free space at the
@@ -1346,6 +1376,17 @@ int sdsTest(void) {
 
             sdsfree(x);
         }
+
+        x = sdsnewlenaux("foo",3);
+        test_cond("sdsnewlenaux() creates an aux field",
+            sdsaux(x) != NULL && *sdsaux(x) == 0 &&
+            sdslen(x) == 3 && memcmp(x,"foo\0",4) == 0);
+        *sdsaux(x) = -1;
+        y = sdsdup(x);
+        test_cond("sdsdup() of a string with an aux field",
+            sdsaux(y) == NULL && sdslen(y) == 3 && *sdsaux(x) == -1);
+        sdsfree(y);
+        sdsfree(x);
     }
     test_report()
     return 0;
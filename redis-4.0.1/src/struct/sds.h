@@ -90,6 +90,9 @@ struct __attribute__ ((__packed__)) sdshdr64 {
 #define SDS_TYPE_64 4
 #define SDS_TYPE_MASK 7
 #define SDS_TYPE_BITS 3
+/* Flag of the strings with an aux field, see sdsnewlenaux(). Never set for
+ * SDS_TYPE_5, where the unused bits of the flags store the length. */
+#define SDS_AUX 8
 /*##起连接作用*/
 /*取得动态字符串头并赋值给sh*/
 #define SDS_HDR_VAR(T,s) struct sdshdr##T *sh = (void*)((s)-(sizeof(struct sdshdr##T)));
@@ -236,8 +239,29 @@ static inline void sdssetalloc(sds s, size_t newlen) {
     }
 }
 
+/* Return a pointer to the aux field of a string created by sdsnewlenaux(),
+ * or NULL if the string has no aux field. */
+/*取得附加字段指针，没有附加字段返回NULL*/
+static inline int64_t *sdsaux(const sds s) {
+    unsigned char flags = s[-1];
+    if (!(flags&SDS_AUX)) return NULL;
+    switch(flags&SDS_TYPE_MASK) {
+        case SDS_TYPE_8:
+            return (int64_t*)(s-sizeof(struct sdshdr8)-sizeof(int64_t));
+        case SDS_TYPE_16:
+            return (int64_t*)(s-sizeof(struct sdshdr16)-sizeof(int64_t));
+        case SDS_TYPE_32:
+            return (int64_t*)(s-sizeof(struct sdshdr32)-sizeof(int64_t));
+        case SDS_TYPE_64:
+            return (int64_t*)(s-sizeof(struct sdshdr64)-sizeof(int64_t));
+    }
+    return NULL;
+}
+
 /*创建动态字符串并初始化字符串内容和长度*/
 sds sdsnewlen(const void *init, size_t initlen);
+/*创建带附加字段的动态字符串*/
+sds sdsnewlenaux(const void *init, size_t initlen);
 /*创建动态字符串并初始化字符串内容*/
 sds sdsnew(const char *init);
 /*创建空的动态字符串*/
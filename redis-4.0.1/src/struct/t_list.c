@@ -79,6 +79,17 @@ unsigned long listTypeLength(const robj *subject) {
     }
 }
 
+/* Must be called before reading the list 'subject' stored at 'key'. The
+ * nodes of a compressed list are decompressed in place while it is read,
+ * and compressed again later, freeing the compressed data the snapshot
+ * thread may be saving: such a list is handled like a key about to be
+ * modified, so that it is saved before the main thread touches it. */
+void listTypeBeforeRead(redisDb *db, robj *key, robj *subject) {
+    if (subject->encoding == OBJ_ENCODING_QUICKLIST &&
+        ((quicklist*)subject->ptr)->compress)
+        rdbSnapshotKeyWrite(db,key->ptr);
+}
+
 /* Initialize an iterator at the specified index. */
 listTypeIterator *listTypeInitIterator(robj *subject, long index,
                                        unsigned char direction) {
@@ -320,6 +331,7 @@ void lindexCommand(client *c) {
     if ((getLongFromObjectOrReply(c, c->argv[2], &index, NULL) != C_OK))
         return;
 
+    listTypeBeforeRead(c->db,c->argv[1],o);
     if (o->encoding == OBJ_ENCODING_QUICKLIST) {
         quicklistEntry entry;
         if (quicklistIndex(o->ptr, index, &entry)) {
@@ -422,6 +434,7 @@ void lrangeCommand(client *c) {
 
     /* Return the result in form of a multi-bulk reply */
     addReplyMultiBulkLen(c,rangelen);
+    listTypeBeforeRead(c->db,c->argv[1],o);
     if (o->encoding == OBJ_ENCODING_QUICKLIST) {
         listTypeIterator *iter = listTypeInitIterator(o, start, LIST_TAIL);
 
@@ -782,6 +795,8 @@ int serveClientBlockedOnList(client *receiver, robj *key, robj *dstkey, redisDb
             return C_ERR;
         }
     }
+    /* The reply waits for the AOF fsync of the pop, like for a command. */
+    receiver->aof_woff = server.aof_fed_offset;
     return C_OK;
 }
 
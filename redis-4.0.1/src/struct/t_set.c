@@ -52,11 +52,11 @@ robj *setTypeCreate(sds value) {
 int setTypeAdd(robj *subject, sds value) {
     long long llval;
     if (subject->encoding == OBJ_ENCODING_HT) {
-        dict *ht = subject->ptr;
-        dictEntry *de = dictAddRaw(ht,value,NULL);
+        hashtable *ht = subject->ptr;
+        hashtableEntry *de = hashtableAddRaw(ht,value,NULL);
         if (de) {
-            dictSetKey(ht,de,sdsdup(value));
-            dictSetVal(ht,de,NULL);
+            hashtableSetKey(ht,de,sdsdup(value));
+            hashtableSetVal(ht,de,NULL);
             return 1;
         }
     } else if (subject->encoding == OBJ_ENCODING_INTSET) {
@@ -75,8 +75,8 @@ int setTypeAdd(robj *subject, sds value) {
             setTypeConvert(subject,OBJ_ENCODING_HT);
 
             /* The set *was* an intset and this value is not integer
-             * encodable, so dictAdd should always work. */
-            serverAssert(dictAdd(subject->ptr,sdsdup(value),NULL) == DICT_OK);
+             * encodable, so hashtableAdd should always work. */
+            serverAssert(hashtableAdd(subject->ptr,sdsdup(value),NULL) == DICT_OK);
             return 1;
         }
     } else {
@@ -88,8 +88,8 @@ int setTypeAdd(robj *subject, sds value) {
 int setTypeRemove(robj *setobj, sds value) {
     long long llval;
     if (setobj->encoding == OBJ_ENCODING_HT) {
-        if (dictDelete(setobj->ptr,value) == DICT_OK) {
-            if (htNeedsResize(setobj->ptr)) dictResize(setobj->ptr);
+        if (hashtableDelete(setobj->ptr,value) == DICT_OK) {
+            if (hashtableNeedsResize(setobj->ptr)) hashtableResize(setobj->ptr);
             return 1;
         }
     } else if (setobj->encoding == OBJ_ENCODING_INTSET) {
@@ -107,7 +107,7 @@ int setTypeRemove(robj *setobj, sds value) {
 int setTypeIsMember(robj *subject, sds value) {
     long long llval;
     if (subject->encoding == OBJ_ENCODING_HT) {
-        return dictFind((dict*)subject->ptr,value) != NULL;
+        return hashtableFind((hashtable*)subject->ptr,value) != NULL;
     } else if (subject->encoding == OBJ_ENCODING_INTSET) {
         if (isSdsRepresentableAsLongLong(value,&llval) == C_OK) {
             return intsetFind((intset*)subject->ptr,llval);
@@ -123,7 +123,7 @@ setTypeIterator *setTypeInitIterator(robj *subject) {
     si->subject = subject;
     si->encoding = subject->encoding;
     if (si->encoding == OBJ_ENCODING_HT) {
-        si->di = dictGetIterator(subject->ptr);
+        si->di = hashtableGetIterator(subject->ptr);
     } else if (si->encoding == OBJ_ENCODING_INTSET) {
         si->ii = 0;
     } else {
@@ -134,7 +134,7 @@ setTypeIterator *setTypeInitIterator(robj *subject) {
 
 void setTypeReleaseIterator(setTypeIterator *si) {
     if (si->encoding == OBJ_ENCODING_HT)
-        dictReleaseIterator(si->di);
+        hashtableReleaseIterator(si->di);
     zfree(si);
 }
 
@@ -153,9 +153,9 @@ void setTypeReleaseIterator(setTypeIterator *si) {
  * When there are no longer elements -1 is returned. */
 int setTypeNext(setTypeIterator *si, sds *sdsele, int64_t *llele) {
     if (si->encoding == OBJ_ENCODING_HT) {
-        dictEntry *de = dictNext(si->di);
+        hashtableEntry *de = hashtableNext(si->di);
         if (de == NULL) return -1;
-        *sdsele = dictGetKey(de);
+        *sdsele = hashtableGetKey(de);
         *llele = -123456789; /* Not needed. Defensive. */
     } else if (si->encoding == OBJ_ENCODING_INTSET) {
         if (!intsetGet(si->subject->ptr,si->ii++,llele))
@@ -207,8 +207,8 @@ sds setTypeNextObject(setTypeIterator *si) {
  * used field with values which are easy to trap if misused. */
 int setTypeRandomElement(robj *setobj, sds *sdsele, int64_t *llele) {
     if (setobj->encoding == OBJ_ENCODING_HT) {
-        dictEntry *de = dictGetRandomKey(setobj->ptr);
-        *sdsele = dictGetKey(de);
+        hashtableEntry *de = hashtableGetRandomEntry(setobj->ptr);
+        *sdsele = hashtableGetKey(de);
         *llele = -123456789; /* Not needed. Defensive. */
     } else if (setobj->encoding == OBJ_ENCODING_INTSET) {
         *llele = intsetRandom(setobj->ptr);
@@ -221,7 +221,7 @@ int setTypeRandomElement(robj *setobj, sds *sdsele, int64_t *llele) {
 
 unsigned long setTypeSize(const robj *subject) {
     if (subject->encoding == OBJ_ENCODING_HT) {
-        return dictSize((const dict*)subject->ptr);
+        return hashtableSize((const hashtable*)subject->ptr);
     } else if (subject->encoding == OBJ_ENCODING_INTSET) {
         return intsetLen((const intset*)subject->ptr);
     } else {
@@ -239,23 +239,23 @@ void setTypeConvert(robj *setobj, int enc) {
 
     if (enc == OBJ_ENCODING_HT) {
         int64_t intele;
-        dict *d = dictCreate(&setDictType,NULL);
+        hashtable *h = hashtableCreate(&setDictType,NULL);
         sds element;
 
-        /* Presize the dict to avoid rehashing */
-        dictExpand(d,intsetLen(setobj->ptr));
+        /* Presize the hash table to avoid rehashing */
+        hashtableExpand(h,intsetLen(setobj->ptr));
 
         /* To add the elements we extract integers and create redis objects */
         si = setTypeInitIterator(setobj);
         while (setTypeNext(si,&element,&intele) != -1) {
             element = sdsfromlonglong(intele);
-            serverAssert(dictAdd(d,element,NULL) == DICT_OK);
+            serverAssert(hashtableAdd(h,element,NULL) == DICT_OK);
         }
         setTypeReleaseIterator(si);
 
         setobj->encoding = OBJ_ENCODING_HT;
         zfree(setobj->ptr);
-        setobj->ptr = d;
+        setobj->ptr = h;
     } else {
         serverPanic("Unsupported set conversion");
     }
@@ -785,6 +785,43 @@ int qsortCompareSetsByRevCardinality(const void *s1, const void *s2) {
     return  (o2 ? setTypeSize(o2) : 0) - (o1 ? setTypeSize(o1) : 0);
 }
 
+/* Reply with the elements of 'dstset', or store it at 'dstkey' replying
+ * with its size if 'dstkey' is not NULL. An empty set is not stored, the
+ * key is deleted instead. 'event' is the keyspace event of the store. */
+static void setReplyOrStore(client *c, robj *dstkey, robj *dstset, char *event) {
+    setTypeIterator *si;
+    sds elesds;
+    int64_t intobj;
+
+    if (!dstkey) {
+        addReplyMultiBulkLen(c,setTypeSize(dstset));
+        si = setTypeInitIterator(dstset);
+        while (setTypeNext(si,&elesds,&intobj) != -1) {
+            if (dstset->encoding == OBJ_ENCODING_HT)
+                addReplyBulkCBuffer(c,elesds,sdslen(elesds));
+            else
+                addReplyBulkLongLong(c,intobj);
+        }
+        setTypeReleaseIterator(si);
+        decrRefCount(dstset);
+    } else {
+        int deleted = dbDelete(c->db,dstkey);
+        if (setTypeSize(dstset) > 0) {
+            dbAdd(c->db,dstkey,dstset);
+            addReplyLongLong(c,setTypeSize(dstset));
+            notifyKeyspaceEvent(NOTIFY_SET,event,dstkey,c->db->id);
+        } else {
+            decrRefCount(dstset);
+            addReply(c,shared.czero);
+            if (deleted)
+                notifyKeyspaceEvent(NOTIFY_GENERIC,"del",
+                    dstkey,c->db->id);
+        }
+        signalModifiedKey(c->db,dstkey);
+        server.dirty++;
+    }
+}
+
 void sinterGenericCommand(client *c, robj **setkeys,
                           unsigned long setnum, robj *dstkey) {
     robj **sets = zmalloc(sizeof(robj*)*setnum);
@@ -823,6 +860,26 @@ void sinterGenericCommand(client *c, robj **setkeys,
      * algorithm's performance */
     qsort(sets,setnum,sizeof(robj*),qsortCompareSetsByCardinality);
 
+    /* When all the sets are intsets, they are merged directly into the
+     * resulting intset, starting from the smallest ones. */
+    for (j = 0; j < setnum; j++)
+        if (sets[j]->encoding != OBJ_ENCODING_INTSET) break;
+    if (j == setnum) {
+        intset *is = intsetDup(sets[0]->ptr), *next;
+
+        for (j = 1; j < setnum && intsetLen(is) > 0; j++) {
+            if (sets[j] == sets[0]) continue;
+            next = intsetIntersect(is,sets[j]->ptr);
+            zfree(is);
+            is = next;
+        }
+        dstset = createObject(OBJ_SET,is);
+        dstset->encoding = OBJ_ENCODING_INTSET;
+        setReplyOrStore(c,dstkey,dstset,"sinterstore");
+        zfree(sets);
+        return;
+    }
+
     /* The first thing we should output is the total number of elements...
      * since this is a multi-bulk write, but at this stage we don't know
      * the intersection set size, so we use a trick, append an empty object
@@ -891,21 +948,7 @@ void sinterGenericCommand(client *c, robj **setkeys,
     if (dstkey) {
         /* Store the resulting set into the target, if the intersection
          * is not an empty set. */
-        int deleted = dbDelete(c->db,dstkey);
-        if (setTypeSize(dstset) > 0) {
-            dbAdd(c->db,dstkey,dstset);
-            addReplyLongLong(c,setTypeSize(dstset));
-            notifyKeyspaceEvent(NOTIFY_SET,"sinterstore",
-                dstkey,c->db->id);
-        } else {
-            decrRefCount(dstset);
-            addReply(c,shared.czero);
-            if (deleted)
-                notifyKeyspaceEvent(NOTIFY_GENERIC,"del",
-                    dstkey,c->db->id);
-        }
-        signalModifiedKey(c->db,dstkey);
-        server.dirty++;
+        setReplyOrStore(c,dstkey,dstset,"sinterstore");
     } else {
         setDeferredMultiBulkLength(c,replylen,cardinality);
     }
@@ -948,6 +991,40 @@ void sunionDiffGenericCommand(client *c, robj **setkeys, int setnum,
         sets[j] = setobj;
     }
 
+    /* When all the sets are intsets, they are merged directly into the
+     * resulting intset. */
+    for (j = 0; j < setnum; j++)
+        if (sets[j] && sets[j]->encoding != OBJ_ENCODING_INTSET) break;
+    if (j == setnum) {
+        intset *is = NULL, *next;
+
+        for (j = 0; j < setnum; j++) {
+            if (!sets[j]) continue; /* non existing keys are like empty sets */
+            if (op == SET_OP_DIFF && j == 0) {
+                is = intsetDup(sets[0]->ptr);
+            } else if (op == SET_OP_DIFF) {
+                if (!is) break; /* the first set is empty. */
+                next = intsetDiff(is,sets[j]->ptr);
+                zfree(is);
+                is = next;
+                if (intsetLen(is) == 0) break;
+            } else {
+                next = is ? intsetUnion(is,sets[j]->ptr) :
+                            intsetDup(sets[j]->ptr);
+                zfree(is);
+                is = next;
+            }
+        }
+        dstset = createObject(OBJ_SET,is ? is : intsetNew());
+        dstset->encoding = OBJ_ENCODING_INTSET;
+        if (intsetLen(dstset->ptr) > server.set_max_intset_entries)
+            setTypeConvert(dstset,OBJ_ENCODING_HT);
+        setReplyOrStore(c,dstkey,dstset,
+            op == SET_OP_UNION ? "sunionstore" : "sdiffstore");
+        zfree(sets);
+        return;
+    }
+
     /* Select what DIFF algorithm to use.
      *
      * Algorithm 1 is O(N*M) where N is the size of the element first set
@@ -1051,36 +1128,10 @@ void sunionDiffGenericCommand(client *c, robj **setkeys, int setnum,
         }
     }
 
-    /* Output the content of the resulting set, if not in STORE mode */
-    if (!dstkey) {
-        addReplyMultiBulkLen(c,cardinality);
-        si = setTypeInitIterator(dstset);
-        while((ele = setTypeNextObject(si)) != NULL) {
-            addReplyBulkCBuffer(c,ele,sdslen(ele));
-            sdsfree(ele);
-        }
-        setTypeReleaseIterator(si);
-        decrRefCount(dstset);
-    } else {
-        /* If we have a target key where to store the resulting set
-         * create this key with the result set inside */
-        int deleted = dbDelete(c->db,dstkey);
-        if (setTypeSize(dstset) > 0) {
-            dbAdd(c->db,dstkey,dstset);
-            addReplyLongLong(c,setTypeSize(dstset));
-            notifyKeyspaceEvent(NOTIFY_SET,
-                op == SET_OP_UNION ? "sunionstore" : "sdiffstore",
-                dstkey,c->db->id);
-        } else {
-            decrRefCount(dstset);
-            addReply(c,shared.czero);
-            if (deleted)
-                notifyKeyspaceEvent(NOTIFY_GENERIC,"del",
-                    dstkey,c->db->id);
-        }
-        signalModifiedKey(c->db,dstkey);
-        server.dirty++;
-    }
+    /* Output the content of the resulting set, if not in STORE mode,
+     * otherwise create the target key with the result set inside. */
+    setReplyOrStore(c,dstkey,dstset,
+        op == SET_OP_UNION ? "sunionstore" : "sdiffstore");
     zfree(sets);
 }
 
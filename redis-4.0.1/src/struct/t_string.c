@@ -164,6 +164,10 @@ int getGenericCommand(client *c) {
         addReply(c,shared.wrongtypeerr);
         return C_ERR;
     } else {
+        /* Compressed bitmaps are converted back to plain strings once read
+         * as a whole, see bitops.c. */
+        if (o->encoding == OBJ_ENCODING_BITMAP)
+            o = dbUnshareStringValue(c->db,c->argv[1],o);
         addReplyBulk(c,o);
         return C_OK;
     }
@@ -257,6 +261,9 @@ void getrangeCommand(client *c) {
     if (o->encoding == OBJ_ENCODING_INT) {
         str = llbuf;
         strlen = ll2string(llbuf,sizeof(llbuf),(long)o->ptr);
+    } else if (o->encoding == OBJ_ENCODING_BITMAP) {
+        str = NULL;
+        strlen = roaringLen(o->ptr);
     } else {
         str = o->ptr;
         strlen = sdslen(str);
@@ -277,24 +284,35 @@ void getrangeCommand(client *c) {
      * nothing can be returned is: start > end. */
     if (start > end || strlen == 0) {
         addReply(c,shared.emptybulk);
+    } else if (str == NULL) {
+        sds range = sdsnewlen(NULL,end-start+1);
+
+        roaringGetRange(o->ptr,start,(unsigned char*)range,end-start+1);
+        addReplyBulkSds(c,range);
     } else {
         addReplyBulkCBuffer(c,(char*)str+start,end-start+1);
     }
 }
 
 void mgetCommand(client *c) {
-    int j;
+    robj *vals[HASHTABLE_FIND_BATCH];
+    int j, k, count, found;
 
     addReplyMultiBulkLen(c,c->argc-1);
-    for (j = 1; j < c->argc; j++) {
-        robj *o = lookupKeyRead(c->db,c->argv[j]);
-        if (o == NULL) {
-            addReply(c,shared.nullbulk);
-        } else {
-            if (o->type != OBJ_STRING) {
+    for (j = 1; j < c->argc; j += count) {
+        count = c->argc-j;
+        if (count > HASHTABLE_FIND_BATCH) count = HASHTABLE_FIND_BATCH;
+        found = lookupKeysRead(c->db,c->argv+j,count,vals);
+        for (k = 0; k < count; k++) {
+            robj *o = k < found ? vals[k] : lookupKeyRead(c->db,c->argv[j+k]);
+            if (o == NULL) {
                 addReply(c,shared.nullbulk);
             } else {
-                addReplyBulk(c,o);
+                if (o->type != OBJ_STRING) {
+                    addReply(c,shared.nullbulk);
+                } else {
+                    addReplyBulk(c,o);
+                }
             }
         }
     }
@@ -0,0 +1,1260 @@
+/* B+tree of (score, element) pairs used by big sorted sets.
+ *
+ * The skiplist used by sorted sets allocates a node for every element, with
+ * on average 1.33 levels (a forward pointer and a span each), and a lookup
+ * touches a different cache line at every step. For sorted sets with
+ * millions of elements this tree stores the same (score, element) pairs
+ * packed in leaves of ZBTREE_LEAF_SLOTS elements, linked together so that
+ * ranges are scanned in both directions, under inner nodes of up to
+ * ZBTREE_INNER_SLOTS children.
+ *
+ * Elements are ordered like in the skiplist: by score, and elements with
+ * the same score lexicographically. Like the skiplist, the tree only holds
+ * the order: finding the score of an element is up to the dict of the
+ * sorted set, and the element SDS strings are shared with it. The tree owns
+ * them, so they are released when they are removed from the tree.
+ *
+ * Every inner node stores, for each child, the number of elements under it,
+ * so the rank of an element, and the element at a given rank, are found in
+ * O(log(N)) summing the sizes of the children on the left of the path, like
+ * the spans of the skiplist.
+ *
+ * Every child of an inner node has a separator (score, element) that is a
+ * lower bound of the elements under it, and all the elements under it are
+ * smaller than the separator of the next child. Separators are copies of
+ * the first element of the child at the time it was created, and they are
+ * not updated when that element is deleted: they remain valid bounds. So
+ * deletions never touch the inner nodes but to update the sizes, unless
+ * nodes are merged.
+ *
+ * Nodes are split in two halves when full, except when the new element is
+ * appended after the last one, or prepended before the first one, in which
+ * case the new node only holds the new element: this way sorted sets built
+ * in order (RDB loading, conversions, timestamps as scores) get full leaves.
+ * When a node is left with less than a quarter of its slots used after a
+ * deletion, it is merged with a sibling if both fit a single node, otherwise
+ * the entries are redistributed between the two.
+ *
+ * Copyright (c) 2009-2012, Salvatore Sanfilippo <antirez at gmail dot com>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *   * Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *   * Neither the name of Redis nor the names of its contributors may be used
+ *     to endorse or promote products derived from this software without
+ *     specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "server.h"
+#include <math.h>
+
+/* The inner nodes crossed to reach a leaf, and the child taken in each of
+ * them, from the root (level 0) down. */
+typedef struct zbtreePath {
+    zbtreeInner *nodes[ZBTREE_MAX_HEIGHT];
+    int pos[ZBTREE_MAX_HEIGHT];
+    int depth; /* Number of inner nodes, that is, height-1. */
+} zbtreePath;
+
+/* A condition that is true for a prefix of the elements in order, and false
+ * for the rest, like "score < min". */
+typedef int zbtreePrefixFn(double score, sds ele, void *privdata);
+
+/* ----------------------------- Nodes -------------------------------------- */
+
+static zbtreeLeaf *zbtCreateLeaf(zbtree *zbt) {
+    zbtreeLeaf *leaf = zmalloc(sizeof(*leaf));
+    leaf->prev = leaf->next = NULL;
+    leaf->count = 0;
+    zbt->leaves++;
+    return leaf;
+}
+
+static zbtreeInner *zbtCreateInner(zbtree *zbt) {
+    zbtreeInner *in = zmalloc(sizeof(*in));
+    in->count = 0;
+    in->eles[0] = NULL;
+    zbt->inners++;
+    return in;
+}
+
+static void zbtFreeLeaf(zbtree *zbt, zbtreeLeaf *leaf) {
+    zfree(leaf);
+    zbt->leaves--;
+}
+
+static void zbtFreeInner(zbtree *zbt, zbtreeInner *in) {
+    zfree(in);
+    zbt->inners--;
+}
+
+/* Create a new empty tree: just an empty leaf as root. */
+zbtree *zbtCreate(void) {
+    zbtree *zbt = zmalloc(sizeof(*zbt));
+
+    zbt->leaves = zbt->inners = 0;
+    zbt->head = zbt->tail = zbtCreateLeaf(zbt);
+    zbt->root = zbt->head;
+    zbt->height = 1;
+    zbt->length = 0;
+    return zbt;
+}
+
+static void zbtFreeNode(zbtree *zbt, void *node, int height) {
+    unsigned int j;
+
+    if (height == 1) {
+        zbtreeLeaf *leaf = node;
+        for (j = 0; j < leaf->count; j++) sdsfree(leaf->eles[j]);
+        zbtFreeLeaf(zbt,leaf);
+    } else {
+        zbtreeInner *in = node;
+        for (j = 0; j < in->count; j++) {
+            sdsfree(in->eles[j]);
+            zbtFreeNode(zbt,in->children[j],height-1);
+        }
+        zbtFreeInner(zbt,in);
+    }
+}
+
+/* Free a whole tree, elements included. */
+void zbtFree(zbtree *zbt) {
+    zbtFreeNode(zbt,zbt->root,zbt->height);
+    zfree(zbt);
+}
+
+/* Compare two elements in the order of the tree. */
+static inline int zbtCompare(double s1, sds e1, double s2, sds e2) {
+    if (s1 < s2) return -1;
+    if (s1 > s2) return 1;
+    return sdscmp(e1,e2);
+}
+
+/* Index of the child of 'in' where score/ele is, or belongs: the last
+ * child whose separator is <= score/ele. */
+static inline int zbtInnerSearch(zbtreeInner *in, double score, sds ele) {
+    int lo = 0, hi = in->count-1;
+
+    while (lo < hi) {
+        int mid = (lo+hi+1)/2;
+        if (zbtCompare(in->scores[mid],in->eles[mid],score,ele) <= 0)
+            lo = mid;
+        else
+            hi = mid-1;
+    }
+    return lo;
+}
+
+/* Index of the first element of the leaf >= score/ele. */
+static inline int zbtLeafSearch(zbtreeLeaf *leaf, double score, sds ele) {
+    int lo = 0, hi = leaf->count;
+
+    while (lo < hi) {
+        int mid = (lo+hi)/2;
+        if (zbtCompare(leaf->scores[mid],leaf->eles[mid],score,ele) < 0)
+            lo = mid+1;
+        else
+            hi = mid;
+    }
+    return lo;
+}
+
+/* Descend from the root to the leaf where score/ele is, or belongs,
+ * recording the path. If 'rank' is not NULL it is set to the number of
+ * elements stored in the leaves on the left of the returned one. */
+static zbtreeLeaf *zbtDescend(zbtree *zbt, double score, sds ele,
+                              zbtreePath *path, unsigned long *rank)
+{
+    void *node = zbt->root;
+    unsigned long r = 0;
+    int l, i;
+
+    path->depth = zbt->height-1;
+    for (l = 0; l < path->depth; l++) {
+        zbtreeInner *in = node;
+        int pos = zbtInnerSearch(in,score,ele);
+
+        if (rank) for (i = 0; i < pos; i++) r += in->sizes[i];
+        path->nodes[l] = in;
+        path->pos[l] = pos;
+        node = in->children[pos];
+    }
+    if (rank) *rank = r;
+    return node;
+}
+
+/* Descend to the leaf holding the element at the 1-based 'rank', recording
+ * the path. The index of the element in the leaf is stored in '*idx'. */
+static zbtreeLeaf *zbtDescendByRank(zbtree *zbt, unsigned long rank,
+                                    zbtreePath *path, int *idx)
+{
+    void *node = zbt->root;
+    int l;
+
+    path->depth = zbt->height-1;
+    for (l = 0; l < path->depth; l++) {
+        zbtreeInner *in = node;
+        int pos = 0;
+
+        while (rank > in->sizes[pos]) rank -= in->sizes[pos++];
+        path->nodes[l] = in;
+        path->pos[l] = pos;
+        node = in->children[pos];
+    }
+    *idx = rank-1;
+    return node;
+}
+
+/* Number of elements for which 'fn' is true. If 'it' is not NULL it is set
+ * to the first element for which 'fn' is false, if any. */
+static unsigned long zbtSeek(zbtree *zbt, zbtreePrefixFn *fn, void *privdata,
+                             zbtreeIter *it)
+{
+    void *node = zbt->root;
+    zbtreeLeaf *leaf;
+    unsigned long rank = 0;
+    int h, i, lo, hi;
+
+    for (h = zbt->height; h > 1; h--) {
+        zbtreeInner *in = node;
+
+        /* All the elements of the children before the last one with a
+         * separator that satisfies 'fn' satisfy it as well, and none of
+         * the elements of the following children do. */
+        lo = 0;
+        hi = in->count-1;
+        while (lo < hi) {
+            int mid = (lo+hi+1)/2;
+            if (fn(in->scores[mid],in->eles[mid],privdata))
+                lo = mid;
+            else
+                hi = mid-1;
+        }
+        for (i = 0; i < lo; i++) rank += in->sizes[i];
+        node = in->children[lo];
+    }
+
+    leaf = node;
+    lo = 0;
+    hi = leaf->count;
+    while (lo < hi) {
+        int mid = (lo+hi)/2;
+        if (fn(leaf->scores[mid],leaf->eles[mid],privdata))
+            lo = mid+1;
+        else
+            hi = mid;
+    }
+    rank += lo;
+
+    if (it) {
+        if ((unsigned int)lo == leaf->count) {
+            it->leaf = leaf->next;
+            it->idx = 0;
+        } else {
+            it->leaf = leaf;
+            it->idx = lo;
+        }
+    }
+    return rank;
+}
+
+/* --------------------------- Insertion ------------------------------------ */
+
+static void zbtLeafInsertAt(zbtreeLeaf *leaf, int idx, double score, sds ele) {
+    int move = leaf->count-idx;
+
+    memmove(leaf->scores+idx+1,leaf->scores+idx,sizeof(double)*move);
+    memmove(leaf->eles+idx+1,leaf->eles+idx,sizeof(sds)*move);
+    leaf->scores[idx] = score;
+    leaf->eles[idx] = ele;
+    leaf->count++;
+}
+
+static void zbtInnerInsertAt(zbtreeInner *in, int pos, double score, sds ele,
+                             void *child, unsigned long size)
+{
+    int move = in->count-pos;
+
+    memmove(in->sizes+pos+1,in->sizes+pos,sizeof(unsigned long)*move);
+    memmove(in->scores+pos+1,in->scores+pos,sizeof(double)*move);
+    memmove(in->eles+pos+1,in->eles+pos,sizeof(sds)*move);
+    memmove(in->children+pos+1,in->children+pos,sizeof(void*)*move);
+    in->sizes[pos] = size;
+    in->scores[pos] = score;
+    in->eles[pos] = ele;
+    in->children[pos] = child;
+    in->count++;
+}
+
+/* Add the new node 'child', holding 'size' elements, after the child that
+ * was split at the bottom of the path, splitting the inner nodes that are
+ * full on the way up, and growing a new root if needed. 'edge' is 1 when
+ * the element was appended at the end of the tree, -1 when it was prepended
+ * at the start, 0 otherwise. */
+static void zbtAddChild(zbtree *zbt, zbtreePath *path, double score, sds ele,
+                        void *child, unsigned long size, int edge)
+{
+    int l;
+
+    for (l = path->depth-1; l >= 0; l--) {
+        zbtreeInner *in = path->nodes[l], *right;
+        int pos = path->pos[l]+1, split, j;
+        unsigned long rsize = 0;
+
+        in->sizes[pos-1] -= size;
+        if (in->count < ZBTREE_INNER_SLOTS) {
+            zbtInnerInsertAt(in,pos,score,ele,child,size);
+            return;
+        }
+
+        /* Split the node: the children from 'split' on are moved to a new
+         * node, and the new child goes to the side where it belongs. */
+        if (edge > 0 && (unsigned int)pos == in->count)
+            split = in->count;
+        else if (edge < 0 && pos == 1)
+            split = 1;
+        else
+            split = in->count/2;
+
+        right = zbtCreateInner(zbt);
+        if (split == (int)in->count) {
+            /* Appending: the new node only holds the new child. */
+            right->sizes[0] = size;
+            right->children[0] = child;
+            right->count = 1;
+        } else {
+            right->count = in->count-split;
+            memcpy(right->sizes,in->sizes+split,sizeof(unsigned long)*right->count);
+            memcpy(right->scores,in->scores+split,sizeof(double)*right->count);
+            memcpy(right->eles,in->eles+split,sizeof(sds)*right->count);
+            memcpy(right->children,in->children+split,sizeof(void*)*right->count);
+            in->count = split;
+            if (pos <= split) {
+                zbtInnerInsertAt(in,pos,score,ele,child,size);
+            } else {
+                zbtInnerInsertAt(right,pos-split,score,ele,child,size);
+            }
+            /* The separator of the first child of the new node is the one
+             * that goes up. */
+            score = right->scores[0];
+            ele = right->eles[0];
+            right->eles[0] = NULL;
+        }
+        for (j = 0; j < (int)right->count; j++) rsize += right->sizes[j];
+        child = right;
+        size = rsize;
+    }
+
+    /* The root was split: grow the tree. */
+    zbtreeInner *root = zbtCreateInner(zbt);
+    root->sizes[0] = zbt->length-size;
+    root->children[0] = zbt->root;
+    root->sizes[1] = size;
+    root->scores[1] = score;
+    root->eles[1] = ele;
+    root->children[1] = child;
+    root->count = 2;
+    zbt->root = root;
+    zbt->height++;
+    serverAssert(zbt->height < ZBTREE_MAX_HEIGHT);
+}
+
+/* Insert a new element, that must not already be in the tree. The tree
+ * takes ownership of the SDS string 'ele'. */
+void zbtInsert(zbtree *zbt, double score, sds ele) {
+    zbtreePath path;
+    zbtreeLeaf *leaf, *right;
+    int idx, split, l, edge = 0;
+
+    serverAssert(!isnan(score));
+    leaf = zbtDescend(zbt,score,ele,&path,NULL);
+    idx = zbtLeafSearch(leaf,score,ele);
+    for (l = 0; l < path.depth; l++) path.nodes[l]->sizes[path.pos[l]]++;
+    zbt->length++;
+
+    if (leaf->count < ZBTREE_LEAF_SLOTS) {
+        zbtLeafInsertAt(leaf,idx,score,ele);
+        return;
+    }
+
+    /* The leaf is full: move the elements from 'split' on to a new leaf
+     * linked after it. */
+    if ((unsigned int)idx == leaf->count && leaf->next == NULL) {
+        split = leaf->count;
+        edge = 1;
+    } else if (idx == 0 && leaf->prev == NULL) {
+        split = 0;
+        edge = -1;
+    } else {
+        split = leaf->count/2;
+    }
+
+    right = zbtCreateLeaf(zbt);
+    right->count = leaf->count-split;
+    memcpy(right->scores,leaf->scores+split,sizeof(double)*right->count);
+    memcpy(right->eles,leaf->eles+split,sizeof(sds)*right->count);
+    leaf->count = split;
+    if (split == ZBTREE_LEAF_SLOTS || idx > split)
+        zbtLeafInsertAt(right,idx-split,score,ele);
+    else
+        zbtLeafInsertAt(leaf,idx,score,ele);
+
+    right->prev = leaf;
+    right->next = leaf->next;
+    if (leaf->next)
+        leaf->next->prev = right;
+    else
+        zbt->tail = right;
+    leaf->next = right;
+
+    zbtAddChild(zbt,&path,right->scores[0],sdsdup(right->eles[0]),right,
+                right->count,edge);
+}
+
+/* ---------------------------- Deletion ------------------------------------ */
+
+/* Remove 'n' elements from 'idx' on, without releasing them. */
+static void zbtLeafRemove(zbtreeLeaf *leaf, int idx, int n) {
+    int move = leaf->count-idx-n;
+
+    memmove(leaf->scores+idx,leaf->scores+idx+n,sizeof(double)*move);
+    memmove(leaf->eles+idx,leaf->eles+idx+n,sizeof(sds)*move);
+    leaf->count -= n;
+}
+
+/* Remove the child 'pos' from 'in'. Its separator is not released. */
+static void zbtInnerRemove(zbtreeInner *in, int pos) {
+    int move = in->count-pos-1;
+
+    memmove(in->sizes+pos,in->sizes+pos+1,sizeof(unsigned long)*move);
+    memmove(in->scores+pos,in->scores+pos+1,sizeof(double)*move);
+    memmove(in->eles+pos,in->eles+pos+1,sizeof(sds)*move);
+    memmove(in->children+pos,in->children+pos+1,sizeof(void*)*move);
+    in->count--;
+}
+
+/* Fix the leaf 'pos' of 'parent' if it has too few elements, merging it
+ * with a sibling or moving elements from it. Returns 1 if the leaf was
+ * merged, that is, if 'parent' lost a child. */
+static int zbtFixLeaf(zbtree *zbt, zbtreeInner *parent, int pos) {
+    zbtreeLeaf *left, *right;
+    int l = pos > 0 ? pos-1 : pos, r = l+1, n;
+
+    if (((zbtreeLeaf*)parent->children[pos])->count >= ZBTREE_LEAF_MIN)
+        return 0;
+    left = parent->children[l];
+    right = parent->children[r];
+
+    if (left->count+right->count <= ZBTREE_LEAF_SLOTS) {
+        memcpy(left->scores+left->count,right->scores,sizeof(double)*right->count);
+        memcpy(left->eles+left->count,right->eles,sizeof(sds)*right->count);
+        left->count += right->count;
+        left->next = right->next;
+        if (right->next)
+            right->next->prev = left;
+        else
+            zbt->tail = left;
+        parent->sizes[l] += parent->sizes[r];
+        sdsfree(parent->eles[r]);
+        zbtInnerRemove(parent,r);
+        zbtFreeLeaf(zbt,right);
+        return 1;
+    }
+
+    /* Both can't fit a single leaf: split the elements in half. */
+    n = (left->count+right->count)/2;
+    if ((int)left->count < n) {
+        n -= left->count;
+        memcpy(left->scores+left->count,right->scores,sizeof(double)*n);
+        memcpy(left->eles+left->count,right->eles,sizeof(sds)*n);
+        left->count += n;
+        zbtLeafRemove(right,0,n);
+        parent->sizes[l] += n;
+        parent->sizes[r] -= n;
+    } else {
+        n = left->count-n;
+        memmove(right->scores+n,right->scores,sizeof(double)*right->count);
+        memmove(right->eles+n,right->eles,sizeof(sds)*right->count);
+        memcpy(right->scores,left->scores+left->count-n,sizeof(double)*n);
+        memcpy(right->eles,left->eles+left->count-n,sizeof(sds)*n);
+        right->count += n;
+        left->count -= n;
+        parent->sizes[l] -= n;
+        parent->sizes[r] += n;
+    }
+    sdsfree(parent->eles[r]);
+    parent->scores[r] = right->scores[0];
+    parent->eles[r] = sdsdup(right->eles[0]);
+    return 0;
+}
+
+/* Like zbtFixLeaf() for the inner node 'pos' of 'parent'. The separators
+ * are rotated through the parent. */
+static int zbtFixInner(zbtree *zbt, zbtreeInner *parent, int pos) {
+    zbtreeInner *left, *right;
+    int l = pos > 0 ? pos-1 : pos, r = l+1, n, j;
+    unsigned long moved = 0;
+
+    if (((zbtreeInner*)parent->children[pos])->count >= ZBTREE_INNER_MIN)
+        return 0;
+    left = parent->children[l];
+    right = parent->children[r];
+
+    if (left->count+right->count <= ZBTREE_INNER_SLOTS) {
+        /* The separator of the right node moves down to its first child. */
+        right->scores[0] = parent->scores[r];
+        right->eles[0] = parent->eles[r];
+        memcpy(left->sizes+left->count,right->sizes,sizeof(unsigned long)*right->count);
+        memcpy(left->scores+left->count,right->scores,sizeof(double)*right->count);
+        memcpy(left->eles+left->count,right->eles,sizeof(sds)*right->count);
+        memcpy(left->children+left->count,right->children,sizeof(void*)*right->count);
+        left->count += right->count;
+        parent->sizes[l] += parent->sizes[r];
+        zbtInnerRemove(parent,r);
+        zbtFreeInner(zbt,right);
+        return 1;
+    }
+
+    n = (left->count+right->count)/2;
+    if ((int)left->count < n) {
+        /* Move the first children of the right node to the left one. */
+        n -= left->count;
+        right->scores[0] = parent->scores[r];
+        right->eles[0] = parent->eles[r];
+        memcpy(left->sizes+left->count,right->sizes,sizeof(unsigned long)*n);
+        memcpy(left->scores+left->count,right->scores,sizeof(double)*n);
+        memcpy(left->eles+left->count,right->eles,sizeof(sds)*n);
+        memcpy(left->children+left->count,right->children,sizeof(void*)*n);
+        left->count += n;
+        for (j = 0; j < n; j++) moved += right->sizes[j];
+        parent->scores[r] = right->scores[n];
+        parent->eles[r] = right->eles[n];
+        for (j = 0; j < n; j++) zbtInnerRemove(right,0);
+        right->eles[0] = NULL;
+        parent->sizes[l] += moved;
+        parent->sizes[r] -= moved;
+    } else {
+        /* Move the last children of the left node to the right one. */
+        n = left->count-n;
+        right->scores[0] = parent->scores[r];
+        right->eles[0] = parent->eles[r];
+        for (j = n-1; j >= 0; j--) {
+            int src = left->count-n+j;
+            zbtInnerInsertAt(right,0,left->scores[src],left->eles[src],
+                             left->children[src],left->sizes[src]);
+            moved += left->sizes[src];
+        }
+        left->count -= n;
+        parent->scores[r] = right->scores[0];
+        parent->eles[r] = right->eles[0];
+        right->eles[0] = NULL;
+        parent->sizes[l] -= moved;
+        parent->sizes[r] += moved;
+    }
+    return 0;
+}
+
+/* Called after elements were removed from the leaf at the bottom of the
+ * path: merge or refill the nodes left with too few entries, and shrink the
+ * tree when the root is left with a single child. */
+static void zbtRebalance(zbtree *zbt, zbtreePath *path) {
+    int l;
+
+    for (l = path->depth; l > 0; l--) {
+        zbtreeInner *parent = path->nodes[l-1];
+        int pos = path->pos[l-1];
+        int merged = (l == path->depth) ? zbtFixLeaf(zbt,parent,pos) :
+                                          zbtFixInner(zbt,parent,pos);
+        if (!merged) break;
+    }
+
+    while (zbt->height > 1 && ((zbtreeInner*)zbt->root)->count == 1) {
+        zbtreeInner *root = zbt->root;
+        zbt->root = root->children[0];
+        zbt->height--;
+        zbtFreeInner(zbt,root);
+    }
+}
+
+/* Delete the element with the matching score and value. Returns 1 if it
+ * was found and deleted, 0 otherwise. If 'deleted' is NULL the SDS string
+ * of the element is released, otherwise it is returned by reference, and
+ * it is up to the caller to free it (or to insert it again). */
+int zbtDelete(zbtree *zbt, double score, sds ele, sds *deleted) {
+    zbtreePath path;
+    zbtreeLeaf *leaf;
+    int idx, l;
+
+    leaf = zbtDescend(zbt,score,ele,&path,NULL);
+    idx = zbtLeafSearch(leaf,score,ele);
+    if ((unsigned int)idx == leaf->count || leaf->scores[idx] != score ||
+        sdscmp(leaf->eles[idx],ele) != 0) return 0;
+
+    if (deleted)
+        *deleted = leaf->eles[idx];
+    else
+        sdsfree(leaf->eles[idx]);
+    zbtLeafRemove(leaf,idx,1);
+    for (l = 0; l < path.depth; l++) path.nodes[l]->sizes[path.pos[l]]--;
+    zbt->length--;
+    zbtRebalance(zbt,&path);
+    return 1;
+}
+
+/* Update the score of an element that must be in the tree. When the
+ * element keeps its position in the leaf, like for small increments of a
+ * member of a big sorted set, the score is updated in place. */
+void zbtUpdateScore(zbtree *zbt, double curscore, sds ele, double newscore) {
+    zbtreePath path;
+    zbtreeLeaf *leaf;
+    int idx, l;
+
+    serverAssert(!isnan(newscore));
+    leaf = zbtDescend(zbt,curscore,ele,&path,NULL);
+    idx = zbtLeafSearch(leaf,curscore,ele);
+    serverAssert((unsigned int)idx < leaf->count &&
+                 leaf->scores[idx] == curscore &&
+                 sdscmp(leaf->eles[idx],ele) == 0);
+
+    if (idx > 0 && (unsigned int)idx < leaf->count-1 &&
+        zbtCompare(leaf->scores[idx-1],leaf->eles[idx-1],newscore,ele) < 0 &&
+        zbtCompare(newscore,ele,leaf->scores[idx+1],leaf->eles[idx+1]) < 0)
+    {
+        leaf->scores[idx] = newscore;
+        return;
+    }
+
+    /* Remove and insert again, reusing the SDS string. */
+    ele = leaf->eles[idx];
+    zbtLeafRemove(leaf,idx,1);
+    for (l = 0; l < path.depth; l++) path.nodes[l]->sizes[path.pos[l]]--;
+    zbt->length--;
+    zbtRebalance(zbt,&path);
+    zbtInsert(zbt,newscore,ele);
+}
+
+/* Delete all the elements with rank between start and end (1-based and
+ * inclusive), removing them from the dict of the sorted set as well.
+ * Elements are removed one leaf at a time. */
+unsigned long zbtDeleteRangeByRank(zbtree *zbt, unsigned long start,
+                                   unsigned long end, dict *dict)
+{
+    unsigned long removed = 0, todo;
+    zbtreePath path;
+
+    if (start < 1) start = 1;
+    if (end > zbt->length) end = zbt->length;
+    if (start > end) return 0;
+    todo = end-start+1;
+
+    while (removed < todo) {
+        zbtreeLeaf *leaf;
+        int idx, n, j, l;
+
+        leaf = zbtDescendByRank(zbt,start,&path,&idx);
+        n = leaf->count-idx;
+        if ((unsigned long)n > todo-removed) n = todo-removed;
+        for (j = idx; j < idx+n; j++) {
+            if (dict) dictDelete(dict,leaf->eles[j]);
+            sdsfree(leaf->eles[j]);
+        }
+        zbtLeafRemove(leaf,idx,n);
+        for (l = 0; l < path.depth; l++)
+            path.nodes[l]->sizes[path.pos[l]] -= n;
+        zbt->length -= n;
+        removed += n;
+        zbtRebalance(zbt,&path);
+    }
+    return removed;
+}
+
+/* ---------------------------- Lookups ------------------------------------- */
+
+/* Find the rank of the element by both score and value. Returns 0 when the
+ * element cannot be found, its 1-based rank otherwise. */
+unsigned long zbtGetRank(zbtree *zbt, double score, sds ele) {
+    zbtreePath path;
+    zbtreeLeaf *leaf;
+    unsigned long rank;
+    int idx;
+
+    leaf = zbtDescend(zbt,score,ele,&path,&rank);
+    idx = zbtLeafSearch(leaf,score,ele);
+    if ((unsigned int)idx == leaf->count || leaf->scores[idx] != score ||
+        sdscmp(leaf->eles[idx],ele) != 0) return 0;
+    return rank+idx+1;
+}
+
+/* Point the iterator to the element with the given 1-based rank. Returns 0
+ * (and a NULL leaf) if the rank is out of range. */
+int zbtGetElementByRank(zbtree *zbt, unsigned long rank, zbtreeIter *it) {
+    void *node = zbt->root;
+    int h;
+
+    if (rank < 1 || rank > zbt->length) {
+        it->leaf = NULL;
+        return 0;
+    }
+    for (h = zbt->height; h > 1; h--) {
+        zbtreeInner *in = node;
+        int pos = 0;
+
+        while (rank > in->sizes[pos]) rank -= in->sizes[pos++];
+        node = in->children[pos];
+    }
+    it->leaf = node;
+    it->idx = rank-1;
+    return 1;
+}
+
+int zbtFirst(zbtree *zbt, zbtreeIter *it) {
+    it->leaf = zbt->length ? zbt->head : NULL;
+    it->idx = 0;
+    return it->leaf != NULL;
+}
+
+int zbtLast(zbtree *zbt, zbtreeIter *it) {
+    it->leaf = zbt->length ? zbt->tail : NULL;
+    it->idx = it->leaf ? (int)it->leaf->count-1 : 0;
+    return it->leaf != NULL;
+}
+
+/* Move to the next element. Returns 0 (and a NULL leaf) past the last one. */
+int zbtNext(zbtreeIter *it) {
+    if (++it->idx == (int)it->leaf->count) {
+        it->leaf = it->leaf->next;
+        it->idx = 0;
+    }
+    return it->leaf != NULL;
+}
+
+/* Move to the previous element. Returns 0 (and a NULL leaf) past the first
+ * one. */
+int zbtPrev(zbtreeIter *it) {
+    if (it->idx-- == 0) {
+        it->leaf = it->leaf->prev;
+        if (it->leaf) it->idx = it->leaf->count-1;
+    }
+    return it->leaf != NULL;
+}
+
+/* Replace the SDS string of an element with 'newele', the same string moved
+ * to a different address by the active defragmentation. 'oldele' was
+ * already released, so it is only compared as a pointer. */
+void zbtReplaceElement(zbtree *zbt, double score, sds oldele, sds newele) {
+    zbtreePath path;
+    zbtreeLeaf *leaf;
+    int lo, hi;
+
+    leaf = zbtDescend(zbt,score,newele,&path,NULL);
+    lo = 0;
+    hi = leaf->count;
+    while (lo < hi) {
+        int mid = (lo+hi)/2;
+        int cmp = leaf->eles[mid] == oldele ? 0 :
+            zbtCompare(leaf->scores[mid],leaf->eles[mid],score,newele);
+        if (cmp < 0)
+            lo = mid+1;
+        else
+            hi = mid;
+    }
+    serverAssert((unsigned int)lo < leaf->count && leaf->eles[lo] == oldele);
+    leaf->eles[lo] = newele;
+}
+
+/* ---------------------------- Ranges -------------------------------------- */
+
+static int zbtScoreBelowMin(double score, sds ele, void *privdata) {
+    UNUSED(ele);
+    return !zslValueGteMin(score,privdata);
+}
+
+static int zbtScoreUpToMax(double score, sds ele, void *privdata) {
+    UNUSED(ele);
+    return zslValueLteMax(score,privdata);
+}
+
+static int zbtLexBelowMin(double score, sds ele, void *privdata) {
+    UNUSED(score);
+    return !zslLexValueGteMin(ele,privdata);
+}
+
+static int zbtLexUpToMax(double score, sds ele, void *privdata) {
+    UNUSED(score);
+    return zslLexValueLteMax(ele,privdata);
+}
+
+/* The ranges are found as the elements after the ones below the min, and up
+ * to the last one that is not above the max: the ranks come for free. */
+static unsigned long zbtFirstMatching(zbtree *zbt, zbtreePrefixFn *below,
+    zbtreePrefixFn *uptomax, void *range, zbtreeIter *it)
+{
+    unsigned long rank = zbtSeek(zbt,below,range,it);
+
+    if (it->leaf == NULL ||
+        !uptomax(zbtIterScore(it),zbtIterEle(it),range))
+    {
+        it->leaf = NULL;
+        return 0;
+    }
+    return rank+1;
+}
+
+static unsigned long zbtLastMatching(zbtree *zbt, zbtreePrefixFn *below,
+    zbtreePrefixFn *uptomax, void *range, zbtreeIter *it)
+{
+    unsigned long rank = zbtSeek(zbt,uptomax,range,it);
+
+    if (rank == 0) {
+        it->leaf = NULL;
+        return 0;
+    }
+    if (it->leaf == NULL)
+        zbtLast(zbt,it);
+    else
+        zbtPrev(it);
+    if (below(zbtIterScore(it),zbtIterEle(it),range)) {
+        it->leaf = NULL;
+        return 0;
+    }
+    return rank;
+}
+
+/* Point the iterator to the first element in the specified range and return
+ * its 1-based rank, or return 0 (and a NULL leaf) when no element is in the
+ * range. */
+unsigned long zbtFirstInRange(zbtree *zbt, zrangespec *range, zbtreeIter *it) {
+    return zbtFirstMatching(zbt,zbtScoreBelowMin,zbtScoreUpToMax,range,it);
+}
+
+/* Like zbtFirstInRange() for the last element in the range. */
+unsigned long zbtLastInRange(zbtree *zbt, zrangespec *range, zbtreeIter *it) {
+    return zbtLastMatching(zbt,zbtScoreBelowMin,zbtScoreUpToMax,range,it);
+}
+
+unsigned long zbtFirstInLexRange(zbtree *zbt, zlexrangespec *range, zbtreeIter *it) {
+    return zbtFirstMatching(zbt,zbtLexBelowMin,zbtLexUpToMax,range,it);
+}
+
+unsigned long zbtLastInLexRange(zbtree *zbt, zlexrangespec *range, zbtreeIter *it) {
+    return zbtLastMatching(zbt,zbtLexBelowMin,zbtLexUpToMax,range,it);
+}
+
+/* Number of elements in the specified range, in O(log(N)). */
+unsigned long zbtCountInRange(zbtree *zbt, zrangespec *range) {
+    unsigned long below = zbtSeek(zbt,zbtScoreBelowMin,range,NULL);
+    unsigned long uptomax = zbtSeek(zbt,zbtScoreUpToMax,range,NULL);
+    return uptomax > below ? uptomax-below : 0;
+}
+
+unsigned long zbtCountInLexRange(zbtree *zbt, zlexrangespec *range) {
+    unsigned long below = zbtSeek(zbt,zbtLexBelowMin,range,NULL);
+    unsigned long uptomax = zbtSeek(zbt,zbtLexUpToMax,range,NULL);
+    return uptomax > below ? uptomax-below : 0;
+}
+
+/* Delete all the elements with score in the specified range, removing them
+ * from the dict of the sorted set as well. */
+unsigned long zbtDeleteRangeByScore(zbtree *zbt, zrangespec *range, dict *dict) {
+    unsigned long below = zbtSeek(zbt,zbtScoreBelowMin,range,NULL);
+    unsigned long uptomax = zbtSeek(zbt,zbtScoreUpToMax,range,NULL);
+    if (uptomax <= below) return 0;
+    return zbtDeleteRangeByRank(zbt,below+1,uptomax,dict);
+}
+
+unsigned long zbtDeleteRangeByLex(zbtree *zbt, zlexrangespec *range, dict *dict) {
+    unsigned long below = zbtSeek(zbt,zbtLexBelowMin,range,NULL);
+    unsigned long uptomax = zbtSeek(zbt,zbtLexUpToMax,range,NULL);
+    if (uptomax <= below) return 0;
+    return zbtDeleteRangeByRank(zbt,below+1,uptomax,dict);
+}
+
+#ifdef REDIS_TEST
+#include <assert.h>
+
+#define UNUSED(x) (void)(x)
+#define ZBTREE_TEST_ELEMENTS 100000
+
+zskiplistNode *zslGetElementByRank(zskiplist *zsl, unsigned long rank);
+unsigned long zslDeleteRangeByRank(zskiplist *zsl, unsigned int start, unsigned int end, dict *dict);
+
+static sds zbtTestEle(long j) {
+    return sdscatprintf(sdsempty(),"ele:%ld",j);
+}
+
+/* Check the structure of the node and of the nodes below it, that must
+ * hold elements >= lo and < hi (a NULL element means no bound). Returns
+ * the number of elements under the node. */
+static unsigned long zbtCheckNode(zbtree *zbt, void *node, int height,
+                                  double loscore, sds loele,
+                                  double hiscore, sds hiele,
+                                  unsigned long *leaves, unsigned long *inners)
+{
+    unsigned long count = 0, size;
+    unsigned int j;
+
+    if (height == 1) {
+        zbtreeLeaf *leaf = node;
+
+        assert(leaf->count <= ZBTREE_LEAF_SLOTS);
+        assert(leaf->count >= 1 || node == zbt->root);
+        for (j = 0; j < leaf->count; j++) {
+            if (j > 0)
+                assert(zbtCompare(leaf->scores[j-1],leaf->eles[j-1],
+                                  leaf->scores[j],leaf->eles[j]) < 0);
+            if (loele)
+                assert(zbtCompare(loscore,loele,
+                                  leaf->scores[j],leaf->eles[j]) <= 0);
+            if (hiele)
+                assert(zbtCompare(leaf->scores[j],leaf->eles[j],
+                                  hiscore,hiele) < 0);
+        }
+        (*leaves)++;
+        return leaf->count;
+    }
+
+    zbtreeInner *in = node;
+    assert(in->count <= ZBTREE_INNER_SLOTS);
+    assert(in->count >= (node == zbt->root ? 2 : 1));
+    assert(in->eles[0] == NULL);
+    for (j = 0; j < in->count; j++) {
+        if (j > 0) {
+            assert(in->eles[j] != NULL);
+            if (j > 1)
+                assert(zbtCompare(in->scores[j-1],in->eles[j-1],
+                                  in->scores[j],in->eles[j]) < 0);
+        }
+        size = zbtCheckNode(zbt,in->children[j],height-1,
+            j ? in->scores[j] : loscore, j ? in->eles[j] : loele,
+            j+1 < in->count ? in->scores[j+1] : hiscore,
+            j+1 < in->count ? in->eles[j+1] : hiele,
+            leaves,inners);
+        assert(size == in->sizes[j]);
+        count += size;
+    }
+    (*inners)++;
+    return count;
+}
+
+/* Check the invariants of the whole tree. */
+static void zbtCheck(zbtree *zbt) {
+    unsigned long leaves = 0, inners = 0, count = 0;
+    zbtreeLeaf *leaf, *prev = NULL;
+
+    assert(zbtCheckNode(zbt,zbt->root,zbt->height,0,NULL,0,NULL,
+                        &leaves,&inners) == zbt->length);
+    assert(leaves == zbt->leaves && inners == zbt->inners);
+    for (leaf = zbt->head; leaf; prev = leaf, leaf = leaf->next) {
+        assert(leaf->prev == prev);
+        count += leaf->count;
+    }
+    assert(prev == zbt->tail && count == zbt->length);
+}
+
+/* The tree must hold the same elements of the skiplist, in both the
+ * directions. */
+static void zbtCompareWithSkiplist(zbtree *zbt, zskiplist *zsl) {
+    zskiplistNode *ln;
+    zbtreeIter it;
+
+    assert(zbt->length == zsl->length);
+    zbtFirst(zbt,&it);
+    for (ln = zsl->header->level[0].forward; ln; ln = ln->level[0].forward) {
+        assert(it.leaf != NULL && zbtIterScore(&it) == ln->score &&
+               sdscmp(zbtIterEle(&it),ln->ele) == 0);
+        zbtNext(&it);
+    }
+    assert(it.leaf == NULL);
+    zbtLast(zbt,&it);
+    for (ln = zsl->tail; ln; ln = ln->backward) {
+        assert(it.leaf != NULL && zbtIterScore(&it) == ln->score &&
+               sdscmp(zbtIterEle(&it),ln->ele) == 0);
+        zbtPrev(&it);
+    }
+    assert(it.leaf == NULL);
+}
+
+/* Compare the B+tree with the skiplist on 'n' elements with random scores,
+ * printing the time of the main operations and the memory used by the two
+ * data structures (the elements excluded). */
+static void zbtBenchmark(unsigned long n) {
+    zskiplist *zsl = zslCreate();
+    zbtree *zbt = zbtCreate();
+    sds *eles = zmalloc(sizeof(sds)*n), *copies = zmalloc(sizeof(sds)*n);
+    double *scores = zmalloc(sizeof(double)*n), sum1 = 0, sum2 = 0;
+    unsigned long j, k, *order = zmalloc(sizeof(unsigned long)*n);
+    size_t mem;
+    long long start, t1, t2;
+    zskiplistNode *ln;
+    zbtreeIter it;
+
+    for (j = 0; j < n; j++) {
+        eles[j] = zbtTestEle(j);
+        copies[j] = sdsdup(eles[j]);
+        scores[j] = rand() % n;
+        order[j] = j;
+    }
+    for (j = n-1; j > 0; j--) {
+        k = rand() % (j+1);
+        unsigned long tmp = order[j];
+        order[j] = order[k];
+        order[k] = tmp;
+    }
+    printf("%lu elements, skiplist vs B+tree:\n", n);
+
+    mem = zmalloc_used_memory();
+    start = ustime();
+    for (j = 0; j < n; j++) zslInsert(zsl,scores[j],eles[j]);
+    t1 = ustime()-start;
+    mem = zmalloc_used_memory()-mem;
+    start = ustime();
+    for (j = 0; j < n; j++) zbtInsert(zbt,scores[j],copies[j]);
+    t2 = ustime()-start;
+    printf("  insert:        %8lld ms %8lld ms\n", t1/1000, t2/1000);
+    printf("  memory:        %8zu kb %8zu kb\n", mem/1024,
+        (sizeof(*zbt)+zbt->leaves*sizeof(zbtreeLeaf)+
+         zbt->inners*sizeof(zbtreeInner))/1024);
+
+    start = ustime();
+    for (j = 0; j < n; j++)
+        sum1 += zslGetRank(zsl,scores[order[j]],eles[order[j]]);
+    t1 = ustime()-start;
+    start = ustime();
+    for (j = 0; j < n; j++)
+        sum2 += zbtGetRank(zbt,scores[order[j]],eles[order[j]]);
+    t2 = ustime()-start;
+    assert(sum1 == sum2);
+    printf("  rank:          %8lld ms %8lld ms\n", t1/1000, t2/1000);
+
+    /* Ranges of 100 elements starting at random ranks. */
+    start = ustime();
+    for (j = 0; j < n/100; j++) {
+        ln = zslGetElementByRank(zsl,order[j]+1);
+        for (k = 0; k < 100 && ln; k++, ln = ln->level[0].forward)
+            sum1 += ln->score;
+    }
+    t1 = ustime()-start;
+    start = ustime();
+    for (j = 0; j < n/100; j++) {
+        zbtGetElementByRank(zbt,order[j]+1,&it);
+        for (k = 0; k < 100 && it.leaf; k++, zbtNext(&it))
+            sum2 += zbtIterScore(&it);
+    }
+    t2 = ustime()-start;
+    assert(sum1 == sum2);
+    printf("  range of 100:  %8lld ms %8lld ms\n", t1/1000, t2/1000);
+
+    /* The tree first, since the skiplist releases the elements. */
+    start = ustime();
+    for (j = 0; j < n; j++)
+        zbtDelete(zbt,scores[order[j]],eles[order[j]],NULL);
+    t2 = ustime()-start;
+    start = ustime();
+    for (j = 0; j < n; j++)
+        zslDelete(zsl,scores[order[j]],eles[order[j]],NULL);
+    t1 = ustime()-start;
+    printf("  delete:        %8lld ms %8lld ms\n", t1/1000, t2/1000);
+
+    zslFree(zsl);
+    zbtFree(zbt);
+    zfree(eles);
+    zfree(copies);
+    zfree(scores);
+    zfree(order);
+}
+
+int zbtreeTest(int argc, char *argv[]) {
+    zskiplist *zsl = zslCreate();
+    zbtree *zbt = zbtCreate();
+    double *scores = zmalloc(sizeof(double)*ZBTREE_TEST_ELEMENTS);
+    dict *d1, *d2;
+    zskiplistNode *ln, *first, *last;
+    zbtreeIter it;
+    unsigned long j, rank, lastrank;
+    sds ele, deleted;
+
+    printf("Insert random elements: ");
+    for (j = 0; j < ZBTREE_TEST_ELEMENTS; j++) {
+        /* Few distinct scores, so that elements are compared as well. */
+        scores[j] = rand() % (ZBTREE_TEST_ELEMENTS/4);
+        ele = zbtTestEle(j);
+        zslInsert(zsl,scores[j],ele);
+        zbtInsert(zbt,scores[j],sdsdup(ele));
+    }
+    zbtCheck(zbt);
+    zbtCompareWithSkiplist(zbt,zsl);
+    printf("[ok]\n");
+
+    printf("Rank of every element: ");
+    rank = 1;
+    for (ln = zsl->header->level[0].forward; ln; ln = ln->level[0].forward) {
+        assert(zbtGetRank(zbt,ln->score,ln->ele) == rank);
+        assert(zbtGetElementByRank(zbt,rank,&it));
+        assert(sdscmp(zbtIterEle(&it),ln->ele) == 0);
+        rank++;
+    }
+    ele = zbtTestEle(ZBTREE_TEST_ELEMENTS);
+    assert(zbtGetRank(zbt,0,ele) == 0);
+    sdsfree(ele);
+    assert(!zbtGetElementByRank(zbt,0,&it) && it.leaf == NULL);
+    assert(!zbtGetElementByRank(zbt,rank,&it) && it.leaf == NULL);
+    printf("[ok]\n");
+
+    printf("Score ranges: ");
+    for (j = 0; j < 10000; j++) {
+        zrangespec range;
+
+        range.min = rand() % (ZBTREE_TEST_ELEMENTS/4);
+        range.max = range.min + rand() % 20 - 2;
+        range.minex = rand() % 2;
+        range.maxex = rand() % 2;
+        first = zslFirstInRange(zsl,&range);
+        last = zslLastInRange(zsl,&range);
+        rank = zbtFirstInRange(zbt,&range,&it);
+        if (first == NULL) {
+            assert(rank == 0 && it.leaf == NULL);
+            assert(zbtLastInRange(zbt,&range,&it) == 0);
+            assert(zbtCountInRange(zbt,&range) == 0);
+            continue;
+        }
+        assert(rank == zslGetRank(zsl,first->score,first->ele));
+        assert(sdscmp(zbtIterEle(&it),first->ele) == 0);
+        lastrank = zbtLastInRange(zbt,&range,&it);
+        assert(lastrank == zslGetRank(zsl,last->score,last->ele));
+        assert(sdscmp(zbtIterEle(&it),last->ele) == 0);
+        assert(zbtCountInRange(zbt,&range) == lastrank-rank+1);
+    }
+    printf("[ok]\n");
+
+    printf("Update scores: ");
+    for (j = 0; j < 20000; j++) {
+        long k = rand() % ZBTREE_TEST_ELEMENTS;
+        double newscore = scores[k] + (j % 2 ? 1 : rand() % 1000 - 500);
+
+        ele = zbtTestEle(k);
+        assert(zslDelete(zsl,scores[k],ele,NULL));
+        zslInsert(zsl,newscore,sdsdup(ele));
+        zbtUpdateScore(zbt,scores[k],ele,newscore);
+        scores[k] = newscore;
+        sdsfree(ele);
+    }
+    zbtCheck(zbt);
+    zbtCompareWithSkiplist(zbt,zsl);
+    printf("[ok]\n");
+
+    printf("Delete half of the elements: ");
+    for (j = 0; j < ZBTREE_TEST_ELEMENTS; j += 2) {
+        ele = zbtTestEle(j);
+        assert(zslDelete(zsl,scores[j],ele,NULL));
+        if (j % 4) {
+            assert(zbtDelete(zbt,scores[j],ele,NULL));
+        } else {
+            assert(zbtDelete(zbt,scores[j],ele,&deleted));
+            assert(deleted != ele && sdscmp(deleted,ele) == 0);
+            sdsfree(deleted);
+        }
+        assert(!zbtDelete(zbt,scores[j],ele,NULL));
+        sdsfree(ele);
+    }
+    zbtCheck(zbt);
+    zbtCompareWithSkiplist(zbt,zsl);
+    printf("[ok]\n");
+
+    printf("Delete ranges: ");
+    d1 = dictCreate(&zsetDictType,NULL);
+    d2 = dictCreate(&zsetDictType,NULL);
+    for (zbtFirst(zbt,&it); it.leaf; zbtNext(&it))
+        dictAdd(d1,zbtIterEle(&it),NULL);
+    for (ln = zsl->header->level[0].forward; ln; ln = ln->level[0].forward)
+        dictAdd(d2,ln->ele,NULL);
+    for (j = 0; j < 100; j++) {
+        zrangespec range;
+        unsigned long start;
+
+        range.min = rand() % (ZBTREE_TEST_ELEMENTS/4);
+        range.max = range.min + rand() % 100;
+        range.minex = rand() % 2;
+        range.maxex = rand() % 2;
+        assert(zbtDeleteRangeByScore(zbt,&range,d1) ==
+               zslDeleteRangeByScore(zsl,&range,d2));
+        start = rand() % zsl->length + 1;
+        rank = start + rand() % 500;
+        if (rank > zsl->length) rank = zsl->length;
+        assert(zbtDeleteRangeByRank(zbt,start,rank,d1) ==
+               zslDeleteRangeByRank(zsl,start,rank,d2));
+    }
+    assert(dictSize(d1) == zbt->length);
+    zbtCheck(zbt);
+    zbtCompareWithSkiplist(zbt,zsl);
+    assert(zbtDeleteRangeByRank(zbt,1,zbt->length,d1) ==
+           zslDeleteRangeByRank(zsl,1,zsl->length,d2));
+    assert(dictSize(d1) == 0 && zbt->length == 0);
+    assert(zbt->height == 1 && zbt->leaves == 1 && zbt->inners == 0);
+    zbtCheck(zbt);
+    dictRelease(d1);
+    dictRelease(d2);
+    zslFree(zsl);
+    zbtFree(zbt);
+    printf("[ok]\n");
+
+    printf("Lex ranges: ");
+    zsl = zslCreate();
+    zbt = zbtCreate();
+    for (j = 0; j < ZBTREE_TEST_ELEMENTS; j++) {
+        ele = zbtTestEle(j);
+        zslInsert(zsl,0,ele);
+        zbtInsert(zbt,0,sdsdup(ele));
+    }
+    for (j = 0; j < 10000; j++) {
+        zlexrangespec range;
+
+        range.min = zbtTestEle(rand() % ZBTREE_TEST_ELEMENTS);
+        range.max = zbtTestEle(rand() % ZBTREE_TEST_ELEMENTS);
+        range.minex = rand() % 2;
+        range.maxex = rand() % 2;
+        first = zslFirstInLexRange(zsl,&range);
+        last = zslLastInLexRange(zsl,&range);
+        rank = zbtFirstInLexRange(zbt,&range,&it);
+        if (first == NULL) {
+            assert(rank == 0 && it.leaf == NULL);
+            assert(zbtLastInLexRange(zbt,&range,&it) == 0);
+            assert(zbtCountInLexRange(zbt,&range) == 0);
+        } else {
+            assert(rank == zslGetRank(zsl,first->score,first->ele));
+            assert(sdscmp(zbtIterEle(&it),first->ele) == 0);
+            lastrank = zbtLastInLexRange(zbt,&range,&it);
+            assert(lastrank == zslGetRank(zsl,last->score,last->ele));
+            assert(sdscmp(zbtIterEle(&it),last->ele) == 0);
+            assert(zbtCountInLexRange(zbt,&range) == lastrank-rank+1);
+        }
+        sdsfree(range.min);
+        sdsfree(range.max);
+    }
+    zbtCheck(zbt);
+    zslFree(zsl);
+    zbtFree(zbt);
+    zfree(scores);
+    printf("[ok]\n");
+
+    zbtBenchmark(argc > 3 ? strtoul(argv[3],NULL,10) : 1000000);
+    return 0;
+}
+#endif
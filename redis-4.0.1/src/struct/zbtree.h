@@ -0,0 +1,144 @@
+/* B+tree of (score, element) pairs used by big sorted sets.
+ *
+ * This file implements an ordered index of the elements of a sorted set with
+ * the same semantics of the skiplist (order by score, then lexicographically
+ * by element, O(log(N)) rank operations), but storing the elements packed in
+ * leaves of 1024 bytes instead of one node for every element, so that range
+ * queries and scans walk arrays instead of chasing a pointer per element.
+ * Inner nodes store, for every child, how many elements it holds, which is
+ * what makes ranks O(log(N)). See the source code for more information.
+ *
+ * Copyright (c) 2009-2012, Salvatore Sanfilippo <antirez at gmail dot com>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *   * Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *   * Neither the name of Redis nor the names of its contributors may be used
+ *     to endorse or promote products derived from this software without
+ *     specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "sds.h"
+#include "dict.h"
+
+#ifndef __ZBTREE_H
+#define __ZBTREE_H
+
+/* Elements stored in every leaf: with the links and the count a leaf is
+ * just below 1024 bytes. */
+#define ZBTREE_LEAF_SLOTS 62
+/* Children of every inner node, just below 2048 bytes. */
+#define ZBTREE_INNER_SLOTS 63
+/* Nodes left with less entries than this after a deletion are merged with
+ * a sibling, or refilled from it when the two don't fit a single node. */
+#define ZBTREE_LEAF_MIN (ZBTREE_LEAF_SLOTS/4)
+#define ZBTREE_INNER_MIN (ZBTREE_INNER_SLOTS/4)
+/* Given the minimum fill of the nodes, enough for any number of elements. */
+#define ZBTREE_MAX_HEIGHT 32
+
+/* Scores and elements are stored in two arrays, so that the binary search
+ * of a score touches only the cache lines of the scores. */
+/*叶子节点，元素按分值和成员排序*/
+typedef struct zbtreeLeaf {
+    /*前后叶子节点*/
+    struct zbtreeLeaf *prev, *next;
+    /*元素个数*/
+    unsigned int count;
+    /*分值*/
+    double scores[ZBTREE_LEAF_SLOTS];
+    /*成员，与zset的dict共用*/
+    sds eles[ZBTREE_LEAF_SLOTS];
+} zbtreeLeaf;
+
+/* The separator of the child 'i' (scores[i], eles[i]) is a lower bound of
+ * the elements stored under it, and all of them are smaller than the
+ * separator of the child 'i+1'. The separator of the first child is unused
+ * (eles[0] is always NULL), and the separators are private copies of the
+ * elements, so that they can outlive them. */
+/*内部节点*/
+typedef struct zbtreeInner {
+    /*子节点个数*/
+    unsigned int count;
+    /*每个子节点下的元素个数*/
+    unsigned long sizes[ZBTREE_INNER_SLOTS];
+    /*每个子节点的分隔键*/
+    double scores[ZBTREE_INNER_SLOTS];
+    sds eles[ZBTREE_INNER_SLOTS];
+    /*子节点*/
+    void *children[ZBTREE_INNER_SLOTS];
+} zbtreeInner;
+
+/*B+树*/
+typedef struct zbtree {
+    /*根节点，高度为1时是叶子节点*/
+    void *root;
+    /*第一个和最后一个叶子节点*/
+    zbtreeLeaf *head, *tail;
+    /*元素个数*/
+    unsigned long length;
+    /*叶子节点和内部节点个数*/
+    unsigned long leaves, inners;
+    /*树的高度*/
+    int height;
+} zbtree;
+
+/* Position of an element. The leaf is NULL past the first or last one. */
+/*B+树迭代器*/
+typedef struct zbtreeIter {
+    zbtreeLeaf *leaf;
+    int idx;
+} zbtreeIter;
+
+/*迭代器当前元素的分值和成员*/
+#define zbtIterScore(it) ((it)->leaf->scores[(it)->idx])
+#define zbtIterEle(it) ((it)->leaf->eles[(it)->idx])
+
+/* API */
+/*创建B+树*/
+zbtree *zbtCreate(void);
+/*释放B+树及其所有成员*/
+void zbtFree(zbtree *zbt);
+/*插入不存在的元素，B+树获得ele的所有权*/
+void zbtInsert(zbtree *zbt, double score, sds ele);
+/*删除元素，deleted不为NULL时返回成员而不释放*/
+int zbtDelete(zbtree *zbt, double score, sds ele, sds *deleted);
+/*修改已存在元素的分值*/
+void zbtUpdateScore(zbtree *zbt, double curscore, sds ele, double newscore);
+/*取得元素的排名，从1开始，不存在返回0*/
+unsigned long zbtGetRank(zbtree *zbt, double score, sds ele);
+/*根据排名（从1开始）定位元素*/
+int zbtGetElementByRank(zbtree *zbt, unsigned long rank, zbtreeIter *it);
+/*定位第一个和最后一个元素*/
+int zbtFirst(zbtree *zbt, zbtreeIter *it);
+int zbtLast(zbtree *zbt, zbtreeIter *it);
+/*移动迭代器*/
+int zbtNext(zbtreeIter *it);
+int zbtPrev(zbtreeIter *it);
+/*删除排名在start和end之间的元素，同时从dict中删除*/
+unsigned long zbtDeleteRangeByRank(zbtree *zbt, unsigned long start, unsigned long end, dict *dict);
+/*替换碎片整理移动后的成员指针*/
+void zbtReplaceElement(zbtree *zbt, double score, sds oldele, sds newele);
+
+#ifdef REDIS_TEST
+int zbtreeTest(int argc, char *argv[]);
+#endif
+
+#endif /* __ZBTREE_H */
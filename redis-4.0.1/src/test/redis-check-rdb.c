@@ -44,6 +44,7 @@ struct {
     unsigned long keys;             /* Number of keys processed. */
     unsigned long expires;          /* Number of keys with an expire. */
     unsigned long already_expired;  /* Number of keys already expired. */
+    unsigned long chunks;           /* Number of chunks processed. */
     int doing;                      /* The state while reading the RDB. */
     int error_set;                  /* True if error is populated. */
     char error[1024];
@@ -59,6 +60,8 @@ struct {
 #define RDB_CHECK_DOING_CHECK_SUM 5
 #define RDB_CHECK_DOING_READ_LEN 6
 #define RDB_CHECK_DOING_READ_AUX 7
+#define RDB_CHECK_DOING_READ_CHUNK 8
+#define RDB_CHECK_DOING_READ_CHUNK_INDEX 9
 
 char *rdb_check_doing_string[] = {
     "start",
@@ -68,7 +71,9 @@ char *rdb_check_doing_string[] = {
     "read-object-value",
     "check-sum",
     "read-len",
-    "read-aux"
+    "read-aux",
+    "read-chunk",
+    "read-chunk-index"
 };
 
 char *rdb_type_string[] = {
@@ -85,7 +90,11 @@ char *rdb_type_string[] = {
     "set-intset",
     "zset-ziplist",
     "hash-ziplist",
-    "quicklist"
+    "quicklist",
+    "hash-listpack",
+    "zset-listpack",
+    "quicklist-v2",
+    "string-bitmap"
 };
 
 /* Show a few stats collected into 'rdbstate' */
@@ -93,6 +102,8 @@ void rdbShowGenericInfo(void) {
     printf("[info] %lu keys read\n", rdbstate.keys);
     printf("[info] %lu expires\n", rdbstate.expires);
     printf("[info] %lu already expired\n", rdbstate.already_expired);
+    if (rdbstate.chunks)
+        printf("[info] %lu chunks\n", rdbstate.chunks);
 }
 
 /* Called on RDB errors. Provides details about the RDB and the offset
@@ -172,6 +183,99 @@ void rdbCheckSetupSignals(void) {
     sigaction(SIGILL, &act, NULL);
 }
 
+/* Read and check a key-value pair of the specified type, after the type and
+ * the optional expire time. Returns -1 on read errors. */
+static int rdbCheckKeyValue(rio *rdb, int type, long long expiretime,
+                            long long now)
+{
+    robj *key, *val;
+
+    rdbstate.key_type = type;
+
+    /* Read key */
+    rdbstate.doing = RDB_CHECK_DOING_READ_KEY;
+    if ((key = rdbLoadStringObject(rdb)) == NULL) return -1;
+    rdbstate.key = key;
+    rdbstate.keys++;
+    /* Read value */
+    rdbstate.doing = RDB_CHECK_DOING_READ_OBJECT_VALUE;
+    if ((val = rdbLoadObject(type,rdb)) == NULL) return -1;
+    /* Check if the key already expired. This function is used when loading
+     * an RDB file from disk, either at startup, or when an RDB was
+     * received from the master. In the latter case, the master is
+     * responsible for key expiry. If we would expire keys here, the
+     * snapshot taken by the master may not be reflected on the slave. */
+    if (server.masterhost == NULL && expiretime != -1 && expiretime < now)
+        rdbstate.already_expired++;
+    if (expiretime != -1) rdbstate.expires++;
+    rdbstate.key = NULL;
+    decrRefCount(key);
+    decrRefCount(val);
+    rdbstate.key_type = -1;
+    return 0;
+}
+
+/* Read and check a chunk, after its opcode, adding it to 'idx'. The payload
+ * is decompressed first if 'compressed' is true. Returns -1 on read errors, 1
+ * if the chunk is corrupted, otherwise 0. */
+static int rdbCheckChunk(rio *rdb, rdbChunkIndex *idx, int compressed,
+                         long long now)
+{
+    rdbChunkInfo ci;
+    sds payload = sdsempty();
+    uint64_t crc, j;
+    int retval = -1;
+    rio r;
+
+    rdbstate.doing = RDB_CHECK_DOING_READ_CHUNK;
+    if (rdbLoadChunk(rdb,&ci,&payload,&crc) == -1) goto end;
+    rdbChunkIndexAdd(idx,&ci);
+    rdbstate.chunks++;
+    if (!rdbVerifyChunk(payload,crc)) {
+        rdbCheckError("Chunk CRC error");
+        retval = 1;
+        goto end;
+    }
+    if (compressed && rdbDecompressChunk(&payload) == -1) {
+        rdbCheckError("Invalid zstd compressed chunk");
+        retval = 1;
+        goto end;
+    }
+
+    /* The payload is made of 'keys' key-value pairs, with optional expire
+     * times. */
+    rioInitWithBuffer(&r,payload);
+    for (j = 0; j < ci.keys; j++) {
+        long long expiretime = -1;
+        int type;
+
+        rdbstate.doing = RDB_CHECK_DOING_READ_TYPE;
+        if ((type = rdbLoadType(&r)) == -1) goto end;
+        if (type == RDB_OPCODE_EXPIRETIME_MS) {
+            rdbstate.doing = RDB_CHECK_DOING_READ_EXPIRE;
+            if ((expiretime = rdbLoadMillisecondTime(&r)) == -1) goto end;
+            rdbstate.doing = RDB_CHECK_DOING_READ_TYPE;
+            if ((type = rdbLoadType(&r)) == -1) goto end;
+        }
+        if (!rdbIsObjectType(type)) {
+            rdbCheckError("Invalid object type in chunk: %d", type);
+            retval = 1;
+            goto end;
+        }
+        if (rdbCheckKeyValue(&r,type,expiretime,now) == -1) goto end;
+    }
+    if ((size_t)r.io.buffer.pos != sdslen(payload)) {
+        rdbCheckError("Chunk payload longer than its keys");
+        retval = 1;
+        goto end;
+    }
+    retval = 0;
+
+end:
+    sdsfree(payload);
+    return retval;
+}
+
 /* Check the specified RDB file. Return 0 if the RDB looks sane, otherwise
  * 1 is returned.
  * The file is specified as a filename in 'rdbfilename' if 'fp' is not NULL,
@@ -182,6 +286,7 @@ int redis_check_rdb(char *rdbfilename, FILE *fp) {
     char buf[1024];
     long long expiretime, now = mstime();
     static rio rdb; /* Pointed by global struct riostate. */
+    rdbChunkIndex idx = {NULL,0,0};
 
     int closefile = (fp == NULL);
     if (fp == NULL && (fp = fopen(rdbfilename,"r")) == NULL) return 1;
@@ -196,14 +301,13 @@ int redis_check_rdb(char *rdbfilename, FILE *fp) {
         return 1;
     }
     rdbver = atoi(buf+5);
-    if (rdbver < 1 || rdbver > RDB_VERSION) {
+    if (rdbver < 1 || rdbver > RDB_VERSION_CHUNKED) {
         rdbCheckError("Can't handle RDB format version %d",rdbver);
         return 1;
     }
 
     startLoading(fp);
     while(1) {
-        robj *key, *val;
         expiretime = -1;
 
         /* Read type. */
@@ -234,6 +338,27 @@ int redis_check_rdb(char *rdbfilename, FILE *fp) {
         } else if (type == RDB_OPCODE_EOF) {
             /* EOF: End of file, exit the main loop. */
             break;
+        } else if (type == RDB_OPCODE_CHUNK ||
+                   type == RDB_OPCODE_CHUNK_ZSTD)
+        {
+            /* CHUNK: a checksummed group of keys of a DB. */
+            int retval = rdbCheckChunk(&rdb,&idx,
+                                       type == RDB_OPCODE_CHUNK_ZSTD,now);
+            if (retval == -1) goto eoferr;
+            if (retval == 1) return 1;
+            continue; /* Read type again. */
+        } else if (type == RDB_OPCODE_CHUNK_INDEX) {
+            /* CHUNK_INDEX: must match the chunks read so far. */
+            int retval;
+            rdbstate.doing = RDB_CHECK_DOING_READ_CHUNK_INDEX;
+            if ((retval = rdbLoadChunkIndex(&rdb,&idx)) == -1) goto eoferr;
+            if (retval == 0) {
+                rdbCheckError("The chunk index doesn't match the chunks");
+                return 1;
+            }
+            rdbCheckInfo("Chunk index OK, %llu chunks",
+                (unsigned long long)idx.count);
+            continue; /* Read type again. */
         } else if (type == RDB_OPCODE_SELECTDB) {
             /* SELECTDB: Select the specified database. */
             rdbstate.doing = RDB_CHECK_DOING_READ_LEN;
@@ -272,30 +397,11 @@ int redis_check_rdb(char *rdbfilename, FILE *fp) {
                 rdbCheckError("Invalid object type: %d", type);
                 return 1;
             }
-            rdbstate.key_type = type;
         }
 
-        /* Read key */
-        rdbstate.doing = RDB_CHECK_DOING_READ_KEY;
-        if ((key = rdbLoadStringObject(&rdb)) == NULL) goto eoferr;
-        rdbstate.key = key;
-        rdbstate.keys++;
-        /* Read value */
-        rdbstate.doing = RDB_CHECK_DOING_READ_OBJECT_VALUE;
-        if ((val = rdbLoadObject(type,&rdb)) == NULL) goto eoferr;
-        /* Check if the key already expired. This function is used when loading
-         * an RDB file from disk, either at startup, or when an RDB was
-         * received from the master. In the latter case, the master is
-         * responsible for key expiry. If we would expire keys here, the
-         * snapshot taken by the master may not be reflected on the slave. */
-        if (server.masterhost == NULL && expiretime != -1 && expiretime < now)
-            rdbstate.already_expired++;
-        if (expiretime != -1) rdbstate.expires++;
-        rdbstate.key = NULL;
-        decrRefCount(key);
-        decrRefCount(val);
-        rdbstate.key_type = -1;
+        if (rdbCheckKeyValue(&rdb,type,expiretime,now) == -1) goto eoferr;
     }
+    rdbChunkIndexFree(&idx);
     /* Verify the checksum if RDB version is >= 5 */
     if (rdbver >= 5 && server.rdb_checksum) {
         uint64_t cksum, expected = rdb.cksum;
@@ -470,22 +470,57 @@ int getBitfieldTypeFromArgument(client *c, robj *o, int *sign, int *bits) {
     return C_OK;
 }
 
+/* Strings written by the bit commands that grow past the
+ * bitmap-raw-max-bytes limit are encoded as compressed bitmaps, so that
+ * only the chunks of the string with bits set take memory. All the bit
+ * commands work on the compressed bitmap directly, while the commands that
+ * need the whole string convert it back to a plain string, see
+ * getGenericCommand() and dbUnshareStringValue(). */
+static int bitmapShouldCompress(size_t len) {
+    return server.bitmap_raw_max_bytes && len > server.bitmap_raw_max_bytes &&
+           len <= ROARING_MAX_BYTES;
+}
+
 /* This is an helper function for commands implementations that need to write
  * bits to a string object. The command creates or pad with zeroes the string
  * so that the 'maxbit' bit can be addressed. The object is finally
  * returned. Otherwise if the key holds a wrong type NULL is returned and
- * an error is sent to the client. */
+ * an error is sent to the client.
+ *
+ * The returned object may be encoded as a compressed bitmap: this happens
+ * when a string is created or grown past the bitmap-raw-max-bytes limit. */
 robj *lookupStringForBitCommand(client *c, size_t maxbit) {
     size_t byte = maxbit >> 3;
     robj *o = lookupKeyWrite(c->db,c->argv[1]);
 
     if (o == NULL) {
-        o = createObject(OBJ_STRING,sdsnewlen(NULL, byte+1));
+        if (bitmapShouldCompress(byte+1))
+            o = createBitmapObject(byte+1);
+        else
+            o = createObject(OBJ_STRING,sdsnewlen(NULL, byte+1));
         dbAdd(c->db,c->argv[1],o);
     } else {
         if (checkType(c,o,OBJ_STRING)) return NULL;
-        o = dbUnshareStringValue(c->db,c->argv[1],o);
-        o->ptr = sdsgrowzero(o->ptr,byte+1);
+        if (o->encoding == OBJ_ENCODING_BITMAP) {
+            if (o->refcount != 1) {
+                o = dupStringObject(o);
+                dbOverwrite(c->db,c->argv[1],o);
+            }
+            roaringGrow(o->ptr,byte+1);
+        } else if (byte >= stringObjectLen(o) && bitmapShouldCompress(byte+1)) {
+            /* The string has to grow anyway: compress it instead. */
+            robj *decoded = getDecodedObject(o);
+
+            o = createObject(OBJ_STRING,
+                roaringFromString(decoded->ptr,sdslen(decoded->ptr)));
+            o->encoding = OBJ_ENCODING_BITMAP;
+            roaringGrow(o->ptr,byte+1);
+            decrRefCount(decoded);
+            dbOverwrite(c->db,c->argv[1],o);
+        } else {
+            o = dbUnshareStringValue(c->db,c->argv[1],o);
+            o->ptr = sdsgrowzero(o->ptr,byte+1);
+        }
     }
     return o;
 }
@@ -502,7 +537,8 @@ robj *lookupStringForBitCommand(client *c, size_t maxbit) {
  * the length of such buffer.
  *
  * If the source object is NULL the function is guaranteed to return NULL
- * and set 'len' to 0. */
+ * and set 'len' to 0. Compressed bitmaps have no array of bytes, so NULL is
+ * returned as well, but 'len' is set to the length of the string. */
 unsigned char *getObjectReadOnlyString(robj *o, long *len, char *llbuf) {
     serverAssert(o->type == OBJ_STRING);
     unsigned char *p = NULL;
@@ -512,6 +548,8 @@ unsigned char *getObjectReadOnlyString(robj *o, long *len, char *llbuf) {
     if (o && o->encoding == OBJ_ENCODING_INT) {
         p = (unsigned char*) llbuf;
         if (len) *len = ll2string(llbuf,LONG_STR_SIZE,(long)o->ptr);
+    } else if (o && o->encoding == OBJ_ENCODING_BITMAP) {
+        if (len) *len = roaringLen(o->ptr);
     } else if (o) {
         p = (unsigned char*) o->ptr;
         if (len) *len = sdslen(o->ptr);
@@ -544,16 +582,20 @@ void setbitCommand(client *c) {
 
     if ((o = lookupStringForBitCommand(c,bitoffset)) == NULL) return;
 
-    /* Get current values */
-    byte = bitoffset >> 3;
-    byteval = ((uint8_t*)o->ptr)[byte];
-    bit = 7 - (bitoffset & 0x7);
-    bitval = byteval & (1 << bit);
+    if (o->encoding == OBJ_ENCODING_BITMAP) {
+        bitval = roaringSetBit(o->ptr,bitoffset,on);
+    } else {
+        /* Get current values */
+        byte = bitoffset >> 3;
+        byteval = ((uint8_t*)o->ptr)[byte];
+        bit = 7 - (bitoffset & 0x7);
+        bitval = byteval & (1 << bit);
 
-    /* Update byte with new bit value and return original value */
-    byteval &= ~(1 << bit);
-    byteval |= ((on & 0x1) << bit);
-    ((uint8_t*)o->ptr)[byte] = byteval;
+        /* Update byte with new bit value and return original value */
+        byteval &= ~(1 << bit);
+        byteval |= ((on & 0x1) << bit);
+        ((uint8_t*)o->ptr)[byte] = byteval;
+    }
     signalModifiedKey(c->db,c->argv[1]);
     notifyKeyspaceEvent(NOTIFY_STRING,"setbit",c->argv[1],c->db->id);
     server.dirty++;
@@ -579,6 +621,8 @@ void getbitCommand(client *c) {
     if (sdsEncodedObject(o)) {
         if (byte < sdslen(o->ptr))
             bitval = ((uint8_t*)o->ptr)[byte] & (1 << bit);
+    } else if (o->encoding == OBJ_ENCODING_BITMAP) {
+        bitval = roaringGetBit(o->ptr,bitoffset);
     } else {
         if (byte < (size_t)ll2string(llbuf,sizeof(llbuf),(long)o->ptr))
             bitval = llbuf[byte] & (1 << bit);
@@ -587,6 +631,91 @@ void getbitCommand(client *c) {
     addReply(c, bitval ? shared.cone : shared.czero);
 }
 
+/* Copy the chunk 'key' of the string object 'o', that is either a compressed
+ * bitmap or a plain string, to 'buf'. If the chunk is known to be all zero
+ * 0 is returned and 'buf' is left untouched. */
+static int bitopGetChunk(robj *o, uint32_t key, unsigned char *buf) {
+    uint64_t start = (uint64_t)key*ROARING_CHUNK_BYTES;
+    size_t len;
+
+    if (o == NULL) return 0;
+    if (o->encoding == OBJ_ENCODING_BITMAP)
+        return roaringGetChunk(o->ptr,key,buf);
+    len = sdslen(o->ptr);
+    if (start >= len) return 0;
+    len -= start;
+    if (len > ROARING_CHUNK_BYTES) len = ROARING_CHUNK_BYTES;
+    memcpy(buf,(char*)o->ptr+start,len);
+    memset(buf+len,0,ROARING_CHUNK_BYTES-len);
+    return 1;
+}
+
+/* BITOP where at least one of the sources is a compressed bitmap. The
+ * operation is performed one chunk at a time, skipping the chunks where the
+ * result is known to be all zero, so that the sources are never decoded as
+ * a whole. The result is a compressed bitmap of 'maxlen' bytes, unless it is
+ * small enough to be a plain string. */
+static robj *bitopCompressed(int op, robj **objects, unsigned long numkeys,
+                             unsigned long maxlen)
+{
+    unsigned char *res = zmalloc(ROARING_CHUNK_BYTES);
+    unsigned char *buf = zmalloc(ROARING_CHUNK_BYTES);
+    uint32_t key, chunks = (maxlen+ROARING_CHUNK_BYTES-1)/ROARING_CHUNK_BYTES;
+    roaring *r = roaringNew(maxlen);
+    unsigned long j, i;
+    int found;
+    robj *o;
+
+    for (key = 0; key < chunks; key++) {
+        found = bitopGetChunk(objects[0],key,res);
+        if (op == BITOP_NOT) {
+            uint64_t tail = maxlen-(uint64_t)key*ROARING_CHUNK_BYTES;
+
+            if (!found) memset(res,0,ROARING_CHUNK_BYTES);
+            for (i = 0; i < ROARING_CHUNK_BYTES; i++) res[i] = ~res[i];
+            /* The string ends inside the last chunk. */
+            if (tail < ROARING_CHUNK_BYTES)
+                memset(res+tail,0,ROARING_CHUNK_BYTES-tail);
+            roaringSetChunk(r,key,res);
+            continue;
+        }
+        if (!found) {
+            if (op == BITOP_AND) continue;
+            memset(res,0,ROARING_CHUNK_BYTES);
+        }
+        for (j = 1; j < numkeys; j++) {
+            if (!bitopGetChunk(objects[j],key,buf)) {
+                if (op == BITOP_AND) break;
+                continue;
+            }
+            found = 1;
+            if (op == BITOP_AND) {
+                for (i = 0; i < ROARING_CHUNK_BYTES; i++) res[i] &= buf[i];
+            } else if (op == BITOP_OR) {
+                for (i = 0; i < ROARING_CHUNK_BYTES; i++) res[i] |= buf[i];
+            } else {
+                for (i = 0; i < ROARING_CHUNK_BYTES; i++) res[i] ^= buf[i];
+            }
+        }
+        if (op == BITOP_AND && j != numkeys) continue;
+        if (found) roaringSetChunk(r,key,res);
+    }
+    zfree(res);
+    zfree(buf);
+
+    if (bitmapShouldCompress(maxlen)) {
+        o = createObject(OBJ_STRING,r);
+        o->encoding = OBJ_ENCODING_BITMAP;
+    } else {
+        sds s = sdsnewlen(NULL,maxlen);
+
+        roaringGetRange(r,0,(unsigned char*)s,maxlen);
+        roaringFree(r);
+        o = createObject(OBJ_STRING,s);
+    }
+    return o;
+}
+
 /* BITOP op_name target_key src_key1 src_key2 src_key3 ... src_keyN */
 void bitopCommand(client *c) {
     char *opname = c->argv[1]->ptr;
@@ -598,6 +727,7 @@ void bitopCommand(client *c) {
                                        and max len. */
     unsigned long minlen = 0;    /* Min len among the input keys. */
     unsigned char *res = NULL; /* Resulting string. */
+    int compressed = 0;        /* True if a source is a compressed bitmap. */
 
     /* Parse the operation name. */
     if ((opname[0] == 'a' || opname[0] == 'A') && !strcasecmp(opname,"and"))
@@ -646,15 +776,37 @@ void bitopCommand(client *c) {
             zfree(objects);
             return;
         }
-        objects[j] = getDecodedObject(o);
-        src[j] = objects[j]->ptr;
-        len[j] = sdslen(objects[j]->ptr);
+        if (o->encoding == OBJ_ENCODING_BITMAP) {
+            incrRefCount(o);
+            objects[j] = o;
+            src[j] = NULL;
+            len[j] = roaringLen(o->ptr);
+            compressed = 1;
+        } else {
+            objects[j] = getDecodedObject(o);
+            src[j] = objects[j]->ptr;
+            len[j] = sdslen(objects[j]->ptr);
+        }
         if (len[j] > maxlen) maxlen = len[j];
         if (j == 0 || len[j] < minlen) minlen = len[j];
     }
 
     /* Compute the bit operation, if at least one string is not empty. */
-    if (maxlen) {
+    if (maxlen && compressed && maxlen <= ROARING_MAX_BYTES) {
+        o = bitopCompressed(op,objects,numkeys,maxlen);
+    } else if (maxlen) {
+        /* Plain strings longer than the longest bitmap are possible when
+         * proto-max-bulk-len is raised: decode the bitmaps in this case. */
+        for (j = 0; compressed && j < numkeys; j++) {
+            if (objects[j] && objects[j]->encoding == OBJ_ENCODING_BITMAP) {
+                robj *decoded = getDecodedObject(objects[j]);
+
+                decrRefCount(objects[j]);
+                objects[j] = decoded;
+                src[j] = decoded->ptr;
+            }
+        }
+
         res = (unsigned char*) sdsnewlen(NULL,maxlen);
         unsigned char output, byte;
         unsigned long i;
@@ -742,6 +894,7 @@ void bitopCommand(client *c) {
             }
             res[j] = output;
         }
+        o = createObject(OBJ_STRING,res);
     }
     for (j = 0; j < numkeys; j++) {
         if (objects[j])
@@ -753,7 +906,6 @@ void bitopCommand(client *c) {
 
     /* Store the computed value into the target key */
     if (maxlen) {
-        o = createObject(OBJ_STRING,res);
         setKey(c->db,targetkey,o);
         notifyKeyspaceEvent(NOTIFY_STRING,"set",targetkey,c->db->id);
         decrRefCount(o);
@@ -807,6 +959,8 @@ void bitcountCommand(client *c) {
      * zero can be returned is: start > end. */
     if (start > end) {
         addReply(c,shared.czero);
+    } else if (o->encoding == OBJ_ENCODING_BITMAP) {
+        addReplyLongLong(c,roaringCount(o->ptr,start,end));
     } else {
         long bytes = end-start+1;
 
@@ -872,6 +1026,13 @@ void bitposCommand(client *c) {
      * not contain a 0 nor a 1. */
     if (start > end) {
         addReplyLongLong(c, -1);
+    } else if (o->encoding == OBJ_ENCODING_BITMAP) {
+        long long pos = roaringBitpos(o->ptr,bit,start,end);
+
+        /* Like below, clear bits are found on the right of the string
+         * when no explicit end is given. */
+        if (pos == -1 && bit == 0 && !end_given) pos = (long long)(end+1)*8;
+        addReplyLongLong(c,pos);
     } else {
         long bytes = end-start+1;
         long pos = redisBitpos(p+start,bytes,bit);
@@ -1015,6 +1176,16 @@ void bitfieldCommand(client *c) {
             /* SET and INCRBY: We handle both with the same code path
              * for simplicity. SET return value is the previous value so
              * we need fetch & store as well. */
+            unsigned char *p = o->ptr, window[9];
+            uint64_t offset = thisop->offset;
+
+            /* Compressed bitmaps are operated on a copy of the 9 bytes
+             * containing the integer, that is written back at the end. */
+            if (o->encoding == OBJ_ENCODING_BITMAP) {
+                roaringGetRange(o->ptr,offset>>3,window,sizeof(window));
+                p = window;
+                offset &= 7;
+            }
 
             /* We need two different but very similar code paths for signed
              * and unsigned operations, since the set of functions to get/set
@@ -1023,8 +1194,7 @@ void bitfieldCommand(client *c) {
                 int64_t oldval, newval, wrapped, retval;
                 int overflow;
 
-                oldval = getSignedBitfield(o->ptr,thisop->offset,
-                        thisop->bits);
+                oldval = getSignedBitfield(p,offset,thisop->bits);
 
                 if (thisop->opcode == BITFIELDOP_INCRBY) {
                     newval = oldval + thisop->i64;
@@ -1044,8 +1214,7 @@ void bitfieldCommand(client *c) {
                  * NULL to signal the condition. */
                 if (!(overflow && thisop->owtype == BFOVERFLOW_FAIL)) {
                     addReplyLongLong(c,retval);
-                    setSignedBitfield(o->ptr,thisop->offset,
-                                      thisop->bits,newval);
+                    setSignedBitfield(p,offset,thisop->bits,newval);
                 } else {
                     addReply(c,shared.nullbulk);
                 }
@@ -1053,8 +1222,7 @@ void bitfieldCommand(client *c) {
                 uint64_t oldval, newval, wrapped, retval;
                 int overflow;
 
-                oldval = getUnsignedBitfield(o->ptr,thisop->offset,
-                        thisop->bits);
+                oldval = getUnsignedBitfield(p,offset,thisop->bits);
 
                 if (thisop->opcode == BITFIELDOP_INCRBY) {
                     newval = oldval + thisop->i64;
@@ -1073,12 +1241,13 @@ void bitfieldCommand(client *c) {
                  * NULL to signal the condition. */
                 if (!(overflow && thisop->owtype == BFOVERFLOW_FAIL)) {
                     addReplyLongLong(c,retval);
-                    setUnsignedBitfield(o->ptr,thisop->offset,
-                                        thisop->bits,newval);
+                    setUnsignedBitfield(p,offset,thisop->bits,newval);
                 } else {
                     addReply(c,shared.nullbulk);
                 }
             }
+            if (p == window)
+                roaringSetRange(o->ptr,thisop->offset>>3,window,sizeof(window));
             changes++;
         } else {
             /* GET */
@@ -1097,6 +1266,8 @@ void bitfieldCommand(client *c) {
             memset(buf,0,9);
             int i;
             size_t byte = thisop->offset >> 3;
+            if (o != NULL && o->encoding == OBJ_ENCODING_BITMAP)
+                roaringGetRange(o->ptr,byte,buf,9);
             for (i = 0; i < 9; i++) {
                 if (src == NULL || i+byte >= (size_t)strlen) break;
                 buf[i] = src[i+byte];
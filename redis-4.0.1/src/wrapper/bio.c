@@ -85,13 +85,9 @@ struct bio_job {
 
 void *bioProcessBackgroundJobs(void *arg);
 void lazyfreeFreeObjectFromBioThread(robj *o);
-void lazyfreeFreeDatabaseFromBioThread(dict *ht1, dict *ht2);
+void lazyfreeFreeDatabaseFromBioThread(hashtable *ht1, hashtable *ht2);
 void lazyfreeFreeSlotsMapFromBioThread(zskiplist *sl);
 
-/* Make sure we have enough stack to perform all the things we do in the
- * main thread. */
-#define REDIS_THREAD_STACK_SIZE (1024*1024*4)
-
 /* Initialize the background system, spawning the thread. */
 void bioInit(void) {
     pthread_attr_t attr;
@@ -187,12 +183,21 @@ void *bioProcessBackgroundJobs(void *arg) {
         if (type == BIO_CLOSE_FILE) {
             close((long)job->arg1);
         } else if (type == BIO_AOF_FSYNC) {
-            aof_fsync((long)job->arg1);
+            /* arg2 is set when the file is retired and should be closed
+             * once synced, like the incremental files of the AOF, arg3
+             * when the fsync completes an AOF group commit. */
+            int err;
+
+            if (job->arg3 && server.aof_fsync_delay)
+                usleep(server.aof_fsync_delay);
+            err = aof_fsync((long)job->arg1) == -1 ? errno : 0;
+            if (job->arg2) close((long)job->arg1);
+            if (job->arg3) aofGroupCommitFsynced(err);
         } else if (type == BIO_LAZY_FREE) {
             /* What we free changes depending on what arguments are set:
              * arg1 -> free the object at pointer.
              * arg2 & arg3 -> free two dictionaries (a Redis DB).
-             * only arg3 -> free the skiplist. */
+             * only arg3 -> free the skiplist (or an expire index). */
             if (job->arg1)
                 lazyfreeFreeObjectFromBioThread(job->arg1);
             else if (job->arg2 && job->arg3)
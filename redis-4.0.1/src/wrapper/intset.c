@@ -34,6 +34,11 @@
 #include "intset.h"
 #include "zmalloc.h"
 #include "endianconv.h"
+#include "config.h"
+
+#ifdef HAVE_X86_SIMD
+#include <emmintrin.h>
+#endif
 
 /* Note that these encodings are ordered, so:
  * INTSET_ENC_INT16 < INTSET_ENC_INT32 < INTSET_ENC_INT64. */
@@ -276,11 +281,279 @@ uint32_t intsetLen(const intset *is) {
     return intrev32ifbe(is->length);
 }
 
+/* Return a copy of the intset. */
+intset *intsetDup(intset *is) {
+    size_t len = intsetBlobLen(is);
+    intset *dup = zmalloc(len);
+
+    memcpy(dup,is,len);
+    return dup;
+}
+
 /* Return intset blob size in bytes. */
 size_t intsetBlobLen(intset *is) {
     return sizeof(intset)+intrev32ifbe(is->length)*intrev32ifbe(is->encoding);
 }
 
+/* ----------------------------- Set operations ----------------------------
+ * The intersection, union and difference of two intsets are computed
+ * walking both of them in order, and the result is written directly into
+ * a new intset, in order as well.
+ *
+ * When one intset is much smaller than the other one, every element of the
+ * small one is looked up in the big one instead, starting from the
+ * position of the previous element: an exponential search finds a range
+ * containing it, a binary search narrows it down to INTSET_BLOCK elements,
+ * and the position in the block is the number of elements smaller than
+ * the one looked up, counted at once with SSE2 where available. */
+
+/* Size ratio over which the elements of the small intset are looked up in
+ * the big one, instead of walking both. */
+#define INTSET_GALLOP_RATIO 16
+/* Elements compared at once at the end of a lookup. */
+#define INTSET_BLOCK 16
+
+/* Create an empty intset with the given encoding and room for 'len'
+ * elements. */
+static intset *intsetNewEncoded(uint8_t enc, uint64_t len) {
+    intset *is = zmalloc(sizeof(intset)+len*enc);
+    is->encoding = intrev32ifbe(enc);
+    is->length = 0;
+    return is;
+}
+
+/* Set the length of an intset created by intsetNewEncoded(), releasing
+ * the room left. */
+static intset *intsetShrink(intset *is, uint32_t len) {
+    is->length = intrev32ifbe(len);
+    return intsetResize(is,len);
+}
+
+/* Copy the elements in the range [from,to) of 'src' at the position 'pos'
+ * of 'dst', converting them to the encoding of 'dst' if needed. */
+static void intsetCopyRange(intset *dst, uint32_t pos, intset *src, uint32_t from, uint32_t to) {
+    uint8_t srcenc = intrev32ifbe(src->encoding);
+    uint8_t dstenc = intrev32ifbe(dst->encoding);
+
+    if (srcenc == dstenc) {
+        memcpy(dst->contents+(size_t)pos*dstenc,
+               src->contents+(size_t)from*srcenc,(size_t)(to-from)*srcenc);
+    } else {
+        while (from < to) _intsetSet(dst,pos++,_intsetGetEncoded(src,from++,srcenc));
+    }
+}
+
+#ifdef HAVE_X86_SIMD
+/* Number of elements smaller than 'value' among the INTSET_BLOCK elements
+ * starting at 'pos', for the 16 and 32 bit encodings. */
+static uint32_t intsetCountSmallerSSE2(intset *is, uint8_t enc, uint32_t pos, int64_t value) {
+    __m128i v, lt0, lt1, lt2, lt3;
+
+    if (enc == INTSET_ENC_INT16) {
+        const __m128i *p = (const __m128i*)((int16_t*)is->contents+pos);
+
+        if (value > INT16_MAX) return INTSET_BLOCK;
+        if (value < INT16_MIN) return 0;
+        v = _mm_set1_epi16((int16_t)value);
+        lt0 = _mm_cmplt_epi16(_mm_loadu_si128(p),v);
+        lt1 = _mm_cmplt_epi16(_mm_loadu_si128(p+1),v);
+        return __builtin_popcount(
+            _mm_movemask_epi8(_mm_packs_epi16(lt0,lt1)));
+    } else {
+        const __m128i *p = (const __m128i*)((int32_t*)is->contents+pos);
+
+        if (value > INT32_MAX) return INTSET_BLOCK;
+        if (value < INT32_MIN) return 0;
+        v = _mm_set1_epi32((int32_t)value);
+        lt0 = _mm_cmplt_epi32(_mm_loadu_si128(p),v);
+        lt1 = _mm_cmplt_epi32(_mm_loadu_si128(p+1),v);
+        lt2 = _mm_cmplt_epi32(_mm_loadu_si128(p+2),v);
+        lt3 = _mm_cmplt_epi32(_mm_loadu_si128(p+3),v);
+        return __builtin_popcount(_mm_movemask_epi8(_mm_packs_epi16(
+            _mm_packs_epi32(lt0,lt1),_mm_packs_epi32(lt2,lt3))));
+    }
+}
+#endif
+
+/* Return the position of the first element not smaller than 'value' among
+ * the ones in the range [lo,len) of 'is', or 'len' if there is none. The
+ * search starts with steps doubling at every element, so it's fast when
+ * the position is near 'lo'. */
+static uint32_t intsetLowerBound(intset *is, uint8_t enc, uint32_t lo, uint32_t len, int64_t value) {
+    uint64_t hi = lo, step = 1, mid;
+
+    while (hi < len && _intsetGetEncoded(is,hi,enc) < value) {
+        lo = hi+1;
+        hi += step;
+        step <<= 1;
+    }
+    if (hi > len) hi = len;
+
+    /* Here the elements before 'lo' are smaller than 'value', and the one
+     * at 'hi', if any, is not. */
+    while (hi-lo > INTSET_BLOCK) {
+        mid = lo+(hi-lo)/2;
+        if (_intsetGetEncoded(is,mid,enc) < value)
+            lo = mid+1;
+        else
+            hi = mid;
+    }
+#ifdef HAVE_X86_SIMD
+    /* The elements of the block after 'hi' are not smaller than 'value'
+     * either, so they don't change the count. */
+    if (enc != INTSET_ENC_INT64 && (uint64_t)lo+INTSET_BLOCK <= len)
+        return lo+intsetCountSmallerSSE2(is,enc,lo,value);
+#endif
+    while (lo < hi && _intsetGetEncoded(is,lo,enc) < value) lo++;
+    return lo;
+}
+
+/* Return a new intset with the elements both in 'a' and 'b'. */
+intset *intsetIntersect(intset *a, intset *b) {
+    intset *res;
+    uint8_t aenc, benc;
+    uint32_t alen, blen, i = 0, j = 0, n = 0;
+    int64_t av, bv;
+
+    /* Make 'a' the smallest one. */
+    if (intrev32ifbe(a->length) > intrev32ifbe(b->length)) {
+        res = a;
+        a = b;
+        b = res;
+    }
+    aenc = intrev32ifbe(a->encoding);
+    benc = intrev32ifbe(b->encoding);
+    alen = intrev32ifbe(a->length);
+    blen = intrev32ifbe(b->length);
+    /* Every element of the result fits in both the encodings. */
+    res = intsetNewEncoded(aenc < benc ? aenc : benc,alen);
+
+    if ((uint64_t)alen*INTSET_GALLOP_RATIO < blen) {
+        for (i = 0; i < alen && j < blen; i++) {
+            av = _intsetGetEncoded(a,i,aenc);
+            j = intsetLowerBound(b,benc,j,blen,av);
+            if (j < blen && _intsetGetEncoded(b,j,benc) == av) {
+                _intsetSet(res,n++,av);
+                j++;
+            }
+        }
+    } else {
+        while (i < alen && j < blen) {
+            av = _intsetGetEncoded(a,i,aenc);
+            bv = _intsetGetEncoded(b,j,benc);
+            if (av < bv) {
+                i++;
+            } else if (av > bv) {
+                j++;
+            } else {
+                _intsetSet(res,n++,av);
+                i++;
+                j++;
+            }
+        }
+    }
+    return intsetShrink(res,n);
+}
+
+/* Return a new intset with the elements in 'a', 'b' or both. */
+intset *intsetUnion(intset *a, intset *b) {
+    intset *res;
+    uint8_t aenc, benc;
+    uint32_t alen, blen, i = 0, j = 0, n = 0, pos;
+    int64_t av, bv;
+
+    /* Make 'a' the biggest one. */
+    if (intrev32ifbe(a->length) < intrev32ifbe(b->length)) {
+        res = a;
+        a = b;
+        b = res;
+    }
+    aenc = intrev32ifbe(a->encoding);
+    benc = intrev32ifbe(b->encoding);
+    alen = intrev32ifbe(a->length);
+    blen = intrev32ifbe(b->length);
+    res = intsetNewEncoded(aenc > benc ? aenc : benc,(uint64_t)alen+blen);
+
+    if ((uint64_t)blen*INTSET_GALLOP_RATIO < alen) {
+        /* Copy the elements of 'a' up to the position of every element of
+         * 'b', adding the latter if it's not in 'a'. */
+        for (j = 0; j < blen; j++) {
+            bv = _intsetGetEncoded(b,j,benc);
+            pos = intsetLowerBound(a,aenc,i,alen,bv);
+            intsetCopyRange(res,n,a,i,pos);
+            n += pos-i;
+            i = pos;
+            if (i < alen && _intsetGetEncoded(a,i,aenc) == bv) continue;
+            _intsetSet(res,n++,bv);
+        }
+    } else {
+        while (i < alen && j < blen) {
+            av = _intsetGetEncoded(a,i,aenc);
+            bv = _intsetGetEncoded(b,j,benc);
+            if (av <= bv) {
+                _intsetSet(res,n++,av);
+                i++;
+                if (av == bv) j++;
+            } else {
+                _intsetSet(res,n++,bv);
+                j++;
+            }
+        }
+        intsetCopyRange(res,n,b,j,blen);
+        n += blen-j;
+    }
+    intsetCopyRange(res,n,a,i,alen);
+    n += alen-i;
+    return intsetShrink(res,n);
+}
+
+/* Return a new intset with the elements in 'a' but not in 'b'. */
+intset *intsetDiff(intset *a, intset *b) {
+    intset *res;
+    uint8_t aenc = intrev32ifbe(a->encoding), benc = intrev32ifbe(b->encoding);
+    uint32_t alen = intrev32ifbe(a->length), blen = intrev32ifbe(b->length);
+    uint32_t i = 0, j = 0, n = 0, pos;
+    int64_t av, bv;
+
+    res = intsetNewEncoded(aenc,alen);
+    if ((uint64_t)alen*INTSET_GALLOP_RATIO < blen) {
+        /* Look up every element of 'a' in 'b'. */
+        for (i = 0; i < alen; i++) {
+            av = _intsetGetEncoded(a,i,aenc);
+            j = intsetLowerBound(b,benc,j,blen,av);
+            if (j < blen && _intsetGetEncoded(b,j,benc) == av) continue;
+            _intsetSet(res,n++,av);
+        }
+        return intsetShrink(res,n);
+    } else if ((uint64_t)blen*INTSET_GALLOP_RATIO < alen) {
+        /* Look up every element of 'b' in 'a', copying what is between
+         * them. */
+        for (j = 0; j < blen; j++) {
+            bv = _intsetGetEncoded(b,j,benc);
+            pos = intsetLowerBound(a,aenc,i,alen,bv);
+            intsetCopyRange(res,n,a,i,pos);
+            n += pos-i;
+            i = pos;
+            if (i < alen && _intsetGetEncoded(a,i,aenc) == bv) i++;
+        }
+    } else {
+        while (i < alen && j < blen) {
+            av = _intsetGetEncoded(a,i,aenc);
+            bv = _intsetGetEncoded(b,j,benc);
+            if (av < bv) {
+                _intsetSet(res,n++,av);
+                i++;
+            } else {
+                if (av == bv) i++;
+                j++;
+            }
+        }
+    }
+    intsetCopyRange(res,n,a,i,alen);
+    n += alen-i;
+    return intsetShrink(res,n);
+}
+
 #ifdef REDIS_TEST
 #include <sys/time.h>
 #include <time.h>
@@ -471,6 +744,113 @@ int intsetTest(int argc, char **argv) {
                num,size,usec()-start);
     }
 
+    printf("Set operations: "); {
+        int sizes[][2] = {{0,100},{100,0},{10,10},{10,5000},{5000,10},
+                          {1000,1000},{300,20000}};
+        int64_t extra[] = {0,70000,1LL<<40};
+        int j, k, ea, eb;
+        uint32_t count;
+        int64_t v = 0;
+        intset *a, *b, *res;
+
+        for (j = 0; j < (int)(sizeof(sizes)/sizeof(sizes[0])); j++) {
+            for (ea = 0; ea < 3; ea++) {
+                for (eb = 0; eb < 3; eb++) {
+                    /* Values overlapping in a small range, plus one making
+                     * the set use a bigger encoding. */
+                    int span = (sizes[j][0]+sizes[j][1])*2+1;
+                    a = intsetNew();
+                    b = intsetNew();
+                    for (k = 0; k < sizes[j][0]; k++)
+                        a = intsetAdd(a,rand()%span-span/2,NULL);
+                    for (k = 0; k < sizes[j][1]; k++)
+                        b = intsetAdd(b,rand()%span-span/2,NULL);
+                    if (extra[ea]) a = intsetAdd(a,extra[ea],NULL);
+                    if (extra[eb]) b = intsetAdd(b,-extra[eb],NULL);
+
+                    res = intsetIntersect(a,b);
+                    for (count = 0, k = 0; k < (int)intsetLen(a); k++) {
+                        intsetGet(a,k,&v);
+                        if (intsetFind(b,v)) count++;
+                    }
+                    assert(intsetLen(res) == count);
+                    for (k = 0; k < (int)intsetLen(res); k++) {
+                        intsetGet(res,k,&v);
+                        assert(intsetFind(a,v) && intsetFind(b,v));
+                    }
+                    if (count) checkConsistency(res);
+                    zfree(res);
+
+                    res = intsetUnion(a,b);
+                    for (count = intsetLen(a), k = 0; k < (int)intsetLen(b); k++) {
+                        intsetGet(b,k,&v);
+                        if (!intsetFind(a,v)) count++;
+                    }
+                    assert(intsetLen(res) == count);
+                    for (k = 0; k < (int)intsetLen(res); k++) {
+                        intsetGet(res,k,&v);
+                        assert(intsetFind(a,v) || intsetFind(b,v));
+                    }
+                    if (count) checkConsistency(res);
+                    zfree(res);
+
+                    res = intsetDiff(a,b);
+                    for (count = 0, k = 0; k < (int)intsetLen(a); k++) {
+                        intsetGet(a,k,&v);
+                        if (!intsetFind(b,v)) count++;
+                    }
+                    assert(intsetLen(res) == count);
+                    for (k = 0; k < (int)intsetLen(res); k++) {
+                        intsetGet(res,k,&v);
+                        assert(intsetFind(a,v) && !intsetFind(b,v));
+                    }
+                    if (count) checkConsistency(res);
+                    zfree(res);
+
+                    zfree(a);
+                    zfree(b);
+                }
+            }
+        }
+        ok();
+    }
+
+    printf("Stress set operations: "); {
+        int sizes[][2] = {{512,512},{16,512},{64,20000}};
+        int j, k, num = 1000, bits = 20;
+        long long start, lookups, merge;
+        uint32_t n;
+        int64_t v = 0;
+        intset *a, *b, *res;
+
+        printf("\n");
+        for (j = 0; j < (int)(sizeof(sizes)/sizeof(sizes[0])); j++) {
+            a = createSet(bits,sizes[j][0]);
+            b = createSet(bits,sizes[j][1]);
+
+            /* Looking up every element, as SINTER used to do. */
+            start = usec();
+            for (k = 0; k < num; k++) {
+                res = intsetNew();
+                for (n = 0; n < intsetLen(a); n++) {
+                    intsetGet(a,n,&v);
+                    if (intsetFind(b,v)) res = intsetAdd(res,v,NULL);
+                }
+                zfree(res);
+            }
+            lookups = usec()-start;
+
+            start = usec();
+            for (k = 0; k < num; k++) zfree(intsetIntersect(a,b));
+            merge = usec()-start;
+            printf("  %d intersections of %d and %d elements: "
+                   "lookups %lldusec, intsetIntersect %lldusec\n",
+                   num,sizes[j][0],sizes[j][1],lookups,merge);
+            zfree(a);
+            zfree(b);
+        }
+    }
+
     printf("Stress add+delete: "); {
         int i, v1, v2;
         is = intsetNew();
@@ -173,6 +173,10 @@ robj *dupStringObject(const robj *o) {
         d->encoding = OBJ_ENCODING_INT;
         d->ptr = o->ptr;
         return d;
+    case OBJ_ENCODING_BITMAP:
+        d = createObject(OBJ_STRING, roaringDup(o->ptr));
+        d->encoding = OBJ_ENCODING_BITMAP;
+        return d;
     default:
         serverPanic("Wrong encoding.");
         break;
@@ -186,16 +190,9 @@ robj *createQuicklistObject(void) {
     return o;
 }
 
-robj *createZiplistObject(void) {
-    unsigned char *zl = ziplistNew();
-    robj *o = createObject(OBJ_LIST,zl);
-    o->encoding = OBJ_ENCODING_ZIPLIST;
-    return o;
-}
-
 robj *createSetObject(void) {
-    dict *d = dictCreate(&setDictType,NULL);
-    robj *o = createObject(OBJ_SET,d);
+    hashtable *h = hashtableCreate(&setDictType,NULL);
+    robj *o = createObject(OBJ_SET,h);
     o->encoding = OBJ_ENCODING_HT;
     return o;
 }
@@ -207,10 +204,18 @@ robj *createIntsetObject(void) {
     return o;
 }
 
+/* Create a string object of 'len' bytes, all zero, encoded as a compressed
+ * bitmap. Only the bit commands create them, see bitops.c. */
+robj *createBitmapObject(uint64_t len) {
+    robj *o = createObject(OBJ_STRING,roaringNew(len));
+    o->encoding = OBJ_ENCODING_BITMAP;
+    return o;
+}
+
 robj *createHashObject(void) {
-    unsigned char *zl = ziplistNew();
-    robj *o = createObject(OBJ_HASH, zl);
-    o->encoding = OBJ_ENCODING_ZIPLIST;
+    unsigned char *lp = lpSetFingerprints(lpNew(),server.listpack_fingerprints);
+    robj *o = createObject(OBJ_HASH, lp);
+    o->encoding = OBJ_ENCODING_LISTPACK;
     return o;
 }
 
@@ -220,15 +225,28 @@ robj *createZsetObject(void) {
 
     zs->dict = dictCreate(&zsetDictType,NULL);
     zs->zsl = zslCreate();
+    zs->zbt = NULL;
     o = createObject(OBJ_ZSET,zs);
     o->encoding = OBJ_ENCODING_SKIPLIST;
     return o;
 }
 
-robj *createZsetZiplistObject(void) {
-    unsigned char *zl = ziplistNew();
-    robj *o = createObject(OBJ_ZSET,zl);
-    o->encoding = OBJ_ENCODING_ZIPLIST;
+robj *createZsetBtreeObject(void) {
+    zset *zs = zmalloc(sizeof(*zs));
+    robj *o;
+
+    zs->dict = dictCreate(&zsetDictType,NULL);
+    zs->zsl = NULL;
+    zs->zbt = zbtCreate();
+    o = createObject(OBJ_ZSET,zs);
+    o->encoding = OBJ_ENCODING_BTREE;
+    return o;
+}
+
+robj *createZsetListpackObject(void) {
+    unsigned char *lp = lpSetFingerprints(lpNew(),server.listpack_fingerprints);
+    robj *o = createObject(OBJ_ZSET,lp);
+    o->encoding = OBJ_ENCODING_LISTPACK;
     return o;
 }
 
@@ -242,6 +260,8 @@ robj *createModuleObject(moduleType *mt, void *value) {
 void freeStringObject(robj *o) {
     if (o->encoding == OBJ_ENCODING_RAW) {
         sdsfree(o->ptr);
+    } else if (o->encoding == OBJ_ENCODING_BITMAP) {
+        roaringFree(o->ptr);
     }
 }
 
@@ -256,7 +276,7 @@ void freeListObject(robj *o) {
 void freeSetObject(robj *o) {
     switch (o->encoding) {
     case OBJ_ENCODING_HT:
-        dictRelease((dict*) o->ptr);
+        hashtableRelease((hashtable*) o->ptr);
         break;
     case OBJ_ENCODING_INTSET:
         zfree(o->ptr);
@@ -275,7 +295,13 @@ void freeZsetObject(robj *o) {
         zslFree(zs->zsl);
         zfree(zs);
         break;
-    case OBJ_ENCODING_ZIPLIST:
+    case OBJ_ENCODING_BTREE:
+        zs = o->ptr;
+        dictRelease(zs->dict);
+        zbtFree(zs->zbt);
+        zfree(zs);
+        break;
+    case OBJ_ENCODING_LISTPACK:
         zfree(o->ptr);
         break;
     default:
@@ -286,9 +312,9 @@ void freeZsetObject(robj *o) {
 void freeHashObject(robj *o) {
     switch (o->encoding) {
     case OBJ_ENCODING_HT:
-        dictRelease((dict*) o->ptr);
+        hashtableRelease((hashtable*) o->ptr);
         break;
-    case OBJ_ENCODING_ZIPLIST:
+    case OBJ_ENCODING_LISTPACK:
         zfree(o->ptr);
         break;
     default:
@@ -366,6 +392,8 @@ int isObjectRepresentableAsLongLong(robj *o, long long *llval) {
     if (o->encoding == OBJ_ENCODING_INT) {
         if (llval) *llval = (long) o->ptr;
         return C_OK;
+    } else if (o->encoding == OBJ_ENCODING_BITMAP) {
+        return C_ERR;
     } else {
         return isSdsRepresentableAsLongLong(o->ptr,llval);
     }
@@ -465,6 +493,12 @@ robj *getDecodedObject(robj *o) {
         ll2string(buf,32,(long)o->ptr);
         dec = createStringObject(buf,strlen(buf));
         return dec;
+    } else if (o->type == OBJ_STRING && o->encoding == OBJ_ENCODING_BITMAP) {
+        roaring *r = o->ptr;
+        sds s = sdsnewlen(NULL,roaringLen(r));
+
+        roaringGetRange(r,0,(unsigned char*)s,roaringLen(r));
+        return createObject(OBJ_STRING,s);
     } else {
         serverPanic("Unknown encoding type");
     }
@@ -487,6 +521,18 @@ int compareStringObjectsWithFlags(robj *a, robj *b, int flags) {
     size_t alen, blen, minlen;
 
     if (a == b) return 0;
+    if (a->encoding == OBJ_ENCODING_BITMAP ||
+        b->encoding == OBJ_ENCODING_BITMAP)
+    {
+        int cmp;
+
+        a = getDecodedObject(a);
+        b = getDecodedObject(b);
+        cmp = compareStringObjectsWithFlags(a,b,flags);
+        decrRefCount(a);
+        decrRefCount(b);
+        return cmp;
+    }
     if (sdsEncodedObject(a)) {
         astr = a->ptr;
         alen = sdslen(astr);
@@ -542,6 +588,8 @@ size_t stringObjectLen(robj *o) {
     serverAssertWithInfo(NULL,o,o->type == OBJ_STRING);
     if (sdsEncodedObject(o)) {
         return sdslen(o->ptr);
+    } else if (o->encoding == OBJ_ENCODING_BITMAP) {
+        return roaringLen(o->ptr);
     } else {
         return sdigits10((long)o->ptr);
     }
@@ -567,6 +615,12 @@ int getDoubleFromObject(const robj *o, double *target) {
                 return C_ERR;
         } else if (o->encoding == OBJ_ENCODING_INT) {
             value = (long)o->ptr;
+        } else if (o->encoding == OBJ_ENCODING_BITMAP) {
+            robj *dec = getDecodedObject((robj*)o);
+            int retval = getDoubleFromObject(dec,target);
+
+            decrRefCount(dec);
+            return retval;
         } else {
             serverPanic("Unknown string encoding");
         }
@@ -605,6 +659,12 @@ int getLongDoubleFromObject(robj *o, long double *target) {
                 return C_ERR;
         } else if (o->encoding == OBJ_ENCODING_INT) {
             value = (long)o->ptr;
+        } else if (o->encoding == OBJ_ENCODING_BITMAP) {
+            robj *dec = getDecodedObject(o);
+            int retval = getLongDoubleFromObject(dec,target);
+
+            decrRefCount(dec);
+            return retval;
         } else {
             serverPanic("Unknown string encoding");
         }
@@ -638,6 +698,9 @@ int getLongLongFromObject(robj *o, long long *target) {
             if (string2ll(o->ptr,sdslen(o->ptr),&value) == 0) return C_ERR;
         } else if (o->encoding == OBJ_ENCODING_INT) {
             value = (long)o->ptr;
+        } else if (o->encoding == OBJ_ENCODING_BITMAP) {
+            /* Bitmaps are longer than any number. */
+            return C_ERR;
         } else {
             serverPanic("Unknown string encoding");
         }
@@ -683,9 +746,12 @@ char *strEncoding(int encoding) {
     case OBJ_ENCODING_HT: return "hashtable";
     case OBJ_ENCODING_QUICKLIST: return "quicklist";
     case OBJ_ENCODING_ZIPLIST: return "ziplist";
+    case OBJ_ENCODING_LISTPACK: return "listpack";
     case OBJ_ENCODING_INTSET: return "intset";
     case OBJ_ENCODING_SKIPLIST: return "skiplist";
+    case OBJ_ENCODING_BTREE: return "btree";
     case OBJ_ENCODING_EMBSTR: return "embstr";
+    case OBJ_ENCODING_BITMAP: return "bitmap";
     default: return "unknown";
     }
 }
@@ -700,8 +766,9 @@ char *strEncoding(int encoding) {
 size_t objectComputeSize(robj *o, size_t sample_size) {
     sds ele, ele2;
     dict *d;
-    dictIterator *di;
-    struct dictEntry *de;
+    hashtable *h;
+    hashtableIterator *hi;
+    hashtableEntry *he;
     size_t asize = 0, elesize = 0, samples = 0;
 
     if (o->type == OBJ_STRING) {
@@ -711,6 +778,8 @@ size_t objectComputeSize(robj *o, size_t sample_size) {
             asize = sdsAllocSize(o->ptr)+sizeof(*o);
         } else if(o->encoding == OBJ_ENCODING_EMBSTR) {
             asize = sdslen(o->ptr)+2+sizeof(*o);
+        } else if(o->encoding == OBJ_ENCODING_BITMAP) {
+            asize = roaringAllocSize(o->ptr)+sizeof(*o);
         } else {
             serverPanic("Unknown string encoding");
         }
@@ -720,27 +789,25 @@ size_t objectComputeSize(robj *o, size_t sample_size) {
             quicklistNode *node = ql->head;
             asize = sizeof(*o)+sizeof(quicklist);
             do {
-                elesize += sizeof(quicklistNode)+ziplistBlobLen(node->zl);
+                elesize += sizeof(quicklistNode)+node->sz;
                 samples++;
             } while ((node = node->next) && samples < sample_size);
             asize += (double)elesize/samples*listTypeLength(o);
-        } else if (o->encoding == OBJ_ENCODING_ZIPLIST) {
-            asize = sizeof(*o)+ziplistBlobLen(o->ptr);
         } else {
             serverPanic("Unknown list encoding");
         }
     } else if (o->type == OBJ_SET) {
         if (o->encoding == OBJ_ENCODING_HT) {
-            d = o->ptr;
-            di = dictGetIterator(d);
-            asize = sizeof(*o)+sizeof(dict)+(sizeof(struct dictEntry*)*dictSlots(d));
-            while((de = dictNext(di)) != NULL && samples < sample_size) {
-                ele = dictGetKey(de);
-                elesize += sizeof(struct dictEntry) + sdsAllocSize(ele);
+            h = o->ptr;
+            hi = hashtableGetIterator(h);
+            asize = sizeof(*o)+hashtableMemUsage(h);
+            while((he = hashtableNext(hi)) != NULL && samples < sample_size) {
+                ele = hashtableGetKey(he);
+                elesize += sdsAllocSize(ele);
                 samples++;
             }
-            dictReleaseIterator(di);
-            if (samples) asize += (double)elesize/samples*dictSize(d);
+            hashtableReleaseIterator(hi);
+            if (samples) asize += (double)elesize/samples*hashtableSize(h);
         } else if (o->encoding == OBJ_ENCODING_INTSET) {
             intset *is = o->ptr;
             asize = sizeof(*o)+sizeof(*is)+is->encoding*is->length;
@@ -748,8 +815,8 @@ size_t objectComputeSize(robj *o, size_t sample_size) {
             serverPanic("Unknown set encoding");
         }
     } else if (o->type == OBJ_ZSET) {
-        if (o->encoding == OBJ_ENCODING_ZIPLIST) {
-            asize = sizeof(*o)+(ziplistBlobLen(o->ptr));
+        if (o->encoding == OBJ_ENCODING_LISTPACK) {
+            asize = sizeof(*o)+(lpBytes(o->ptr));
         } else if (o->encoding == OBJ_ENCODING_SKIPLIST) {
             d = ((zset*)o->ptr)->dict;
             zskiplist *zsl = ((zset*)o->ptr)->zsl;
@@ -762,25 +829,43 @@ size_t objectComputeSize(robj *o, size_t sample_size) {
                 znode = znode->level[0].forward;
             }
             if (samples) asize += (double)elesize/samples*dictSize(d);
+        } else if (o->encoding == OBJ_ENCODING_BTREE) {
+            zbtree *zbt = ((zset*)o->ptr)->zbt;
+            zbtreeIter it;
+            d = ((zset*)o->ptr)->dict;
+            asize = sizeof(*o)+sizeof(zset)+sizeof(zbtree)+
+                    (sizeof(struct dictEntry*)*dictSlots(d))+
+                    sizeof(struct dictEntry)*dictSize(d)+
+                    zbt->leaves*sizeof(zbtreeLeaf)+
+                    zbt->inners*sizeof(zbtreeInner);
+            zbtFirst(zbt,&it);
+            while(it.leaf != NULL && samples < sample_size) {
+                elesize += sdsAllocSize(zbtIterEle(&it));
+                samples++;
+                zbtNext(&it);
+            }
+            /* Every leaf but the first has a copy of an element in the
+             * inner nodes as separator. */
+            if (samples)
+                asize += (double)elesize/samples*(dictSize(d)+zbt->leaves-1);
         } else {
             serverPanic("Unknown sorted set encoding");
         }
     } else if (o->type == OBJ_HASH) {
-        if (o->encoding == OBJ_ENCODING_ZIPLIST) {
-            asize = sizeof(*o)+(ziplistBlobLen(o->ptr));
+        if (o->encoding == OBJ_ENCODING_LISTPACK) {
+            asize = sizeof(*o)+(lpBytes(o->ptr));
         } else if (o->encoding == OBJ_ENCODING_HT) {
-            d = o->ptr;
-            di = dictGetIterator(d);
-            asize = sizeof(*o)+sizeof(dict)+(sizeof(struct dictEntry*)*dictSlots(d));
-            while((de = dictNext(di)) != NULL && samples < sample_size) {
-                ele = dictGetKey(de);
-                ele2 = dictGetVal(de);
+            h = o->ptr;
+            hi = hashtableGetIterator(h);
+            asize = sizeof(*o)+hashtableMemUsage(h);
+            while((he = hashtableNext(hi)) != NULL && samples < sample_size) {
+                ele = hashtableGetKey(he);
+                ele2 = hashtableGetVal(he);
                 elesize += sdsAllocSize(ele) + sdsAllocSize(ele2);
-                elesize += sizeof(struct dictEntry);
                 samples++;
             }
-            dictReleaseIterator(di);
-            if (samples) asize += (double)elesize/samples*dictSize(d);
+            hashtableReleaseIterator(hi);
+            if (samples) asize += (double)elesize/samples*hashtableSize(h);
         } else {
             serverPanic("Unknown hash encoding");
         }
@@ -823,7 +908,9 @@ struct redisMemOverhead *getMemoryOverheadData(void) {
 
     mem = 0;
     if (server.repl_backlog)
-        mem += zmalloc_size(server.repl_backlog);
+        mem += sizeof(replBacklog) + server.repl_buffer_mem +
+               server.repl_backlog_zlen + (server.repl_backlog->buf ?
+               zmalloc_size(server.repl_backlog->buf) : 0);
     mh->repl_backlog = mem;
     mem_total += mem;
 
@@ -835,7 +922,9 @@ struct redisMemOverhead *getMemoryOverheadData(void) {
         listRewind(server.slaves,&li);
         while((ln = listNext(&li))) {
             client *c = listNodeValue(ln);
-            mem += getClientOutputBufferMemoryUsage(c);
+            /* The replication buffer is accounted with the backlog. */
+            mem += getClientOutputBufferMemoryUsage(c) -
+                   getSlaveReplicationBufferPending(c);
             mem += sdsAllocSize(c->querybuf);
             mem += sizeof(client);
         }
@@ -871,21 +960,21 @@ struct redisMemOverhead *getMemoryOverheadData(void) {
 
     for (j = 0; j < server.dbnum; j++) {
         redisDb *db = server.db+j;
-        long long keyscount = dictSize(db->dict);
+        long long keyscount = hashtableSize(db->dict);
         if (keyscount==0) continue;
 
         mh->total_keys += keyscount;
         mh->db = zrealloc(mh->db,sizeof(mh->db[0])*(mh->num_dbs+1));
         mh->db[mh->num_dbs].dbid = j;
 
-        mem = dictSize(db->dict) * sizeof(dictEntry) +
-              dictSlots(db->dict) * sizeof(dictEntry*) +
-              dictSize(db->dict) * sizeof(robj);
+        mem = hashtableMemUsage(db->dict) +
+              hashtableSize(db->dict) * sizeof(robj);
         mh->db[mh->num_dbs].overhead_ht_main = mem;
         mem_total+=mem;
 
-        mem = dictSize(db->expires) * sizeof(dictEntry) +
-              dictSlots(db->expires) * sizeof(dictEntry*);
+        /* The expires are stored along with the keys, see setExpire(). */
+        mem = hashtableMemUsage(db->expires) +
+              hashtableSize(db->expires) * sizeof(int64_t);
         mh->db[mh->num_dbs].overhead_ht_expires = mem;
         mem_total+=mem;
 
@@ -994,10 +1083,10 @@ sds getMemoryDoctorReport(void) {
 /* This is a helper function for the OBJECT command. We need to lookup keys
  * without any modification of LRU or other parameters. */
 robj *objectCommandLookup(client *c, robj *key) {
-    dictEntry *de;
+    hashtableEntry *de;
 
-    if ((de = dictFind(c->db->dict,key->ptr)) == NULL) return NULL;
-    return (robj*) dictGetVal(de);
+    if ((de = hashtableFind(c->db->dict,key->ptr)) == NULL) return NULL;
+    return (robj*) hashtableGetVal(de);
 }
 
 robj *objectCommandLookupOrReply(client *c, robj *key, robj *reply) {
@@ -1071,7 +1160,7 @@ void memoryCommand(client *c) {
                 == NULL) return;
         size_t usage = objectComputeSize(o,samples);
         usage += sdsAllocSize(c->argv[1]->ptr);
-        usage += sizeof(dictEntry);
+        usage += sizeof(hashtableEntry);
         addReplyLongLong(c,usage);
     } else if (!strcasecmp(c->argv[1]->ptr,"stats") && c->argc == 2) {
         struct redisMemOverhead *mh = getMemoryOverheadData();
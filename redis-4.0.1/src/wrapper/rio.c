@@ -94,6 +94,7 @@ static const rio rioBufferIO = {
     0,              /* current checksum */
     0,              /* bytes read or written */
     0,              /* read/write chunk size */
+    0,              /* flags */
     { { NULL, 0 } } /* union for io-specific vars */
 };
 
@@ -147,6 +148,7 @@ static const rio rioFileIO = {
     0,              /* current checksum */
     0,              /* bytes read or written */
     0,              /* read/write chunk size */
+    0,              /* flags */
     { { NULL, 0 } } /* union for io-specific vars */
 };
 
@@ -260,6 +262,7 @@ static const rio rioFdsetIO = {
     0,              /* current checksum */
     0,              /* bytes read or written */
     0,              /* read/write chunk size */
+    0,              /* flags */
     { { NULL, 0 } } /* union for io-specific vars */
 };
 
@@ -283,6 +286,118 @@ void rioFreeFdset(rio *r) {
     sdsfree(r->io.fdset.buf);
 }
 
+/* ------------------------- Socket implementation -------------------------- */
+
+/* Returns 1 or 0 for success/failure. */
+static size_t rioConnWrite(rio *r, const void *buf, size_t len) {
+    UNUSED(r);
+    UNUSED(buf);
+    UNUSED(len);
+    return 0; /* Error, this target does not support writing. */
+}
+
+/* Returns 1 or 0 for success/failure. The socket is non blocking: while
+ * waiting for data the events of the other clients are processed, so the
+ * server is not frozen if the peer is slow, but the read fails if nothing
+ * arrives for 'timeout' milliseconds. */
+static size_t rioConnRead(rio *r, void *buf, size_t len) {
+    size_t avail = sdslen(r->io.conn.buf)-r->io.conn.pos;
+    long long start = mstime();
+
+    while (avail < len) {
+        size_t toread = len-avail < PROTO_IOBUF_LEN ? PROTO_IOBUF_LEN : len-avail;
+        ssize_t nread;
+
+        /* Make room for the new data at the end of the buffer. */
+        if (r->io.conn.pos) {
+            sdsrange(r->io.conn.buf,r->io.conn.pos,-1);
+            r->io.conn.pos = 0;
+        }
+        if (r->io.conn.read_limit &&
+            r->io.conn.read_so_far+(off_t)toread > r->io.conn.read_limit)
+        {
+            toread = r->io.conn.read_limit-r->io.conn.read_so_far;
+            if (toread < len-avail) {
+                errno = EOVERFLOW;
+                r->flags |= RIO_FLAG_READ_ERROR;
+                return 0;
+            }
+        }
+        r->io.conn.buf = sdsMakeRoomFor(r->io.conn.buf,toread);
+        nread = read(r->io.conn.fd,r->io.conn.buf+avail,toread);
+        if (nread > 0) {
+            sdsIncrLen(r->io.conn.buf,nread);
+            r->io.conn.read_so_far += nread;
+            avail += nread;
+            start = mstime();
+            continue;
+        }
+        if (nread == 0) errno = ECONNRESET;
+        if (nread == 0 || errno != EAGAIN) {
+            r->flags |= RIO_FLAG_READ_ERROR;
+            return 0;
+        }
+        if (mstime()-start >= r->io.conn.timeout) {
+            errno = ETIMEDOUT;
+            r->flags |= RIO_FLAG_READ_ERROR;
+            return 0;
+        }
+        aeWait(r->io.conn.fd,AE_READABLE,100);
+        processEventsWhileBlocked();
+    }
+    memcpy(buf,r->io.conn.buf+r->io.conn.pos,len);
+    r->io.conn.pos += len;
+    return 1;
+}
+
+/* Returns the offset of the data consumed so far. */
+static off_t rioConnTell(rio *r) {
+    return r->io.conn.read_so_far-(sdslen(r->io.conn.buf)-r->io.conn.pos);
+}
+
+/* Flushes any buffer to target device if applicable. Returns 1 on success
+ * and 0 on failures. */
+static int rioConnFlush(rio *r) {
+    UNUSED(r);
+    return 1;
+}
+
+static const rio rioConnIO = {
+    rioConnRead,
+    rioConnWrite,
+    rioConnTell,
+    rioConnFlush,
+    NULL,           /* update_checksum */
+    0,              /* current checksum */
+    0,              /* bytes read or written */
+    0,              /* read/write chunk size */
+    0,              /* flags */
+    { { NULL, 0 } } /* union for io-specific vars */
+};
+
+/* Create a rio reading from the non blocking socket 'fd', that will not
+ * read more than 'read_limit' bytes from it if not zero, and will fail
+ * if no data is received for 'timeout' milliseconds. */
+void rioInitWithConn(rio *r, int fd, off_t read_limit, long long timeout) {
+    *r = rioConnIO;
+    r->io.conn.fd = fd;
+    r->io.conn.buf = sdsempty();
+    r->io.conn.pos = 0;
+    r->io.conn.read_limit = read_limit;
+    r->io.conn.read_so_far = 0;
+    r->io.conn.timeout = timeout;
+}
+
+/* Release the rio stream. The data read from the socket but not consumed
+ * is returned, so that the caller can process it. */
+sds rioFreeConn(rio *r) {
+    sds remaining = r->io.conn.buf;
+
+    sdsrange(remaining,r->io.conn.pos,-1);
+    r->io.conn.buf = NULL;
+    return remaining;
+}
+
 /* ---------------------------- Generic functions ---------------------------- */
 
 /* This function can be installed both in memory and file streams when checksum
@@ -60,6 +60,9 @@ struct _rio {
     /* maximum single read or write chunk size */
     size_t max_processing_chunk;
 
+    /* RIO_FLAG_* flags, set by the backend. */
+    int flags;
+
     /* Backend-specific vars. */
     union {
         /* In-memory buffer target. */
@@ -81,9 +84,22 @@ struct _rio {
             off_t pos;
             sds buf;
         } fdset;
+        /* Socket source (used to read the RDB sent by the master). */
+        struct {
+            int fd;             /* Non blocking socket. */
+            sds buf;            /* Data read but not consumed yet. */
+            size_t pos;         /* Position of the first unconsumed byte. */
+            off_t read_limit;   /* Don't read past this offset, 0 = no limit. */
+            off_t read_so_far;  /* Bytes read from the socket. */
+            long long timeout;  /* Max milliseconds waiting for data. */
+        } conn;
     } io;
 };
 
+/* The read failed because of the backend (connection lost, timeout), not
+ * because the data is truncated or corrupted. */
+#define RIO_FLAG_READ_ERROR (1<<0)
+
 typedef struct _rio rio;
 
 /* The following functions are our interface with the stream. They'll call the
@@ -127,8 +143,10 @@ static inline int rioFlush(rio *r) {
 void rioInitWithFile(rio *r, FILE *fp);
 void rioInitWithBuffer(rio *r, sds s);
 void rioInitWithFdset(rio *r, int *fds, int numfds);
+void rioInitWithConn(rio *r, int fd, off_t read_limit, long long timeout);
 
 void rioFreeFdset(rio *r);
+sds rioFreeConn(rio *r);
 
 size_t rioWriteBulkCount(rio *r, char prefix, int count);
 size_t rioWriteBulkString(rio *r, const char *buf, size_t len);
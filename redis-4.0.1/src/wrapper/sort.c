@@ -302,8 +302,12 @@ void sortCommand(client *c) {
     }
 
     /* Destructively convert encoded sorted sets for SORT. */
-    if (sortval->type == OBJ_ZSET)
+    if (sortval->type == OBJ_ZSET && sortval->encoding == OBJ_ENCODING_LISTPACK) {
+        rdbSnapshotKeyWrite(c->db,c->argv[1]->ptr);
         zsetConvert(sortval, OBJ_ENCODING_SKIPLIST);
+    }
+    if (sortval->type == OBJ_LIST)
+        listTypeBeforeRead(c->db,c->argv[1],sortval);
 
     /* Objtain the length of the object to sort. */
     switch(sortval->type) {
@@ -402,27 +406,43 @@ void sortCommand(client *c) {
         sds sdsele;
         int rangelen = vectorlen;
 
-        /* Check if starting point is trivial, before doing log(N) lookup. */
-        if (desc) {
-            long zsetlen = dictSize(((zset*)sortval->ptr)->dict);
+        if (sortval->encoding == OBJ_ENCODING_BTREE) {
+            long zsetlen = dictSize(zs->dict);
+            zbtreeIter it;
 
-            ln = zsl->tail;
-            if (start > 0)
-                ln = zslGetElementByRank(zsl,zsetlen-start);
+            zbtGetElementByRank(zs->zbt,desc ? zsetlen-start : start+1,&it);
+            while(rangelen--) {
+                serverAssertWithInfo(c,sortval,it.leaf != NULL);
+                sdsele = zbtIterEle(&it);
+                vector[j].obj = createStringObject(sdsele,sdslen(sdsele));
+                vector[j].u.score = 0;
+                vector[j].u.cmpobj = NULL;
+                j++;
+                if (desc) zbtPrev(&it); else zbtNext(&it);
+            }
         } else {
-            ln = zsl->header->level[0].forward;
-            if (start > 0)
-                ln = zslGetElementByRank(zsl,start+1);
-        }
+            /* Check if starting point is trivial, before doing log(N) lookup. */
+            if (desc) {
+                long zsetlen = dictSize(((zset*)sortval->ptr)->dict);
 
-        while(rangelen--) {
-            serverAssertWithInfo(c,sortval,ln != NULL);
-            sdsele = ln->ele;
-            vector[j].obj = createStringObject(sdsele,sdslen(sdsele));
-            vector[j].u.score = 0;
-            vector[j].u.cmpobj = NULL;
-            j++;
-            ln = desc ? ln->backward : ln->level[0].forward;
+                ln = zsl->tail;
+                if (start > 0)
+                    ln = zslGetElementByRank(zsl,zsetlen-start);
+            } else {
+                ln = zsl->header->level[0].forward;
+                if (start > 0)
+                    ln = zslGetElementByRank(zsl,start+1);
+            }
+
+            while(rangelen--) {
+                serverAssertWithInfo(c,sortval,ln != NULL);
+                sdsele = ln->ele;
+                vector[j].obj = createStringObject(sdsele,sdslen(sdsele));
+                vector[j].u.score = 0;
+                vector[j].u.cmpobj = NULL;
+                j++;
+                ln = desc ? ln->backward : ln->level[0].forward;
+            }
         }
         /* Fix start/end: output code is not aware of this optimization. */
         end -= start;
@@ -476,6 +496,9 @@ void sortCommand(client *c) {
                      * integer-encoded (the only encoding supported) so
                      * far. We can just cast it */
                     vector[j].u.score = (long)byval->ptr;
+                } else if (byval->encoding == OBJ_ENCODING_BITMAP) {
+                    if (getDoubleFromObject(byval,&vector[j].u.score) != C_OK)
+                        int_convertion_error = 1;
                 } else {
                     serverAssertWithInfo(c,sortval,1 != 1);
                 }
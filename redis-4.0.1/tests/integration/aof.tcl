@@ -257,4 +257,256 @@ tags {"aof"} {
             r expire x -1
         }
     }
+
+    ## AOF made of a base file and incremental files listed by a manifest.
+    ## The AOF written without a manifest becomes the first base.
+    create_aof {
+        append_to_aof [formatCommand set foo hello]
+        append_to_aof [formatCommand rpush list a b c]
+    }
+
+    start_server_aof [list dir $server_path aof-use-manifest yes] {
+        set client [redis [dict get $srv host] [dict get $srv port]]
+        wait_for_condition 50 100 {
+            [catch {$client ping} e] == 0
+        } else {
+            fail "Loading DB is taking too much time."
+        }
+
+        test "AOF manifest: the AOF without manifest is loaded as the base" {
+            assert_equal hello [$client get foo]
+            assert_equal 3 [$client llen list]
+            set manifest [exec cat $aof_path.manifest]
+            assert_match {*"appendonly.aof" seq 0 type b*} $manifest
+            assert_match {*"appendonly.aof.1.incr.aof" seq 1 type i*} $manifest
+        }
+
+        test "AOF manifest: writes are appended to the incremental file" {
+            $client incr counter
+            assert_match "*incr*counter*" [exec cat $aof_path.1.incr.aof]
+        }
+
+        test "AOF manifest: rewrite replaces the base and older incremental files" {
+            $client debug populate 100000
+            $client bgrewriteaof
+            for {set j 0} {$j < 100} {incr j} {$client incr counter}
+            wait_for_condition 100 100 {
+                [string match {*aof_rewrite_in_progress:0*} [$client info persistence]]
+            } else {
+                fail "AOF rewrite not finished"
+            }
+            for {set j 0} {$j < 100} {incr j} {$client incr counter}
+
+            set manifest [exec cat $aof_path.manifest]
+            assert_match {*"appendonly.aof.1.base.aof" seq 1 type b*} $manifest
+            assert_match {*"appendonly.aof.2.incr.aof" seq 2 type i*} $manifest
+            assert_equal 2 [llength [split [string trim $manifest] "\n"]]
+            assert_equal 0 [file exists $aof_path]
+            assert_equal 0 [file exists $aof_path.1.incr.aof]
+
+            set d1 [$client debug digest]
+            $client debug loadaof
+            assert_equal $d1 [$client debug digest]
+            assert_equal 201 [$client get counter]
+        }
+    }
+
+    start_server_aof [list dir $server_path aof-use-manifest yes] {
+        test "AOF manifest: base and incremental files are loaded at startup" {
+            set client [redis [dict get $srv host] [dict get $srv port]]
+            wait_for_condition 50 100 {
+                [catch {$client ping} e] == 0
+            } else {
+                fail "Loading DB is taking too much time."
+            }
+            assert_equal 201 [$client get counter]
+            assert_equal 100003 [$client dbsize]
+        }
+    }
+
+    start_server {overrides {aof-use-manifest yes}} {
+        set dir [lindex [r config get dir] 1]
+
+        test "AOF manifest: rewrite with the AOF disabled only writes a base" {
+            r set foo bar
+            r bgrewriteaof
+            waitForBgrewriteaof r
+            set manifest [exec cat $dir/appendonly.aof.manifest]
+            assert_match {*"appendonly.aof.1.base.aof" seq 1 type b*} $manifest
+            assert_equal 1 [llength [split [string trim $manifest] "\n"]]
+        }
+
+        test "AOF manifest: writes performed while enabling the AOF are kept" {
+            r config set aof-use-rdb-preamble yes
+            r debug populate 100000
+            r config set appendonly yes
+            for {set j 0} {$j < 100} {incr j} {r incr counter}
+            waitForBgrewriteaof r
+            r incr counter
+            set manifest [exec cat $dir/appendonly.aof.manifest]
+            assert_match {*"appendonly.aof.2.base.rdb" seq 2 type b*} $manifest
+            assert_match {*"appendonly.aof.1.incr.aof" seq 1 type i*} $manifest
+            assert_equal 0 [file exists $dir/appendonly.aof.1.base.aof]
+
+            set d1 [r debug digest]
+            r debug loadaof
+            assert_equal $d1 [r debug digest]
+            assert_equal 101 [r get counter]
+        }
+    }
+
+    ## The AOF disabled and enabled again at runtime: until the rewrite
+    ## enabling it is done, the files written before it was disabled are
+    ## not followed by the new writes.
+    set reenable_path [tmpdir server.aof.reenable]
+
+    proc aof_child_pid {pid} {
+        if {[catch {exec pgrep -P $pid} children]} {return {}}
+        lindex [split $children "\n"] 0
+    }
+
+    start_server_aof [list dir $reenable_path aof-use-manifest yes aof-use-rdb-preamble yes] {
+        set client [redis [dict get $srv host] [dict get $srv port]]
+        set pid [dict get $srv pid]
+
+        test "AOF manifest: the AOF enabled again is not listed before its rewrite" {
+            $client set counter 10
+            $client config set appendonly no
+            $client set counter 100
+            $client debug populate 1000
+            $client config set rdb-key-save-delay 5000
+            $client config set appendonly yes
+            assert_equal 101 [$client incr counter]
+            set manifest [exec cat $reenable_path/appendonly.aof.manifest]
+            assert_equal {file "appendonly.aof.1.incr.aof" seq 1 type i} [string trim $manifest]
+            assert_match "*incr*counter*" [exec cat $reenable_path/temp-appendonly.aof.2.incr.aof]
+            set child [aof_child_pid $pid]
+            assert {$child ne {}}
+            exec kill -9 $pid $child
+        }
+    }
+
+    start_server_aof [list dir $reenable_path aof-use-manifest yes aof-use-rdb-preamble yes] {
+        set client [redis [dict get $srv host] [dict get $srv port]]
+        set pid [dict get $srv pid]
+        wait_for_condition 50 100 {
+            [catch {$client ping} e] == 0
+        } else {
+            fail "Loading DB is taking too much time."
+        }
+
+        test "AOF manifest: after a crash the AOF is loaded as it was when disabled" {
+            assert_equal 10 [$client get counter]
+            assert_equal 1 [$client dbsize]
+        }
+
+        test "AOF manifest: failed rewrites enabling the AOF reuse the same file" {
+            $client config set appendonly no
+            $client set counter 100
+            $client debug populate 1000
+            $client config set rdb-key-save-delay 2000
+            $client config set appendonly yes
+            $client incr counter
+            for {set j 0} {$j < 3} {incr j} {
+                set child [aof_child_pid $pid]
+                assert {$child ne {}}
+                exec kill -9 $child
+                wait_for_condition 50 100 {
+                    [aof_child_pid $pid] ni [list {} $child]
+                } else {
+                    fail "AOF rewrite not rescheduled"
+                }
+                $client incr counter
+            }
+            assert_equal 1 [llength [glob -directory $reenable_path temp-*.incr.aof]]
+            set manifest [exec cat $reenable_path/appendonly.aof.manifest]
+            assert_equal {file "appendonly.aof.1.incr.aof" seq 1 type i} [string trim $manifest]
+        }
+
+        test "AOF manifest: the rewrite enabling the AOF replaces the stale files" {
+            wait_for_condition 100 100 {
+                [string match {*aof_rewrite_in_progress:0*} [$client info persistence]]
+            } else {
+                fail "AOF rewrite not finished"
+            }
+            $client incr counter
+            set manifest [exec cat $reenable_path/appendonly.aof.manifest]
+            assert_match {*"appendonly.aof.1.base.rdb" seq 1 type b*} $manifest
+            assert_match {*"appendonly.aof.2.incr.aof" seq 2 type i*} $manifest
+            assert_equal 2 [llength [split [string trim $manifest] "\n"]]
+            assert_equal 0 [file exists $reenable_path/appendonly.aof.1.incr.aof]
+            assert_equal {} [glob -nocomplain -directory $reenable_path temp-*.incr.aof]
+
+            set d1 [$client debug digest]
+            $client debug loadaof
+            assert_equal $d1 [$client debug digest]
+            assert_equal 105 [$client get counter]
+        }
+    }
+
+    start_server {overrides {appendonly {yes} appendfsync {always} aof-group-commit {yes}}} {
+        test {AOF group commit: pipelined writes of many clients are replied} {
+            set clients {}
+            for {set i 0} {$i < 5} {incr i} {lappend clients [redis_deferring_client]}
+            for {set j 0} {$j < 500} {incr j} {
+                set i 0
+                foreach rd $clients {$rd incr counter:[incr i]; $rd incr counter}
+            }
+            foreach rd $clients {
+                for {set j 1} {$j <= 500} {incr j} {
+                    assert_equal $j [$rd read]
+                    $rd read
+                }
+                $rd close
+            }
+            assert_equal 2500 [r get counter]
+            assert {[s aof_group_commits] > 0}
+
+            set d1 [r debug digest]
+            r debug loadaof
+            assert_equal $d1 [r debug digest]
+        }
+
+        test {AOF group commit: clients served by a write are replied} {
+            set rd [redis_deferring_client]
+            $rd brpoplpush src dst 0
+            after 100
+            r lpush src foo
+            assert_equal foo [$rd read]
+            assert_equal foo [r lindex dst 0]
+            $rd close
+        }
+
+        test {AOF group commit: replies wait for the fsync} {
+            r config set aof-fsync-delay 500000
+            set commits [s aof_group_commits]
+            set start [clock milliseconds]
+            set rd [redis_deferring_client]
+            $rd set slow yes
+            # The write is applied and other clients are served, but no fsync
+            # completed yet, so its reply must still be held.
+            wait_for_condition 50 10 {
+                [r get slow] eq {yes}
+            } else {
+                fail "Write not applied"
+            }
+            assert_equal $commits [s aof_group_commits]
+            assert_equal OK [$rd read]
+            assert {[clock milliseconds]-$start >= 500}
+            assert {[s aof_group_commits] > $commits}
+            r config set aof-fsync-delay 0
+            $rd close
+        }
+
+        test {AOF group commit: replies are sent when it is disabled} {
+            set rd [redis_deferring_client]
+            for {set j 0} {$j < 100} {incr j} {$rd incr counter}
+            r config set aof-group-commit no
+            for {set j 0} {$j < 100} {incr j} {$rd incr counter}
+            for {set j 1} {$j <= 200} {incr j} {
+                assert_equal [expr {2500+$j}] [$rd read]
+            }
+            $rd close
+        }
+    }
 }
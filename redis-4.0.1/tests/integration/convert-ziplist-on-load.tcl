@@ -0,0 +1,43 @@
+# Copy RDB with ziplist encoded hash, sorted set and list nodes to server path
+set server_path [tmpdir "server.convert-ziplist-on-load"]
+
+exec cp -f tests/assets/ziplist-encodings.rdb $server_path
+start_server [list overrides [list "dir" $server_path "dbfilename" "ziplist-encodings.rdb"]] {
+  test "RDB load ziplist hash and zset: converts to listpack" {
+    r select 0
+
+    assert_encoding listpack hash
+    assert_encoding listpack zset
+    assert_equal {a 1 b 2 c 300000 d -5 e hello} [r hgetall hash]
+    assert_equal {100000 -10 a 1 b 2 c 3.5 dd 6000000000} [r zrange zset 0 -1 withscores]
+  }
+
+  test "RDB load quicklist of ziplists: converts to listpack nodes" {
+    assert_encoding quicklist list
+    assert_equal 17 [r llen list]
+    assert_equal {1 2 3 a b c 100000 6000000000 -1 -100000} [r lrange list 0 9]
+    assert_equal [string repeat x 100] [r lindex list 10]
+    assert_equal [string repeat abc 30] [r lindex list 12]
+    assert_equal {7 8 9 end} [r lrange list -4 -1]
+  }
+
+  test "RDB load ziplist encodings: values survive a save and reload" {
+    set digest [r debug digest]
+    r debug reload
+    assert_equal $digest [r debug digest]
+    assert_encoding listpack hash
+    assert_encoding listpack zset
+  }
+}
+
+exec cp -f tests/assets/ziplist-encodings.rdb $server_path
+start_server [list overrides [list "dir" $server_path "dbfilename" "ziplist-encodings.rdb" "hash-max-ziplist-entries" 1 "zset-max-ziplist-entries" 1]] {
+  test "RDB load ziplist hash and zset: converts to hash table and skiplist when the entries are exceeded" {
+    r select 0
+
+    assert_encoding hashtable hash
+    assert_encoding skiplist zset
+    assert_equal 300000 [r hget hash c]
+    assert_equal 6000000000 [r zscore zset dd]
+  }
+}
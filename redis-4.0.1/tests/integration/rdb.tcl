@@ -23,6 +23,18 @@ start_server [list overrides [list "dir" $server_path "dbfilename" "encodings.rd
 }
 }
 
+start_server [list overrides [list "dir" $server_path "dbfilename" "encodings.rdb" "rdb-load-threads" 4]] {
+  test "RDB encoding loading test with rdb-load-threads" {
+    r select 0
+    set dump [csvdump r]
+    r config set rdb-load-threads 1
+    r debug reload
+    set same [expr {$dump eq [csvdump r]}]
+    r select 0
+    list [r dbsize] $same
+  } {13 1}
+}
+
 set server_path [tmpdir "server.rdb-startup-test"]
 
 start_server [list overrides [list "dir" $server_path]] {
@@ -96,3 +108,254 @@ start_server_and_kill_it [list "dir" $server_path] {
         }
     }
 }
+
+start_server {overrides {rdb-load-threads 4}} {
+    test {Parallel RDB loading preserves the dataset} {
+        createComplexDataset r 10000
+        r debug populate 20000
+        for {set j 0} {$j < 100} {incr j} {
+            r setex expire:$j 1000 [randstring 0 500 alpha]
+        }
+        # Values bigger than a whole batch, compressed and not.
+        r set big:compressible [string repeat x 3000000]
+        r set big:random [randstring 1500000 1500000 binary]
+        set digest [r debug digest]
+        r debug reload
+        set digest_threaded [r debug digest]
+        r config set rdb-load-threads 1
+        r debug reload
+        r config set rdb-load-threads 4
+        list [expr {$digest eq $digest_threaded}] \
+             [expr {$digest eq [r debug digest]}] \
+             [expr {[r ttl expire:0] > 900}]
+    } {1 1 1}
+
+    test {Parallel RDB loading skips the keys already expired} {
+        r flushall
+        r debug set-active-expire 0
+        r psetex expired 100 a
+        r set persistent b
+        after 200
+        r debug reload
+        r debug set-active-expire 1
+        list [r dbsize] [r get persistent]
+    } {1 b}
+
+    test {Parallel RDB loading logs the throughput} {
+        string match {*RDB loaded by 4 threads*} \
+            [exec cat [srv 0 stdout]]
+    } {1}
+}
+
+start_server {overrides {rdb-chunked yes rdb-save-threads 4 rdb-load-threads 4}} {
+    test {Chunked RDB saving and loading preserves the dataset} {
+        createComplexDataset r 10000
+        r debug populate 20000
+        for {set j 0} {$j < 100} {incr j} {
+            r setex expire:$j 1000 [randstring 0 500 alpha]
+        }
+        set digest [r debug digest]
+        r debug reload
+        set digest_threaded [r debug digest]
+        r config set rdb-save-threads 1
+        r config set rdb-load-threads 1
+        r debug reload
+        r config set rdb-save-threads 4
+        r config set rdb-load-threads 4
+        list [expr {$digest eq $digest_threaded}] \
+             [expr {$digest eq [r debug digest]}] \
+             [expr {[r ttl expire:0] > 900}]
+    } {1 1 1}
+
+    test {Chunked RDB files are understood by redis-check-rdb} {
+        r bgsave
+        waitForBgsave r
+        set rdb [file join [lindex [r config get dir] 1] dump.rdb]
+        set result [exec src/redis-check-rdb $rdb]
+        list [string match {*Chunk index OK*} $result] \
+             [string match {*RDB looks OK*} $result]
+    } {1 1}
+
+    test {Chunked RDB preamble in the AOF} {
+        r config set aof-use-rdb-preamble yes
+        r config set appendonly yes
+        wait_for_condition 50 100 {
+            [s aof_rewrite_in_progress] == 0 &&
+            [s aof_rewrite_scheduled] == 0
+        } else {
+            fail "AOF rewrite not terminated"
+        }
+        set digest [r debug digest]
+        r debug loadaof
+        set digest_aof [r debug digest]
+        r config set appendonly no
+        r config set aof-use-rdb-preamble no
+        expr {$digest eq $digest_aof}
+    } {1}
+
+    test {Corrupted chunks are detected by redis-check-rdb} {
+        r flushall
+        r debug populate 20000
+        r save
+        set rdb [file join [lindex [r config get dir] 1] dump.rdb]
+        set fd [open $rdb r+]
+        fconfigure $fd -translation binary
+        seek $fd [expr {[file size $rdb]/2}]
+        set byte [read $fd 1]
+        seek $fd [expr {[file size $rdb]/2}]
+        puts -nonewline $fd [expr {$byte eq "x" ? "y" : "x"}]
+        close $fd
+        catch {exec src/redis-check-rdb $rdb} result
+        string match {*Chunk CRC error*} $result
+    } {1}
+}
+
+start_server {overrides {rdb-compression-codec zstd}} {
+    test {RDB with zstd compressed chunks preserves the dataset} {
+        createComplexDataset r 10000
+        r set big:json [string repeat {{"id":12345,"name":"redis","tags":["a","b"]},} 10000]
+        r set big:random [randstring 100000 100000 binary]
+        set digest [r debug digest]
+        r debug reload
+        set digest_zstd [r debug digest]
+        r config set rdb-load-threads 4
+        r config set rdb-chunked yes
+        r debug reload
+        r config set rdb-chunked no
+        r config set rdb-load-threads 1
+        list [expr {$digest eq $digest_zstd}] [expr {$digest eq [r debug digest]}]
+    } {1 1}
+
+    test {RDB with zstd compressed chunks is smaller than with LZF} {
+        r save
+        set rdb [file join [lindex [r config get dir] 1] dump.rdb]
+        set zstd_size [file size $rdb]
+        set result [exec src/redis-check-rdb $rdb]
+        r config set rdb-compression-codec lzf
+        r save
+        set lzf_size [file size $rdb]
+        r config set rdb-compression-codec zstd
+        list [string match {*RDB looks OK*} $result] \
+             [expr {$zstd_size < $lzf_size}]
+    } {1 1}
+}
+
+start_server {overrides {rdb-snapshot-mode thread}} {
+    test {Snapshot thread saves the dataset as it was when BGSAVE started} {
+        createComplexDataset r 5000
+        r debug populate 5000
+        set digest [r debug digest]
+        r config set rdb-key-save-delay 300
+        r bgsave
+        # Modify the dataset while the thread is saving it.
+        for {set j 0} {$j < 200} {incr j} {
+            r set key:$j changed
+            r del key:[expr {$j+1000}]
+            r append key:[expr {$j+2000}] changed
+            r expire key:[expr {$j+3000}] 1000
+            r sadd newset $j
+        }
+        waitForBgsave r
+        r config set rdb-key-save-delay 0
+        set dir [tmpdir snapshot]
+        file copy [file join [lindex [r config get dir] 1] dump.rdb] $dir
+        start_server [list overrides [list dir $dir]] {
+            set loaded [r debug digest]
+        }
+        list [expr {$loaded eq $digest}] [s rdb_last_bgsave_status] \
+             [expr {[s rdb_last_cow_size] > 0}]
+    } {1 ok 1}
+
+    test {Snapshot thread with the chunked format} {
+        r config set rdb-chunked yes
+        r config set rdb-key-save-delay 100
+        set digest [r debug digest]
+        r bgsave
+        for {set j 0} {$j < 100} {incr j} {r set key:$j chunked}
+        waitForBgsave r
+        r config set rdb-key-save-delay 0
+        r config set rdb-chunked no
+        set dir [tmpdir snapshot]
+        file copy [file join [lindex [r config get dir] 1] dump.rdb] $dir
+        set result [exec src/redis-check-rdb [file join $dir dump.rdb]]
+        start_server [list overrides [list dir $dir]] {
+            set loaded [r debug digest]
+        }
+        list [string match {*RDB looks OK*} $result] [expr {$loaded eq $digest}]
+    } {1 1}
+
+    test {Snapshot thread saves compressed lists read during the snapshot} {
+        r flushall
+        r config set list-compress-depth 1
+        r config set list-max-ziplist-size 16
+        for {set j 0} {$j < 20} {incr j} {
+            for {set i 0} {$i < 1000} {incr i} {
+                r rpush list:$j [string repeat "element:$i " 5]
+            }
+        }
+        set digest [r debug digest]
+        r config set rdb-key-save-delay 100000
+        r bgsave
+        # Reading the lists decompresses their nodes in place: they must be
+        # saved by the main thread before, like keys about to be modified.
+        for {set j 0} {$j < 20} {incr j} {
+            assert_equal 1000 [llength [r lrange list:$j 0 -1]]
+            r lindex list:$j 500
+        }
+        r config set rdb-key-save-delay 0
+        waitForBgsave r
+        r config set list-compress-depth 0
+        r config set list-max-ziplist-size -2
+        set dir [tmpdir snapshot]
+        file copy [file join [lindex [r config get dir] 1] dump.rdb] $dir
+        start_server [list overrides [list dir $dir]] {
+            set loaded [r debug digest]
+        }
+        list [s rdb_last_bgsave_status] [expr {[s rdb_last_cow_size] > 0}] \
+             [expr {$loaded eq $digest}]
+    } {ok 1 1}
+
+    test {Only one snapshot can be in progress} {
+        r config set rdb-key-save-delay 1000
+        r bgsave
+        catch {r bgsave} e
+        catch {r save} e2
+        r bgrewriteaof
+        list $e $e2 [s aof_rewrite_scheduled]
+    } {{ERR Background save already in progress} {ERR Background save already in progress} 1}
+
+    test {FLUSHALL aborts the snapshot in progress} {
+        r flushall
+        r config set rdb-key-save-delay 0
+        waitForBgsave r
+        wait_for_condition 50 100 {
+            [s aof_rewrite_in_progress] == 0 &&
+            [s aof_rewrite_scheduled] == 0
+        } else {
+            fail "AOF rewrite not terminated"
+        }
+        set dir [lindex [r config get dir] 1]
+        list [s rdb_last_bgsave_status] \
+             [llength [glob -nocomplain -directory $dir temp-snapshot-*]]
+    } {ok 0}
+
+    test {Slaves are synchronized by the snapshot thread} {
+        r debug populate 5000
+        r config set rdb-key-save-delay 200
+        start_server {} {
+            r slaveof [srv -1 host] [srv -1 port]
+            for {set j 0} {$j < 200} {incr j} {r -1 set key:$j synced:$j}
+            wait_for_condition 100 100 {
+                [s master_link_status] eq {up}
+            } else {
+                fail "Slave not synchronized"
+            }
+            wait_for_condition 50 100 {
+                [r -1 debug digest] eq [r debug digest]
+            } else {
+                fail "Different dataset on the slave"
+            }
+        }
+        r config set rdb-key-save-delay 0
+    } {OK}
+}
@@ -7,6 +7,14 @@ proc stop_bg_complex_data {handle} {
     catch {exec /bin/kill -9 $handle}
 }
 
+# Number of lines of the log of the server at 'level' matching 'pattern'.
+proc count_log_lines {level pattern} {
+    set fd [open [srv $level stdout]]
+    set count [llength [lsearch -all [split [read $fd] "\n"] $pattern]]
+    close $fd
+    return $count
+}
+
 start_server {tags {"repl"}} {
     start_server {} {
 
@@ -153,3 +161,115 @@ start_server {tags {"repl"}} {
         }
     }
 }
+
+start_server {tags {"repl"}} {
+    start_server {} {
+        start_server {} {
+            set master [srv -2 client]
+            set master_host [srv -2 host]
+            set master_port [srv -2 port]
+            set slave1 [srv -1 client]
+            set slave2 [srv 0 client]
+            $master config set repl-backlog-size 1mb
+            set script {
+                redis.replicate_commands()
+                for i=1,ARGV[1] do
+                    redis.call('set','big',string.rep('x',100000)..i)
+                end
+            }
+
+            test {Slaves send the stream from the shared replication buffer} {
+                $slave1 slaveof $master_host $master_port
+                $slave2 slaveof $master_host $master_port
+                wait_for_condition 50 100 {
+                    [s -1 master_link_status] eq {up} &&
+                    [s 0 master_link_status] eq {up}
+                } else {
+                    fail "Replication not started."
+                }
+                set payload [string repeat x 100]
+                for {set j 0} {$j < 20000} {incr j} {
+                    $master set key:$j $payload
+                }
+                wait_for_condition 50 100 {
+                    [$master debug digest] eq [$slave1 debug digest] &&
+                    [$master debug digest] eq [$slave2 debug digest]
+                } else {
+                    fail "Slaves not in sync"
+                }
+                # The stream is stored once for the backlog and both slaves.
+                assert {[s -2 repl_backlog_histlen] >= 1048576}
+                assert {[s -2 repl_buffer_mem] < 1048576+65536}
+                foreach line [split [string trim [$master client list]] "\n"] {
+                    if {[string match {*flags=S*} $line]} {
+                        assert_match {*omem=0*} $line
+                    }
+                }
+            }
+
+            test {The blocks not sent by a slow slave are kept until it catches up} {
+                set rd [redis_deferring_client -1]
+                $rd debug sleep 5
+                after 100
+                # Replicated as 1000 SET commands of 100k each.
+                $master eval $script 0 1000
+                # Only the slow slave holds the blocks beyond the backlog,
+                # what it didn't send yet is its output buffer.
+                assert {[s -2 repl_buffer_mem] > 20000000}
+                set maxomem 0
+                foreach line [split [string trim [$master client list]] "\n"] {
+                    if {[regexp {flags=S.*omem=([0-9]+)} $line - omem] &&
+                        $omem > $maxomem} {set maxomem $omem}
+                }
+                assert {$maxomem > 20000000}
+                $rd read
+                $rd close
+                wait_for_condition 100 100 {
+                    [$master debug digest] eq [$slave1 debug digest] &&
+                    [$master debug digest] eq [$slave2 debug digest]
+                } else {
+                    fail "Slaves not in sync"
+                }
+                wait_for_condition 50 100 {
+                    [s -2 repl_buffer_mem] < 1048576+200000
+                } else {
+                    fail "Replication buffer not trimmed"
+                }
+                assert_equal 2 [s -2 sync_full]
+            }
+
+            test {A slow slave is disconnected at its output buffer limit} {
+                $master config set client-output-buffer-limit "slave 4mb 0 0"
+                set pattern {*closed ASAP for overcoming of output buffer limits*}
+                set closed [count_log_lines -2 $pattern]
+                set rd [redis_deferring_client -1]
+                $rd debug sleep 5
+                after 100
+                $master eval $script 0 1000
+                # No output buffer is drained while the script runs, and the
+                # slaves may already be reconnecting once it returns, so
+                # check that the master closed them instead of counting them.
+                wait_for_condition 50 100 {
+                    [count_log_lines -2 $pattern] > $closed
+                } else {
+                    fail "Slow slave not disconnected"
+                }
+                # Its blocks are released once it is gone.
+                wait_for_condition 50 100 {
+                    [s -2 repl_buffer_mem] < 1048576+200000
+                } else {
+                    fail "Replication buffer not trimmed"
+                }
+                $rd read
+                $rd close
+                wait_for_condition 100 100 {
+                    [s -1 master_link_status] eq {up} &&
+                    [$master debug digest] eq [$slave1 debug digest] &&
+                    [$master debug digest] eq [$slave2 debug digest]
+                } else {
+                    fail "Slaves not in sync"
+                }
+            }
+        }
+    }
+}
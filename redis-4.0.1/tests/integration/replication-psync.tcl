@@ -17,9 +17,11 @@ proc stop_bg_complex_data {handle} {
 # If reconnect is > 0, the test actually try to break the connection and
 # reconnect with the master, otherwise just the initial synchronization is
 # checked for consistency.
-proc test_psync {descr duration backlog_size backlog_ttl delay cond diskless reconnect} {
-    start_server {tags {"repl"}} {
-        start_server {} {
+#
+# If compress is yes, the master sends the stream compressed.
+proc test_psync {descr duration backlog_size backlog_ttl delay cond diskless reconnect {compress no}} {
+    start_server [list tags {"repl"} overrides [list repl-compression $compress]] {
+        start_server [list overrides [list repl-compression $compress]] {
 
             set master [srv -1 client]
             set master_host [srv -1 host]
@@ -54,7 +56,7 @@ proc test_psync {descr duration backlog_size backlog_ttl delay cond diskless rec
                 }
             }
 
-            test "Test replication partial resync: $descr (diskless: $diskless, reconnect: $reconnect)" {
+            test "Test replication partial resync: $descr (diskless: $diskless, reconnect: $reconnect, compress: $compress)" {
                 # Now while the clients are writing data, break the maste-slave
                 # link multiple times.
                 if ($reconnect) {
@@ -126,3 +128,80 @@ foreach diskless {no yes} {
         assert {[s -1 sync_partial_err] > 0}
     } $diskless 1
 }
+
+foreach diskless {no yes} {
+    test_psync {no reconnection, just sync} 6 1000000 3600 0 {
+        assert_equal [s master_link_compressed] 1
+        assert {[s -1 repl_stream_compressed_bytes] > 0}
+        assert {[s -1 repl_stream_compressed_bytes] <
+                [s -1 repl_stream_raw_bytes]}
+    } $diskless 0 yes
+
+    test_psync {ok psync} 6 100000000 3600 0 {
+        assert {[s -1 sync_partial_ok] > 0}
+    } $diskless 1 yes
+}
+
+start_server {tags {"repl"} overrides {repl-compression yes}} {
+    start_server {} {
+        set master [srv -1 client]
+        set master_host [srv -1 host]
+        set master_port [srv -1 port]
+        set slave [srv 0 client]
+
+        test {REPLCONF compress is accepted only with repl-compression} {
+            assert_equal [$master replconf compress zstd] OK
+            catch {$slave replconf compress zstd} e
+            set e
+        } {ERR*not enabled*}
+
+        test {The compressed backlog holds more than its size} {
+            $master config set repl-backlog-size 100000
+            $slave slaveof $master_host $master_port
+            wait_for_condition 50 100 {
+                [lindex [$slave role] 3] eq {connected}
+            } else {
+                fail "Replication not started."
+            }
+            for {set j 0} {$j < 5000} {incr j} {
+                $master set key:$j [string repeat "value:$j " 20]
+            }
+            assert {[s -1 repl_backlog_histlen] > 100000}
+            assert {[s -1 repl_backlog_compressed_len] <= 100000}
+        }
+
+        test {PSYNC succeeds with history only the compressed backlog has} {
+            set partial [s -1 sync_partial_ok]
+            # Stop the slave while the master writes more than the backlog
+            # size, so that the slave needs the compressed blocks.
+            set rd [redis_deferring_client]
+            $rd multi
+            $rd client kill $master_host:$master_port
+            $rd debug sleep 3
+            $rd exec
+            for {set j 0} {$j < 3} {incr j} {$rd read}
+            for {set j 0} {$j < 3000} {incr j} {
+                $master set other:$j [string repeat "value:$j " 20]
+            }
+            $rd read
+            $rd close
+            wait_for_condition 50 100 {
+                [lindex [$slave role] 3] eq {connected}
+            } else {
+                fail "Slave not reconnected."
+            }
+            assert_equal [expr {$partial+1}] [s -1 sync_partial_ok]
+            wait_for_condition 50 100 {
+                [$master debug digest] eq [$slave debug digest]
+            } else {
+                fail "Master and slave have different data."
+            }
+        }
+
+        test {The slave asks for the stream compressed only if enabled} {
+            # Unlike the master, the slave has repl-compression disabled.
+            list [s master_link_compressed] \
+                 [s -1 repl_stream_compressed_bytes]
+        } {0 0}
+    }
+}
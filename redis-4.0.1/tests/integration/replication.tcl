@@ -266,3 +266,92 @@ foreach dl {no yes} {
         }
     }
 }
+
+foreach mdl {no yes} {
+    foreach sdl {disabled on-empty-db swapdb} {
+        start_server {tags {"repl"}} {
+            set master [srv 0 client]
+            $master config set repl-diskless-sync $mdl
+            $master config set repl-diskless-sync-delay 0
+            set master_host [srv 0 host]
+            set master_port [srv 0 port]
+            $master debug populate 10000
+            createComplexDataset $master 1000
+            start_server {} {
+                set slave [srv 0 client]
+                $slave config set repl-diskless-load $sdl
+                $slave set oldkey oldvalue
+                test "Diskless load: master diskless=$mdl, slave load $sdl" {
+                    $slave slaveof $master_host $master_port
+                    wait_for_condition 500 100 {
+                        [s master_link_status] eq {up}
+                    } else {
+                        fail "Slave not synchronized"
+                    }
+                    assert_equal 0 [$slave exists oldkey]
+                    $master set newkey newvalue
+                    wait_for_condition 50 100 {
+                        [$slave get newkey] eq {newvalue}
+                    } else {
+                        fail "Write not propagated to the slave"
+                    }
+                    assert_equal [$master debug digest] [$slave debug digest]
+                }
+            }
+        }
+    }
+}
+
+start_server {tags {"repl"}} {
+    set master [srv 0 client]
+    $master config set repl-diskless-sync yes
+    $master config set repl-diskless-sync-delay 0
+    set master_host [srv 0 host]
+    set master_port [srv 0 port]
+    $master debug populate 20000
+    start_server {} {
+        set slave [srv 0 client]
+        $slave config set repl-diskless-load swapdb
+        $slave set oldkey oldvalue
+
+        test {Diskless load swapdb: the old data is kept if the transfer fails} {
+            $master config set rdb-key-save-delay 200
+            $slave slaveof $master_host $master_port
+            wait_for_condition 50 100 {
+                [s async_loading] eq 1
+            } else {
+                fail "Slave is not loading the RDB from the socket"
+            }
+            exec kill -9 [get_child_pid -1]
+            wait_for_condition 50 100 {
+                [string match {*Failed trying to load the MASTER synchronization DB from the socket*} [exec tail -20 < [srv 0 stdout]]]
+            } else {
+                fail "The transfer did not fail"
+            }
+            assert_equal oldvalue [$slave get oldkey]
+        }
+
+        test {Diskless load swapdb: the old data is served while loading} {
+            wait_for_condition 50 100 {
+                [s async_loading] eq 1
+            } else {
+                fail "Slave is not loading the RDB from the socket"
+            }
+            assert_equal 0 [s loading]
+            assert_equal oldvalue [$slave get oldkey]
+            assert_equal 1 [$slave dbsize]
+            catch {$slave slaveof no one} e
+            assert_match {*LOADING*} $e
+
+            $master config set rdb-key-save-delay 0
+            wait_for_condition 500 100 {
+                [s master_link_status] eq {up}
+            } else {
+                fail "Slave not synchronized"
+            }
+            assert_equal 0 [s async_loading]
+            assert_equal 0 [$slave exists oldkey]
+            assert_equal [$master debug digest] [$slave debug digest]
+        }
+    }
+}
@@ -375,3 +375,11 @@ proc start_write_load {host port seconds} {
 proc stop_write_load {handle} {
     catch {exec /bin/kill -9 $handle}
 }
+
+# Return the PID of the child process of the Redis instance 'idx', like
+# the one saving an RDB, or an empty string if there is no child.
+proc get_child_pid {idx} {
+    set pid [srv $idx pid]
+    catch {exec pgrep -P $pid} children
+    return [lindex [split $children "\n"] 0]
+}
@@ -40,6 +40,7 @@ set ::all_tests {
     integration/aof
     integration/rdb
     integration/convert-zipmap-hash-on-load
+    integration/convert-ziplist-on-load
     integration/logging
     integration/psync2
     integration/psync2-reg
@@ -58,6 +59,7 @@ set ::all_tests {
     unit/hyperloglog
     unit/lazyfree
     unit/wait
+    unit/threaded-io
 }
 # Index to the next test to run in the ::all_tests list.
 set ::next_test 0
@@ -134,10 +134,10 @@ start_server {tags {"aofrw"}} {
     }
 
     foreach d {string int} {
-        foreach e {ziplist hashtable} {
+        foreach e {listpack hashtable} {
             test "AOF rewrite of hash with $e encoding, $d data" {
                 r flushall
-                if {$e eq {ziplist}} {set len 10} else {set len 1000}
+                if {$e eq {listpack}} {set len 10} else {set len 1000}
                 for {set j 0} {$j < $len} {incr j} {
                     if {$d eq {string}} {
                         set data [randstring 0 16 alpha]
@@ -160,10 +160,16 @@ start_server {tags {"aofrw"}} {
     }
 
     foreach d {string int} {
-        foreach e {ziplist skiplist} {
+        foreach e {listpack skiplist btree} {
             test "AOF rewrite of zset with $e encoding, $d data" {
                 r flushall
-                if {$e eq {ziplist}} {set len 10} else {set len 1000}
+                if {$e eq {listpack}} {
+                    set len 10
+                } elseif {$e eq {skiplist}} {
+                    set len 1000
+                } else {
+                    set len 5000
+                }
                 for {set j 0} {$j < $len} {incr j} {
                     if {$d eq {string}} {
                         set data [randstring 0 16 alpha]
@@ -185,6 +191,56 @@ start_server {tags {"aofrw"}} {
         }
     }
 
+    test "AOF rewrite of string with bitmap encoding" {
+        r flushall
+        for {set j 0} {$j < 1000} {incr j} {
+            r setbit key [randomInt 4000000] 1
+        }
+        # A dense chunk, and a length that is not a multiple of 8 bytes.
+        for {set j 0} {$j < 8000} {incr j} {
+            r setbit key [expr {65536+$j*2}] 1
+        }
+        r setbit key 4000012 1
+        assert_equal [r object encoding key] bitmap
+        set d1 [r debug digest]
+        r bgrewriteaof
+        waitForBgrewriteaof r
+        r debug loadaof
+        set d2 [r debug digest]
+        if {$d1 ne $d2} {
+            error "assertion:$d1 is not equal to $d2"
+        }
+        assert_equal [r object encoding key] bitmap
+        assert_equal 500002 [r strlen key]
+    }
+
+    foreach preamble {no yes} {
+        test "AOF rewrite with multiple threads, preamble $preamble" {
+            r flushall
+            r config set aof-use-rdb-preamble $preamble
+            r config set aof-rewrite-threads 4
+            createComplexDataset r 2000
+            r debug populate 20000
+            for {set j 0} {$j < 1000} {incr j} {
+                r expire key:$j [expr {1000+$j}]
+            }
+            r select 10
+            r debug populate 1000 other
+            r select 9
+            set d1 [r debug digest]
+            r bgrewriteaof
+            waitForBgrewriteaof r
+            assert {[s aof_last_rewrite_keys_per_sec] > 0}
+            r debug loadaof
+            set d2 [r debug digest]
+            r config set aof-rewrite-threads 1
+            r config set aof-use-rdb-preamble no
+            if {$d1 ne $d2} {
+                error "assertion:$d1 is not equal to $d2"
+            }
+        }
+    }
+
     test {BGREWRITEAOF is delayed if BGSAVE is in progress} {
         r multi
         r bgsave
@@ -348,4 +348,140 @@ start_server {tags {"bitops"}} {
             }
         }
     }
+
+    test {SETBIT at a big offset creates a compressed bitmap} {
+        r del bm
+        assert_equal 0 [r setbit bm 4294967295 1]
+        assert_encoding bitmap bm
+        assert_equal 536870912 [r strlen bm]
+        assert {[r memory usage bm] < 1024}
+        assert_equal 1 [r getbit bm 4294967295]
+        assert_equal 0 [r getbit bm 4294967294]
+        assert_equal 1 [r bitcount bm]
+        assert_equal 1 [r bitcount bm -1 -1]
+        assert_equal 4294967295 [r bitpos bm 1]
+        assert_equal 0 [r bitpos bm 0]
+        assert_equal 4294967288 [r bitpos bm 0 -1]
+        assert_equal 1 [r bitfield bm get u8 4294967288]
+        assert_equal "\x00\x01" [r getrange bm -2 -1]
+        assert_equal 1 [r setbit bm 4294967295 0]
+        assert_equal -1 [r bitpos bm 1]
+        assert_equal 536870912 [r strlen bm]
+    }
+
+    test {Compressed bitmaps fuzzing against plain strings} {
+        r del bm plain
+        set max [expr {200000*8}]
+        set ops {}
+        for {set j 0} {$j < 3000} {incr j} {
+            if {[randomInt 3] == 0} {
+                # Dense words in the first chunks.
+                set word [randomInt 2048]
+                set val [expr {[randomInt 3] ? -1 : [randomInt 1000000]}]
+                lappend ops [list bitfield set i64 #$word $val]
+            } elseif {[randomInt 10] == 0} {
+                lappend ops [list bitfield incrby u7 [randomInt $max] 100]
+            } else {
+                lappend ops [list setbit [randomInt $max] [randomInt 2]]
+            }
+        }
+
+        # The same operations on a plain string and on a compressed bitmap.
+        r config set bitmap-raw-max-bytes 0
+        set replies {}
+        foreach op $ops {
+            lappend replies [r [lindex $op 0] plain {*}[lrange $op 1 end]]
+        }
+        r config set bitmap-raw-max-bytes 4096
+        foreach op $ops reply $replies {
+            assert_equal $reply [r [lindex $op 0] bm {*}[lrange $op 1 end]]
+        }
+        assert_encoding raw plain
+        assert_encoding bitmap bm
+
+        set len [r strlen plain]
+        assert_equal $len [r strlen bm]
+        for {set j 0} {$j < 500} {incr j} {
+            set start [expr {[randomInt [expr {$len+100}]]-$len/2}]
+            set end [expr {[randomInt [expr {$len+100}]]-$len/2}]
+            assert_equal [r bitcount plain $start $end] [r bitcount bm $start $end]
+            assert_equal [r getrange plain $start $end] [r getrange bm $start $end]
+            foreach bit {0 1} {
+                assert_equal [r bitpos plain $bit $start] [r bitpos bm $bit $start]
+                assert_equal [r bitpos plain $bit $start $end] \
+                             [r bitpos bm $bit $start $end]
+            }
+            set offset [randomInt [expr {$len*8+100}]]
+            assert_equal [r getbit plain $offset] [r getbit bm $offset]
+            assert_equal [r bitfield plain get i64 $offset get u9 $offset] \
+                         [r bitfield bm get i64 $offset get u9 $offset]
+        }
+        assert_equal [r bitcount plain] [r bitcount bm]
+        assert_equal [r bitpos plain 0] [r bitpos bm 0]
+
+        # GET converts the bitmap to a plain string.
+        assert_equal [r get plain] [r get bm]
+        assert_encoding raw bm
+    }
+
+    test {BITOP with compressed bitmaps} {
+        r del a b c pa pb pc
+        r config set bitmap-raw-max-bytes 4096
+        for {set j 0} {$j < 1000} {incr j} {
+            r setbit a [randomInt 2000000] 1
+            r setbit b [randomInt 1000000] 1
+        }
+        for {set j 0} {$j < 100} {incr j} {
+            r bitfield a set i64 #[randomInt 1024] -1
+            r bitfield b set i64 #[randomInt 1024] -1
+        }
+        r set c [string repeat "\xaa" 100]
+        assert_encoding bitmap a
+        assert_encoding bitmap b
+        foreach k {a b c} {
+            r set p$k [r getrange $k 0 -1]
+        }
+        foreach op {and or xor} {
+            assert_equal [r bitop $op pdest pa pb pc] [r bitop $op dest a b c]
+            assert_encoding bitmap dest
+            assert_equal [r get pdest] [r get dest]
+            assert_equal [r bitop $op pdest pa nokey] [r bitop $op dest a nokey]
+            assert_equal [r get pdest] [r get dest]
+        }
+        assert_equal [r bitop not pdest pb] [r bitop not dest b]
+        assert_equal [r bitcount pdest] [r bitcount dest]
+        assert_equal [r get pdest] [r get dest]
+    }
+
+    test {Compressed bitmaps are persisted} {
+        r del bm
+        for {set j 0} {$j < 1000} {incr j} {
+            r setbit bm [randomInt 50000000] 1
+        }
+        for {set j 0} {$j < 2000} {incr j} {
+            r bitfield bm set i64 #[randomInt 4096] -1
+        }
+        set count [r bitcount bm]
+        set digest [r debug digest]
+        r debug reload
+        assert_encoding bitmap bm
+        assert_equal $count [r bitcount bm]
+        assert_equal $digest [r debug digest]
+
+        set dump [r dump bm]
+        r del bm
+        r restore bm 0 $dump
+        assert_encoding bitmap bm
+        assert_equal $digest [r debug digest]
+    }
+
+    test {APPEND converts compressed bitmaps to plain strings} {
+        r del bm
+        r setbit bm 100000 1
+        assert_encoding bitmap bm
+        r append bm "foo"
+        assert_encoding raw bm
+        assert_equal 12504 [r strlen bm]
+        assert_equal 1 [r getbit bm 100000]
+    }
 }
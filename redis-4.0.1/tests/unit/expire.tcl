@@ -219,4 +219,91 @@ start_server {tags {"expire"}} {
         set ttl [r ttl foo]
         assert {$ttl <= 98 && $ttl > 90}
     }
+
+    test {Setting, removing and setting again the TTL of many keys} {
+        r flushdb
+        for {set j 0} {$j < 1000} {incr j} {
+            r set key:$j $j
+            if {$j % 2} {r expire key:$j 100}
+        }
+        for {set j 0} {$j < 1000} {incr j 4} {
+            r persist key:[expr {$j+1}]
+            r set key:[expr {$j+2}] new EX 300
+            r expire key:$j 200
+        }
+        assert_equal [r dbsize] 1000
+        assert_match {*expires=750,*} [r info keyspace]
+        r debug reload
+        r swapdb 0 9
+        r select 0
+        set err {}
+        for {set j 0} {$j < 1000} {incr j} {
+            set ttl [r ttl key:$j]
+            switch [expr {$j % 4}] {
+                0 {set ok [expr {$ttl > 190 && $ttl <= 200}]}
+                1 {set ok [expr {$ttl == -1}]}
+                2 {set ok [expr {$ttl > 290 && $ttl <= 300}]}
+                3 {set ok [expr {$ttl > 90 && $ttl <= 100}]}
+            }
+            if {!$ok} {lappend err "key:$j $ttl"}
+        }
+        r flushdb
+        r select 9
+        set err
+    } {}
+
+    test {Redis should actively expire keys in order with active-expire-index} {
+        r flushdb
+        r config set active-expire-index yes
+        for {set j 0} {$j < 1000} {incr j} {
+            r setex long:$j 1000 a
+            r psetex short:$j [expr {100+$j}] a
+        }
+        # Keys updated, persisted and deleted must leave the index too.
+        foreach j {0 1 2 3} {r psetex upd:$j 1000 a}
+        r pexpire upd:0 100000
+        r persist upd:1
+        r del upd:2
+        r set upd:3 b
+        wait_for_condition 50 100 {
+            [r dbsize] == 1003
+        } else {
+            fail "Expired keys were not actively expired"
+        }
+        # The old expire of upd:0 must not be in the index anymore: the
+        # key is only expired at its new time.
+        assert_equal 1003 [r dbsize]
+        assert {[r pttl upd:0] > 95000}
+        assert_match {*expired_stale_keys:0*} [r info stats]
+        r pexpire upd:0 500
+        after 200
+        assert_equal 1003 [r dbsize]
+        wait_for_condition 50 100 {
+            [r dbsize] == 1002
+        } else {
+            fail "upd:0 was not expired at its new time"
+        }
+        list [r exists upd:0 upd:1 upd:3] \
+             [r config get active-expire-index]
+    } {2 {active-expire-index yes}}
+
+    test {The expire index is emptied by FLUSHDB and swapped by SWAPDB} {
+        r flushdb
+        r psetex key1 100 a
+        r select 10
+        r flushdb
+        r psetex key2 200 a
+        r swapdb 9 10
+        r select 9
+        r flushdb async
+        r psetex key3 100 a
+        after 500
+        set res [list [r dbsize] [r exists key1 key2 key3]]
+        r select 10
+        lappend res [r dbsize]
+        r flushdb
+        r select 9
+        r config set active-expire-index no
+        set res
+    } {0 0 0}
 }
@@ -41,6 +41,143 @@ start_server {tags {"keyspace"}} {
         r debug set-active-expire 1
     }
 
+    test "MGET, EXISTS and DEL with many keys, repeated and expired keys" {
+        r flushdb
+        r debug set-active-expire 0
+        set keys {}
+        for {set j 0} {$j < 40} {incr j} {
+            if {$j % 3 == 0} {
+                r set key:$j val:$j
+            } elseif {$j % 3 == 1} {
+                r psetex key:$j 100 val:$j
+            }
+            lappend keys key:$j key:[expr {$j/2}]
+        }
+        after 200
+        set expected {}
+        set existing 0
+        foreach key $keys {
+            set j [lindex [split $key :] 1]
+            if {$j % 3 == 0} {
+                lappend expected val:$j
+                incr existing
+            } else {
+                lappend expected {}
+            }
+        }
+        assert_equal $expected [r mget {*}$keys]
+        assert_equal $existing [r exists {*}$keys]
+        assert_equal 14 [r del {*}$keys]
+        r debug set-active-expire 1
+        r dbsize
+    } {0}
+
+    test "Mixed MGET/MSET workload while the keyspace grows" {
+        r flushdb
+        array set model {}
+        for {set i 0} {$i < 200} {incr i} {
+            set args {}
+            for {set j 0} {$j < 50} {incr j} {
+                set key key:[randomInt 5000]
+                set val [randomValue]
+                lappend args $key $val
+                set model($key) $val
+            }
+            r mset {*}$args
+            set keys {}
+            set expected {}
+            for {set j 0} {$j < 70} {incr j} {
+                set key key:[randomInt 5000]
+                lappend keys $key
+                if {[info exists model($key)]} {
+                    lappend expected $model($key)
+                } else {
+                    lappend expected {}
+                }
+            }
+            assert_equal $expected [r mget {*}$keys]
+        }
+        assert_equal [array size model] [r dbsize]
+        r flushdb
+    } {OK}
+
+    proc keyspace_table_size {} {
+        regexp {table size: ([0-9]+)} [r debug htstats 9] - size
+        return $size
+    }
+
+    test "Keys and values survive the keyspace growing and shrinking" {
+        r flushdb
+        r debug populate 30000
+        assert_equal 30000 [r dbsize]
+        set grown [keyspace_table_size]
+        assert {$grown >= 8192}
+        # Keep one key out of 20, so that the table is shrunk by the cron.
+        for {set j 0} {$j < 30000} {incr j 100} {
+            set keys {}
+            for {set k $j} {$k < $j+100} {incr k} {
+                if {$k % 20} {lappend keys key:$k}
+            }
+            r del {*}$keys
+        }
+        assert_equal 1500 [r dbsize]
+        wait_for_condition 50 100 {
+            [keyspace_table_size] < $grown &&
+            ![string match {*rehashing target*} [r debug htstats 9]]
+        } else {
+            fail "Keyspace not resized"
+        }
+        for {set j 0} {$j < 30000} {incr j 1000} {
+            set keys {}
+            set expected {}
+            for {set k $j} {$k < $j+1000} {incr k} {
+                lappend keys key:$k
+                lappend expected [expr {$k % 20 ? {} : "value:$k"}]
+            }
+            assert_equal $expected [r mget {*}$keys]
+        }
+        r flushdb
+    } {OK}
+
+    test "SCAN returns every key while the keyspace grows" {
+        r flushdb
+        r debug populate 1000
+        set size [keyspace_table_size]
+        set keys {}
+        set added 0
+        set cur 0
+        while 1 {
+            set res [r scan $cur count 100]
+            set cur [lindex $res 0]
+            lappend keys {*}[lindex $res 1]
+            if {$cur == 0} break
+            # Add enough keys at every call to double the table a few
+            # times before the iteration is over.
+            if {$added >= 20000} continue
+            set args {}
+            for {set j 0} {$j < 400} {incr j} {
+                lappend args added:$added x
+                incr added
+            }
+            r mset {*}$args
+        }
+        assert {[keyspace_table_size] >= $size*4}
+
+        # Every key existing for the whole iteration is reported, and no
+        # key that was never written is.
+        set populated 0
+        foreach k [lsort -unique $keys] {
+            if {[string match key:* $k]} {
+                incr populated
+            } else {
+                assert_match added:* $k
+                assert {[string range $k 6 end] < $added}
+            }
+        }
+        assert_equal 1000 $populated
+        r flushdb
+    } {OK}
+
     test {EXISTS} {
         set res {}
         r set newkey test
@@ -36,4 +36,27 @@ start_server {tags {"lazyfree"}} {
             fail "Memory is not reclaimed by FLUSHDB ASYNC"
         }
     }
+
+    test "FLUSHDB ASYNC with big values queued in output buffers" {
+        set big [string repeat x 100000]
+        for {set i 0} {$i < 100} {incr i} {
+            r set key:$i $big
+        }
+        r config resetstat
+        set rd [redis_deferring_client]
+        for {set i 0} {$i < 100} {incr i} {
+            $rd get key:$i
+        }
+        wait_for_condition 50 100 {
+            [string match {*cmdstat_get:calls=100,*} [r info commandstats]]
+        } else {
+            fail "GET commands not processed"
+        }
+        r flushdb async
+        for {set i 0} {$i < 100} {incr i} {
+            assert_equal $big [$rd read]
+        }
+        $rd close
+        r dbsize
+    } {0}
 }
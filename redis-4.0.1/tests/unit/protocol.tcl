@@ -115,3 +115,52 @@ start_server {tags {"regression"}} {
         $rd read
     }
 }
+
+start_server {tags {"protocol"}} {
+    test "Replies spanning many reply list nodes are sent intact" {
+        r del biglist
+        set elements {}
+        for {set i 0} {$i < 2000} {incr i} {
+            lappend elements [string repeat [expr {$i%10}] 200]
+        }
+        r rpush biglist {*}$elements
+        r config resetstat
+        set rd [redis_deferring_client]
+        for {set i 0} {$i < 10} {incr i} {
+            $rd lrange biglist 0 -1
+        }
+        for {set i 0} {$i < 10} {incr i} {
+            assert_equal $elements [$rd read]
+        }
+        $rd close
+        assert {[s total_writev_calls] > 0}
+        assert {[s writev_avg_iovecs] > 1}
+    }
+
+    test "Pipelines mixing commands, databases and request types" {
+        r flushall
+        set fd [r channel]
+        set proto {}
+        for {set i 0} {$i < 50} {incr i} {
+            append proto "*3\r\n\$3\r\nSET\r\n\$5\r\nkey:[expr {$i%10}]\r\n\$[string length $i]\r\n$i\r\n"
+            append proto "*2\r\n\$3\r\nget\r\n\$5\r\nkey:[expr {$i%10}]\r\n"
+            if {$i % 7 == 0} {append proto "*2\r\n\$6\r\nSELECT\r\n\$1\r\n[expr {$i%2 ? 9 : 8}]\r\n"}
+            if {$i % 11 == 0} {append proto "*1\r\n\$7\r\nNOTACMD\r\n"}
+            if {$i % 13 == 0} {append proto "INCR counter\r\n"}
+        }
+        puts -nonewline $fd $proto
+        flush $fd
+        for {set i 0} {$i < 50} {incr i} {
+            assert_equal OK [r read]
+            assert_equal $i [r read]
+            if {$i % 7 == 0} {assert_equal OK [r read]}
+            if {$i % 11 == 0} {
+                catch {r read} err
+                assert_match {*unknown command*} $err
+            }
+            if {$i % 13 == 0} {r read}
+        }
+        r select 9
+        r ping
+    } {PONG}
+}
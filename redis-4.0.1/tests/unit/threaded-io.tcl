@@ -0,0 +1,80 @@
+start_server {tags {"threaded-io"} overrides {io-threads 4 io-threads-do-reads yes}} {
+    test {Threaded I/O: pipelined commands from many clients} {
+        set clients {}
+        for {set j 0} {$j < 20} {incr j} {
+            lappend clients [redis_deferring_client]
+        }
+        for {set i 0} {$i < 100} {incr i} {
+            set j 0
+            foreach rd $clients {
+                $rd set key:$j:$i $i
+                $rd incr counter
+                incr j
+            }
+        }
+        foreach rd $clients {
+            for {set i 0} {$i < 100} {incr i} {
+                assert_equal OK [$rd read]
+                $rd read
+            }
+        }
+        foreach rd $clients {$rd close}
+        list [r get counter] [r get key:19:99] [r dbsize]
+    } {2000 99 2001}
+
+    test {Threaded I/O: reads are handed to the I/O threads} {
+        assert {[s io_threaded_reads_processed] > 0}
+    }
+
+    test {Threaded I/O: big replies are written by the I/O threads} {
+        r del biglist
+        for {set i 0} {$i < 1000} {incr i} {
+            r rpush biglist [string repeat x 100]$i
+        }
+        set clients {}
+        for {set j 0} {$j < 20} {incr j} {
+            lappend clients [redis_deferring_client]
+        }
+        foreach rd $clients {$rd lrange biglist 0 -1}
+        foreach rd $clients {
+            set reply [$rd read]
+            assert_equal 1000 [llength $reply]
+            assert_equal [string repeat x 100]999 [lindex $reply end]
+            $rd close
+        }
+        assert {[s io_threaded_writes_processed] > 0}
+        assert {[s io_threaded_writes_usec] >= 0}
+        r del biglist
+    } {1}
+
+    test {Threaded I/O: protocol errors are reported} {
+        set s [socket [srv 0 host] [srv 0 port]]
+        fconfigure $s -translation binary
+        puts -nonewline $s "*3000000000\r\n"
+        flush $s
+        set reply [gets $s]
+        close $s
+        assert_match {*invalid multibulk length*} $reply
+    }
+
+    test {Threaded I/O: MULTI/EXEC works with parsed commands} {
+        set rd [redis_deferring_client]
+        $rd multi
+        $rd incr counter
+        $rd incr counter
+        $rd exec
+        assert_equal OK [$rd read]
+        assert_equal QUEUED [$rd read]
+        assert_equal QUEUED [$rd read]
+        set res [$rd read]
+        $rd close
+        set res
+    } {2001 2002}
+
+    test {Threaded I/O: io-threads-do-reads can be disabled at runtime} {
+        r config set io-threads-do-reads no
+        r set foo bar
+        r config set io-threads-do-reads yes
+        r get foo
+    } {bar}
+}
@@ -246,6 +246,74 @@ start_server {
         }
     }
 
+    test "SINTER, SUNION, SDIFF fuzzing with intsets" {
+        for {set j 0} {$j < 100} {incr j} {
+            set args {}
+            set num_sets [expr {[randomInt 4]+1}]
+            for {set i 0} {$i < $num_sets} {incr i} {
+                # Sets of very different sizes and encodings.
+                set num_elements [expr {[randomInt 2] ? [randomInt 10] : [randomInt 400]}]
+                set span [lindex {1000 100000 10000000000} [randomInt 3]]
+                r del set_$i
+                lappend args set_$i
+                set s($i) {}
+                for {set k 0} {$k < $num_elements} {incr k} {
+                    set ele [expr {[randomInt 1000]-500}]
+                    if {[randomInt 10] == 0} {set ele [expr {$ele*$span}]}
+                    r sadd set_$i $ele
+                    lappend s($i) $ele
+                }
+                set s($i) [lsort -integer -unique $s($i)]
+            }
+
+            set inter $s(0)
+            set union $s(0)
+            set diff $s(0)
+            for {set i 1} {$i < $num_sets} {incr i} {
+                set next {}
+                foreach ele $inter {
+                    if {[lsearch -exact -sorted -integer $s($i) $ele] != -1} {
+                        lappend next $ele
+                    }
+                }
+                set inter $next
+                set union [lsort -integer -unique [concat $union $s($i)]]
+                set next {}
+                foreach ele $diff {
+                    if {[lsearch -exact -sorted -integer $s($i) $ele] == -1} {
+                        lappend next $ele
+                    }
+                }
+                set diff $next
+            }
+
+            assert_equal $inter [lsort -integer [r sinter {*}$args]]
+            assert_equal $union [lsort -integer [r sunion {*}$args]]
+            assert_equal $diff [lsort -integer [r sdiff {*}$args]]
+            foreach {cmd res} [list sinterstore $inter sunionstore $union \
+                                    sdiffstore $diff] {
+                assert_equal [llength $res] [r $cmd setres {*}$args]
+                assert_equal $res [lsort -integer [r smembers setres]]
+                if {[llength $res] > 0 && [llength $res] <= 512} {
+                    assert_encoding intset setres
+                }
+            }
+        }
+    }
+
+    test "SUNIONSTORE of intsets bigger than set-max-intset-entries" {
+        r del set1 set2
+        for {set j 0} {$j < 400} {incr j} {
+            r sadd set1 $j
+            r sadd set2 [expr {$j+1000}]
+        }
+        assert_encoding intset set1
+        assert_encoding intset set2
+        assert_equal 800 [r sunionstore setres set1 set2]
+        assert_encoding hashtable setres
+        assert_equal 800 [llength [r sunion set1 set2]]
+    }
+
     test "SINTER against non-set should throw error" {
         r set key1 x
         assert_error "WRONGTYPE*" {r sinter key1 noset}
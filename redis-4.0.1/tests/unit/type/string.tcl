@@ -419,4 +419,49 @@ start_server {tags {"string"}} {
         r set foo bar
         r getrange foo 0 4294967297
     } {bar}
+
+    test {Big values queued in the output buffer are not changed by writes} {
+        set big [string repeat x 100000]
+        r set foo $big
+        set rd [redis_deferring_client]
+        $rd get foo
+        $rd append foo y
+        $rd setrange foo 0 z
+        $rd get foo
+        $rd setbit foo 1 0
+        $rd get foo
+        assert_equal $big [$rd read]
+        assert_equal 100001 [$rd read]
+        assert_equal 100001 [$rd read]
+        assert_equal "z[string repeat x 99999]y" [$rd read]
+        assert_equal 1 [$rd read]
+        assert_equal ":[string repeat x 99999]y" [$rd read]
+        $rd close
+    }
+
+    test {Big values sent to many clients survive deletion and overwrite} {
+        set big [string repeat abcd 50000]
+        r set foo $big
+        r config resetstat
+        set clients {}
+        for {set j 0} {$j < 10} {incr j} {
+            set rd [redis_deferring_client]
+            for {set k 0} {$k < 10} {incr k} {$rd get foo}
+            lappend clients $rd
+        }
+        # Make sure all the GETs were processed before changing the key.
+        wait_for_condition 50 100 {
+            [string match {*cmdstat_get:calls=100,*} [r info commandstats]]
+        } else {
+            fail "Clients GET commands not processed"
+        }
+        r set foo bar
+        r del foo
+        foreach rd $clients {
+            for {set k 0} {$k < 10} {incr k} {
+                assert_equal $big [$rd read]
+            }
+            $rd close
+        }
+    }
 }
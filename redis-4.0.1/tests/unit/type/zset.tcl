@@ -7,12 +7,17 @@ start_server {tags {"zset"}} {
     }
 
     proc basics {encoding} {
-        if {$encoding == "ziplist"} {
+        if {$encoding == "listpack"} {
             r config set zset-max-ziplist-entries 128
             r config set zset-max-ziplist-value 64
         } elseif {$encoding == "skiplist"} {
             r config set zset-max-ziplist-entries 0
             r config set zset-max-ziplist-value 0
+            r config set zset-max-skiplist-entries 1000000
+        } elseif {$encoding == "btree"} {
+            r config set zset-max-ziplist-entries 0
+            r config set zset-max-ziplist-value 0
+            r config set zset-max-skiplist-entries 0
         } else {
             puts "Unknown sorted set encoding"
             exit
@@ -650,8 +655,33 @@ start_server {tags {"zset"}} {
         }
     }
 
-    basics ziplist
+    basics listpack
     basics skiplist
+    basics btree
+
+    test {ZSET skiplist is converted into a B+tree past zset-max-skiplist-entries} {
+        r config set zset-max-ziplist-entries 16
+        r config set zset-max-ziplist-value 64
+        r config set zset-max-skiplist-entries 100
+        r del ztmp
+        for {set j 0} {$j < 100} {incr j} {
+            r zadd ztmp $j m$j
+        }
+        assert_encoding skiplist ztmp
+        r zadd ztmp 100 m100
+        assert_encoding btree ztmp
+
+        # Removing elements never turns it back into a skiplist, but a
+        # reload picks the encoding from the length again.
+        r zremrangebyrank ztmp 0 40
+        assert_encoding btree ztmp
+        r debug reload
+        assert_encoding skiplist ztmp
+        r zremrangebyscore ztmp 0 90
+        r debug reload
+        assert_encoding listpack ztmp
+        r zrange ztmp 0 -1
+    } {m91 m92 m93 m94 m95 m96 m97 m98 m99 m100}
 
     test {ZINTERSTORE regression with two sets, intset+hashtable} {
         r del seta setb setc
@@ -666,7 +696,7 @@ start_server {tags {"zset"}} {
         r zrange out 0 -1 withscores
     } {neginf 0}
 
-    test {ZINTERSTORE #516 regression, mixed sets and ziplist zsets} {
+    test {ZINTERSTORE #516 regression, mixed sets and listpack zsets} {
         r sadd one 100 101 102 103
         r sadd two 100 200 201 202
         r zadd three 1 500 1 501 1 502 1 503 1 100
@@ -697,7 +727,7 @@ start_server {tags {"zset"}} {
     }
 
     proc stressers {encoding} {
-        if {$encoding == "ziplist"} {
+        if {$encoding == "listpack"} {
             # Little extra to allow proper fuzzing in the sorting stresser
             r config set zset-max-ziplist-entries 256
             r config set zset-max-ziplist-value 64
@@ -705,7 +735,13 @@ start_server {tags {"zset"}} {
         } elseif {$encoding == "skiplist"} {
             r config set zset-max-ziplist-entries 0
             r config set zset-max-ziplist-value 0
+            r config set zset-max-skiplist-entries 1000000
             if {$::accurate} {set elements 1000} else {set elements 100}
+        } elseif {$encoding == "btree"} {
+            r config set zset-max-ziplist-entries 0
+            r config set zset-max-ziplist-value 0
+            r config set zset-max-skiplist-entries 0
+            if {$::accurate} {set elements 10000} else {set elements 1000}
         } else {
             puts "Unknown sorted set encoding"
             exit
@@ -742,6 +778,37 @@ start_server {tags {"zset"}} {
             }
         }
 
+        if {$encoding == "listpack"} {
+            test "ZSCORE with and without listpack fingerprints" {
+                set n [expr {$elements/2}]
+                foreach fp {no yes} other {yes no} {
+                    r config set listpack-fingerprints $fp
+                    r del zscoretest
+                    for {set i 0} {$i < $n} {incr i} {
+                        r zadd zscoretest $i $i
+                        r zadd zscoretest -$i m$i
+                    }
+                    for {set i 0} {$i < $n} {incr i 3} {
+                        r zrem zscoretest $i
+                    }
+                    assert_encoding listpack zscoretest
+                    foreach reload {0 1} {
+                        if {$reload} {
+                            r config set listpack-fingerprints $other
+                            r debug reload
+                        }
+                        for {set i 0} {$i < $n} {incr i} {
+                            assert_equal [expr {$i % 3 ? $i : {}}] \
+                                [r zscore zscoretest $i]
+                            assert_equal -$i [r zscore zscoretest m$i]
+                        }
+                        assert_equal {} [r zscore zscoretest missing]
+                    }
+                }
+                r config set listpack-fingerprints yes
+            }
+        }
+
         test "ZSET sorting stresser - $encoding" {
             set delta 0
             for {set test 0} {$test < 2} {incr test} {
@@ -1024,7 +1091,8 @@ start_server {tags {"zset"}} {
     }
 
     tags {"slow"} {
-        stressers ziplist
+        stressers listpack
         stressers skiplist
+        stressers btree
     }
 }
@@ -0,0 +1,111 @@
+#!/usr/bin/env tclsh8.5
+# Compare the RDB compression codecs (see rdb-compression-codec in redis.conf)
+# on a few representative datasets, reporting for every codec the time to
+# SAVE the dataset, the time to load it at startup, and the size of the file.
+#
+# Run it from the utils directory once Redis is built:
+#
+#   ./rdb-codec-benchmark.tcl [keys]
+#
+# Released under the BSD license like Redis itself
+
+source ../tests/support/redis.tcl
+set ::port 12124
+set ::dir /tmp/rdb-codec-benchmark
+set ::keys [expr {$argc ? [lindex $argv 0] : 200000}]
+set ::codecs {lzf zstd}
+
+proc randword {} {
+    set words {redis user order item price status created updated name
+               email address city country enabled tags score session token}
+    lindex $words [expr {int(rand()*[llength $words])}]
+}
+
+# Values of the datasets, every one of them representative of a workload.
+proc value {dataset j} {
+    switch $dataset {
+        json {
+            format {{"id":%d,"%s":"%s-%d","%s":%d,"%s":[%s],"%s":%s}} \
+                $j [randword] [randword] [expr {$j*7}] [randword] \
+                [expr {int(rand()*100000)}] [randword] \
+                "\"[randword]\",\"[randword]\",\"[randword]\"" \
+                [randword] [expr {rand() > 0.5 ? "true" : "false"}]
+        }
+        text {
+            set s {}
+            for {set i 0} {$i < 40} {incr i} {lappend s [randword]}
+            join $s
+        }
+        small {
+            format "%s:%d:%s" [randword] [expr {int(rand()*1000000)}] [randword]
+        }
+        random {
+            set s {}
+            for {set i 0} {$i < 200} {incr i} {
+                append s [format %c [expr {int(rand()*256)}]]
+            }
+            set s
+        }
+    }
+}
+
+proc start-server {codec} {
+    set pid [exec ../src/redis-server --port $::port --dir $::dir \
+        --save "" --rdb-compression-codec $codec --loglevel warning \
+        > /dev/null 2> /dev/null &]
+    set start [clock microseconds]
+    while 1 {
+        if {![catch {set r [redis 127.0.0.1 $::port]}]} {
+            if {![catch {$r ping}]} break
+            $r close
+        }
+        after 1
+    }
+    list $pid $r [expr {[clock microseconds]-$start}]
+}
+
+proc stop-server {pid r} {
+    $r close
+    exec kill $pid
+    after 100
+}
+
+file mkdir $::dir
+file delete [file join $::dir dump.rdb]
+puts [format "%-8s %-6s %10s %10s %12s" dataset codec save(ms) load(ms) size(bytes)]
+foreach dataset {json text small random} {
+    # Populate the dataset once, it is saved with every codec.
+    lassign [start-server lzf] pid r
+    for {set j 0} {$j < $::keys} {incr j 100} {
+        set args {}
+        for {set i $j} {$i < $j+100 && $i < $::keys} {incr i} {
+            lappend args key:$i [value $dataset $i]
+        }
+        $r mset {*}$args
+    }
+    set empty_load 0
+    foreach codec $::codecs {
+        $r config set rdb-compression-codec $codec
+        set start [clock microseconds]
+        $r save
+        set save_usec [expr {[clock microseconds]-$start}]
+        set size [file size [file join $::dir dump.rdb]]
+
+        # Time the loading at startup, minus the startup time of an empty
+        # server, measured once.
+        stop-server $pid $r
+        if {$empty_load == 0} {
+            file rename -force [file join $::dir dump.rdb] [file join $::dir saved.rdb]
+            lassign [start-server $codec] pid r empty_load
+            stop-server $pid $r
+            file rename -force [file join $::dir saved.rdb] [file join $::dir dump.rdb]
+        }
+        lassign [start-server $codec] pid r load_usec
+        set load_usec [expr {max($load_usec-$empty_load,0)}]
+        puts [format "%-8s %-6s %10.1f %10.1f %12d" $dataset $codec \
+            [expr {$save_usec/1000.0}] [expr {$load_usec/1000.0}] $size]
+    }
+    $r flushall
+    stop-server $pid $r
+    file delete [file join $::dir dump.rdb]
+}